@@ -7,7 +7,12 @@
 //
 
 #include "BMCReverb.h"
+#include "BMFastMath.h"
+#include "BMCReverbConvolution.h"
+#include "BMCReverbTrace.h"
+#include "BMLockFree.h"
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -20,7 +25,31 @@ extern "C" {
 #endif
     
 #define BMCREVERB_MATRIXATTENUATION 0.5 // 1/sqrt(4) keep the mixing unitary
-#define BMCREVERB_TEMPBUFFERLENGTH 256 // buffered operation in chunks of 256
+#define BMCREVERB_NETWORKCOST 18.0 // multiply-adds per delay per frame, measured against the convolver
+#define BMCREVERB_FROZENIR_TAILMARGIN 1.5 // allow frozen responses 50% longer than the RT60 predicts
+#define BMCREVERB_FREEZER_CAPACITY 64 // reverbs that can wait for the background thread at once
+#define BMCREVERB_MODULATION_MARGIN 5 // the modulated read stays this many samples behind the write
+#define BMCREVERB_DIFFUSIONSTEREOSPREAD 1.13 // the right input's allpass delays are this much longer than the left's
+#define BMCREVERB_CACHELINE 64 // bytes. The unit blocks are aligned to this
+#define BMCREVERB_RESAMPLERCUTOFF 0.8 // cutoff of the resampling filters, as a fraction of the network's Nyquist frequency
+#define BMCREVERB_SNAPSHOT_MAGIC 0x56524D42 // "BMRV"
+#define BMCREVERB_SNAPSHOT_VERSION 4 // increase when the snapshot format or the network changes
+    
+#ifdef BMCREVERB_INSTRUMENTATION
+#define BMCREVERB_STAGE_START(rv) ((rv)->instrumentation.stageStart = BMCReverbCycles())
+#define BMCREVERB_STAGE_END(rv, stage) BMCReverbInstrumentationStageEnd(&(rv)->instrumentation, stage)
+#define BMCREVERB_COUNT_NONFINITE(rv, count) ((rv)->instrumentation.working.nonFiniteInputs += (count))
+#define BMCREVERB_COUNT_DENORMALS(rv, outputs) BMCReverbCountDenormals(rv, outputs)
+#else
+#define BMCREVERB_STAGE_START(rv) ((void)0)
+#define BMCREVERB_STAGE_END(rv, stage) ((void)0)
+#define BMCREVERB_COUNT_NONFINITE(rv, count) ((void)0)
+#define BMCREVERB_COUNT_DENORMALS(rv, outputs) ((void)0)
+#endif
+    
+// the start time of an event, if rv has a trace
+#define BMCREVERB_TRACE_START(rv) ((rv)->trace ? BMCReverbTraceTime() : 0)
+#define BMCREVERB_TRACE(rv, type, start, value) do { if ((rv)->trace) BMCReverbTraceRecord((rv)->trace, type, start, value); } while (0)
     
 #define BM_MAX(a,b) ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); _a > _b ? _a : _b; })
 #define BM_MIN(a,b) ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); _a < _b ? _a : _b; })
@@ -38,6 +67,88 @@ extern "C" {
 #define M_SQRT2 1.41421356237309504880
 #endif
     
+#define BM_LOG2_10 3.32192809488736234787 // log2(10)
+    
+// delay units per block in the blocked kernel. With 4, each row of a
+// field is 4 floats and each field one cache line. 8 or 16 give whole
+// registers on CPUs with 8 or 16 float lanes.
+#ifndef BMCREVERB_BLOCKUNITS
+#define BMCREVERB_BLOCKUNITS 4
+#endif
+    
+    
+    // The state and coefficients of BMCREVERB_BLOCKUNITS delay units, for
+    // the blocked kernel.
+    //
+    // The block-circulant matrix mixes the delays in the same position in
+    // each quarter of the network, so delay unit u is the delays u, u +
+    // n/4, u + n/2 and u + 3n/4 of the flat arrays. Row k of each field
+    // holds delay u + k*n/4 of each unit u in the block. Every operation
+    // on a unit is then the same operation on the columns of a field, and
+    // a unit's state and coefficients are in the same few cache lines
+    // instead of in a dozen arrays of n elements.
+    typedef struct BMCReverbUnitBlock {
+        float feedback [4][BMCREVERB_BLOCKUNITS];
+        float z1 [4][BMCREVERB_BLOCKUNITS];
+        float decay [4][BMCREVERB_BLOCKUNITS];
+        float a1 [4][BMCREVERB_BLOCKUNITS];
+        float b0 [4][BMCREVERB_BLOCKUNITS];
+        float b1 [4][BMCREVERB_BLOCKUNITS];
+        float outputSigns [4][BMCREVERB_BLOCKUNITS];
+        size_t rwIndices [4][BMCREVERB_BLOCKUNITS];
+        size_t startIndices [4][BMCREVERB_BLOCKUNITS];
+        size_t endIndices [4][BMCREVERB_BLOCKUNITS];
+    } BMCReverbUnitBlock;
+    
+    
+    // the default delays of the input allpass filters (seconds)
+    static const float BMCReverbDefaultDiffusionTimes [BMCREVERB_MAXDIFFUSIONSTAGES] = {0.00477f, 0.00360f, 0.01273f, 0.00931f, 0.00213f, 0.00691f, 0.00153f, 0.00817f};
+    
+    
+    // the start of a snapshot. The rwIndices, delay memory, feedback
+    // buffers, z1, LFO phases, diffusion memory and the state of the
+    // convolver follow. The resampler state is short enough to go in the
+    // header.
+    typedef struct BMCReverbSnapshotHeader {
+        uint32_t magic, version;
+        uint64_t size;
+        float sampleRate, minDelay_seconds, maxDelay_seconds, rt60, slowDecayRT60, hfDecayMultiplier, hfSlowDecayMultiplier, highShelfFC;
+        float wetGain, dryGain, straightStereoMix, crossStereoMix, highpassFC, lowpassFC;
+        float modulationDepth_seconds, modulationRate, diffusionGain;
+        float diffusionTimes [BMCREVERB_MAXDIFFUSIONSTAGES];
+        uint32_t seed, mixingMatrix, frozenIRMode, interpolation, numDiffusionStages, decimationFactor;
+        uint8_t slowDecay, autoSustain, frozen, frozenSlowDecay;
+        uint64_t numDelays, totalSamples, idleFramesLeft, convolverStateSize, diffusionTotalSamples;
+        uint64_t diffusionIndices [2*BMCREVERB_MAXDIFFUSIONSTAGES], resamplerPhase;
+        float mainFilterHistory [12];
+        float decimatorHistory [2][BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS], interpolatorHistory [2][BMCREVERB_RESAMPLERTAPS];
+    } BMCReverbSnapshotHeader;
+    
+    
+    // A request to the background thread to render the frozen impulse
+    // response of a design, and to set up a convolver for it if the
+    // reverb doesn't have one with the right layout. Each reverb has one,
+    // allocated with the reverb. While the state is QUEUED the background
+    // thread owns the rest of it, otherwise the reverb does. The reverb
+    // leaves the convolver it replaces in retired for the background
+    // thread to free. Whichever of the two lets go last frees the job.
+    enum {BMCREVERB_FREEZE_IDLE, BMCREVERB_FREEZE_QUEUED, BMCREVERB_FREEZE_DONE, BMCREVERB_FREEZE_FAILED};
+    typedef struct BMCReverbFreezeJob {
+        BMCReverbDesign* design;
+        bool slowDecay, hasConvolver;
+        size_t numPartitions [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        BMCReverbConvolver *convolver, *retired;
+        int32_t state, refCount;
+    } BMCReverbFreezeJob;
+    
+    
+    // the background thread that renders frozen impulse responses, and the
+    // jobs waiting for it
+    static pthread_once_t BMCReverbFreezerOnce = PTHREAD_ONCE_INIT;
+    static BMLockFreeQueue BMCReverbFreezerJobs;
+    static BMSemaphore BMCReverbFreezerWake;
+    static bool BMCReverbFreezerRunning = false;
+    
     
     /*
      * these functions should be called only from functions within this file
@@ -47,14 +158,79 @@ extern "C" {
     void BMCReverbUpdateDelayTimes(struct BMCReverb* rv);
     void BMCReverbUpdateDecayHighShelfFilters(struct BMCReverb* rv);
     void BMCReverbUpdateRT60DecayTime(struct BMCReverb* rv);
-    double BMCReverbDelayGainFromRT60(double rt60, double delayTime);
+    void BMCReverbUpdateDecayCoefficients(struct BMCReverb* rv);
+    void BMCReverbHighShelfCoefficients(float gamma, float* b0, float* b1, float* a1, size_t count);
+    double BMCReverbDecayExponentFromRT60(double rt60);
     void BMCReverbProcessWetSample(struct BMCReverb* rv, float inputL, float inputR, float* outputL, float* outputR);
     void BMCReverbUpdateNumDelayUnits(struct BMCReverb* rv);
     void BMCReverbPointersToNull(struct BMCReverb* rv);
-    void BMCReverbRandomiseOrder(float* list, size_t seed, size_t length);
+    void BMCReverbRandomiseOrder(float* list, uint32_t seed, uint32_t stream, size_t length);
     void BMCReverbInitDelayOutputSigns(struct BMCReverb* rv);
     void BMCReverbUpdateMainFilter(struct BMCReverb* rv);
-    void BMCReverbUpdateSettings(struct BMCReverb* rv);
+    void BMCReverbMainFilterChannel(struct BMCReverb* rv, float* data, float* history, size_t numSamples);
+    void BMCReverbReserveDelays(struct BMCReverb* rv, size_t numDelays);
+    void BMCReverbReserveDelayMemory(struct BMCReverb* rv, size_t totalSamples);
+    size_t BMCReverbMaxTotalSamples(size_t numDelays, double sampleRate, double preDelay_seconds, double roomSize_seconds);
+    void BMCReverbUpdateSettings(struct BMCReverb* rv, bool wait);
+    void BMCReverbMixBlockCirculant(struct BMCReverb* rv);
+    void BMCReverbMixBlockCirculantScalar(struct BMCReverb* rv);
+    void BMCReverbFeedbackVector(struct BMCReverb* rv, float inputL, float inputR);
+    void BMCReverbFeedbackScalar(struct BMCReverb* rv, float inputL, float inputR);
+    void BMCReverbMixHadamard(struct BMCReverb* rv);
+    void BMCReverbMixHouseholder(struct BMCReverb* rv);
+    void BMCReverbRotateFeedback(struct BMCReverb* rv);
+    void BMCReverbInitInstance(struct BMCReverb* rv);
+    void BMCReverbAttachDesign(struct BMCReverb* rv);
+    void BMCReverbResetDelays(struct BMCReverb* rv);
+    void BMCReverbClearStaleDelays(struct BMCReverb* rv);
+    void BMCReverbMakeDesignPrivate(struct BMCReverb* rv, size_t numDelays);
+    BMCReverbDesign* BMCReverbDesignAlloc(size_t capacityNumDelays);
+    size_t BMCReverbDesignSize(size_t capacityNumDelays);
+    BMCReverbDesign* BMCReverbDesignCopy(const BMCReverbDesign* design, size_t capacityNumDelays);
+    bool BMCReverbDesignIsShared(const BMCReverbDesign* design);
+    bool BMCReverbDesignMatchesSettings(const BMCReverbDesign* design, const struct BMCReverb* rv);
+    bool BMCReverbDesignLayoutsMatch(const BMCReverbDesign* a, const BMCReverbDesign* b);
+    void BMCReverbDesignDropFrozenIRs(BMCReverbDesign* design);
+    bool BMCReverbDesignHasFrozenIR(const BMCReverbDesign* design);
+    void BMCReverbUpdateWetPath(struct BMCReverb* rv, bool wait);
+    bool BMCReverbShouldFreeze(const struct BMCReverb* rv);
+    size_t BMCReverbFrozenIRLengthEstimate(const struct BMCReverb* rv);
+    struct BMCReverbFrozenIR* BMCReverbGetFrozenIR(BMCReverbDesign* design, bool slowDecay);
+    struct BMCReverbFrozenIR* BMCReverbRenderFrozenIR(BMCReverbDesign* design, bool slowDecay);
+    bool BMCReverbFrozenIRLayoutMatches(const struct BMCReverbFrozenIR* ir, const size_t* numPartitions);
+    void BMCReverbStartFreezer(void);
+    void* BMCReverbFreezer(void* context);
+    bool BMCReverbFreezeJobSubmit(struct BMCReverb* rv);
+    void BMCReverbFreezeJobProcess(BMCReverbFreezeJob* job);
+    void BMCReverbFreezeJobRelease(BMCReverbFreezeJob* job);
+    void BMCReverbBeginBuffer(struct BMCReverb* rv);
+    void BMCReverbEndBuffer(struct BMCReverb* rv, size_t numSamples);
+    void BMCReverbProcessWetChunk(struct BMCReverb* rv, float* outputL, float* outputR, size_t numSamples);
+    void BMCReverbProcessNetworkChunk(struct BMCReverb* rv, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples);
+    size_t BMCReverbCopySanitised(const float* input, float* output, size_t numSamples);
+    size_t BMCReverbCountNonFinite(const float* data, size_t numSamples);
+    void BMCReverbCountSanitised(struct BMCReverb* rv, size_t numSanitised);
+    void BMCReverbRecoverFromFault(struct BMCReverb* rv);
+    void BMCReverbUpdateModulation(struct BMCReverb* rv);
+    void BMCReverbReadModulated(struct BMCReverb* rv);
+    void BMCReverbReadModulatedStale(struct BMCReverb* rv);
+    size_t BMCReverbDiffusionLengths(const float* delayTimes, size_t numStages, float sampleRate, size_t* lengths);
+    void BMCReverbReserveDiffusionMemory(struct BMCReverb* rv, size_t totalSamples);
+    void BMCReverbUpdateDiffusion(struct BMCReverb* rv);
+    void BMCReverbResetDiffusion(struct BMCReverb* rv);
+    void BMCReverbDiffuse(struct BMCReverb* rv, const float* input, float* output, size_t firstFilter, size_t numSamples);
+    bool BMCReverbUsesBlockedKernel(const struct BMCReverb* rv);
+    void BMCReverbPackUnitBlocks(struct BMCReverb* rv);
+    void BMCReverbUnpackUnitBlocks(struct BMCReverb* rv);
+    void BMCReverbProcessBlockedSample(struct BMCReverb* rv, float inputL, float inputR, float* outputL, float* outputR);
+    size_t BMCReverbDecimationFactor(const struct BMCReverb* rv);
+    void BMCReverbUpdateNetworkRate(struct BMCReverb* rv);
+    void BMCReverbResetResampler(struct BMCReverb* rv);
+    size_t BMCReverbDecimate(struct BMCReverb* rv, const float* input, float* history, float* output, size_t numSamples);
+    void BMCReverbInterpolate(struct BMCReverb* rv, float* history, float* output, size_t numSamples);
+#ifdef BMCREVERB_INSTRUMENTATION
+    void BMCReverbCountDenormals(struct BMCReverb* rv, const float* delayOutputs);
+#endif
     
     
     
@@ -65,19 +241,59 @@ extern "C" {
      * Initialization: this MUST be called before running the reverb
      */
     void BMCReverbInit(struct BMCReverb* rv){
+        // reserve just enough memory for the default settings
+        BMCReverbInitWithCapacity(rv, BMCREVERB_DEFAULTSAMPLERATE, BMCREVERB_NUMDELAYUNITS, BMCREVERB_PREDELAY, BMCREVERB_ROOMSIZE);
+    }
+    
+    
+    
+    
+    void BMCReverbInitWithCapacity(struct BMCReverb* rv, float maxSampleRate, size_t maxDelayUnits, float maxPreDelay_seconds, float maxRoomSize_seconds){
+        BMCReverbInitInstance(rv);
+        
+        // reserve memory for the largest network we have been asked to run
+        size_t maxNumDelays = BM_MAX(maxDelayUnits*4, rv->newNumDelays);
+        rv->design = BMCReverbDesignAlloc(maxNumDelays);
+        BMCReverbReserveDelays(rv, maxNumDelays);
+        BMCReverbReserveDelayMemory(rv, BMCReverbMaxTotalSamples(maxNumDelays, maxSampleRate, maxPreDelay_seconds, maxRoomSize_seconds));
+        
+        // and for input diffusion with all the default stages
+        size_t diffusionLengths [2*BMCREVERB_MAXDIFFUSIONSTAGES];
+        BMCReverbReserveDiffusionMemory(rv, BMCReverbDiffusionLengths(BMCReverbDefaultDiffusionTimes, BMCREVERB_MAXDIFFUSIONSTAGES, maxSampleRate, diffusionLengths));
+        
+        // initialize all the delays and delay-dependent settings
+        BMCReverbUpdateNumDelayUnits(rv);
+    }
+    
+    
+    
+    
+    void BMCReverbInitWithDesign(struct BMCReverb* rv, BMCReverbDesign* design){
+        BMCReverbInitInstance(rv);
+        
+        // use the shared design instead of computing our own
+        BMCReverbSetDesign(rv, design);
+        BMCReverbUpdateSettings(rv, true);
+    }
+    
+    
+    
+    
+    // default settings and the buffers that don't depend on the network
+    void BMCReverbInitInstance(struct BMCReverb* rv){
         // initialize all pointers to NULL
         BMCReverbPointersToNull(rv);
-        
-        // create pointers to the various filter sections
-        rv->fcChLSec0 = rv->mainFilterCoefficients + 0*2*5 + 0*5;
-        rv->fcChLSec1 = rv->mainFilterCoefficients + 1*2*5 + 0*5;
-        rv->fcChRSec0 = rv->mainFilterCoefficients + 0*2*5 + 1*5;
-        rv->fcChRSec1 = rv->mainFilterCoefficients + 1*2*5 + 1*5;
+        rv->capacityNumDelays = rv->capacityTotalSamples = rv->capacityDiffusionSamples = 0;
+        rv->numDelays = 0;
+        rv->bytesAllocated = 0;
+        rv->sanitisedSamples = rv->faultsRecovered = 0;
         
         // initialize default settings
         rv->sampleRate = BMCREVERB_DEFAULTSAMPLERATE;
+        rv->decimation = BMCREVERB_DECIMATION;
+        rv->decimationFactor = 1;
+        rv->networkSampleRate = rv->sampleRate;
         rv->delayUnits = BMCREVERB_NUMDELAYUNITS;
-        rv->matrixAttenuation = BMCREVERB_MATRIXATTENUATION;
         rv->highShelfFC = BMCREVERB_HIGHSHELFFC;
         rv->hfDecayMultiplier = BMCREVERB_HFDECAYMULTIPLIER;
         rv->hfSlowDecayMultiplier = BMCREVERB_HFSLOWDECAYMULTIPLIER;
@@ -87,19 +303,61 @@ extern "C" {
         rv->delayUnits = BMCREVERB_NUMDELAYUNITS;
         rv->slowDecay = false;
         rv->settingsQueuedForUpdate = false;
+        rv->decayCoefficientsQueuedForUpdate = false;
         rv->slowDecayRT60 = BMCREVERB_SLOWDECAYRT60;
-        rv->newNumDelayUnits = BMCREVERB_NUMDELAYUNITS;
+        rv->newNumDelays = 4*BMCREVERB_NUMDELAYUNITS;
+        rv->newMixingMatrix = BMCREVERB_MIXINGMATRIX;
+        rv->seed = BMCREVERB_SEED;
         rv->autoSustain=false;
+        rv->frozenIRMode = BMCREVERB_FROZENIR_OFF;
+        rv->frozen = rv->frozenSlowDecay = rv->freezePending = false;
+        rv->idleFramesLeft = 0;
+        
+        // frozen impulse responses are rendered in the background. The
+        // job is allocated here so that the audio thread never has to.
+        pthread_once(&BMCReverbFreezerOnce, BMCReverbStartFreezer);
+        rv->freezeJob = calloc(1, sizeof(BMCReverbFreezeJob));
+        if (rv->freezeJob) rv->freezeJob->refCount = 1;
+        
         BMCReverbSetHighPassFC(rv, BMCREVERB_HIGHPASS_FC);
         BMCReverbSetLowPassFC(rv, BMCREVERB_LOWPASS_FC);
         BMCReverbSetWetGain(rv, BMCREVERB_WETMIX);
         BMCReverbSetCrossStereoMix(rv, BMCREVERB_CROSSSTEREOMIX);
         
-        // initialize the filter setup
-        rv->mainFilterSetup = vDSP_biquadm_CreateSetup(rv->mainFilterCoefficients, 2, 2);
-        
-        // initialize all the delays and delay-dependent settings
-        BMCReverbUpdateNumDelayUnits(rv);
+        // buffers for processing in chunks. The filter buffers have two
+        // extra samples at the start to hold the filter history. They
+        // have room for the longest chunks, so the chunk length can change
+        // at any time.
+        rv->kernel = BMCREVERB_KERNEL_VECTOR;
+        rv->chunkLength = BMCREVERB_CHUNKLENGTH;
+        rv->modulationDepth_seconds = BMCREVERB_MODULATIONDEPTH;
+        rv->modulationRate = BMCREVERB_MODULATIONRATE;
+        rv->modulationDepthSamples = 0.0f;
+        rv->interpolation = BMCREVERB_INTERPOLATION;
+        rv->modulationQueuedForUpdate = false;
+        rv->numDiffusionStages = BMCREVERB_DIFFUSIONSTAGES;
+        rv->activeDiffusionStages = rv->diffusionTotalSamples = 0;
+        rv->diffusionGain = BMCREVERB_DIFFUSIONGAIN;
+        memcpy(rv->diffusionTimes, BMCReverbDefaultDiffusionTimes, sizeof(rv->diffusionTimes));
+        rv->leftOutputTemp = malloc(BMCREVERB_MAXCHUNKLENGTH*sizeof(float));
+        rv->dryL = malloc(BMCREVERB_MAXCHUNKLENGTH*sizeof(float));
+        rv->dryR = malloc(BMCREVERB_MAXCHUNKLENGTH*sizeof(float));
+        rv->filterTemp0 = malloc((BMCREVERB_MAXCHUNKLENGTH+2)*sizeof(float));
+        rv->filterTemp1 = malloc((BMCREVERB_MAXCHUNKLENGTH+2)*sizeof(float));
+        memset(rv->mainFilterHistory, 0, sizeof(rv->mainFilterHistory));
+        
+        // buffers for the reduced rate wet path. The histories of the
+        // resampling filters sit in front of the frames of each chunk.
+        rv->decimatedL = malloc(BMCREVERB_MAXCHUNKLENGTH*sizeof(float));
+        rv->decimatedR = malloc(BMCREVERB_MAXCHUNKLENGTH*sizeof(float));
+        rv->decimatorHistoryL = malloc((BMCREVERB_MAXCHUNKLENGTH + BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS)*sizeof(float));
+        rv->decimatorHistoryR = malloc((BMCREVERB_MAXCHUNKLENGTH + BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS)*sizeof(float));
+        rv->interpolatorHistoryL = malloc((BMCREVERB_MAXCHUNKLENGTH + BMCREVERB_RESAMPLERTAPS)*sizeof(float));
+        rv->interpolatorHistoryR = malloc((BMCREVERB_MAXCHUNKLENGTH + BMCREVERB_RESAMPLERTAPS)*sizeof(float));
+        BMCReverbResetResampler(rv);
+#ifdef BMCREVERB_INSTRUMENTATION
+        BMCReverbInstrumentationInit(&rv->instrumentation);
+#endif
     }
     
     
@@ -110,97 +368,335 @@ extern "C" {
      * the same data for mono to stereo operation
      */
     void BMCReverbProcessBuffer(struct BMCReverb* rv, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples){
-        
-        // don't process anything if there are nan values in the input
-        if (isnan(inputL[0]) || isnan(inputR[0])) {
-            memset(outputL, 0, sizeof(float)*numSamples);
-            memset(outputR, 0, sizeof(float)*numSamples);
-            return;
-        }
+        BMCReverbBeginBuffer(rv);
         
         
         // this requires buffer memory so we do it in limited sized chunks to
         // avoid having to adjust the buffer length at runtime
         size_t samplesLeftToMix = numSamples;
-        size_t samplesMixingNext = BM_MIN(BMCREVERB_TEMPBUFFERLENGTH,samplesLeftToMix);
+        size_t samplesMixingNext = BM_MIN(rv->chunkLength,samplesLeftToMix);
         size_t bufferedProcessingIndex = 0;
+        size_t numSanitised = 0;
         while (samplesLeftToMix != 0) {
             
-            
-            if(rv->autoSustain){
-                // check volume of the current frame
-                float volume;
-                vDSP_svesq(inputL+bufferedProcessingIndex, 1, &volume, samplesMixingNext);
-                
-                // if the volume is high, enable sustain mode
-                if((volume / (float)samplesMixingNext) > 0.001)
-                    BMCReverbSetSlowDecayState(rv, true);
-                
-                // if the volume is very low, disable sustain mode
-                if((volume / (float)samplesMixingNext) < 0.00001)
-                    BMCReverbSetSlowDecayState(rv, false);
-            }
+            // backup the input to allow in place processing, replacing the
+            // samples that would break the network
+            numSanitised += BMCReverbCopySanitised(inputL+bufferedProcessingIndex, rv->dryL, samplesMixingNext);
+            numSanitised += BMCReverbCopySanitised(inputR+bufferedProcessingIndex, rv->dryR, samplesMixingNext);
             
             
-            // backup the input to allow in place processing
-            memcpy(rv->dryL, inputL+bufferedProcessingIndex, sizeof(float)*samplesMixingNext);
-            memcpy(rv->dryR, inputR+bufferedProcessingIndex, sizeof(float)*samplesMixingNext);
-            
+            // process the reverb to get the wet signal
+            BMCReverbProcessWetChunk(rv, outputL+bufferedProcessingIndex, outputR+bufferedProcessingIndex, samplesMixingNext);
             
             
-            // process the reverb to get the wet signal
-            for (size_t i=bufferedProcessingIndex; i < bufferedProcessingIndex+samplesMixingNext; i++)
-                BMCReverbProcessWetSample(rv, inputL[i], inputR[i], &outputL[i], &outputR[i]);
+            // mix dry and wet signals
+            BMCREVERB_STAGE_START(rv);
+            vDSP_vsmsma(rv->dryL, 1, &rv->dryGain, outputL+bufferedProcessingIndex, 1, &rv->wetGain, outputL+bufferedProcessingIndex, 1, samplesMixingNext);
+            vDSP_vsmsma(rv->dryR, 1, &rv->dryGain, outputR+bufferedProcessingIndex, 1, &rv->wetGain, outputR+bufferedProcessingIndex, 1, samplesMixingNext);
+            BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_DRYWET);
             
             
             
-            // mix R and L wet signals
-            // mix left and right to left temp
-            vDSP_vsmsma(outputL+bufferedProcessingIndex, 1, &rv->straightStereoMix, outputR+bufferedProcessingIndex, 1, &rv->crossStereoMix, rv->leftOutputTemp, 1, samplesMixingNext);
-            // mix right and left to right
-            vDSP_vsmsma(outputR+bufferedProcessingIndex, 1, &rv->straightStereoMix, outputL+bufferedProcessingIndex, 1, &rv->crossStereoMix, outputR+bufferedProcessingIndex, 1, samplesMixingNext);
-            // copy left temp back to left output
-            memcpy(outputL+bufferedProcessingIndex, rv->leftOutputTemp, sizeof(float)*samplesMixingNext);
+            // update the number of samples left to process in the buffer
+            samplesLeftToMix -= samplesMixingNext;
+            bufferedProcessingIndex += samplesMixingNext;
+            samplesMixingNext = BM_MIN(rv->chunkLength,samplesLeftToMix);
+        }
+        
+        
+        
+        BMCReverbCountSanitised(rv, numSanitised);
+        BMCReverbEndBuffer(rv, numSamples);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbProcessSends(struct BMCReverb* rv, const float* const* inputsL, const float* const* inputsR, const float* sendGains, size_t numSources, float* outputL, float* outputR, size_t numSamples){
+        BMCReverbBeginBuffer(rv);
+        
+        
+        size_t samplesLeftToMix = numSamples;
+        size_t samplesMixingNext = BM_MIN(rv->chunkLength,samplesLeftToMix);
+        size_t bufferedProcessingIndex = 0;
+        size_t numSanitised = 0;
+        while (samplesLeftToMix != 0) {
             
+            // sum the sends into the input of the network
+            vDSP_vclr(rv->dryL, 1, samplesMixingNext);
+            vDSP_vclr(rv->dryR, 1, samplesMixingNext);
+            for (size_t j=0; j<numSources; j++) {
+                if (sendGains[j] == 0.0f) continue;
+                vDSP_vsma(inputsL[j]+bufferedProcessingIndex, 1, &sendGains[j], rv->dryL, 1, rv->dryL, 1, samplesMixingNext);
+                vDSP_vsma(inputsR[j]+bufferedProcessingIndex, 1, &sendGains[j], rv->dryR, 1, rv->dryR, 1, samplesMixingNext);
+            }
             
+            // a bad sample in any source shows in the sum
+            numSanitised += BMCReverbCopySanitised(rv->dryL, rv->dryL, samplesMixingNext);
+            numSanitised += BMCReverbCopySanitised(rv->dryR, rv->dryR, samplesMixingNext);
             
-            // mix dry and wet signals
-            vDSP_vsmsma(rv->dryL, 1, &rv->dryGain, outputL+bufferedProcessingIndex, 1, &rv->wetGain, outputL+bufferedProcessingIndex, 1, samplesMixingNext);
-            vDSP_vsmsma(rv->dryR, 1, &rv->dryGain, outputR+bufferedProcessingIndex, 1, &rv->wetGain, outputR+bufferedProcessingIndex, 1, samplesMixingNext);
             
+            // the output is the wet signal only
+            BMCReverbProcessWetChunk(rv, outputL+bufferedProcessingIndex, outputR+bufferedProcessingIndex, samplesMixingNext);
             
             
-            // update the number of samples left to process in the buffer
             samplesLeftToMix -= samplesMixingNext;
             bufferedProcessingIndex += samplesMixingNext;
-            samplesMixingNext = BM_MIN(BMCREVERB_TEMPBUFFERLENGTH,samplesLeftToMix);
+            samplesMixingNext = BM_MIN(rv->chunkLength,samplesLeftToMix);
         }
         
         
+        BMCReverbCountSanitised(rv, numSanitised);
+        BMCReverbEndBuffer(rv, numSamples);
+    }
+    
+    
+    
+    
+    
+    // applies the settings that can change at the start of a buffer
+    void BMCReverbBeginBuffer(struct BMCReverb* rv){
+        rv->traceBufferStart = BMCREVERB_TRACE_START(rv);
+        BMCREVERB_STAGE_START(rv);
+        
+        // apply all changes to the decay settings since the last buffer in
+        // a single pass
+        if (rv->decayCoefficientsQueuedForUpdate) {
+            // we can't modify a design that other reverbs are using. Copying
+            // it requires memory allocation, so we wait until the end of the
+            // buffer. The same goes for a design with impulse responses
+            // that will have to be rendered again.
+            if (BMCReverbDesignIsShared(rv->design) || BMCReverbDesignHasFrozenIR(rv->design))
+                rv->settingsQueuedForUpdate = true;
+            else
+                BMCReverbUpdateDecayCoefficients(rv);
+        }
         
-        // filter the wet output signal (highpass and lowpass)
-        //
-        // combine the two channels into a single 2-dimensional array as required
-        // by vDSP_biquadm
-        rv->twoChannelFilterData[0] = outputL;
-        rv->twoChannelFilterData[1] = outputR;
-        // apply a multilevel biquad filter to both channels
-        vDSP_biquadm(rv->mainFilterSetup, (const float**)rv->twoChannelFilterData, 1, rv->twoChannelFilterData, 1, numSamples);
+        if (rv->modulationQueuedForUpdate)
+            BMCReverbUpdateModulation(rv);
         
+        // a frozen reverb needs a different impulse response for slow
+        // decay, unless it is already waiting for one
+        if (rv->frozen && rv->slowDecay != rv->frozenSlowDecay && !rv->freezePending)
+            rv->settingsQueuedForUpdate = true;
         
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_SETTINGS);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbEndBuffer(struct BMCReverb* rv, size_t numSamples){
+        BMCReverbRecoverFromFault(rv);
         
         /*
          * if an update requiring memory allocation was requested, do it now.
          */
+        BMCREVERB_STAGE_START(rv);
         if (rv->settingsQueuedForUpdate)
-            BMCReverbUpdateSettings(rv);
+            BMCReverbUpdateSettings(rv, false);
+        // switch to the frozen impulse response once the background
+        // thread has finished with it
+        else if (rv->freezePending && __atomic_load_n(&rv->freezeJob->state, __ATOMIC_ACQUIRE) != BMCREVERB_FREEZE_QUEUED)
+            BMCReverbUpdateWetPath(rv, false);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_SETTINGS);
+        
+#ifdef BMCREVERB_INSTRUMENTATION
+        rv->instrumentation.working.buffers++;
+        BMCReverbInstrumentationPublish(&rv->instrumentation);
+#endif        
+        BMCREVERB_TRACE(rv, BMCREVERB_TRACE_PROCESS, rv->traceBufferStart, numSamples);
     }
     
     
     
-    void BMCReverbUpdateSettings(struct BMCReverb* rv){
-        BMCReverbUpdateNumDelayUnits(rv);
+    
+    
+    // processes numSamples (at most rv->chunkLength) frames of
+    // input from dryL and dryR into the wet output, filtered and mixed
+    // between the channels but not scaled by wetGain.
+    void BMCReverbProcessWetChunk(struct BMCReverb* rv, float* outputL, float* outputR, size_t numSamples){
+        if (rv->decimationFactor == 1) {
+            BMCReverbProcessNetworkChunk(rv, rv->dryL, rv->dryR, outputL, outputR, numSamples);
+            return;
+        }
+        
+        // decimate the input, run the wet path at the network rate into
+        // the interpolator histories and interpolate its output back up
+        BMCREVERB_STAGE_START(rv);
+        size_t numDecimated = BMCReverbDecimate(rv, rv->dryL, rv->decimatorHistoryL, rv->decimatedL, numSamples);
+        BMCReverbDecimate(rv, rv->dryR, rv->decimatorHistoryR, rv->decimatedR, numSamples);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_RESAMPLING);
+        
+        if (numDecimated > 0)
+            BMCReverbProcessNetworkChunk(rv, rv->decimatedL, rv->decimatedR, rv->interpolatorHistoryL + BMCREVERB_RESAMPLERTAPS, rv->interpolatorHistoryR + BMCREVERB_RESAMPLERTAPS, numDecimated);
+        
+        BMCREVERB_STAGE_START(rv);
+        BMCReverbInterpolate(rv, rv->interpolatorHistoryL, outputL, numSamples);
+        BMCReverbInterpolate(rv, rv->interpolatorHistoryR, outputR, numSamples);
+        rv->resamplerPhase = (rv->resamplerPhase + numSamples) % rv->decimationFactor;
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_RESAMPLING);
+    }
+    
+    
+    
+    
+    
+    // the wet path at the network rate, from inputL and inputR to the
+    // outputs. The outputs may not overlap the inputs.
+    void BMCReverbProcessNetworkChunk(struct BMCReverb* rv, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples){
+        if(rv->autoSustain){
+            bool slowDecay = rv->slowDecay;
+            
+            // check volume of the current frame
+            float volume;
+            vDSP_svesq(inputL, 1, &volume, numSamples);
+            
+            // if the volume is high, enable sustain mode
+            if((volume / (float)numSamples) > 0.001)
+                BMCReverbSetSlowDecayState(rv, true);
+            
+            // if the volume is very low, disable sustain mode
+            if((volume / (float)numSamples) < 0.00001)
+                BMCReverbSetSlowDecayState(rv, false);
+            
+            if (rv->slowDecay != slowDecay)
+                BMCREVERB_TRACE(rv, BMCREVERB_TRACE_SLOWDECAY, 0, rv->slowDecay);
+        }
+        
+        
+        
+        // diffuse the input into the output buffers. The network and the
+        // convolver both read each input sample before writing the output
+        // sample in its place.
+        if (rv->activeDiffusionStages > 0) {
+            BMCREVERB_STAGE_START(rv);
+            BMCReverbDiffuse(rv, inputL, outputL, 0, numSamples);
+            BMCReverbDiffuse(rv, inputR, outputR, rv->activeDiffusionStages, numSamples);
+            inputL = outputL;
+            inputR = outputR;
+            BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_DIFFUSION);
+        }
+        
+        
+        
+        // process the reverb to get the wet signal
+        if (rv->frozen)
+            BMCReverbConvolverProcess(rv->convolver, inputL, inputR, outputL, outputR, numSamples);
+        else if (BMCReverbUsesBlockedKernel(rv)) {
+            // the rest of the reverb only sees the flat arrays, which are
+            // up to date again at the end of the chunk
+            BMCReverbPackUnitBlocks(rv);
+            for (size_t i=0; i < numSamples; i++)
+                BMCReverbProcessBlockedSample(rv, inputL[i], inputR[i], &outputL[i], &outputR[i]);
+            BMCReverbUnpackUnitBlocks(rv);
+        } else
+            for (size_t i=0; i < numSamples; i++)
+                BMCReverbProcessWetSample(rv, inputL[i], inputR[i], &outputL[i], &outputR[i]);
+        
+        
+        // after a switch between the network and the convolver, the
+        // one we switched from finishes its tail without input
+        if (rv->idleFramesLeft > 0) {
+            size_t n = BM_MIN(rv->idleFramesLeft, numSamples);
+            if (rv->frozen)
+                for (size_t i=0; i<n; i++)
+                    BMCReverbProcessWetSample(rv, 0.0f, 0.0f, rv->filterTemp0+i, rv->filterTemp1+i);
+            else
+                BMCReverbConvolverProcess(rv->convolver, NULL, NULL, rv->filterTemp0, rv->filterTemp1, n);
+            vDSP_vadd(outputL, 1, rv->filterTemp0, 1, outputL, 1, n);
+            vDSP_vadd(outputR, 1, rv->filterTemp1, 1, outputR, 1, n);
+            rv->idleFramesLeft -= n;
+            if (rv->idleFramesLeft == 0)
+                BMCREVERB_TRACE(rv, BMCREVERB_TRACE_IDLE, 0, 0);
+        }
+        
+        
+        
+        // mix R and L wet signals
+        BMCREVERB_STAGE_START(rv);
+        // mix left and right to left temp
+        vDSP_vsmsma(outputL, 1, &rv->straightStereoMix, outputR, 1, &rv->crossStereoMix, rv->leftOutputTemp, 1, numSamples);
+        // mix right and left to right
+        vDSP_vsmsma(outputR, 1, &rv->straightStereoMix, outputL, 1, &rv->crossStereoMix, outputR, 1, numSamples);
+        // copy left temp back to left output
+        memcpy(outputL, rv->leftOutputTemp, sizeof(float)*numSamples);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_CROSSSTEREO);
+        
+        
+        
+        // filter the wet output signal (highpass and lowpass)
+        BMCReverbMainFilterChannel(rv, outputL, rv->mainFilterHistory+0, numSamples);
+        BMCReverbMainFilterChannel(rv, outputR, rv->mainFilterHistory+6, numSamples);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_BIQUAD);
+    }
+    
+    
+    
+    // applies queued settings. If wait is false the frozen impulse
+    // response is rendered in the background instead of here.
+    void BMCReverbUpdateSettings(struct BMCReverb* rv, bool wait){
+        uint64_t traceStart = BMCREVERB_TRACE_START(rv);
+        size_t bytesAllocated = rv->bytesAllocated;
+        
+        // switch to the queued design, if there is one
+        BMCReverbDesign* newDesign = __atomic_exchange_n(&rv->newDesign, NULL, __ATOMIC_ACQ_REL);
+        if (newDesign) {
+            BMCReverbDesign* oldDesign = rv->design;
+            rv->design = newDesign;
+            BMCReverbAttachDesign(rv);
+            if (!oldDesign || !BMCReverbDesignLayoutsMatch(oldDesign, newDesign))
+                BMCReverbResetDelays(rv);
+            BMCReverbDesignRelease(oldDesign);
+        }
+        
+        // everything below depends on the rate the network runs at
+        BMCReverbUpdateNetworkRate(rv);
+        
+        // if settings have changed since the design was computed, compute
+        // a new one. Otherwise the design is already up to date.
+        if (BMCReverbDesignMatchesSettings(rv->design, rv)) {
+            rv->settingsQueuedForUpdate = false;
+            rv->decayCoefficientsQueuedForUpdate = false;
+        } else
+            BMCReverbUpdateNumDelayUnits(rv);
+        
         BMCReverbUpdateMainFilter(rv);
+        BMCReverbUpdateDiffusion(rv);
+        BMCReverbUpdateWetPath(rv, wait);
+        
+        BMCREVERB_TRACE(rv, BMCREVERB_TRACE_UPDATESETTINGS, traceStart, rv->bytesAllocated - bytesAllocated);
+    }
+    
+    
+    
+    // filters one channel of wet signal in place through the highpass and
+    // lowpass sections.
+    //
+    // vDSP_deq22 expects the two previous input and output samples to sit
+    // in front of the input and output arrays. history holds those samples
+    // for the input, the highpass output and the lowpass output, in that
+    // order, so the filter state lives in the reverb struct rather than in
+    // an opaque setup object.
+    void BMCReverbMainFilterChannel(struct BMCReverb* rv, float* data, float* history, size_t numSamples){
+        // highpass: filterTemp0 => filterTemp1
+        memcpy(rv->filterTemp0, history+0, sizeof(float)*2);
+        memcpy(rv->filterTemp0+2, data, sizeof(float)*numSamples);
+        memcpy(rv->filterTemp1, history+2, sizeof(float)*2);
+        vDSP_deq22(rv->filterTemp0, 1, rv->highpassCoefficients, rv->filterTemp1, 1, numSamples);
+        
+        // save the input and highpass history before we reuse filterTemp0
+        memcpy(history+0, rv->filterTemp0+numSamples, sizeof(float)*2);
+        memcpy(history+2, rv->filterTemp1+numSamples, sizeof(float)*2);
+        
+        // lowpass: filterTemp1 => filterTemp0
+        memcpy(rv->filterTemp0, history+4, sizeof(float)*2);
+        vDSP_deq22(rv->filterTemp1, 1, rv->lowpassCoefficients, rv->filterTemp0, 1, numSamples);
+        memcpy(history+4, rv->filterTemp0+numSamples, sizeof(float)*2);
+        
+        memcpy(data, rv->filterTemp0+2, sizeof(float)*numSamples);
     }
     
     void BMCReverbSetSlowDecayState(struct BMCReverb* rv, bool slowDecay){
@@ -209,14 +705,77 @@ extern "C" {
     
     void BMCReverbSetAutoSustain(struct BMCReverb* rv, bool autoSustain){
         rv->autoSustain = autoSustain;
+        // auto-sustain needs the network
+        if (rv->frozenIRMode != BMCREVERB_FROZENIR_OFF)
+            rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    void BMCReverbSetKernel(struct BMCReverb* rv, BMCReverbKernel kernel){
+        rv->kernel = kernel;
+    }
+    
+    
+    
+    void BMCReverbSetChunkLength(struct BMCReverb* rv, size_t chunkLength){
+        assert(chunkLength > 0 && chunkLength <= BMCREVERB_MAXCHUNKLENGTH);
+        rv->chunkLength = chunkLength;
+    }
+    
+    
+    
+    void BMCReverbSetModulation(struct BMCReverb* rv, float depth_seconds, float rate_hz){
+        assert(depth_seconds >= 0.0 && rate_hz >= 0.0);
+        bool wasModulated = rv->modulationDepth_seconds > 0.0f;
+        rv->modulationDepth_seconds = depth_seconds;
+        rv->modulationRate = rate_hz;
+        rv->modulationQueuedForUpdate = true;
+        // automatic freezing depends on it
+        if (rv->frozenIRMode == BMCREVERB_FROZENIR_AUTO && wasModulated != (depth_seconds > 0.0f))
+            rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    void BMCReverbSetInterpolation(struct BMCReverb* rv, BMCReverbInterpolation interpolation){
+        rv->interpolation = interpolation;
+    }
+    
+    
+    
+    void BMCReverbSetDiffusion(struct BMCReverb* rv, size_t numStages, const float* delayTimes_seconds){
+        assert(numStages <= BMCREVERB_MAXDIFFUSIONSTAGES);
+        const float* delayTimes = delayTimes_seconds ? delayTimes_seconds : BMCReverbDefaultDiffusionTimes;
+        for (size_t i=0; i<numStages; i++) {
+            assert(delayTimes[i] > 0.0 && delayTimes[i] <= BMCREVERB_MAXDIFFUSIONTIME);
+            rv->diffusionTimes[i] = delayTimes[i];
+        }
+        rv->numDiffusionStages = numStages;
+        // the delays may need more memory
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    void BMCReverbSetDecimation(struct BMCReverb* rv, size_t decimation){
+        assert(decimation <= BMCREVERB_MAXDECIMATION);
+        rv->decimation = decimation;
+        // the network has to be designed again for the new rate
+        rv->settingsQueuedForUpdate = true;
     }
     
     
+    
+    void BMCReverbSetDiffusionGain(struct BMCReverb* rv, float gain){
+        assert(gain >= 0.0 && gain < 1.0);
+        rv->diffusionGain = gain;
+    }
+    
+    
+    // recomputes the filter coefficients after a change in sample rate
     void BMCReverbUpdateMainFilter(struct BMCReverb* rv){
-        if(rv->mainFilterSetup)
-            vDSP_biquadm_DestroySetup(rv->mainFilterSetup);
-        
-        rv->mainFilterSetup = vDSP_biquadm_CreateSetup(rv->mainFilterCoefficients, 2, 2);
+        BMCReverbSetHighPassFC(rv, rv->highpassFC);
+        BMCReverbSetLowPassFC(rv, rv->lowpassFC);
     }
     
     
@@ -240,7 +799,7 @@ extern "C" {
         
         // else, for useful settings of fc, setup the filter
         else {
-            double gamma = tan(M_PI * fc / (double)rv->sampleRate);
+            double gamma = tan(M_PI * fc / (double)rv->networkSampleRate);
             double gamma_2 = gamma * gamma;
             double gamma_x_sqrt_2 = gamma * M_SQRT2;
             double one_over_denominator = 1.0 / (gamma_2 + gamma_x_sqrt_2 + 1.0);
@@ -253,10 +812,9 @@ extern "C" {
             *a2 = (gamma_2 - gamma_x_sqrt_2 + 1.0) * one_over_denominator;
         }
         
-        // copy the same filter coefficients to both channels
-        memcpy(rv->fcChLSec0, coeffs, sizeof(double)*5);
-        memcpy(rv->fcChRSec0, coeffs, sizeof(double)*5);
-        rv->settingsQueuedForUpdate = true;
+        // the filter takes effect immediately; no memory allocation required
+        for (size_t i=0; i<5; i++)
+            rv->highpassCoefficients[i] = coeffs[i];
     }
     
     
@@ -277,14 +835,14 @@ extern "C" {
         double* a2 = a1 + 1;
         
         // if fc is greater than 99% of the nyquyst frequency, bypass the filter
-        if (fc > 0.99*0.5*rv->sampleRate){
+        if (fc > 0.99*0.5*rv->networkSampleRate){
             *b0 = 1.0;
             *b1 = *b2 = *a1 = *a2 = 0.0;
         }
         
         // else, the cutoff frequency is non-trivial
         else {
-            double gamma = tan(M_PI * fc / (double)rv->sampleRate);
+            double gamma = tan(M_PI * fc / (double)rv->networkSampleRate);
             double gamma_2 = gamma * gamma;
             double gamma_x_sqrt_2 = gamma * M_SQRT2;
             double one_over_denominator = 1.0 / (gamma_2 + gamma_x_sqrt_2 + 1.0);
@@ -297,10 +855,9 @@ extern "C" {
             *a2 = (gamma_2 - gamma_x_sqrt_2 + 1.0) * one_over_denominator;
         }
         
-        // copy the same filter coefficients to both channels
-        memcpy(rv->fcChLSec1, coeffs, sizeof(double)*5);
-        memcpy(rv->fcChRSec1, coeffs, sizeof(double)*5);
-        rv->settingsQueuedForUpdate = true;
+        // the filter takes effect immediately; no memory allocation required
+        for (size_t i=0; i<5; i++)
+            rv->lowpassCoefficients[i] = coeffs[i];
     }
     
     
@@ -310,8 +867,7 @@ extern "C" {
     void BMCReverbSetRT60DecayTime(struct BMCReverb* rv, float rt60){
         assert(rt60 >= 0.0);
         rv->rt60 = rt60;
-        BMCReverbUpdateRT60DecayTime(rv);
-        BMCReverbUpdateDecayHighShelfFilters(rv);
+        rv->decayCoefficientsQueuedForUpdate = true;
     }
     
     
@@ -321,41 +877,71 @@ extern "C" {
     void BMCReverbSetSlowRT60DecayTime(struct BMCReverb* rv, float slowRT60){
         assert(slowRT60 >= 0.0);
         rv->slowDecayRT60 = slowRT60;
-        BMCReverbUpdateRT60DecayTime(rv);
+        rv->decayCoefficientsQueuedForUpdate = true;
     }
     
     
     
     void BMCReverbInitDelayOutputSigns(struct BMCReverb* rv){
-        // init delay output signs with an equal number of + and - for each channel
+        // init delay output signs with an equal number of + and - for each
+        // channel. (if halfNumDelays is odd there is one extra +)
         float one = 1.0, negativeOne = -1.0;
+        size_t numPositive = (rv->halfNumDelays + 1) / 2;
+        size_t numNegative = rv->halfNumDelays - numPositive;
         // left
-        vDSP_vfill(&one, rv->delayOutputSigns+0*rv->fourthNumDelays, 1, rv->fourthNumDelays);
-        vDSP_vfill(&negativeOne, rv->delayOutputSigns+1*rv->fourthNumDelays, 1, rv->fourthNumDelays);
+        vDSP_vfill(&one, rv->delayOutputSigns, 1, numPositive);
+        vDSP_vfill(&negativeOne, rv->delayOutputSigns+numPositive, 1, numNegative);
         // right
-        vDSP_vfill(&one, rv->delayOutputSigns+2*rv->fourthNumDelays, 1, rv->fourthNumDelays);
-        vDSP_vfill(&negativeOne, rv->delayOutputSigns+3*rv->fourthNumDelays, 1, rv->fourthNumDelays);
+        vDSP_vfill(&one, rv->delayOutputSigns+rv->halfNumDelays, 1, numPositive);
+        vDSP_vfill(&negativeOne, rv->delayOutputSigns+rv->halfNumDelays+numPositive, 1, numNegative);
         
         // randomise the order of the signs for each channel
-        unsigned int seed = 1;
+        uint32_t stream = 1;
         // left
-        BMCReverbRandomiseOrder(rv->delayOutputSigns, seed, rv->halfNumDelays);
+        BMCReverbRandomiseOrder(rv->delayOutputSigns, rv->seed, stream, rv->halfNumDelays);
         //right
-        BMCReverbRandomiseOrder(rv->delayOutputSigns+rv->halfNumDelays, seed, rv->halfNumDelays);
+        BMCReverbRandomiseOrder(rv->delayOutputSigns+rv->halfNumDelays, rv->seed, stream, rv->halfNumDelays);
+    }
+    
+    
+    
+    
+    // recomputes everything that depends on rt60, slowDecayRT60,
+    // hfDecayMultiplier or highShelfFC. The setters for those only mark the
+    // coefficients as out of date, so automating several of them in the
+    // same buffer costs just one update.
+    void BMCReverbUpdateDecayCoefficients(struct BMCReverb* rv){
+        uint64_t traceStart = BMCREVERB_TRACE_START(rv);
+        BMCReverbDesignDropFrozenIRs(rv->design);
+        BMCReverbUpdateRT60DecayTime(rv);
+        BMCReverbUpdateDecayHighShelfFilters(rv);
+        
+        // note the settings in the design
+        BMCReverbDesign* d = rv->design;
+        d->rt60 = rv->rt60;
+        d->slowDecayRT60 = rv->slowDecayRT60;
+        d->hfDecayMultiplier = rv->hfDecayMultiplier;
+        d->hfSlowDecayMultiplier = rv->hfSlowDecayMultiplier;
+        d->highShelfFC = rv->highShelfFC;
+        
+        rv->decayCoefficientsQueuedForUpdate = false;
+        
+        BMCREVERB_TRACE(rv, BMCREVERB_TRACE_COEFFICIENTS, traceStart, 0);
     }
     
     
     
     
     void BMCReverbUpdateRT60DecayTime(struct BMCReverb* rv){
-        for (size_t i=0; i<rv->numDelays; i++){
-            
-            // set gain for normal operation
-            rv->decayGainAttenuation[i] = BMCReverbDelayGainFromRT60(rv->rt60, rv->delayTimes[i]);
-            
-            // set gain for when the hold pedal is down
-            rv->slowDecayGainAttenuation[i] = BMCReverbDelayGainFromRT60(rv->slowDecayRT60, rv->delayTimes[i]);
-        }
+        // set gain for normal operation
+        float exponent = BMCReverbDecayExponentFromRT60(rv->rt60);
+        vDSP_vsmul(rv->delayTimes, 1, &exponent, rv->decayGainAttenuation, 1, rv->numDelays);
+        BMFastExp2(rv->decayGainAttenuation, rv->decayGainAttenuation, rv->numDelays);
+        
+        // set gain for when the hold pedal is down
+        exponent = BMCReverbDecayExponentFromRT60(rv->slowDecayRT60);
+        vDSP_vsmul(rv->delayTimes, 1, &exponent, rv->slowDecayGainAttenuation, 1, rv->numDelays);
+        BMFastExp2(rv->slowDecayGainAttenuation, rv->slowDecayGainAttenuation, rv->numDelays);
     }
     
     
@@ -371,14 +957,20 @@ extern "C" {
     
     
     
-    // computes the appropriate feedback gain attenuation
-    // to get an exponential decay envelope with the specified RT60 time
-    // (in seconds) from a delay line of the specified length.
+    // The appropriate feedback gain attenuation to get an exponential decay
+    // envelope with the specified RT60 time (in seconds) from a delay line
+    // of length delayTime is
+    //
+    //     gain = 10^(-3 * delayTime / rt60)
+    //          = 2^(delayTime * exponent)
+    //
+    // This function returns the exponent, so that the gains for all the
+    // delays can be found with one vector multiply and one vector exp2.
     //
     // This formula comes from solving EQ 11.33 in DESIGNING AUDIO EFFECT PLUG-INS IN C++ by Will Pirkle
     // which is attributed to Jot, originally.
-    double BMCReverbDelayGainFromRT60(double rt60, double delayTime){
-        return pow(10.0, (-3.0 * delayTime) / rt60 );
+    double BMCReverbDecayExponentFromRT60(double rt60){
+        return (-3.0 * BM_LOG2_10) / rt60;
     }
     
     
@@ -389,7 +981,7 @@ extern "C" {
     void BMCReverbSetHFDecayFC(struct BMCReverb* rv, float fc){
         assert(fc <= 18000.0 && fc > 100.0f);
         rv->highShelfFC = fc;
-        BMCReverbUpdateDecayHighShelfFilters(rv);
+        rv->decayCoefficientsQueuedForUpdate = true;
     }
     
     
@@ -413,7 +1005,7 @@ extern "C" {
     void BMCReverbSetHFDecayMultiplier(struct BMCReverb* rv, float multiplier){
         assert(multiplier >= 1.0);
         rv->hfDecayMultiplier = multiplier;
-        BMCReverbUpdateDecayHighShelfFilters(rv);
+        rv->decayCoefficientsQueuedForUpdate = true;
     }
     
     
@@ -421,56 +1013,60 @@ extern "C" {
     
     // updates the high shelf filters after a change in FC or gain
     void BMCReverbUpdateDecayHighShelfFilters(struct BMCReverb* rv){
-        double g,D;
-        double gamma;
-        
-        gamma = tan((M_PI * rv->highShelfFC) / rv->sampleRate);
+        float gamma = tan((M_PI * rv->highShelfFC) / rv->networkSampleRate);
         
         // bypass the filters if the multiplier is  1
         if (rv->hfDecayMultiplier == 1.0) {
-            for (size_t i = 0; i < rv->numDelays; i++){
-                
-                // set the filter coefficients
-                rv->b0[i] = 1.0f;
-                rv->b1[i] = 0.0f;
-                rv->a1[i] = 0.0f;
-                
-                // set the slow decay filter coefficients
-                rv->b0Slow[i] = 1.0f;
-                rv->b1Slow[i] = 0.0f;
-                rv->a1Slow[i] = 0.0f;
-            }
+            float one = 1.0f, zero = 0.0f;
+            
+            // set the filter coefficients
+            vDSP_vfill(&one, rv->b0, 1, rv->numDelays);
+            vDSP_vfill(&zero, rv->b1, 1, rv->numDelays);
+            vDSP_vfill(&zero, rv->a1, 1, rv->numDelays);
+            
+            // set the slow decay filter coefficients
+            vDSP_vfill(&one, rv->b0Slow, 1, rv->numDelays);
+            vDSP_vfill(&zero, rv->b1Slow, 1, rv->numDelays);
+            vDSP_vfill(&zero, rv->a1Slow, 1, rv->numDelays);
         } else
         {
+            // set the filter gains
+            //
+            // The gain of the filter is the desired HF gain divided by the
+            // broadband gain already applied to each delay line. Both are
+            // powers of 2, so we compute the ratio as a single power of 2
+            // and store it temporarily in b0.
+            float exponent = BMCReverbDecayExponentFromRT60(rv->rt60 / rv->hfDecayMultiplier) - BMCReverbDecayExponentFromRT60(rv->rt60);
+            vDSP_vsmul(rv->delayTimes, 1, &exponent, rv->b0, 1, rv->numDelays);
+            BMFastExp2(rv->b0, rv->b0, rv->numDelays);
+            BMCReverbHighShelfCoefficients(gamma, rv->b0, rv->b1, rv->a1, rv->numDelays);
             
-            for (size_t i = 0; i < rv->numDelays; i++){
-                // set the filter gains
-                //
-                // here we find the gain already applied to each delay line
-                double broadbandGain = BMCReverbDelayGainFromRT60(rv->rt60, rv->delayTimes[i]);
-                double desiredHFGain = BMCReverbDelayGainFromRT60(rv->rt60 / rv->hfDecayMultiplier, rv->delayTimes[i]);
-                double broadbandSlowGain = BMCReverbDelayGainFromRT60(rv->slowDecayRT60, rv->delayTimes[i]);
-                double desiredHFSlowGain = BMCReverbDelayGainFromRT60(rv->slowDecayRT60 / rv->hfSlowDecayMultiplier, rv->delayTimes[i]);
-                // and now find how much additional filter gain to apply for the given increase in HF decay speed
-                g = desiredHFGain / broadbandGain;
-                
-                // just a temp variable
-                D= 1.0 / ((g * gamma) + 1.0);
-                
-                // set the filter coefficients
-                rv->b0[i] = g * (gamma + 1.0) * D;
-                rv->b1[i] = g * (gamma - 1.0) * D;
-                // Rusty Allred omits the negative sign in the next line.  We use it to avoid a subtraction in the optimized filter code.
-                rv->a1[i] = -1.0 * ((g * gamma) - 1.0) * D;
-                
-                
-                // set the slow filter coefficients
-                g = desiredHFSlowGain / broadbandSlowGain;
-                D= 1.0 / ((g * gamma) + 1.0);
-                rv->b0Slow[i] = g * (gamma + 1.0) * D;
-                rv->b1Slow[i] = g * (gamma - 1.0) * D;
-                rv->a1Slow[i] = -1.0 * ((g * gamma) - 1.0) * D;
-            }
+            // set the slow filter coefficients
+            exponent = BMCReverbDecayExponentFromRT60(rv->slowDecayRT60 / rv->hfSlowDecayMultiplier) - BMCReverbDecayExponentFromRT60(rv->slowDecayRT60);
+            vDSP_vsmul(rv->delayTimes, 1, &exponent, rv->b0Slow, 1, rv->numDelays);
+            BMFastExp2(rv->b0Slow, rv->b0Slow, rv->numDelays);
+            BMCReverbHighShelfCoefficients(gamma, rv->b0Slow, rv->b1Slow, rv->a1Slow, rv->numDelays);
+        }
+    }
+    
+    
+    
+    
+    // Converts the filter gains g stored in b0 into the coefficients of a
+    // first order high shelf filter with prewarped cutoff gamma. b0 is
+    // overwritten.
+    void BMCReverbHighShelfCoefficients(float gamma, float* b0, float* b1, float* a1, size_t count){
+        for (size_t i = 0; i < count; i++){
+            float g = b0[i];
+            
+            // just a temp variable
+            float D = 1.0f / ((g * gamma) + 1.0f);
+            
+            // set the filter coefficients
+            b0[i] = g * (gamma + 1.0f) * D;
+            b1[i] = g * (gamma - 1.0f) * D;
+            // Rusty Allred omits the negative sign in the next line.  We use it to avoid a subtraction in the optimized filter code.
+            a1[i] = -1.0f * ((g * gamma) - 1.0f) * D;
         }
     }
     
@@ -555,150 +1151,1894 @@ extern "C" {
     // generate an evenly spaced but randomly jittered list of times between min and max
     void BMCReverbUpdateDelayTimes(struct BMCReverb* rv){
         
-        float spacing = (rv->maxDelay_seconds - rv->minDelay_seconds) / (float)rv->halfNumDelays;
+        // the resampling filters delay the wet signal, so the shortest
+        // delays are shortened by as much, but by no more than half
+        float minDelay = rv->minDelay_seconds;
+        if (rv->decimationFactor > 1)
+            minDelay = BM_MAX(minDelay - (float)(rv->decimationFactor*BMCREVERB_RESAMPLERTAPS - 1) / rv->sampleRate, 0.5f*minDelay);
+        
+        float spacing = (rv->maxDelay_seconds - minDelay) / (float)rv->halfNumDelays;
         
         // generate an evenly spaced list of times between min and max
         // left channel
-        vDSP_vramp(&rv->minDelay_seconds, &spacing, rv->delayTimes, 1, rv->halfNumDelays);
+        vDSP_vramp(&minDelay, &spacing, rv->delayTimes, 1, rv->halfNumDelays);
         // right channel
-        vDSP_vramp(&rv->minDelay_seconds, &spacing, rv->delayTimes+rv->halfNumDelays, 1, rv->halfNumDelays);
+        vDSP_vramp(&minDelay, &spacing, rv->delayTimes+rv->halfNumDelays, 1, rv->halfNumDelays);
         
         // Seed the random number generator for consistency. Doing this ensures
         // that we get the same delay times every time we run the reverb.
-        srand(111);
+        uint32_t randomState = BMCReverbRandomInit(rv->seed, 0);
         
         // jitter the times so that the spacing is not perfectly even
         for (size_t i = 0; i < rv->numDelays; i++)
-            rv->delayTimes[i] += spacing * ((float)rand() / (float) RAND_MAX);
+            rv->delayTimes[i] += spacing * ((float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX);
         
         
         // randomise the order of the list of delay times
         // left channel
-        BMCReverbRandomiseOrder(rv->delayTimes, 17, rv->halfNumDelays);
+        BMCReverbRandomiseOrder(rv->delayTimes, rv->seed, 17, rv->halfNumDelays);
         // right channel
-        BMCReverbRandomiseOrder(rv->delayTimes+rv->halfNumDelays, 4, rv->halfNumDelays);
+        BMCReverbRandomiseOrder(rv->delayTimes+rv->halfNumDelays, rv->seed, 4, rv->halfNumDelays);
         
         
         // convert times from milliseconds to samples and count the total
-        rv->totalSamples = 0;
+        BMCReverbDesign* d = rv->design;
+        bool layoutChanged = false;
+        size_t totalSamples = 0;
         for (size_t i = 0; i < rv->numDelays; i++) {
-            rv->bufferLengths[i] = (size_t)round(rv->sampleRate*rv->delayTimes[i]);
-            rv->totalSamples += rv->bufferLengths[i];
+            size_t bufferLength = (size_t)round(rv->networkSampleRate*rv->delayTimes[i]);
+            layoutChanged |= bufferLength != rv->bufferLengths[i];
+            rv->bufferLengths[i] = bufferLength;
+            
+            // mark the start and end (after the end) of each delay in memory
+            rv->bufferStartIndices[i] = totalSamples;
+            totalSamples += bufferLength;
+            rv->bufferEndIndices[i] = totalSamples;
         }
+        d->totalSamples = totalSamples;
+        d->sampleRate = rv->sampleRate;
+        d->decimationFactor = rv->decimationFactor;
+        d->minDelay_seconds = rv->minDelay_seconds;
+        d->maxDelay_seconds = rv->maxDelay_seconds;
         
         
-        // allocate memory for the main delays in the network
-        if (rv->delayLines) free(rv->delayLines);
-        rv->delayLines = malloc(sizeof(float)*rv->totalSamples);
-        vDSP_vclr(rv->delayLines,1, rv->totalSamples);
+        // if the delay lengths are the same as before, the delay memory and
+        // indices are still valid and we leave the reverb tail running
+        if (layoutChanged)
+            BMCReverbResetDelays(rv);
         
         
         
         // The following depend on delay time and have to be updated
         // whenever there is a change
-        BMCReverbUpdateRT60DecayTime(rv);
-        BMCReverbUpdateDecayHighShelfFilters(rv);
-        BMCReverbInitIndices(rv);
+        BMCReverbUpdateDecayCoefficients(rv);
     }
     
     
     
     
     
-    void BMCReverbSetNumDelayUnits(struct BMCReverb* rv, size_t delayUnits){
-        rv->newNumDelayUnits = delayUnits;
-        rv->settingsQueuedForUpdate = true;
+    void BMCReverbReset(struct BMCReverb* rv){
+        BMCReverbResetDelays(rv);
+        BMCReverbResetDiffusion(rv);
+        BMCReverbResetResampler(rv);
+        memset(rv->mainFilterHistory, 0, sizeof(rv->mainFilterHistory));
+        if (rv->convolver)
+            BMCReverbConvolverReset(rv->convolver);
+        rv->idleFramesLeft = 0;
     }
     
     
     
     
     
-    void BMCReverbUpdateNumDelayUnits(struct BMCReverb* rv){
-        /*
-         * before beginning, calculate some frequently reused values
-         */
-        size_t delayUnits = rv->newNumDelayUnits;
-        rv->numDelays = delayUnits*4;
-        rv->delayUnits = delayUnits;
-        rv->halfNumDelays = delayUnits*2;
-        rv->fourthNumDelays = delayUnits;
-        rv->threeFourthsNumDelays = delayUnits*3;
-        // we compute attenuation on half delays because the reverb is stereo
-        rv->inputAttenuation = 1.0f/sqrt((float)rv->halfNumDelays);
-        
-        
-        
-        // free old memory if necessary
-        if (rv->bufferLengths) BMCReverbFree(rv);
-        
+    void BMCReverbApplySettings(struct BMCReverb* rv){
+        if (rv->settingsQueuedForUpdate || rv->decayCoefficientsQueuedForUpdate || rv->freezePending)
+            BMCReverbUpdateSettings(rv, true);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetTrace(struct BMCReverb* rv, struct BMCReverbTrace* trace){
+        rv->trace = trace;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbGetStats(const struct BMCReverb* rv, BMCReverbStats* stats){
+#ifdef BMCREVERB_INSTRUMENTATION
+        BMCReverbInstrumentationRead(&rv->instrumentation, stats);
+        return true;
+#else
+        (void)rv;
+        memset(stats, 0, sizeof(BMCReverbStats));
+        return false;
+#endif
+    }
+    
+    
+    
+    
+    
+    // Copies numSamples samples from input to output, which may be the
+    // same, replacing NaN, infinite and huge values with zero, and returns
+    // how many were replaced. The test is on the bits and has no
+    // branches, so the loop vectorises: without the sign bit, floats
+    // compare like unsigned integers, and NaN and infinity compare above
+    // any finite limit.
+    size_t BMCReverbCopySanitised(const float* input, float* output, size_t numSamples){
+        const float limitFloat = BMCREVERB_INPUTLIMIT;
+        uint32_t limit;
+        memcpy(&limit, &limitFloat, sizeof(limit));
         
-        /*
-         * allocate memory for smaller buffers
-         */
-        rv->bufferLengths = malloc(sizeof(size_t)*rv->numDelays);
-        rv->delayTimes = malloc(rv->numDelays*sizeof(float));
-        rv->feedbackBuffers = malloc(rv->numDelays*sizeof(float));
-        vDSP_vclr(rv->feedbackBuffers, 1, rv->numDelays);
-        rv->rwIndices = malloc(rv->numDelays*sizeof(size_t));
-        rv->bufferStartIndices = malloc(rv->numDelays*sizeof(size_t));
-        rv->bufferEndIndices = malloc(rv->numDelays*sizeof(size_t));
-        rv->mixingBuffers = malloc(rv->numDelays*sizeof(float));
-        rv->z1 = malloc(rv->numDelays*sizeof(float));
-        vDSP_vclr(rv->z1, 1, rv->numDelays);
-        rv->a1 = malloc(rv->numDelays*sizeof(float));
-        rv->b0 = malloc(rv->numDelays*sizeof(float));
-        rv->b1 = malloc(rv->numDelays*sizeof(float));
-        rv->a1Slow = malloc(rv->numDelays*sizeof(float));
-        rv->b0Slow = malloc(rv->numDelays*sizeof(float));
-        rv->b1Slow = malloc(rv->numDelays*sizeof(float));
-        rv->decayGainAttenuation = malloc(rv->numDelays*sizeof(float));
-        rv->slowDecayGainAttenuation = malloc(rv->numDelays*sizeof(float));
-        rv->leftOutputTemp = malloc(BMCREVERB_TEMPBUFFERLENGTH*sizeof(float));
-        rv->dryL = malloc(BMCREVERB_TEMPBUFFERLENGTH*sizeof(float));
-        rv->dryR = malloc(BMCREVERB_TEMPBUFFERLENGTH*sizeof(float));
-        rv->delayOutputSigns = malloc(rv->numDelays*sizeof(float));
+        uint32_t numReplaced = 0;
+        for (size_t i=0; i<numSamples; i++){
+            uint32_t bits;
+            memcpy(&bits, input + i, sizeof(bits));
+            uint32_t bad = (bits & 0x7FFFFFFF) > limit;
+            bits &= bad - 1;
+            memcpy(output + i, &bits, sizeof(bits));
+            numReplaced += bad;
+        }
+        return numReplaced;
+    }
+    
+    
+    
+    
+    
+    // counts NaN and infinite values, which have all exponent bits set
+    size_t BMCReverbCountNonFinite(const float* data, size_t numSamples){
+        uint32_t count = 0;
+        for (size_t i=0; i<numSamples; i++){
+            uint32_t bits;
+            memcpy(&bits, data + i, sizeof(bits));
+            count += (bits & 0x7F800000) == 0x7F800000;
+        }
+        return count;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbCountSanitised(struct BMCReverb* rv, size_t numSanitised){
+        BMCREVERB_COUNT_NONFINITE(rv, numSanitised);
+        if (numSanitised > 0)
+            __atomic_store_n(&rv->sanitisedSamples, rv->sanitisedSamples + numSanitised, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    // Clears the state that carries over to the next buffer if it isn't
+    // finite, which would otherwise silence the reverb for good. With the
+    // input sanitised this takes an overflow inside the network, so it
+    // should never happen, but it costs only a pass over the feedback
+    // state. The network and the output filters are checked separately
+    // and only the one that went bad is cleared.
+    void BMCReverbRecoverFromFault(struct BMCReverb* rv){
+        bool fault = false;
+        
+        if (BMCReverbCountNonFinite(rv->feedbackBuffers, rv->numDelays) + BMCReverbCountNonFinite(rv->z1, rv->numDelays) > 0) {
+            // stale delay memory reads as zero, so this doesn't allocate
+            // or clear the delay lines
+            BMCReverbResetDelays(rv);
+            fault = true;
+        }
+        
+        if (BMCReverbCountNonFinite(rv->mainFilterHistory, sizeof(rv->mainFilterHistory)/sizeof(float)) > 0) {
+            memset(rv->mainFilterHistory, 0, sizeof(rv->mainFilterHistory));
+            fault = true;
+        }
+        
+        if (BMCReverbCountNonFinite(rv->interpolatorHistoryL, BMCREVERB_RESAMPLERTAPS) + BMCReverbCountNonFinite(rv->interpolatorHistoryR, BMCREVERB_RESAMPLERTAPS) > 0) {
+            BMCReverbResetResampler(rv);
+            fault = true;
+        }
+        
+        if (fault)
+            __atomic_store_n(&rv->faultsRecovered, rv->faultsRecovered + 1, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGetFaultCounts(const struct BMCReverb* rv, uint64_t* sanitisedSamples, uint64_t* faultsRecovered){
+        *sanitisedSamples = __atomic_load_n(&rv->sanitisedSamples, __ATOMIC_RELAXED);
+        *faultsRecovered = __atomic_load_n(&rv->faultsRecovered, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+#ifdef BMCREVERB_INSTRUMENTATION
+    // counts the delay outputs in the denormal range. The time this takes
+    // is not counted in any stage.
+    void BMCReverbCountDenormals(struct BMCReverb* rv, const float* delayOutputs){
+        uint64_t count = 0;
+        for (size_t i=0; i < rv->numDelays; i++)
+            count += fpclassify(delayOutputs[i]) == FP_SUBNORMAL;
+        rv->instrumentation.working.denormals += count;
+        BMCREVERB_STAGE_START(rv);
+    }
+#endif
+    
+    
+    
+    
+    
+    float BMCReverbStoredEnergy(const struct BMCReverb* rv){
+        float feedbackEnergy, filterEnergy, historyEnergy, diffusionEnergy;
+        // (only the delay memory written since the last reset counts)
+        float delayEnergy = 0.0f;
+        for (size_t i=0; i<rv->numDelays; i++){
+            float energy;
+            vDSP_svesq(rv->delayLines + rv->bufferStartIndices[i], 1, &energy, BM_MIN(rv->framesSinceReset, rv->bufferLengths[i]));
+            delayEnergy += energy;
+        }
+        // (the feedback buffers hold the samples we read from the delays
+        // last, which haven't been written back yet)
+        vDSP_svesq(rv->feedbackBuffers, 1, &feedbackEnergy, rv->numDelays);
+        vDSP_svesq(rv->z1, 1, &filterEnergy, rv->numDelays);
+        vDSP_svesq(rv->mainFilterHistory, 1, &historyEnergy, sizeof(rv->mainFilterHistory)/sizeof(float));
+        vDSP_svesq(rv->diffusionMemory, 1, &diffusionEnergy, rv->diffusionTotalSamples);
+        float convolverEnergy = rv->convolver ? BMCReverbConvolverStoredEnergy(rv->convolver) : 0.0f;
+        return delayEnergy + feedbackEnergy + filterEnergy + historyEnergy + diffusionEnergy + convolverEnergy;
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbRenderImpulseResponse(struct BMCReverb* rv, float* left, float* right, size_t maxLength, float threshold_dB){
+        assert(threshold_dB < 0.0f);
+        
+        BMCReverbApplySettings(rv);
+        BMCReverbReset(rv);
+        
+        float threshold = powf(10.0f, threshold_dB / 10.0f);
+        float peakEnergy = 0.0f;
+        size_t length = 0;
+        while (length < maxLength) {
+            size_t n = maxLength - length < BMCREVERB_IRBLOCKLENGTH ? maxLength - length : BMCREVERB_IRBLOCKLENGTH;
+            float* blockL = left + length;
+            float* blockR = right + length;
+            memset(blockL, 0, sizeof(float)*n);
+            memset(blockR, 0, sizeof(float)*n);
+            if (length == 0) blockL[0] = blockR[0] = 1.0f;
+            
+            BMCReverbProcessBuffer(rv, blockL, blockR, blockL, blockR, n);
+            length += n;
+            
+            float energy = BMCReverbStoredEnergy(rv);
+            if (energy > peakEnergy) peakEnergy = energy;
+            else if (energy <= threshold*peakEnergy) break;
+        }
+        
+        BMCReverbReset(rv);
+        return length;
+    }
+    
+    
+    
+    
+    
+    // clears the feedback state and sets up the indices for the layout in
+    // rv->design.
+    //
+    // The delay memory isn't cleared. Instead, a reset starts a new epoch:
+    // memory that hasn't been written since the start of the epoch is
+    // stale, and ProcessWetSample reads it as zero. Each delay is written
+    // from its start, so delay i holds min(framesSinceReset,
+    // bufferLengths[i]) valid samples from bufferStartIndices[i] on. This
+    // makes a reset cost O(numDelays) instead of O(totalSamples).
+    void BMCReverbResetDelays(struct BMCReverb* rv){
+        // allocate memory for the main delays in the network (only if
+        // the existing memory is too small)
+        rv->totalSamples = rv->design->totalSamples;
+        BMCReverbReserveDelayMemory(rv, rv->totalSamples);
+        vDSP_vclr(rv->feedbackBuffers, 1, rv->numDelays);
+        vDSP_vclr(rv->z1, 1, rv->numDelays);
+        BMCReverbInitIndices(rv);
+        rv->framesSinceReset = 0;
+        
+        // start the LFOs at random phases in [-1, 1), the same every time
+        uint32_t randomState = BMCReverbRandomInit(rv->seed, 6);
+        for (size_t i=0; i<rv->numDelays; i++)
+            rv->lfoPhases[i] = 2.0f * ((float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX) - 1.0f;
+        
+        // the depth limit depends on the lengths of the delays
+        BMCReverbUpdateModulation(rv);
+    }
+    
+    
+    
+    
+    
+    // Sets the depth of the modulation in samples and the phase increment
+    // of each LFO. The rates are spread randomly around the mean so that
+    // the delays drift independently.
+    void BMCReverbUpdateModulation(struct BMCReverb* rv){
+        rv->modulationQueuedForUpdate = false;
+        
+        // the cubic interpolation reads up to two samples past the offset,
+        // which must stay behind the sample written in this frame
+        size_t shortestDelay = SIZE_MAX;
+        for (size_t i=0; i<rv->numDelays; i++)
+            shortestDelay = BM_MIN(shortestDelay, rv->bufferLengths[i]);
+        float maxDepth = shortestDelay > BMCREVERB_MODULATION_MARGIN ? (float)(shortestDelay - BMCREVERB_MODULATION_MARGIN) : 0.0f;
+        rv->modulationDepthSamples = BM_MIN(rv->modulationDepth_seconds * rv->networkSampleRate, maxDepth);
+        
+        // the phase goes from -1 to 1 in each cycle
+        uint32_t randomState = BMCReverbRandomInit(rv->seed, 5);
+        for (size_t i=0; i<rv->numDelays; i++){
+            float spread = BMCREVERB_MODULATIONSPREAD * (2.0f * ((float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX) - 1.0f);
+            rv->lfoIncrements[i] = 2.0f * rv->modulationRate * (1.0f + spread) / rv->networkSampleRate;
+        }
+    }
+    
+    
+    
+    
+    
+    // Reads the delays at positions that move with their LFOs, replacing
+    // the plain gather in BMCReverbProcessWetSample.
+    //
+    // The read index points at the oldest sample in each delay. Reading
+    // offset samples after it shortens the delay by offset samples. The
+    // LFOs, offsets and interpolation weights are computed for all the
+    // delays in one loop without branches, which the compiler vectorises.
+    // The second loop gathers and interpolates.
+    void BMCReverbReadModulated(struct BMCReverb* rv){
+        size_t n = rv->numDelays;
+        size_t capacity = rv->capacityNumDelays;
+        float halfDepth = 0.5f * rv->modulationDepthSamples;
+        float* w0 = rv->readWeights;
+        float* w1 = w0 + capacity;
+        float* w2 = w1 + capacity;
+        float* w3 = w2 + capacity;
+        bool cubic = rv->interpolation == BMCREVERB_INTERPOLATION_CUBIC;
+        
+        for (size_t i=0; i<n; i++){
+            float phase = rv->lfoPhases[i] + rv->lfoIncrements[i];
+            phase -= phase >= 1.0f ? 2.0f : 0.0f;
+            rv->lfoPhases[i] = phase;
+            
+            // a parabola approximates sin(pi*phase), smooth enough for an LFO
+            float lfo = 4.0f * phase * (1.0f - fabsf(phase));
+            
+            // at least one sample, so that cubic interpolation can read
+            // the sample before the offset
+            float offset = 1.0f + halfDepth + halfDepth * lfo;
+            int32_t whole = (int32_t)offset;
+            float f = offset - (float)whole;
+            rv->readOffsets[i] = whole;
+            
+            // the weights of the samples at whole-1 ... whole+2. Linear
+            // interpolation uses only the middle two. Both are computed so
+            // that choosing one is a select, not a branch.
+            float f2 = f*f;
+            float c0 = f * (-0.5f + f - 0.5f*f2);
+            float c1 = 1.0f + f2 * (-2.5f + 1.5f*f);
+            float c2 = f * (0.5f + f * (2.0f - 1.5f*f));
+            float c3 = f2 * (-0.5f + 0.5f*f);
+            float l1 = 1.0f - f;
+            w0[i] = cubic ? c0 : 0.0f;
+            w1[i] = cubic ? c1 : l1;
+            w2[i] = cubic ? c2 : f;
+            w3[i] = cubic ? c3 : 0.0f;
+        }
+        
+        if (!cubic)
+            for (size_t i=0; i<n; i++){
+                size_t start = rv->bufferStartIndices[i];
+                size_t length = rv->bufferLengths[i];
+                size_t j1 = rv->rwIndices[i] - start + (size_t)rv->readOffsets[i];
+                j1 -= j1 >= length ? length : 0;
+                size_t j2 = j1 + 1;
+                j2 -= j2 >= length ? length : 0;
+                float x1 = rv->delayLines[start + j1];
+                float x2 = rv->delayLines[start + j2];
+                rv->feedbackBuffers[i] = w1[i]*x1 + w2[i]*x2;
+            }
+        else
+            for (size_t i=0; i<n; i++){
+                size_t start = rv->bufferStartIndices[i];
+                size_t length = rv->bufferLengths[i];
+                size_t j0 = rv->rwIndices[i] - start + (size_t)rv->readOffsets[i] - 1;
+                j0 -= j0 >= length ? length : 0;
+                size_t j1 = j0 + 1;
+                j1 -= j1 >= length ? length : 0;
+                size_t j2 = j1 + 1;
+                j2 -= j2 >= length ? length : 0;
+                size_t j3 = j2 + 1;
+                j3 -= j3 >= length ? length : 0;
+                const float* x = rv->delayLines + start;
+                rv->feedbackBuffers[i] = w0[i]*x[j0] + w1[i]*x[j1] + w2[i]*x[j2] + w3[i]*x[j3];
+            }
+    }
+    
+    
+    
+    
+    
+    // Repeats the modulated read for the delays that haven't been written
+    // all the way around since the last reset, reading the samples that
+    // are still stale as zero. The sample offset samples after the read
+    // index has been written once framesSinceReset >= bufferLengths[i] -
+    // offset, so the taps further from the read index become valid first.
+    void BMCReverbReadModulatedStale(struct BMCReverb* rv){
+        size_t capacity = rv->capacityNumDelays;
+        const float* w0 = rv->readWeights;
+        const float* w1 = w0 + capacity;
+        const float* w2 = w1 + capacity;
+        const float* w3 = w2 + capacity;
+        bool cubic = rv->interpolation == BMCREVERB_INTERPOLATION_CUBIC;
+        size_t written = rv->framesSinceReset;
+        
+        for (size_t i=0; i<rv->numDelays; i++){
+            size_t start = rv->bufferStartIndices[i];
+            size_t length = rv->bufferLengths[i];
+            
+            // the offset of the tap before the read position. If it has
+            // been written, so have the others.
+            size_t first = (size_t)rv->readOffsets[i] - 1;
+            if (written + first >= length) continue;
+            
+            const float* x = rv->delayLines + start;
+            float y [4];
+            for (size_t k=0; k<4; k++){
+                size_t j = rv->rwIndices[i] - start + first + k;
+                j -= j >= length ? length : 0;
+                y[k] = written + first + k >= length ? x[j] : 0.0f;
+            }
+            rv->feedbackBuffers[i] = cubic ? w0[i]*y[0] + w1[i]*y[1] + w2[i]*y[2] + w3[i]*y[3] : w1[i]*y[1] + w2[i]*y[2];
+        }
+    }
+    
+    
+    
+    
+    
+    // zeros the stale delay memory, so that all of it is valid
+    void BMCReverbClearStaleDelays(struct BMCReverb* rv){
+        for (size_t i=0; i<rv->numDelays; i++){
+            size_t valid = BM_MIN(rv->framesSinceReset, rv->bufferLengths[i]);
+            vDSP_vclr(rv->delayLines + rv->bufferStartIndices[i] + valid, 1, rv->bufferLengths[i] - valid);
+        }
+        rv->framesSinceReset = rv->longestDelay;
+    }
+    
+    
+    
+    
+    
+    // Returns an upper bound on totalSamples for any delay times that
+    // BMCReverbUpdateDelayTimes can generate with the given settings.
+    //
+    // Each channel has halfNumDelays delays. The kth one is at most
+    // preDelay + (k+1)*spacing long, so the sum over both channels is at
+    // most numDelays*preDelay + (roomSize - preDelay)*(halfNumDelays + 1).
+    // Rounding to whole samples adds at most one sample per delay.
+    size_t BMCReverbMaxTotalSamples(size_t numDelays, double sampleRate, double preDelay_seconds, double roomSize_seconds){
+        double seconds = (double)numDelays*preDelay_seconds + (roomSize_seconds - preDelay_seconds)*(double)(numDelays/2 + 1);
+        return (size_t)ceil(sampleRate*seconds) + numDelays;
+    }
+    
+    
+    
+    
+    
+    // makes sure the per-delay state of the reverb has room for at least
+    // numDelays elements. This only allocates when it has to grow. (the
+    // per-delay tables are in the design)
+    void BMCReverbReserveDelays(struct BMCReverb* rv, size_t numDelays){
+        if (numDelays <= rv->capacityNumDelays) return;
+        
+        free(rv->feedbackBuffers);
+        free(rv->rwIndices);
+        free(rv->mixingBuffers);
+        free(rv->z1);
+        free(rv->lfoPhases);
+        free(rv->lfoIncrements);
+        free(rv->readWeights);
+        free(rv->readOffsets);
+        free(rv->unitBlockMemory);
+        
+        rv->feedbackBuffers = malloc(numDelays*sizeof(float));
+        rv->rwIndices = malloc(numDelays*sizeof(size_t));
+        rv->mixingBuffers = malloc(numDelays*sizeof(float));
+        rv->z1 = malloc(numDelays*sizeof(float));
+        rv->lfoPhases = malloc(numDelays*sizeof(float));
+        rv->lfoIncrements = malloc(numDelays*sizeof(float));
+        // one array of weights for each of the four samples
+        rv->readWeights = malloc(4*numDelays*sizeof(float));
+        rv->readOffsets = malloc(numDelays*sizeof(int32_t));
+        
+        // blocks for the delay units, aligned to a cache line
+        size_t blockBytes = sizeof(BMCReverbUnitBlock) * ((numDelays/4 + BMCREVERB_BLOCKUNITS - 1) / BMCREVERB_BLOCKUNITS);
+        rv->unitBlockMemory = malloc(blockBytes + BMCREVERB_CACHELINE - 1);
+        rv->unitBlocks = (BMCReverbUnitBlock*)(((uintptr_t)rv->unitBlockMemory + BMCREVERB_CACHELINE - 1) & ~(uintptr_t)(BMCREVERB_CACHELINE - 1));
+        
+        rv->capacityNumDelays = numDelays;
+        rv->bytesAllocated += numDelays*(9*sizeof(float) + sizeof(size_t) + sizeof(int32_t)) + blockBytes + BMCREVERB_CACHELINE - 1;
+    }
+    
+    
+    
+    
+    
+    // makes sure the delay memory has room for at least totalSamples
+    // samples. This only allocates when it has to grow.
+    void BMCReverbReserveDelayMemory(struct BMCReverb* rv, size_t totalSamples){
+        if (totalSamples <= rv->capacityTotalSamples) return;
+        
+        free(rv->delayLines);
+        rv->delayLines = malloc(sizeof(float)*totalSamples);
+        rv->capacityTotalSamples = totalSamples;
+        rv->bytesAllocated += sizeof(float)*totalSamples;
+    }
+    
+    
+    
+    
+    
+    // Computes the lengths of the input allpass filters for numStages
+    // stages per channel, the left channel's first, and returns their sum.
+    size_t BMCReverbDiffusionLengths(const float* delayTimes, size_t numStages, float sampleRate, size_t* lengths){
+        size_t totalSamples = 0;
+        for (size_t i=0; i<numStages; i++){
+            lengths[i] = BM_MAX((size_t)roundf(delayTimes[i] * sampleRate), (size_t)1);
+            lengths[numStages + i] = BM_MAX((size_t)roundf(delayTimes[i] * BMCREVERB_DIFFUSIONSTEREOSPREAD * sampleRate), (size_t)1);
+            totalSamples += lengths[i] + lengths[numStages + i];
+        }
+        return totalSamples;
+    }
+    
+    
+    
+    
+    
+    // makes sure the diffusion memory has room for at least totalSamples
+    // samples. This only allocates when it has to grow.
+    void BMCReverbReserveDiffusionMemory(struct BMCReverb* rv, size_t totalSamples){
+        if (totalSamples <= rv->capacityDiffusionSamples) return;
+        
+        free(rv->diffusionMemory);
+        rv->diffusionMemory = malloc(sizeof(float)*totalSamples);
+        rv->capacityDiffusionSamples = totalSamples;
+        rv->bytesAllocated += sizeof(float)*totalSamples;
+    }
+    
+    
+    
+    
+    
+    // applies the number and delay times of the input allpass filters.
+    // The filters are cleared only if their lengths change.
+    void BMCReverbUpdateDiffusion(struct BMCReverb* rv){
+        size_t lengths [2*BMCREVERB_MAXDIFFUSIONSTAGES];
+        size_t totalSamples = BMCReverbDiffusionLengths(rv->diffusionTimes, rv->numDiffusionStages, rv->networkSampleRate, lengths);
+        size_t numFilters = 2*rv->numDiffusionStages;
+        if (rv->numDiffusionStages == rv->activeDiffusionStages && memcmp(lengths, rv->diffusionLengths, sizeof(size_t)*numFilters) == 0)
+            return;
+        
+        BMCReverbReserveDiffusionMemory(rv, totalSamples);
+        memcpy(rv->diffusionLengths, lengths, sizeof(size_t)*numFilters);
+        rv->activeDiffusionStages = rv->numDiffusionStages;
+        rv->diffusionTotalSamples = totalSamples;
+        BMCReverbResetDiffusion(rv);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbResetDiffusion(struct BMCReverb* rv){
+        if (rv->diffusionTotalSamples > 0)
+            vDSP_vclr(rv->diffusionMemory, 1, rv->diffusionTotalSamples);
+        memset(rv->diffusionIndices, 0, sizeof(rv->diffusionIndices));
+    }
+    
+    
+    
+    
+    
+    // Filters one input channel through its allpass filters, starting
+    // with filter number firstFilter. Each filter is
+    //
+    //     v[n] = x[n] + g*v[n-M]
+    //     y[n] = v[n-M] - g*v[n]
+    //
+    // with v[n-M] in a ring buffer of length M. The values of v[n-M] for
+    // the next M samples are all in the ring buffer already, so within a
+    // block of up to M samples nothing depends on the output, and each
+    // block is two vector multiply-adds instead of a loop that waits for
+    // the previous sample. v[n] is written over v[n-M] as it is read.
+    void BMCReverbDiffuse(struct BMCReverb* rv, const float* input, float* output, size_t firstFilter, size_t numSamples){
+        float gain = rv->diffusionGain;
+        float negativeGain = -gain;
+        // leftOutputTemp isn't used until the wet channels are mixed
+        float* delayed = rv->leftOutputTemp;
+        
+        float* ring = rv->diffusionMemory;
+        for (size_t i=0; i<firstFilter; i++)
+            ring += rv->diffusionLengths[i];
+        
+        const float* x = input;
+        for (size_t i=firstFilter; i<firstFilter + rv->activeDiffusionStages; i++){
+            size_t length = rv->diffusionLengths[i];
+            size_t index = rv->diffusionIndices[i];
+            size_t done = 0;
+            while (done < numSamples) {
+                size_t n = BM_MIN(numSamples - done, length - index);
+                memcpy(delayed, ring + index, sizeof(float)*n);
+                // v = x + g*delayed
+                vDSP_vsma(delayed, 1, &gain, x + done, 1, ring + index, 1, n);
+                // y = delayed - g*v
+                vDSP_vsma(ring + index, 1, &negativeGain, delayed, 1, output + done, 1, n);
+                index += n;
+                if (index == length) index = 0;
+                done += n;
+            }
+            rv->diffusionIndices[i] = index;
+            ring += length;
+            
+            // the other stages work in place
+            x = output;
+        }
+    }
+    
+    
+    
+    
+    
+    // the decimation factor the current settings call for
+    size_t BMCReverbDecimationFactor(const struct BMCReverb* rv){
+        if (rv->decimation != BMCREVERB_DECIMATION_AUTO)
+            return rv->decimation;
+        
+        size_t factor = BMCREVERB_MAXDECIMATION;
+        while (factor > 1 && rv->sampleRate / (float)factor < BMCREVERB_MINNETWORKSAMPLERATE)
+            factor--;
+        return factor;
+    }
+    
+    
+    
+    
+    
+    // Sets the rate of the network from the sample rate and the decimation
+    // setting, and designs the resampling filters if the factor changed.
+    //
+    // Both filters come from one Blackman windowed sinc lowpass of
+    // decimationFactor*BMCREVERB_RESAMPLERTAPS taps at the full rate.
+    // Decimating only needs the outputs at every decimationFactor-th frame,
+    // and interpolating only the taps that meet a network frame rather
+    // than a zero stuffed between them, which are the taps p, p + factor,
+    // p + 2*factor ... in phase p. Each phase is scaled to unity gain at
+    // DC, so a constant input doesn't come out with a ripple at the
+    // network rate. The taps are stored reversed for vDSP_dotpr.
+    void BMCReverbUpdateNetworkRate(struct BMCReverb* rv){
+        size_t factor = BMCReverbDecimationFactor(rv);
+        rv->networkSampleRate = rv->sampleRate / (float)factor;
+        if (factor == rv->decimationFactor)
+            return;
+        rv->decimationFactor = factor;
+        
+        size_t length = factor*BMCREVERB_RESAMPLERTAPS;
+        double fc = 0.5 * BMCREVERB_RESAMPLERCUTOFF / (double)factor;
+        double h [BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS];
+        double sum = 0.0;
+        for (size_t i=0; i<length; i++) {
+            double x = (double)i - 0.5*(double)(length - 1);
+            double window = 0.42 - 0.5*cos(2.0*M_PI*(double)i/(double)(length - 1)) + 0.08*cos(4.0*M_PI*(double)i/(double)(length - 1));
+            h[i] = window * (x == 0.0 ? 2.0*fc : sin(2.0*M_PI*fc*x) / (M_PI*x));
+            sum += h[i];
+        }
+        
+        for (size_t i=0; i<length; i++)
+            rv->decimationFilter[i] = (float)(h[length - 1 - i] / sum);
+        
+        for (size_t p=0; p<factor; p++) {
+            double phaseSum = 0.0;
+            for (size_t k=0; k<BMCREVERB_RESAMPLERTAPS; k++)
+                phaseSum += h[k*factor + p];
+            for (size_t k=0; k<BMCREVERB_RESAMPLERTAPS; k++)
+                rv->interpolationFilters[p*BMCREVERB_RESAMPLERTAPS + k] = (float)(h[(BMCREVERB_RESAMPLERTAPS - 1 - k)*factor + p] / phaseSum);
+        }
+        
+        BMCReverbResetResampler(rv);
+        
+        // the modulation depth and rates are in network frames
+        rv->modulationQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbResetResampler(struct BMCReverb* rv){
+        vDSP_vclr(rv->decimatorHistoryL, 1, BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS);
+        vDSP_vclr(rv->decimatorHistoryR, 1, BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS);
+        vDSP_vclr(rv->interpolatorHistoryL, 1, BMCREVERB_RESAMPLERTAPS);
+        vDSP_vclr(rv->interpolatorHistoryR, 1, BMCREVERB_RESAMPLERTAPS);
+        rv->resamplerPhase = 0;
+    }
+    
+    
+    
+    
+    
+    // Lowpass filters numSamples frames of input and writes every
+    // decimationFactor-th to output, starting from the frame where
+    // resamplerPhase comes round to 0. history holds the last frames of
+    // input from earlier chunks, which the new ones are copied after.
+    // Returns the number of frames written.
+    //
+    // Like the input diffusion, the filter goes over the whole chunk one
+    // tap at a time, so each tap is a single vector multiply-add with a
+    // stride of decimationFactor on the input.
+    size_t BMCReverbDecimate(struct BMCReverb* rv, const float* input, float* history, float* output, size_t numSamples){
+        size_t factor = rv->decimationFactor;
+        size_t length = factor*BMCREVERB_RESAMPLERTAPS;
+        memcpy(history + length - 1, input, sizeof(float)*numSamples);
+        
+        size_t first = (factor - rv->resamplerPhase) % factor;
+        size_t numOutput = first < numSamples ? (numSamples - first - 1) / factor + 1 : 0;
+        vDSP_vsmul(history + first, factor, rv->decimationFilter, output, 1, numOutput);
+        for (size_t i=1; i<length; i++)
+            vDSP_vsma(history + first + i, factor, rv->decimationFilter + i, output, 1, output, 1, numOutput);
+        
+        memmove(history, history + numSamples, sizeof(float)*(length - 1));
+        return numOutput;
+    }
+    
+    
+    
+    
+    
+    // Interpolates the output of the network back up to numSamples frames
+    // at the full rate. history holds the last BMCREVERB_RESAMPLERTAPS
+    // network frames from earlier chunks, followed by the ones from this
+    // chunk, which line up with the frames BMCReverbDecimate kept. Each
+    // output frame is one phase of the filter over the network frames up
+    // to the latest one at or before it.
+    //
+    // The output frames in the same phase are decimationFactor apart and
+    // each is one network frame further on than the last, so each tap of
+    // each phase is a single vector multiply-add with a stride on the
+    // output.
+    void BMCReverbInterpolate(struct BMCReverb* rv, float* history, float* output, size_t numSamples){
+        size_t factor = rv->decimationFactor;
+        size_t phase = rv->resamplerPhase;
+        
+        // the latest network frame at or before output frame i is
+        // history[BMCREVERB_RESAMPLERTAPS + (phase + i) / factor - 1],
+        // unless the chunk starts on a network frame
+        size_t offset = BMCREVERB_RESAMPLERTAPS - (phase > 0);
+        
+        for (size_t p=0; p<factor; p++) {
+            size_t first = (p + factor - phase) % factor;
+            if (first >= numSamples) continue;
+            size_t count = (numSamples - first - 1) / factor + 1;
+            const float* x = history + offset + (phase + first) / factor + 1 - BMCREVERB_RESAMPLERTAPS;
+            const float* taps = rv->interpolationFilters + p*BMCREVERB_RESAMPLERTAPS;
+            vDSP_vsmul(x, 1, taps, output + first, factor, count);
+            for (size_t k=1; k<BMCREVERB_RESAMPLERTAPS; k++)
+                vDSP_vsma(x + k, 1, taps + k, output + first, factor, output + first, factor, count);
+        }
+        
+        // keep the network frames the next chunk starts from
+        size_t latest = offset + (phase + numSamples - 1) / factor;
+        memmove(history, history + latest + 1 - BMCREVERB_RESAMPLERTAPS, sizeof(float)*BMCREVERB_RESAMPLERTAPS);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetNumDelayUnits(struct BMCReverb* rv, size_t delayUnits){
+        BMCReverbSetNumDelays(rv, delayUnits*4);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetNumDelays(struct BMCReverb* rv, size_t numDelays){
+        assert(numDelays >= 2 && numDelays % 2 == 0);
+        assert(BMCReverbMixingMatrixSupports(rv->newMixingMatrix, numDelays));
+        rv->newNumDelays = numDelays;
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetMixingMatrix(struct BMCReverb* rv, BMCReverbMixingMatrix matrix){
+        assert(BMCReverbMixingMatrixSupports(matrix, rv->newNumDelays));
+        rv->newMixingMatrix = matrix;
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbMixingMatrixSupports(BMCReverbMixingMatrix matrix, size_t numDelays){
+        switch (matrix) {
+            case BMCREVERB_MATRIX_BLOCKCIRCULANT:
+                return numDelays % 4 == 0;
+            case BMCREVERB_MATRIX_HADAMARD:
+                // power of two
+                return (numDelays & (numDelays - 1)) == 0;
+            default:
+                return true;
+        }
+    }
+    
+    
+    
+    
+    
+    void BMCReverbUpdateNumDelayUnits(struct BMCReverb* rv){
+        /*
+         * we are about to recompute the network, so we need a design that
+         * no other reverb is using. This doesn't allocate unless the design
+         * is shared or numDelays exceeds the capacity reserved at init.
+         */
+        BMCReverbMakeDesignPrivate(rv, rv->newNumDelays);
+        BMCReverbDesign* d = rv->design;
+        BMCReverbDesignDropFrozenIRs(d);
+        
+        // the layout of the delay memory depends on numDelays, so we have
+        // to start over if it changed
+        if (d->numDelays != rv->newNumDelays)
+            memset(d->bufferLengths, 0, sizeof(size_t)*rv->newNumDelays);
+        d->numDelays = rv->newNumDelays;
+        d->mixingMatrix = rv->newMixingMatrix;
+        d->seed = rv->seed;
+        BMCReverbAttachDesign(rv);
+        
+        
+        /*
+         * set randomised signs for the output taps
+         */
+        BMCReverbInitDelayOutputSigns(rv);
+        
+        
+        
+        /*
+         * Allocate memory for the network delay buffers and update all the
+         * delay-time-dependent parameters
+         */
+        BMCReverbUpdateDelayTimes(rv);
+        
+        
+        rv->settingsQueuedForUpdate = false;
+    }
+    
+    
+    
+    
+    // sets up the reverb to run the network in rv->design. This doesn't
+    // touch the contents of the delays.
+    void BMCReverbAttachDesign(struct BMCReverb* rv){
+        BMCReverbDesign* d = rv->design;
+        
+        /*
+         * before beginning, calculate some frequently reused values
+         */
+        rv->numDelays = d->numDelays;
+        rv->delayUnits = rv->numDelays/4;
+        rv->halfNumDelays = rv->numDelays/2;
+        rv->fourthNumDelays = rv->numDelays/4;
+        rv->threeFourthsNumDelays = rv->fourthNumDelays*3;
+        
+        // select the mixing matrix and its normalisation
+        rv->mixingMatrix = d->mixingMatrix;
+        switch (rv->mixingMatrix) {
+            case BMCREVERB_MATRIX_BLOCKCIRCULANT:
+                rv->matrixAttenuation = BMCREVERB_MATRIXATTENUATION;
+                break;
+            case BMCREVERB_MATRIX_HADAMARD:
+                rv->matrixAttenuation = 1.0f/sqrt((float)rv->numDelays);
+                break;
+            default:
+                // Householder and permutation matrices are already unitary
+                rv->matrixAttenuation = 1.0f;
+        }
+        // we compute attenuation on half delays because the reverb is stereo
+        rv->inputAttenuation = 1.0f/sqrt((float)rv->halfNumDelays);
+        
+        
+        
+        /*
+         * the tables that don't change while the reverb runs are in the
+         * design
+         */
+        rv->bufferLengths = d->bufferLengths;
+        rv->bufferStartIndices = d->bufferStartIndices;
+        rv->bufferEndIndices = d->bufferEndIndices;
+        rv->delayTimes = d->delayTimes;
+        rv->decayGainAttenuation = d->decayGainAttenuation;
+        rv->slowDecayGainAttenuation = d->slowDecayGainAttenuation;
+        rv->a1 = d->a1;
+        rv->b0 = d->b0;
+        rv->b1 = d->b1;
+        rv->a1Slow = d->a1Slow;
+        rv->b0Slow = d->b0Slow;
+        rv->b1Slow = d->b1Slow;
+        rv->delayOutputSigns = d->delayOutputSigns;
+        
+        
+        
+        /*
+         * make sure the smaller buffers are large enough. This doesn't
+         * allocate unless numDelays exceeds the capacity reserved at init.
+         */
+        BMCReverbReserveDelays(rv, rv->numDelays);
+        
+        
+        /*
+         * create pointers to facilitate mixing
+         */
+        rv->fb0 = rv->feedbackBuffers+(0*rv->fourthNumDelays);
+        rv->fb1 = rv->feedbackBuffers+(1*rv->fourthNumDelays);
+        rv->fb2 = rv->feedbackBuffers+(2*rv->fourthNumDelays);
+        rv->fb3 = rv->feedbackBuffers+(3*rv->fourthNumDelays);
+        rv->mb0 = rv->mixingBuffers+(0*rv->fourthNumDelays);
+        rv->mb1 = rv->mixingBuffers+(1*rv->fourthNumDelays);
+        rv->mb2 = rv->mixingBuffers+(2*rv->fourthNumDelays);
+        rv->mb3 = rv->mixingBuffers+(3*rv->fourthNumDelays);
+    }
+    
+    
+    
+    
+    
+    /*
+     * Designs
+     */
+    
+    // the size of a design with room for capacityNumDelays delays: the
+    // struct, 3 tables of indices and 10 tables of floats
+    size_t BMCReverbDesignSize(size_t capacityNumDelays){
+        return sizeof(BMCReverbDesign) + capacityNumDelays*(3*sizeof(size_t) + 10*sizeof(float));
+    }
+    
+    
+    
+    
+    
+    // allocates a design with room for capacityNumDelays delays. The struct
+    // and all the tables share a single block of memory.
+    BMCReverbDesign* BMCReverbDesignAlloc(size_t capacityNumDelays){
+        size_t numIndexTables = 3;
+        BMCReverbDesign* d = calloc(1, BMCReverbDesignSize(capacityNumDelays));
+        
+        // the tables of indices come first to keep them aligned
+        size_t* indexTables = (size_t*)(d + 1);
+        d->bufferLengths = indexTables + 0*capacityNumDelays;
+        d->bufferStartIndices = indexTables + 1*capacityNumDelays;
+        d->bufferEndIndices = indexTables + 2*capacityNumDelays;
+        
+        float* floatTables = (float*)(indexTables + numIndexTables*capacityNumDelays);
+        d->delayTimes = floatTables + 0*capacityNumDelays;
+        d->decayGainAttenuation = floatTables + 1*capacityNumDelays;
+        d->slowDecayGainAttenuation = floatTables + 2*capacityNumDelays;
+        d->a1 = floatTables + 3*capacityNumDelays;
+        d->b0 = floatTables + 4*capacityNumDelays;
+        d->b1 = floatTables + 5*capacityNumDelays;
+        d->a1Slow = floatTables + 6*capacityNumDelays;
+        d->b0Slow = floatTables + 7*capacityNumDelays;
+        d->b1Slow = floatTables + 8*capacityNumDelays;
+        d->delayOutputSigns = floatTables + 9*capacityNumDelays;
+        
+        d->capacityNumDelays = capacityNumDelays;
+        d->refCount = 1;
+        return d;
+    }
+    
+    
+    
+    
+    
+    // returns a new design with the same contents as design and room for
+    // at least capacityNumDelays delays
+    BMCReverbDesign* BMCReverbDesignCopy(const BMCReverbDesign* design, size_t capacityNumDelays){
+        BMCReverbDesign* d = BMCReverbDesignAlloc(BM_MAX(capacityNumDelays, design->numDelays));
+        
+        // settings
+        d->minDelay_seconds = design->minDelay_seconds;
+        d->maxDelay_seconds = design->maxDelay_seconds;
+        d->sampleRate = design->sampleRate;
+        d->decimationFactor = design->decimationFactor;
+        d->hfDecayMultiplier = design->hfDecayMultiplier;
+        d->hfSlowDecayMultiplier = design->hfSlowDecayMultiplier;
+        d->highShelfFC = design->highShelfFC;
+        d->rt60 = design->rt60;
+        d->slowDecayRT60 = design->slowDecayRT60;
+        d->numDelays = design->numDelays;
+        d->totalSamples = design->totalSamples;
+        d->seed = design->seed;
+        d->mixingMatrix = design->mixingMatrix;
+        
+        // tables
+        size_t n = design->numDelays;
+        memcpy(d->bufferLengths, design->bufferLengths, sizeof(size_t)*n);
+        memcpy(d->bufferStartIndices, design->bufferStartIndices, sizeof(size_t)*n);
+        memcpy(d->bufferEndIndices, design->bufferEndIndices, sizeof(size_t)*n);
+        memcpy(d->delayTimes, design->delayTimes, sizeof(float)*n);
+        memcpy(d->decayGainAttenuation, design->decayGainAttenuation, sizeof(float)*n);
+        memcpy(d->slowDecayGainAttenuation, design->slowDecayGainAttenuation, sizeof(float)*n);
+        memcpy(d->a1, design->a1, sizeof(float)*n);
+        memcpy(d->b0, design->b0, sizeof(float)*n);
+        memcpy(d->b1, design->b1, sizeof(float)*n);
+        memcpy(d->a1Slow, design->a1Slow, sizeof(float)*n);
+        memcpy(d->b0Slow, design->b0Slow, sizeof(float)*n);
+        memcpy(d->b1Slow, design->b1Slow, sizeof(float)*n);
+        memcpy(d->delayOutputSigns, design->delayOutputSigns, sizeof(float)*n);
+        
+        return d;
+    }
+    
+    
+    
+    
+    
+    BMCReverbDesign* BMCReverbDesignCreateFromReverb(struct BMCReverb* rv){
+        BMCReverbApplySettings(rv);
+        
+        return BMCReverbDesignCopy(rv->design, rv->design->numDelays);
+    }
+    
+    
+    
+    
+    
+    BMCReverbDesign* BMCReverbDesignRetain(BMCReverbDesign* design){
+        __atomic_add_fetch(&design->refCount, 1, __ATOMIC_RELAXED);
+        return design;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbDesignRelease(BMCReverbDesign* design){
+        if (!design) return;
+        
+        if (__atomic_sub_fetch(&design->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+            BMCReverbDesignDropFrozenIRs(design);
+            free(design);
+        }
+    }
+    
+    
+    
+    
+    
+    void BMCReverbCopyMixSettings(struct BMCReverb* destination, const struct BMCReverb* source){
+        destination->wetGain = source->wetGain;
+        destination->dryGain = source->dryGain;
+        destination->straightStereoMix = source->straightStereoMix;
+        destination->crossStereoMix = source->crossStereoMix;
+        destination->slowDecay = source->slowDecay;
+        destination->kernel = source->kernel;
+        destination->chunkLength = source->chunkLength;
+        destination->interpolation = source->interpolation;
+        BMCReverbSetModulation(destination, source->modulationDepth_seconds, source->modulationRate);
+        destination->diffusionGain = source->diffusionGain;
+        BMCReverbSetDiffusion(destination, source->numDiffusionStages, source->diffusionTimes);
+        BMCReverbSetHighPassFC(destination, source->highpassFC);
+        BMCReverbSetLowPassFC(destination, source->lowpassFC);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbCopySettings(struct BMCReverb* destination, const struct BMCReverb* source){
+        destination->sampleRate = source->sampleRate;
+        destination->decimation = source->decimation;
+        destination->minDelay_seconds = source->minDelay_seconds;
+        destination->maxDelay_seconds = source->maxDelay_seconds;
+        destination->rt60 = source->rt60;
+        destination->slowDecayRT60 = source->slowDecayRT60;
+        destination->hfDecayMultiplier = source->hfDecayMultiplier;
+        destination->hfSlowDecayMultiplier = source->hfSlowDecayMultiplier;
+        destination->highShelfFC = source->highShelfFC;
+        destination->seed = source->seed;
+        destination->newNumDelays = source->newNumDelays;
+        destination->newMixingMatrix = source->newMixingMatrix;
+        destination->autoSustain = source->autoSustain;
+        destination->frozenIRMode = source->frozenIRMode;
+        BMCReverbCopyMixSettings(destination, source);
+        destination->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbDesignIsShared(const BMCReverbDesign* design){
+        return __atomic_load_n(&design->refCount, __ATOMIC_ACQUIRE) > 1;
+    }
+    
+    
+    
+    
+    
+    // gives the reverb a design that it can modify, with room for at least
+    // numDelays delays. If the current design is shared or too small, we
+    // replace it with a private copy.
+    void BMCReverbMakeDesignPrivate(struct BMCReverb* rv, size_t numDelays){
+        BMCReverbDesign* d = rv->design;
+        if (!BMCReverbDesignIsShared(d) && d->capacityNumDelays >= numDelays)
+            return;
+        
+        rv->design = BMCReverbDesignCopy(d, BM_MAX(numDelays, rv->capacityNumDelays));
+        rv->bytesAllocated += BMCReverbDesignSize(rv->design->capacityNumDelays);
+        BMCReverbDesignRelease(d);
+        BMCReverbAttachDesign(rv);
+    }
+    
+    
+    
+    
+    
+    // returns true if the design was computed from the current settings
+    bool BMCReverbDesignMatchesSettings(const BMCReverbDesign* design, const struct BMCReverb* rv){
+        return design->numDelays == rv->newNumDelays
+            && design->mixingMatrix == rv->newMixingMatrix
+            && design->seed == rv->seed
+            && design->sampleRate == rv->sampleRate
+            && design->decimationFactor == rv->decimationFactor
+            && design->minDelay_seconds == rv->minDelay_seconds
+            && design->maxDelay_seconds == rv->maxDelay_seconds
+            && design->rt60 == rv->rt60
+            && design->slowDecayRT60 == rv->slowDecayRT60
+            && design->hfDecayMultiplier == rv->hfDecayMultiplier
+            && design->hfSlowDecayMultiplier == rv->hfSlowDecayMultiplier
+            && design->highShelfFC == rv->highShelfFC;
+    }
+    
+    
+    
+    
+    
+    // returns true if both designs put the delays in the same places in
+    // memory, so a reverb can switch between them without clearing the
+    // delays
+    bool BMCReverbDesignLayoutsMatch(const BMCReverbDesign* a, const BMCReverbDesign* b){
+        return a->numDelays == b->numDelays
+            && memcmp(a->bufferLengths, b->bufferLengths, sizeof(size_t)*a->numDelays) == 0;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetDesign(struct BMCReverb* rv, BMCReverbDesign* design){
+        // take the settings from the design so that later calls to the
+        // setters modify the preset rather than being overwritten by it
+        rv->newNumDelays = design->numDelays;
+        rv->newMixingMatrix = design->mixingMatrix;
+        rv->seed = design->seed;
+        rv->sampleRate = design->sampleRate;
+        rv->decimation = design->decimationFactor;
+        rv->minDelay_seconds = design->minDelay_seconds;
+        rv->maxDelay_seconds = design->maxDelay_seconds;
+        rv->rt60 = design->rt60;
+        rv->slowDecayRT60 = design->slowDecayRT60;
+        rv->hfDecayMultiplier = design->hfDecayMultiplier;
+        rv->hfSlowDecayMultiplier = design->hfSlowDecayMultiplier;
+        rv->highShelfFC = design->highShelfFC;
+        
+        // queue the design. The audio thread may be taking the previous
+        // queued design at the same time, so we swap atomically.
+        BMCReverbDesign* previous = __atomic_exchange_n(&rv->newDesign, BMCReverbDesignRetain(design), __ATOMIC_ACQ_REL);
+        BMCReverbDesignRelease(previous);
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    /*
+     * Frozen impulse response mode
+     */
+    
+    void BMCReverbSetFrozenIRMode(struct BMCReverb* rv, BMCReverbFrozenIRMode mode){
+        rv->frozenIRMode = mode;
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbIsFrozen(const struct BMCReverb* rv){
+        return rv->frozen;
+    }
+    
+    
+    
+    
+    
+    // switches between the network and the convolver if the mode or the
+    // settings call for it, and gives the convolver the response of the
+    // current network. If wait is false and the response or a convolver
+    // for it isn't ready, the background thread prepares them and we
+    // come back here at the end of a later buffer.
+    void BMCReverbUpdateWetPath(struct BMCReverb* rv, bool wait){
+        bool freeze = BMCReverbShouldFreeze(rv);
+        struct BMCReverbFrozenIR* ir = NULL;
+        if (freeze && wait)
+            ir = BMCReverbGetFrozenIR(rv->design, rv->slowDecay);
+        else if (freeze)
+            ir = __atomic_load_n(&rv->design->frozenIR[rv->slowDecay ? 1 : 0], __ATOMIC_ACQUIRE);
+        
+        // set up the convolver, keeping its history if we can. Without
+        // waiting, that is only if the buffers are already the right size
+        // or the background thread has made a convolver for this response.
+        bool ready = false;
+        BMCReverbFreezeJob* job = rv->freezeJob;
+        if (ir && rv->convolver && (wait || BMCReverbFrozenIRLayoutMatches(ir, rv->convolver->ir->numPartitions)))
+            ready = BMCReverbConvolverSetIR(rv->convolver, ir);
+        else if (ir && !wait) {
+            if (job && __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == BMCREVERB_FREEZE_DONE && job->convolver && job->convolver->ir == ir) {
+                job->retired = rv->convolver;
+                rv->convolver = job->convolver;
+                job->convolver = NULL;
+                rv->bytesAllocated += sizeof(BMCReverbConvolver) + BMCReverbConvolverStateSize(rv->convolver);
+                ready = true;
+            }
+        } else if (ir) {
+            rv->convolver = malloc(sizeof(BMCReverbConvolver));
+            ready = rv->convolver && BMCReverbConvolverInit(rv->convolver, ir);
+            if (!ready) {
+                free(rv->convolver);
+                rv->convolver = NULL;
+            } else
+                rv->bytesAllocated += sizeof(BMCReverbConvolver) + BMCReverbConvolverStateSize(rv->convolver);
+        }
+        
+        // ask the background thread for what's missing. If it couldn't
+        // render the response, we give up until the settings change again.
+        rv->freezePending = false;
+        if (freeze && !ready && !wait) {
+            if (job && __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == BMCREVERB_FREEZE_FAILED)
+                job->state = BMCREVERB_FREEZE_IDLE;
+            else
+                rv->freezePending = job && (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == BMCREVERB_FREEZE_QUEUED || BMCReverbFreezeJobSubmit(rv));
+        }
+        
+        // if we don't want to freeze or couldn't, run the network. The
+        // convolver finishes its tail. A frozen reverb waiting for a new
+        // response keeps convolving with the old one.
+        if (!ready) {
+            if (rv->frozen && !rv->freezePending) {
+                rv->frozen = false;
+                rv->idleFramesLeft = rv->convolver->ir->length;
+                BMCREVERB_TRACE(rv, BMCREVERB_TRACE_FREEZE, 0, 0);
+            }
+            return;
+        }
+        
+        // the network finishes its tail while the convolver takes over
+        if (!rv->frozen) {
+            rv->frozen = true;
+            rv->idleFramesLeft = ir->length;
+            BMCREVERB_TRACE(rv, BMCREVERB_TRACE_FREEZE, 0, 1);
+        }
+        rv->frozenSlowDecay = rv->slowDecay;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbShouldFreeze(const struct BMCReverb* rv){
+        if (rv->autoSustain) return false;
+        
+        switch (rv->frozenIRMode) {
+            case BMCREVERB_FROZENIR_ON:
+                return true;
+            case BMCREVERB_FROZENIR_AUTO: {
+                // a frozen response can't be modulated
+                if (rv->modulationDepth_seconds > 0.0f) return false;
+                float networkCost = BMCREVERB_NETWORKCOST * (float)rv->numDelays;
+                return BMCReverbConvolutionCost(BMCReverbFrozenIRLengthEstimate(rv)) < networkCost;
+            }
+            default:
+                return false;
+        }
+    }
+    
+    
+    
+    
+    
+    // the number of frames it takes the network to fall to
+    // BMCREVERB_FROZENIR_THRESHOLD_DB, judging by the RT60 time
+    size_t BMCReverbFrozenIRLengthEstimate(const struct BMCReverb* rv){
+        double rt60 = rv->slowDecay ? rv->slowDecayRT60 : rv->rt60;
+        double seconds = rt60 * BMCREVERB_FROZENIR_THRESHOLD_DB / -60.0 + rv->maxDelay_seconds;
+        return (size_t)(seconds * rv->networkSampleRate);
+    }
+    
+    
+    
+    
+    
+    // returns the response of the network of design from its cache,
+    // rendering it if it isn't there. The design keeps the reference.
+    struct BMCReverbFrozenIR* BMCReverbGetFrozenIR(BMCReverbDesign* design, bool slowDecay){
+        size_t slot = slowDecay ? 1 : 0;
+        struct BMCReverbFrozenIR* ir = __atomic_load_n(&design->frozenIR[slot], __ATOMIC_ACQUIRE);
+        if (ir) return ir;
+        
+        ir = BMCReverbRenderFrozenIR(design, slowDecay);
+        if (!ir) return NULL;
+        
+        // another reverb sharing the design may have got there first
+        struct BMCReverbFrozenIR* cached = NULL;
+        if (!__atomic_compare_exchange_n(&design->frozenIR[slot], &cached, ir, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            BMCReverbFrozenIRRelease(ir);
+            ir = cached;
+        }
+        return ir;
+    }
+    
+    
+    
+    
+    
+    // renders the response of the network of design to an impulse on each
+    // input, without the output mixing and filters, which are applied
+    // after the convolution as usual
+    struct BMCReverbFrozenIR* BMCReverbRenderFrozenIR(BMCReverbDesign* design, bool slowDecay){
+        struct BMCReverb network;
+        BMCReverbInitWithDesign(&network, design);
+        network.slowDecay = slowDecay;
+        
+        size_t maxLength = (size_t)(BMCREVERB_FROZENIR_TAILMARGIN * (double)BMCReverbFrozenIRLengthEstimate(&network)) + BMCREVERB_IRBLOCKLENGTH;
+        float* paths = calloc(4*maxLength, sizeof(float));
+        if (!paths) {
+            BMCReverbFree(&network);
+            return NULL;
+        }
+        
+        // paths are in the order LL, LR, RL, RR. We stop when the energy
+        // in the network falls below the threshold, checking every block.
+        float threshold = powf(10.0f, BMCREVERB_FROZENIR_THRESHOLD_DB / 10.0f);
+        size_t length = 0;
+        for (size_t input=0; input<2; input++){
+            float* toL = paths + (2*input)*maxLength;
+            float* toR = paths + (2*input + 1)*maxLength;
+            BMCReverbReset(&network);
+            
+            float peakEnergy = 0.0f;
+            size_t i = 0;
+            while (i < maxLength) {
+                size_t end = BM_MIN(i + BMCREVERB_IRBLOCKLENGTH, maxLength);
+                for (; i < end; i++) {
+                    float impulse = i == 0 ? 1.0f : 0.0f;
+                    BMCReverbProcessWetSample(&network, input == 0 ? impulse : 0.0f, input == 1 ? impulse : 0.0f, toL+i, toR+i);
+                }
+                
+                float energy = BMCReverbStoredEnergy(&network);
+                if (energy > peakEnergy) peakEnergy = energy;
+                else if (energy <= threshold*peakEnergy) break;
+            }
+            length = BM_MAX(length, i);
+        }
+        
+        struct BMCReverbFrozenIR* ir = BMCReverbFrozenIRCreate(paths, paths + maxLength, paths + 2*maxLength, paths + 3*maxLength, length);
+        free(paths);
+        BMCReverbFree(&network);
+        return ir;
+    }
+    
+    
+    
+    
+    
+    // returns true if a convolver set up for ir has numPartitions
+    // partitions in each segment, so it can switch to ir without
+    // allocating
+    bool BMCReverbFrozenIRLayoutMatches(const struct BMCReverbFrozenIR* ir, const size_t* numPartitions){
+        return memcmp(ir->numPartitions, numPartitions, sizeof(ir->numPartitions)) == 0;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbStartFreezer(void){
+        if (!BMLockFreeQueueInit(&BMCReverbFreezerJobs, BMCREVERB_FREEZER_CAPACITY))
+            return;
+        if (!BMSemaphoreInit(&BMCReverbFreezerWake)) {
+            BMLockFreeQueueFree(&BMCReverbFreezerJobs);
+            return;
+        }
+        
+        // the thread runs until the process exits
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, BMCReverbFreezer, NULL) != 0) {
+            BMSemaphoreFree(&BMCReverbFreezerWake);
+            BMLockFreeQueueFree(&BMCReverbFreezerJobs);
+            return;
+        }
+        pthread_detach(thread);
+        BMCReverbFreezerRunning = true;
+    }
+    
+    
+    
+    
+    
+    void* BMCReverbFreezer(void* context){
+        (void)context;
+        while (true) {
+            BMSemaphoreWait(&BMCReverbFreezerWake);
+            void* job;
+            while (BMLockFreeQueuePop(&BMCReverbFreezerJobs, &job))
+                BMCReverbFreezeJobProcess(job);
+        }
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    // queues a job for the response rv needs now. Called from the audio
+    // thread, so this doesn't wait, lock or allocate. Returns false if the
+    // background thread isn't running or has too many jobs waiting.
+    bool BMCReverbFreezeJobSubmit(struct BMCReverb* rv){
+        BMCReverbFreezeJob* job = rv->freezeJob;
+        if (!BMCReverbFreezerRunning) return false;
+        
+        job->design = BMCReverbDesignRetain(rv->design);
+        job->slowDecay = rv->slowDecay;
+        job->hasConvolver = rv->convolver != NULL;
+        if (rv->convolver)
+            memcpy(job->numPartitions, rv->convolver->ir->numPartitions, sizeof(job->numPartitions));
+        job->state = BMCREVERB_FREEZE_QUEUED;
+        __atomic_add_fetch(&job->refCount, 1, __ATOMIC_RELAXED);
+        
+        if (!BMLockFreeQueuePush(&BMCReverbFreezerJobs, job)) {
+            __atomic_sub_fetch(&job->refCount, 1, __ATOMIC_RELAXED);
+            job->state = BMCREVERB_FREEZE_IDLE;
+            BMCReverbDesignRelease(job->design);
+            job->design = NULL;
+            return false;
+        }
+        BMSemaphoreSignal(&BMCReverbFreezerWake);
+        return true;
+    }
+    
+    
+    
+    
+    
+    // renders the response for a job on the background thread, and sets
+    // up a convolver for it unless the reverb's convolver can switch to it
+    // without allocating
+    void BMCReverbFreezeJobProcess(BMCReverbFreezeJob* job){
+        if (job->retired) {
+            BMCReverbConvolverFree(job->retired);
+            free(job->retired);
+            job->retired = NULL;
+        }
+        
+        struct BMCReverbFrozenIR* ir = BMCReverbGetFrozenIR(job->design, job->slowDecay);
+        bool ready = ir != NULL;
+        if (ir && !(job->hasConvolver && BMCReverbFrozenIRLayoutMatches(ir, job->numPartitions))) {
+            // reuse the convolver from an earlier job if the reverb
+            // didn't take it
+            if (job->convolver)
+                ready = BMCReverbConvolverSetIR(job->convolver, ir);
+            else {
+                job->convolver = malloc(sizeof(BMCReverbConvolver));
+                ready = job->convolver && BMCReverbConvolverInit(job->convolver, ir);
+                if (!ready) {
+                    free(job->convolver);
+                    job->convolver = NULL;
+                }
+            }
+        }
+        
+        BMCReverbDesignRelease(job->design);
+        job->design = NULL;
+        __atomic_store_n(&job->state, ready ? BMCREVERB_FREEZE_DONE : BMCREVERB_FREEZE_FAILED, __ATOMIC_RELEASE);
+        BMCReverbFreezeJobRelease(job);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbFreezeJobRelease(BMCReverbFreezeJob* job){
+        if (!job) return;
         
+        if (__atomic_sub_fetch(&job->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+            BMCReverbConvolver* convolvers [2] = {job->convolver, job->retired};
+            for (size_t i=0; i<2; i++)
+                if (convolvers[i]) {
+                    BMCReverbConvolverFree(convolvers[i]);
+                    free(convolvers[i]);
+                }
+            BMCReverbDesignRelease(job->design);
+            free(job);
+        }
+    }
+    
+    
+    
+    
+    
+    // releases the cached impulse responses of a design that is about to
+    // change
+    void BMCReverbDesignDropFrozenIRs(BMCReverbDesign* design){
+        for (size_t i=0; i<2; i++) {
+            BMCReverbFrozenIRRelease(design->frozenIR[i]);
+            design->frozenIR[i] = NULL;
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbDesignHasFrozenIR(const BMCReverbDesign* design){
+        return __atomic_load_n(&design->frozenIR[0], __ATOMIC_ACQUIRE) || __atomic_load_n(&design->frozenIR[1], __ATOMIC_ACQUIRE);
+    }
+    
+    
+    
+    
+    
+    /*
+     * Snapshots and forks
+     */
+    
+    size_t BMCReverbSnapshotSize(struct BMCReverb* rv){
+        BMCReverbApplySettings(rv);
         
+        size_t convolverStateSize = rv->convolver ? BMCReverbConvolverStateSize(rv->convolver) : 0;
+        return sizeof(BMCReverbSnapshotHeader)
+            + sizeof(size_t)*rv->numDelays
+            + sizeof(float)*(rv->totalSamples + 3*rv->numDelays + rv->diffusionTotalSamples)
+            + convolverStateSize;
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbSaveSnapshot(struct BMCReverb* rv, void* buffer, size_t bufferSize){
+        size_t size = BMCReverbSnapshotSize(rv);
+        if (bufferSize < size) return 0;
+        
+        BMCReverbSnapshotHeader h;
+        memset(&h, 0, sizeof(h));
+        h.magic = BMCREVERB_SNAPSHOT_MAGIC;
+        h.version = BMCREVERB_SNAPSHOT_VERSION;
+        h.size = size;
+        h.sampleRate = rv->sampleRate;
+        h.minDelay_seconds = rv->minDelay_seconds;
+        h.maxDelay_seconds = rv->maxDelay_seconds;
+        h.rt60 = rv->rt60;
+        h.slowDecayRT60 = rv->slowDecayRT60;
+        h.hfDecayMultiplier = rv->hfDecayMultiplier;
+        h.hfSlowDecayMultiplier = rv->hfSlowDecayMultiplier;
+        h.highShelfFC = rv->highShelfFC;
+        h.wetGain = rv->wetGain;
+        h.dryGain = rv->dryGain;
+        h.straightStereoMix = rv->straightStereoMix;
+        h.crossStereoMix = rv->crossStereoMix;
+        h.highpassFC = rv->highpassFC;
+        h.lowpassFC = rv->lowpassFC;
+        h.modulationDepth_seconds = rv->modulationDepth_seconds;
+        h.modulationRate = rv->modulationRate;
+        h.interpolation = rv->interpolation;
+        h.diffusionGain = rv->diffusionGain;
+        memcpy(h.diffusionTimes, rv->diffusionTimes, sizeof(h.diffusionTimes));
+        h.numDiffusionStages = (uint32_t)rv->activeDiffusionStages;
+        h.diffusionTotalSamples = rv->diffusionTotalSamples;
+        for (size_t i=0; i<2*BMCREVERB_MAXDIFFUSIONSTAGES; i++)
+            h.diffusionIndices[i] = rv->diffusionIndices[i];
+        h.seed = rv->seed;
+        h.mixingMatrix = rv->mixingMatrix;
+        h.frozenIRMode = rv->frozenIRMode;
+        h.slowDecay = rv->slowDecay;
+        h.autoSustain = rv->autoSustain;
+        h.frozen = rv->frozen;
+        h.frozenSlowDecay = rv->frozenSlowDecay;
+        h.numDelays = rv->numDelays;
+        h.totalSamples = rv->totalSamples;
+        h.idleFramesLeft = rv->idleFramesLeft;
+        h.convolverStateSize = rv->convolver ? BMCReverbConvolverStateSize(rv->convolver) : 0;
+        memcpy(h.mainFilterHistory, rv->mainFilterHistory, sizeof(h.mainFilterHistory));
+        h.decimationFactor = (uint32_t)rv->decimationFactor;
+        h.resamplerPhase = rv->resamplerPhase;
+        memcpy(h.decimatorHistory[0], rv->decimatorHistoryL, sizeof(h.decimatorHistory[0]));
+        memcpy(h.decimatorHistory[1], rv->decimatorHistoryR, sizeof(h.decimatorHistory[1]));
+        memcpy(h.interpolatorHistory[0], rv->interpolatorHistoryL, sizeof(h.interpolatorHistory[0]));
+        memcpy(h.interpolatorHistory[1], rv->interpolatorHistoryR, sizeof(h.interpolatorHistory[1]));
+        
+        // the snapshot holds all of the delay memory, so it must be valid
+        BMCReverbClearStaleDelays(rv);
+        
+        char* p = buffer;
+        memcpy(p, &h, sizeof(h));
+        p += sizeof(h);
+        memcpy(p, rv->rwIndices, sizeof(size_t)*rv->numDelays);
+        p += sizeof(size_t)*rv->numDelays;
+        memcpy(p, rv->delayLines, sizeof(float)*rv->totalSamples);
+        p += sizeof(float)*rv->totalSamples;
+        memcpy(p, rv->feedbackBuffers, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(p, rv->z1, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(p, rv->lfoPhases, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(p, rv->diffusionMemory, sizeof(float)*rv->diffusionTotalSamples);
+        p += sizeof(float)*rv->diffusionTotalSamples;
+        if (rv->convolver)
+            BMCReverbConvolverSaveState(rv->convolver, p);
+        
+        return size;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbRestoreSnapshot(struct BMCReverb* rv, const void* snapshot, size_t size){
         /*
-         * set randomised signs for the output taps
+         * check the snapshot before changing anything
          */
-        BMCReverbInitDelayOutputSigns(rv);
+        BMCReverbSnapshotHeader h;
+        if (size < sizeof(h)) return false;
+        memcpy(&h, snapshot, sizeof(h));
+        if (h.magic != BMCREVERB_SNAPSHOT_MAGIC || h.version != BMCREVERB_SNAPSHOT_VERSION || h.size != size)
+            return false;
+        if (h.mixingMatrix > BMCREVERB_MATRIX_PERMUTATION || h.frozenIRMode > BMCREVERB_FROZENIR_AUTO || h.interpolation > BMCREVERB_INTERPOLATION_CUBIC)
+            return false;
+        if (!(h.modulationDepth_seconds >= 0.0f && h.modulationRate >= 0.0f))
+            return false;
+        if (h.decimationFactor < 1 || h.decimationFactor > BMCREVERB_MAXDECIMATION || h.resamplerPhase >= h.decimationFactor)
+            return false;
+        if (h.numDiffusionStages > BMCREVERB_MAXDIFFUSIONSTAGES || !(h.diffusionGain >= 0.0f && h.diffusionGain < 1.0f))
+            return false;
+        for (size_t i=0; i<h.numDiffusionStages; i++)
+            if (!(h.diffusionTimes[i] > 0.0f && h.diffusionTimes[i] <= BMCREVERB_MAXDIFFUSIONTIME))
+                return false;
+        if (h.numDelays == 0 || h.numDelays % 2 != 0 || !BMCReverbMixingMatrixSupports(h.mixingMatrix, h.numDelays))
+            return false;
+        if (size != sizeof(h) + sizeof(size_t)*h.numDelays + sizeof(float)*(h.totalSamples + 3*h.numDelays + h.diffusionTotalSamples) + h.convolverStateSize)
+            return false;
         
         
         /*
-         * create pointers to facilitate mixing
+         * apply the settings. The network is generated from them, so it
+         * comes out the same as the one in the snapshot.
          */
-        rv->fb0 = rv->feedbackBuffers+(0*rv->fourthNumDelays);
-        rv->fb1 = rv->feedbackBuffers+(1*rv->fourthNumDelays);
-        rv->fb2 = rv->feedbackBuffers+(2*rv->fourthNumDelays);
-        rv->fb3 = rv->feedbackBuffers+(3*rv->fourthNumDelays);
-        rv->mb0 = rv->mixingBuffers+(0*rv->fourthNumDelays);
-        rv->mb1 = rv->mixingBuffers+(1*rv->fourthNumDelays);
-        rv->mb2 = rv->mixingBuffers+(2*rv->fourthNumDelays);
-        rv->mb3 = rv->mixingBuffers+(3*rv->fourthNumDelays);
-        
+        BMCReverbDesignRelease(__atomic_exchange_n(&rv->newDesign, NULL, __ATOMIC_ACQ_REL));
+        rv->sampleRate = h.sampleRate;
+        rv->decimation = h.decimationFactor;
+        rv->minDelay_seconds = h.minDelay_seconds;
+        rv->maxDelay_seconds = h.maxDelay_seconds;
+        rv->rt60 = h.rt60;
+        rv->slowDecayRT60 = h.slowDecayRT60;
+        rv->hfDecayMultiplier = h.hfDecayMultiplier;
+        rv->hfSlowDecayMultiplier = h.hfSlowDecayMultiplier;
+        rv->highShelfFC = h.highShelfFC;
+        rv->seed = h.seed;
+        rv->newNumDelays = h.numDelays;
+        rv->newMixingMatrix = h.mixingMatrix;
+        rv->wetGain = h.wetGain;
+        rv->dryGain = h.dryGain;
+        rv->straightStereoMix = h.straightStereoMix;
+        rv->crossStereoMix = h.crossStereoMix;
+        rv->modulationDepth_seconds = h.modulationDepth_seconds;
+        rv->modulationRate = h.modulationRate;
+        rv->interpolation = h.interpolation;
+        rv->diffusionGain = h.diffusionGain;
+        memcpy(rv->diffusionTimes, h.diffusionTimes, sizeof(rv->diffusionTimes));
+        rv->numDiffusionStages = h.numDiffusionStages;
+        BMCReverbSetHighPassFC(rv, h.highpassFC);
+        BMCReverbSetLowPassFC(rv, h.lowpassFC);
+        rv->slowDecay = h.slowDecay;
+        rv->autoSustain = h.autoSustain;
+        rv->frozenIRMode = h.frozenIRMode;
+        BMCReverbUpdateSettings(rv, true);
+        BMCReverbReset(rv);
+        
+        if (rv->numDelays != h.numDelays || rv->totalSamples != h.totalSamples || rv->frozen != (bool)h.frozen || rv->diffusionTotalSamples != h.diffusionTotalSamples)
+            return false;
+        for (size_t i=0; i<2*rv->activeDiffusionStages; i++)
+            if (h.diffusionIndices[i] >= rv->diffusionLengths[i])
+                return false;
         
         
         /*
-         * Allocate memory for the network delay buffers and update all the
-         * delay-time-dependent parameters
+         * copy the state
          */
-        BMCReverbUpdateDelayTimes(rv);
+        const char* p = (const char*)snapshot + sizeof(h);
+        memcpy(rv->rwIndices, p, sizeof(size_t)*rv->numDelays);
+        p += sizeof(size_t)*rv->numDelays;
+        for (size_t i=0; i<rv->numDelays; i++)
+            if (rv->rwIndices[i] < rv->bufferStartIndices[i] || rv->rwIndices[i] >= rv->bufferEndIndices[i]) {
+                BMCReverbReset(rv);
+                return false;
+            }
+        memcpy(rv->delayLines, p, sizeof(float)*rv->totalSamples);
+        p += sizeof(float)*rv->totalSamples;
+        memcpy(rv->feedbackBuffers, p, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(rv->z1, p, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(rv->lfoPhases, p, sizeof(float)*rv->numDelays);
+        p += sizeof(float)*rv->numDelays;
+        memcpy(rv->diffusionMemory, p, sizeof(float)*rv->diffusionTotalSamples);
+        p += sizeof(float)*rv->diffusionTotalSamples;
+        for (size_t i=0; i<2*rv->activeDiffusionStages; i++)
+            rv->diffusionIndices[i] = (size_t)h.diffusionIndices[i];
+        memcpy(rv->mainFilterHistory, h.mainFilterHistory, sizeof(rv->mainFilterHistory));
+        rv->resamplerPhase = h.resamplerPhase;
+        memcpy(rv->decimatorHistoryL, h.decimatorHistory[0], sizeof(h.decimatorHistory[0]));
+        memcpy(rv->decimatorHistoryR, h.decimatorHistory[1], sizeof(h.decimatorHistory[1]));
+        memcpy(rv->interpolatorHistoryL, h.interpolatorHistory[0], sizeof(h.interpolatorHistory[0]));
+        memcpy(rv->interpolatorHistoryR, h.interpolatorHistory[1], sizeof(h.interpolatorHistory[1]));
+        rv->framesSinceReset = rv->longestDelay;
+        
+        // the indices all move together, so the time until the next wrap
+        // is the shortest distance to the end of a delay
+        rv->samplesTillNextWrap = SIZE_MAX;
+        for (size_t i=0; i<rv->numDelays; i++)
+            rv->samplesTillNextWrap = BM_MIN(rv->samplesTillNextWrap, rv->bufferEndIndices[i] - rv->rwIndices[i]);
+        
+        // the convolver, if it was running or finishing its tail. If the
+        // snapshot was switching from the convolver back to the network,
+        // we may not have a convolver, and the rest of its tail is lost.
+        bool convolverRestored = h.convolverStateSize && rv->convolver && BMCReverbConvolverRestoreState(rv->convolver, p, h.convolverStateSize);
+        if (rv->frozen && !convolverRestored) {
+            BMCReverbReset(rv);
+            return false;
+        }
+        rv->frozenSlowDecay = h.frozenSlowDecay;
+        rv->idleFramesLeft = (rv->frozen || convolverRestored) ? h.idleFramesLeft : 0;
         
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbFork(struct BMCReverb* destination, struct BMCReverb* source){
+        BMCReverbApplySettings(source);
+        
+        // share the network
+        BMCReverbInitWithDesign(destination, source->design);
+        BMCReverbCopyMixSettings(destination, source);
+        destination->autoSustain = source->autoSustain;
+        destination->frozenIRMode = source->frozenIRMode;
+        
+        // copy the state of the network
+        memcpy(destination->delayLines, source->delayLines, sizeof(float)*source->totalSamples);
+        memcpy(destination->rwIndices, source->rwIndices, sizeof(size_t)*source->numDelays);
+        memcpy(destination->feedbackBuffers, source->feedbackBuffers, sizeof(float)*source->numDelays);
+        memcpy(destination->z1, source->z1, sizeof(float)*source->numDelays);
+        memcpy(destination->lfoPhases, source->lfoPhases, sizeof(float)*source->numDelays);
+        memcpy(destination->mainFilterHistory, source->mainFilterHistory, sizeof(source->mainFilterHistory));
+        destination->samplesTillNextWrap = source->samplesTillNextWrap;
+        destination->framesSinceReset = source->framesSinceReset;
+        
+        // and of the input diffusion, which isn't part of the design
+        BMCReverbUpdateDiffusion(destination);
+        memcpy(destination->diffusionMemory, source->diffusionMemory, sizeof(float)*source->diffusionTotalSamples);
+        memcpy(destination->diffusionIndices, source->diffusionIndices, sizeof(source->diffusionIndices));
+        
+        // and of the resampling filters
+        destination->resamplerPhase = source->resamplerPhase;
+        memcpy(destination->decimatorHistoryL, source->decimatorHistoryL, sizeof(float)*BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS);
+        memcpy(destination->decimatorHistoryR, source->decimatorHistoryR, sizeof(float)*BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS);
+        memcpy(destination->interpolatorHistoryL, source->interpolatorHistoryL, sizeof(float)*BMCREVERB_RESAMPLERTAPS);
+        memcpy(destination->interpolatorHistoryR, source->interpolatorHistoryR, sizeof(float)*BMCREVERB_RESAMPLERTAPS);
+        
+        // and of the convolver, which shares the impulse response
+        if (source->convolver) {
+            destination->convolver = malloc(sizeof(BMCReverbConvolver));
+            bool copied = destination->convolver
+                && BMCReverbConvolverInit(destination->convolver, source->convolver->ir)
+                && BMCReverbConvolverCopyState(destination->convolver, source->convolver);
+            if (!copied) {
+                free(destination->convolver);
+                destination->convolver = NULL;
+                return false;
+            }
+        }
+        destination->frozen = source->frozen;
+        destination->frozenSlowDecay = source->frozenSlowDecay;
+        destination->freezePending = source->freezePending;
+        destination->idleFramesLeft = source->idleFramesLeft;
         
-        rv->settingsQueuedForUpdate = false;
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbSetSeed(struct BMCReverb* rv, uint32_t seed){
+        rv->seed = seed;
+        rv->settingsQueuedForUpdate = true;
+    }
+    
+    
+    
+    
+    
+    // Returns the initial state of a random number generator.
+    //
+    // Each (seed, stream) pair gives an independent sequence. We scramble
+    // the pair with the finaliser from MurmurHash3 so that neighbouring
+    // seeds don't produce similar sequences.
+    uint32_t BMCReverbRandomInit(uint32_t seed, uint32_t stream){
+        uint32_t h = seed ^ (stream * 0x9E3779B9u);
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        
+        // the xorshift generator gets stuck at zero
+        return h ? h : 0x6D2B79F5u;
+    }
+    
+    
+    
+    
+    
+    // xorshift32 (Marsaglia 2003). The state lives with the caller, so this
+    // is safe to call from any number of threads at once, unlike rand().
+    uint32_t BMCReverbRandomNext(uint32_t* state){
+        uint32_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x;
+        return x;
     }
     
     
     
+    
+    
     // randomise the order of a list of floats
-    void BMCReverbRandomiseOrder(float* list, size_t seed, size_t length){
+    void BMCReverbRandomiseOrder(float* list, uint32_t seed, uint32_t stream, size_t length){
         // seed the random number generator so we get the same result every time
-        srand((int)seed);
+        uint32_t randomState = BMCReverbRandomInit(seed, stream);
         
-        for (int i = 0; i<length; i++) {
-            int j = rand() % (int)length;
+        for (size_t i = 0; i<length; i++) {
+            size_t j = BMCReverbRandomNext(&randomState) % length;
             
             // swap i with j
             float temp = list[i];
@@ -709,23 +3049,22 @@ extern "C" {
     
     
     
+    // the start and end marks of each delay are in the design. This sets
+    // the rw pointers, which belong to the reverb.
     void BMCReverbInitIndices(struct BMCReverb* rv){
-        size_t idx = 0;
         rv->samplesTillNextWrap = SIZE_MAX;
+        rv->longestDelay = 0;
         for (size_t i = 0; i<rv->numDelays; i++) {
             // set the initial location of the rw pointer
-            rv->rwIndices[i] = idx;
-            
-            // set a mark at the start location
-            rv->bufferStartIndices[i] = idx;
-            
-            // set a mark at the end of the buffer (after the end)
-            idx += rv->bufferLengths[i];
-            rv->bufferEndIndices[i] = idx;
+            rv->rwIndices[i] = rv->bufferStartIndices[i];
             
             // find the shortest distance until the next index wrap-around
             if (rv->bufferLengths[i] < rv->samplesTillNextWrap)
                 rv->samplesTillNextWrap = rv->bufferLengths[i];
+            
+            // and the longest delay
+            if (rv->bufferLengths[i] > rv->longestDelay)
+                rv->longestDelay = rv->bufferLengths[i];
         }
     }
     
@@ -741,6 +3080,19 @@ extern "C" {
         rv->rwIndices = NULL;
         rv->mixingBuffers = NULL;
         rv->z1 = NULL;
+        rv->lfoPhases = NULL;
+        rv->lfoIncrements = NULL;
+        rv->diffusionMemory = NULL;
+        rv->unitBlocks = NULL;
+        rv->unitBlockMemory = NULL;
+        rv->decimatedL = NULL;
+        rv->decimatedR = NULL;
+        rv->decimatorHistoryL = NULL;
+        rv->decimatorHistoryR = NULL;
+        rv->interpolatorHistoryL = NULL;
+        rv->interpolatorHistoryR = NULL;
+        rv->readWeights = NULL;
+        rv->readOffsets = NULL;
         rv->a1 = NULL;
         rv->b0 = NULL;
         rv->b1 = NULL;
@@ -754,7 +3106,13 @@ extern "C" {
         rv->delayOutputSigns = NULL;
         rv->dryL = NULL;
         rv->dryR = NULL;
-        rv->mainFilterSetup = NULL;
+        rv->filterTemp0 = NULL;
+        rv->filterTemp1 = NULL;
+        rv->design = NULL;
+        rv->newDesign = NULL;
+        rv->convolver = NULL;
+        rv->freezeJob = NULL;
+        rv->trace = NULL;
     }
     
     
@@ -762,29 +3120,38 @@ extern "C" {
     
     void BMCReverbFree(struct BMCReverb* rv){
         free(rv->delayLines);
-        free(rv->bufferLengths);
         free(rv->feedbackBuffers);
-        free(rv->bufferStartIndices);
-        free(rv->bufferEndIndices);
         free(rv->rwIndices);
         free(rv->mixingBuffers);
         free(rv->z1);
-        free(rv->a1);
-        free(rv->b0);
-        free(rv->b1);
-        free(rv->a1Slow);
-        free(rv->b0Slow);
-        free(rv->b1Slow);
-        free(rv->delayTimes);
-        free(rv->decayGainAttenuation);
-        free(rv->slowDecayGainAttenuation);
+        free(rv->lfoPhases);
+        free(rv->lfoIncrements);
+        free(rv->readWeights);
+        free(rv->readOffsets);
+        free(rv->diffusionMemory);
+        free(rv->unitBlockMemory);
         free(rv->leftOutputTemp);
-        free(rv->delayOutputSigns);
         free(rv->dryL);
         free(rv->dryR);
-        vDSP_biquadm_DestroySetup(rv->mainFilterSetup);
+        free(rv->filterTemp0);
+        free(rv->filterTemp1);
+        free(rv->decimatedL);
+        free(rv->decimatedR);
+        free(rv->decimatorHistoryL);
+        free(rv->decimatorHistoryR);
+        free(rv->interpolatorHistoryL);
+        free(rv->interpolatorHistoryR);
+        BMCReverbDesignRelease(rv->design);
+        BMCReverbDesignRelease(rv->newDesign);
+        if (rv->convolver) {
+            BMCReverbConvolverFree(rv->convolver);
+            free(rv->convolver);
+        }
+        BMCReverbFreezeJobRelease(rv->freezeJob);
+        rv->frozen = rv->freezePending = false;
         
         BMCReverbPointersToNull(rv);
+        rv->capacityNumDelays = rv->capacityTotalSamples = 0;
     }
     
     
@@ -796,60 +3163,18 @@ extern "C" {
     __inline void BMCReverbProcessWetSample(struct BMCReverb* rv, float inputL, float inputR, float* outputL, float* outputR){
         
         /*
-         * mix feedback from previous sample with the fresh inputs
+         * mix feedback from previous sample with the fresh inputs, then
+         * apply the decay
          */
+        BMCREVERB_STAGE_START(rv);
         // attenuate the input to preserve the volume before splitting the signal
         float attenuatedInputL = inputL * rv->inputAttenuation;
         float attenuatedInputR = inputR * rv->inputAttenuation;
-        // left channel mixes into the first n/2 delays
-        vDSP_vsadd(rv->feedbackBuffers, 1, &attenuatedInputL, rv->feedbackBuffers, 1, rv->halfNumDelays);
-        // right channel mixes into the second n/2 delays
-        vDSP_vsadd(rv->feedbackBuffers+rv->halfNumDelays, 1, &attenuatedInputR, rv->feedbackBuffers+rv->halfNumDelays, 1, rv->halfNumDelays);
-        
-        
-        
-        
-        /*
-         * slowDecay allows implementation of a sustain-pedal effect that
-         * switches over to a really long decay time when slowDecay is on
-         */
-        if (!rv->slowDecay){
-            
-            /*
-             * All Frequencies Decay with slow and standard decay rates
-             * slow rate is used for a hold / sustain pedal control
-             */
-            vDSP_vmul(rv->feedbackBuffers, 1, rv->decayGainAttenuation, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            
-            /*
-             * High Frequency Decay
-             */
-            // apply a first order high-shelf filter to the feedback path
-            //
-            // This filter structure is direct form 2 from figure 14 in section 1.1.6
-            // of Digital Filters for Everyone by Rusty Alred, second ed.
-            //
-            // feedbackBuffers = feedbackBuffers + (a1 * z1);
-            vDSP_vma(rv->a1, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            // feedbackBuffers = b0*feedbackBuffers + b1*z1;
-            vDSP_vmma(rv->b0, 1, rv->feedbackBuffers, 1, rv->b1, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            // z1 = feedbackBuffers;
-            memcpy(rv->z1, rv->feedbackBuffers, rv->numDelays * sizeof(float));
-            
-            
-            /*
-             * the else case uses different paramaters to the the decay, resulting
-             * in longer sustain
-             */
-        } else {
-            // broadband decay
-            vDSP_vmul(rv->feedbackBuffers, 1, rv->slowDecayGainAttenuation, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            
-            // high-frequency filtering
-            vDSP_vma(rv->a1Slow, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            vDSP_vmma(rv->b0Slow, 1, rv->feedbackBuffers, 1, rv->b1Slow, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->numDelays);
-            memcpy(rv->z1, rv->feedbackBuffers, rv->numDelays * sizeof(float));
-        }
+        if (rv->kernel == BMCREVERB_KERNEL_SCALAR) {
+            BMCReverbFeedbackScalar(rv, attenuatedInputL, attenuatedInputR);
+            BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_INPUT);
+        } else
+            BMCReverbFeedbackVector(rv, attenuatedInputL, attenuatedInputR);
         
         
         
@@ -859,6 +3184,7 @@ extern "C" {
          */
         for (size_t i=0; i < rv->numDelays; i++)
             rv->delayLines[rv->rwIndices[i]] = rv->feedbackBuffers[i];
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_WRITE);
         
         
         
@@ -866,6 +3192,7 @@ extern "C" {
          * increment delay indices
          */
         BMCReverbIncrementIndices(rv);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_INCREMENT);
         
         
         
@@ -874,9 +3201,28 @@ extern "C" {
          */
         // vDSP_vgathr indexes 1 as the first element of the array so we have to
         // add +1 to the reference to delayLines to compensate
-        vDSP_vgathr(rv->delayLines+1, rv->rwIndices, 1, rv->feedbackBuffers, 1, rv->numDelays);
-        //for (size_t i=0; i < rv->numDelays; i++)
-        //    rv->feedbackBuffers[i] = rv->delayLines[rv->rwIndices[i]];
+        if (rv->modulationDepthSamples > 0.0f)
+            BMCReverbReadModulated(rv);
+        else if (rv->kernel == BMCREVERB_KERNEL_SCALAR)
+            for (size_t i=0; i < rv->numDelays; i++)
+                rv->feedbackBuffers[i] = rv->delayLines[rv->rwIndices[i]];
+        else
+            vDSP_vgathr(rv->delayLines+1, rv->rwIndices, 1, rv->feedbackBuffers, 1, rv->numDelays);
+        
+        // until every delay has been written all the way around since the
+        // last reset, some of them return stale memory, which reads as zero.
+        // A modulated read sits some samples after the read index, so it
+        // reaches written memory sooner.
+        if (rv->framesSinceReset < rv->longestDelay) {
+            rv->framesSinceReset++;
+            if (rv->modulationDepthSamples > 0.0f)
+                BMCReverbReadModulatedStale(rv);
+            else
+                for (size_t i=0; i < rv->numDelays; i++)
+                    if (rv->framesSinceReset < rv->bufferLengths[i]) rv->feedbackBuffers[i] = 0.0f;
+        }
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_GATHER);
+        BMCREVERB_COUNT_DENORMALS(rv, rv->feedbackBuffers);
         
         
         
@@ -885,29 +3231,321 @@ extern "C" {
         /*
          * sum the delay line outputs to right and left channel outputs
          */
-        // randomise the signs of the output from each delay, caching in mb0
-        vDSP_vmul(rv->feedbackBuffers, 1, rv->delayOutputSigns, 1, rv->mb0, 1, rv->numDelays);
+        // randomise the signs of the output from each delay, caching in mixingBuffers
+        vDSP_vmul(rv->feedbackBuffers, 1, rv->delayOutputSigns, 1, rv->mixingBuffers, 1, rv->numDelays);
         // first half of delays sum to left out
-        vDSP_sve(rv->mb0, 1, outputL, rv->halfNumDelays);
+        vDSP_sve(rv->mixingBuffers, 1, outputL, rv->halfNumDelays);
         // second half of delays sum to right out
-        vDSP_sve(rv->mb2, 1, outputR, rv->halfNumDelays);
+        vDSP_sve(rv->mixingBuffers+rv->halfNumDelays, 1, outputR, rv->halfNumDelays);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_OUTPUTSUM);
         
         
         
         
         /*
          * Mix the feedback signal
-         *
-         * The code below does the first two stages of a fast hadamard transform,
-         * followed by some swapping.
-         * Leaving the transform incomplete is equivalent to using a
-         * block-circulant mixing matrix. Typically, block circulant mixing is
-         * done using the last two stages of the fast hadamard transform. Here
-         * we use the first two stages instead because it permits us to do
-         * vectorised additions and subtractions with a stride of 1.
-         *
-         * Regarding block-circulant mixing, see: https://www.researchgate.net/publication/282252790_Flatter_Frequency_Response_from_Feedback_Delay_Network_Reverbs
          */
+        switch (rv->mixingMatrix) {
+            case BMCREVERB_MATRIX_BLOCKCIRCULANT:
+                if (rv->kernel == BMCREVERB_KERNEL_SCALAR)
+                    BMCReverbMixBlockCirculantScalar(rv);
+                else
+                    BMCReverbMixBlockCirculant(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_MIXING);
+                BMCReverbRotateFeedback(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_ROTATION);
+                break;
+            case BMCREVERB_MATRIX_HADAMARD:
+                BMCReverbMixHadamard(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_MIXING);
+                break;
+            case BMCREVERB_MATRIX_HOUSEHOLDER:
+                BMCReverbMixHouseholder(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_MIXING);
+                BMCReverbRotateFeedback(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_ROTATION);
+                break;
+            case BMCREVERB_MATRIX_PERMUTATION:
+                BMCReverbRotateFeedback(rv);
+                BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_ROTATION);
+                break;
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbUsesBlockedKernel(const struct BMCReverb* rv){
+        return rv->kernel == BMCREVERB_KERNEL_BLOCKED
+            && rv->mixingMatrix == BMCREVERB_MATRIX_BLOCKCIRCULANT
+            && rv->modulationDepthSamples == 0.0f;
+    }
+    
+    
+    
+    
+    
+    // copies the per-delay state and the coefficients in use into the
+    // unit blocks. The columns past the last unit are zero, which they
+    // stay.
+    void BMCReverbPackUnitBlocks(struct BMCReverb* rv){
+        const float *decay = rv->decayGainAttenuation, *a1 = rv->a1, *b0 = rv->b0, *b1 = rv->b1;
+        if (rv->slowDecay) {
+            decay = rv->slowDecayGainAttenuation;
+            a1 = rv->a1Slow;
+            b0 = rv->b0Slow;
+            b1 = rv->b1Slow;
+        }
+        
+        size_t numUnits = rv->fourthNumDelays;
+        size_t numBlocks = (numUnits + BMCREVERB_BLOCKUNITS - 1) / BMCREVERB_BLOCKUNITS;
+        memset(rv->unitBlocks, 0, sizeof(BMCReverbUnitBlock)*numBlocks);
+        for (size_t k=0; k<4; k++)
+            for (size_t u=0; u<numUnits; u++) {
+                BMCReverbUnitBlock* block = rv->unitBlocks + u / BMCREVERB_BLOCKUNITS;
+                size_t c = u % BMCREVERB_BLOCKUNITS;
+                size_t i = k*numUnits + u;
+                block->feedback[k][c] = rv->feedbackBuffers[i];
+                block->z1[k][c] = rv->z1[i];
+                block->decay[k][c] = decay[i];
+                block->a1[k][c] = a1[i];
+                block->b0[k][c] = b0[i];
+                block->b1[k][c] = b1[i];
+                block->outputSigns[k][c] = rv->delayOutputSigns[i];
+                block->rwIndices[k][c] = rv->rwIndices[i];
+                block->startIndices[k][c] = rv->bufferStartIndices[i];
+                block->endIndices[k][c] = rv->bufferEndIndices[i];
+            }
+    }
+    
+    
+    
+    
+    
+    // copies the state back from the unit blocks into the flat arrays
+    void BMCReverbUnpackUnitBlocks(struct BMCReverb* rv){
+        size_t numUnits = rv->fourthNumDelays;
+        for (size_t k=0; k<4; k++)
+            for (size_t u=0; u<numUnits; u++) {
+                const BMCReverbUnitBlock* block = rv->unitBlocks + u / BMCREVERB_BLOCKUNITS;
+                size_t c = u % BMCREVERB_BLOCKUNITS;
+                size_t i = k*numUnits + u;
+                rv->feedbackBuffers[i] = block->feedback[k][c];
+                rv->z1[i] = block->z1[k][c];
+                rv->rwIndices[i] = block->rwIndices[k][c];
+            }
+    }
+    
+    
+    
+    
+    
+    // The same as BMCReverbProcessWetSample with the block-circulant
+    // matrix, in one pass over the unit blocks.
+    //
+    // The floating point operations are the same as the other kernels',
+    // in the same order, so the output is the same. The signed delay
+    // outputs go to mixingBuffers in their flat order and are summed by
+    // the same vDSP calls. The rotation after the mixing moves each
+    // unit's output to the next unit, so the last unit of a block goes to
+    // the first of the next block, and the last unit of the network to
+    // the first unit of the next row.
+    void BMCReverbProcessBlockedSample(struct BMCReverb* rv, float inputL, float inputR, float* outputL, float* outputR){
+        BMCREVERB_STAGE_START(rv);
+        size_t numUnits = rv->fourthNumDelays;
+        float* delayLines = rv->delayLines;
+        float* signedOutputs = rv->mixingBuffers;
+        float matrixAttenuation = rv->matrixAttenuation;
+        float input [4] = {inputL * rv->inputAttenuation, inputL * rv->inputAttenuation, inputR * rv->inputAttenuation, inputR * rv->inputAttenuation};
+        
+        // the indices wrap in this sample if any of them reaches its end
+        bool wrap = rv->samplesTillNextWrap == 1;
+        size_t samplesTillNextWrap = SIZE_MAX;
+        
+        // delays that haven't been written all the way around since the
+        // last reset read as zero
+        bool stale = rv->framesSinceReset < rv->longestDelay;
+        if (stale) rv->framesSinceReset++;
+        size_t framesSinceReset = rv->framesSinceReset;
+        
+        // the mixed output of the last unit of the previous block
+        float carry [4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        
+        for (size_t first=0; first<numUnits; first += BMCREVERB_BLOCKUNITS) {
+            BMCReverbUnitBlock* block = rv->unitBlocks + first / BMCREVERB_BLOCKUNITS;
+            size_t numColumns = BM_MIN(numUnits - first, (size_t)BMCREVERB_BLOCKUNITS);
+            
+            // input, broadband decay and the high-shelf filter
+            for (size_t k=0; k<4; k++)
+                for (size_t c=0; c<BMCREVERB_BLOCKUNITS; c++) {
+                    float x = (block->feedback[k][c] + input[k]) * block->decay[k][c];
+                    float w = block->a1[k][c]*block->z1[k][c] + x;
+                    block->feedback[k][c] = block->b0[k][c]*w + block->b1[k][c]*block->z1[k][c];
+                    block->z1[k][c] = w;
+                }
+            
+            // write the delays, move the indices on and read the delays
+            for (size_t k=0; k<4; k++)
+                for (size_t c=0; c<numColumns; c++) {
+                    size_t index = block->rwIndices[k][c];
+                    delayLines[index++] = block->feedback[k][c];
+                    if (wrap) {
+                        if (index == block->endIndices[k][c]) index = block->startIndices[k][c];
+                        samplesTillNextWrap = BM_MIN(samplesTillNextWrap, block->endIndices[k][c] - index);
+                    }
+                    block->rwIndices[k][c] = index;
+                    float y = delayLines[index];
+                    if (stale && framesSinceReset < block->endIndices[k][c] - block->startIndices[k][c]) y = 0.0f;
+                    block->feedback[k][c] = y;
+                    signedOutputs[k*numUnits + first + c] = y * block->outputSigns[k][c];
+                }
+            
+            // mix the four delays of each unit
+            float mixed [4][BMCREVERB_BLOCKUNITS];
+            for (size_t c=0; c<BMCREVERB_BLOCKUNITS; c++) {
+                float s0 = block->feedback[0][c] + block->feedback[2][c];
+                float s1 = block->feedback[1][c] + block->feedback[3][c];
+                float d0 = block->feedback[0][c] - block->feedback[2][c];
+                float d1 = block->feedback[1][c] - block->feedback[3][c];
+                mixed[0][c] = (s0 + s1) * matrixAttenuation;
+                mixed[1][c] = (s0 - s1) * matrixAttenuation;
+                mixed[2][c] = (d0 + d1) * matrixAttenuation;
+                mixed[3][c] = (d0 - d1) * matrixAttenuation;
+            }
+            
+            // and rotate them into the next unit. The first unit of the
+            // network gets its input when we know the last.
+            for (size_t k=0; k<4; k++) {
+                block->feedback[k][0] = carry[k];
+                for (size_t c=1; c<numColumns; c++)
+                    block->feedback[k][c] = mixed[k][c-1];
+                carry[k] = mixed[k][numColumns-1];
+            }
+        }
+        
+        rv->unitBlocks->feedback[0][0] = carry[3];
+        for (size_t k=1; k<4; k++)
+            rv->unitBlocks->feedback[k][0] = carry[k-1];
+        
+        if (wrap) rv->samplesTillNextWrap = samplesTillNextWrap;
+        else rv->samplesTillNextWrap--;
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_INPUT);
+        BMCREVERB_COUNT_DENORMALS(rv, signedOutputs);
+        
+        
+        // first half of delays sum to left out
+        vDSP_sve(signedOutputs, 1, outputL, rv->halfNumDelays);
+        // second half of delays sum to right out
+        vDSP_sve(signedOutputs+rv->halfNumDelays, 1, outputR, rv->halfNumDelays);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_OUTPUTSUM);
+    }
+    
+    
+    
+    
+    
+    // mixes the input into the feedback and applies the broadband and
+    // high frequency decay, one stage at a time
+    void BMCReverbFeedbackVector(struct BMCReverb* rv, float inputL, float inputR){
+        // left channel mixes into the first n/2 delays
+        vDSP_vsadd(rv->feedbackBuffers, 1, &inputL, rv->feedbackBuffers, 1, rv->halfNumDelays);
+        // right channel mixes into the second n/2 delays
+        vDSP_vsadd(rv->feedbackBuffers+rv->halfNumDelays, 1, &inputR, rv->feedbackBuffers+rv->halfNumDelays, 1, rv->halfNumDelays);
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_INPUT);
+        
+        
+        
+        
+        /*
+         * slowDecay allows implementation of a sustain-pedal effect that
+         * switches over to a really long decay time when slowDecay is on
+         */
+        if (!rv->slowDecay){
+            
+            /*
+             * All Frequencies Decay with slow and standard decay rates
+             * slow rate is used for a hold / sustain pedal control
+             */
+            vDSP_vmul(rv->feedbackBuffers, 1, rv->decayGainAttenuation, 1, rv->feedbackBuffers, 1, rv->numDelays);
+            BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_DECAY);
+            
+            /*
+             * High Frequency Decay
+             */
+            // apply a first order high-shelf filter to the feedback path
+            //
+            // This filter structure is direct form 2 from figure 14 in section 1.1.6
+            // of Digital Filters for Everyone by Rusty Alred, second ed.
+            // The state z1 is the intermediate value w, not the output, so
+            // we keep w in mixingBuffers, which is free until the output
+            // stage.
+            //
+            // w = feedbackBuffers + (a1 * z1);
+            vDSP_vma(rv->a1, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->mixingBuffers, 1, rv->numDelays);
+            // feedbackBuffers = b0*w + b1*z1;
+            vDSP_vmma(rv->b0, 1, rv->mixingBuffers, 1, rv->b1, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->numDelays);
+            // z1 = w;
+            memcpy(rv->z1, rv->mixingBuffers, rv->numDelays * sizeof(float));
+            
+            
+            /*
+             * the else case uses different paramaters to the the decay, resulting
+             * in longer sustain
+             */
+        } else {
+            // broadband decay
+            vDSP_vmul(rv->feedbackBuffers, 1, rv->slowDecayGainAttenuation, 1, rv->feedbackBuffers, 1, rv->numDelays);
+            BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_DECAY);
+            
+            // high-frequency filtering
+            vDSP_vma(rv->a1Slow, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->mixingBuffers, 1, rv->numDelays);
+            vDSP_vmma(rv->b0Slow, 1, rv->mixingBuffers, 1, rv->b1Slow, 1, rv->z1, 1, rv->feedbackBuffers, 1, rv->numDelays);
+            memcpy(rv->z1, rv->mixingBuffers, rv->numDelays * sizeof(float));
+        }
+        BMCREVERB_STAGE_END(rv, BMCREVERB_STAGE_SHELF);
+    }
+    
+    
+    
+    
+    
+    // the same as BMCReverbFeedbackVector in a single pass over the
+    // delays, doing the same floating point operations in the same order
+    void BMCReverbFeedbackScalar(struct BMCReverb* rv, float inputL, float inputR){
+        const float *decay = rv->decayGainAttenuation, *a1 = rv->a1, *b0 = rv->b0, *b1 = rv->b1;
+        if (rv->slowDecay) {
+            decay = rv->slowDecayGainAttenuation;
+            a1 = rv->a1Slow;
+            b0 = rv->b0Slow;
+            b1 = rv->b1Slow;
+        }
+        
+        float* feedback = rv->feedbackBuffers;
+        float* z1 = rv->z1;
+        for (size_t i=0; i < rv->numDelays; i++) {
+            float x = (feedback[i] + (i < rv->halfNumDelays ? inputL : inputR)) * decay[i];
+            float w = a1[i]*z1[i] + x;
+            feedback[i] = b0[i]*w + b1[i]*z1[i];
+            z1[i] = w;
+        }
+    }
+    
+    
+    
+    
+    
+    /*
+     * The code below does the first two stages of a fast hadamard transform.
+     * Leaving the transform incomplete is equivalent to using a
+     * block-circulant mixing matrix. Typically, block circulant mixing is
+     * done using the last two stages of the fast hadamard transform. Here
+     * we use the first two stages instead because it permits us to do
+     * vectorised additions and subtractions with a stride of 1.
+     *
+     * Regarding block-circulant mixing, see: https://www.researchgate.net/publication/282252790_Flatter_Frequency_Response_from_Feedback_Delay_Network_Reverbs
+     */
+    void BMCReverbMixBlockCirculant(struct BMCReverb* rv){
         //
         // Stage 1 of Fast Hadamard Transform
         //
@@ -929,14 +3567,98 @@ extern "C" {
         vDSP_vsub(rv->mb2, 1, rv->mb3, 1, rv->fb3, 1, rv->fourthNumDelays);
         //
         // attenuate to keep the mixing transformation unitary
-        //float endElement = rv->feedbackBuffers[(rv->numDelays)-1];
         vDSP_vsmul(rv->feedbackBuffers, 1, &rv->matrixAttenuation, rv->feedbackBuffers, 1, rv->numDelays);
-        //
-        // rotate the values in the feedback buffer by one position
-        //
-        // the rotation ensures that a signal entering delay n does not
-        // return back to the nth delay until after it has passed through
-        // numDelays/4 other delays.
+    }
+    
+    
+    
+    
+    
+    // the same as BMCReverbMixBlockCirculant, one group of four delays at
+    // a time
+    void BMCReverbMixBlockCirculantScalar(struct BMCReverb* rv){
+        for (size_t i=0; i < rv->fourthNumDelays; i++) {
+            float s0 = rv->fb0[i] + rv->fb2[i];
+            float s1 = rv->fb1[i] + rv->fb3[i];
+            float d0 = rv->fb0[i] - rv->fb2[i];
+            float d1 = rv->fb1[i] - rv->fb3[i];
+            rv->fb0[i] = (s0 + s1) * rv->matrixAttenuation;
+            rv->fb1[i] = (s0 - s1) * rv->matrixAttenuation;
+            rv->fb2[i] = (d0 + d1) * rv->matrixAttenuation;
+            rv->fb3[i] = (d0 - d1) * rv->matrixAttenuation;
+        }
+    }
+    
+    
+    
+    
+    
+    /*
+     * Full fast Hadamard transform in log2(numDelays) stages.
+     *
+     * Every stage is the same "constant geometry" butterfly:
+     *
+     *    out[i]     = in[2i] + in[2i+1]
+     *    out[i+n/2] = in[2i] - in[2i+1]
+     *
+     * Repeating it log2(n) times gives a Hadamard matrix. Because the
+     * addressing is the same in every stage, each stage is just one strided
+     * vector add and one strided vector subtract. We ping-pong between
+     * feedbackBuffers and mixingBuffers and fold the final copy into the
+     * normalisation.
+     */
+    void BMCReverbMixHadamard(struct BMCReverb* rv){
+        float* in = rv->feedbackBuffers;
+        float* out = rv->mixingBuffers;
+        
+        for (size_t stageSize = 2; stageSize <= rv->numDelays; stageSize *= 2) {
+            vDSP_vadd(in, 2, in+1, 2, out, 1, rv->halfNumDelays);
+            vDSP_vsub(in, 2, in+1, 2, out+rv->halfNumDelays, 1, rv->halfNumDelays);
+            
+            // swap input and output for the next stage
+            float* temp = in;
+            in = out;
+            out = temp;
+        }
+        
+        // attenuate to keep the mixing transformation unitary. After an
+        // odd number of stages this also moves the result back into the
+        // feedback buffers.
+        vDSP_vsmul(in, 1, &rv->matrixAttenuation, rv->feedbackBuffers, 1, rv->numDelays);
+    }
+    
+    
+    
+    
+    
+    /*
+     * Householder reflection about the vector [1,1,...,1]
+     *
+     *    out = in - (2/n) * sum(in)
+     *
+     * This is unitary for any n and costs one vector sum and one vector
+     * scalar add. On its own it mixes weakly, so we follow it with the
+     * same rotation used by the block-circulant matrix.
+     */
+    void BMCReverbMixHouseholder(struct BMCReverb* rv){
+        float sum;
+        vDSP_sve(rv->feedbackBuffers, 1, &sum, rv->numDelays);
+        float reflection = -2.0f * sum / (float)rv->numDelays;
+        vDSP_vsadd(rv->feedbackBuffers, 1, &reflection, rv->feedbackBuffers, 1, rv->numDelays);
+    }
+    
+    
+    
+    
+    
+    /*
+     * rotate the values in the feedback buffer by one position
+     *
+     * the rotation ensures that a signal entering delay n does not
+     * return back to the nth delay until after it has passed through
+     * numDelays/4 other delays.
+     */
+    void BMCReverbRotateFeedback(struct BMCReverb* rv){
         float endElement = rv->feedbackBuffers[(rv->numDelays)-1];
         memmove(rv->feedbackBuffers+1, rv->feedbackBuffers, sizeof(float)*(rv->numDelays-1));
         rv->feedbackBuffers[0] = endElement;
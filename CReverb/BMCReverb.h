@@ -10,6 +10,8 @@
 #define BMCReverb_h
 
 #include <stdio.h>
+#include <stdint.h>
+#include "BMCReverbInstrumentation.h"
 
 #ifdef __APPLE__
     #include <Accelerate/Accelerate.h>
@@ -31,21 +33,191 @@
 #define BMCREVERB_LOWPASS_FC 6000.0 // lowpass filter on wet out
 #define BMCREVERB_CROSSSTEREOMIX 0.4 // mixing betwee L and R wet outputs
 #define BMCREVERB_SLOWDECAYRT60 8.0 // RT60 time when hold pedal is down
+#define BMCREVERB_MIXINGMATRIX BMCREVERB_MATRIX_BLOCKCIRCULANT
+#define BMCREVERB_SEED 111 // seeds the random delay times and output signs
+#define BMCREVERB_IRBLOCKLENGTH 1024 // frames between checks for the end of an impulse response
+#define BMCREVERB_FROZENIR_THRESHOLD_DB -90.0 // frozen impulse responses stop here
+#define BMCREVERB_CHUNKLENGTH 256 // default length of the chunks buffers are processed in
+#define BMCREVERB_MAXCHUNKLENGTH 1024
+#define BMCREVERB_MODULATIONDEPTH 0.0 // (seconds) 0 leaves the delays unmodulated
+#define BMCREVERB_MODULATIONRATE 0.5 // (Hz) mean rate of the delay modulation
+#define BMCREVERB_MODULATIONSPREAD 0.5 // delay modulation rates vary by +-50% around the mean
+#define BMCREVERB_INTERPOLATION BMCREVERB_INTERPOLATION_CUBIC
+#define BMCREVERB_DIFFUSIONSTAGES 0 // allpass filters on each input. 0 turns input diffusion off
+#define BMCREVERB_MAXDIFFUSIONSTAGES 8
+#define BMCREVERB_DIFFUSIONGAIN 0.6 // feedback gain of the input allpass filters
+#define BMCREVERB_MAXDIFFUSIONTIME 0.05 // (seconds) longest delay of an input allpass filter
+#define BMCREVERB_DECIMATION 1 // the network runs at sampleRate / decimation. 1 runs it at the full rate
+#define BMCREVERB_DECIMATION_AUTO 0 // choose the decimation from the sample rate
+#define BMCREVERB_MAXDECIMATION 4
+#define BMCREVERB_MINNETWORKSAMPLERATE 44100.0 // automatic decimation keeps the network rate at least this high
+#define BMCREVERB_RESAMPLERTAPS 16 // taps per phase of the decimation and interpolation filters
+#define BMCREVERB_INPUTLIMIT 1.0e5f // input samples beyond +-100 dB full scale are replaced with silence
+#define BMCREVERB_VERSION "1.1" // change when the output or the speed of the processing changes
 
 #ifdef __cplusplus
 extern "C" {
 #endif
     
+    // mixing matrices available for the feedback path of the network
+    typedef enum BMCReverbMixingMatrix {
+        // first two stages of a fast Hadamard transform followed by a
+        // rotation. (block-circulant) numDelays must be a multiple of 4.
+        BMCREVERB_MATRIX_BLOCKCIRCULANT,
+        // all log2(numDelays) stages of the fast Hadamard transform.
+        // numDelays must be a power of 2.
+        BMCREVERB_MATRIX_HADAMARD,
+        // O(numDelays) Householder reflection followed by a rotation.
+        // Works with any even number of delays.
+        BMCREVERB_MATRIX_HOUSEHOLDER,
+        // rotation only. The cheapest option and the least dense.
+        BMCREVERB_MATRIX_PERMUTATION
+    } BMCReverbMixingMatrix;
+    
+    
+    // how the wet signal is computed (see BMCReverbSetFrozenIRMode)
+    typedef enum BMCReverbFrozenIRMode {
+        // always run the network
+        BMCREVERB_FROZENIR_OFF,
+        // always convolve with the impulse response of the network
+        BMCREVERB_FROZENIR_ON,
+        // convolve when that is estimated to be cheaper than the network
+        BMCREVERB_FROZENIR_AUTO
+    } BMCReverbFrozenIRMode;
+    
+    
+    // implementations of the network. They produce the same output but
+    // their speed depends on the CPU and the number of delays. (see
+    // BMCReverbAutotune.h)
+    typedef enum BMCReverbKernel {
+        // one vDSP call per stage of the network, for every sample
+        BMCREVERB_KERNEL_VECTOR,
+        // plain loops that do several stages in one pass over the delays.
+        // Faster for small networks, where the calls cost more than the
+        // arithmetic.
+        BMCREVERB_KERNEL_SCALAR,
+        // the whole network in one pass over blocks of delay units, with
+        // the state and coefficients of each block stored together (see
+        // BMCReverbUnitBlock in BMCReverb.c). Used with the block-circulant
+        // matrix and unmodulated delays. Otherwise it is the same as
+        // BMCREVERB_KERNEL_VECTOR.
+        BMCREVERB_KERNEL_BLOCKED
+    } BMCReverbKernel;
+    
+    
+    // how modulated delays are read between samples (see
+    // BMCReverbSetModulation)
+    typedef enum BMCReverbInterpolation {
+        // two samples per delay. Cheaper, but it filters the high
+        // frequencies by an amount that changes with the modulation.
+        BMCREVERB_INTERPOLATION_LINEAR,
+        // four samples per delay (Catmull-Rom)
+        BMCREVERB_INTERPOLATION_CUBIC
+    } BMCReverbInterpolation;
+    
+    
+    struct BMCReverbFrozenIR;
+    struct BMCReverbConvolver;
+    struct BMCReverbFreezeJob;
+    struct BMCReverbTrace;
+    struct BMCReverbUnitBlock;
+    
+    
+    // An immutable description of a reverb network: the layout of the
+    // delays, the decay coefficients and the output signs, together with
+    // the settings they were computed from. Designs are reference counted
+    // so that any number of reverbs can share one. Never modify a design
+    // after it has been created.
+    typedef struct BMCReverbDesign {
+        size_t *bufferLengths, *bufferStartIndices, *bufferEndIndices;
+        float *delayTimes, *decayGainAttenuation, *slowDecayGainAttenuation, *a1, *b0, *b1, *a1Slow, *b0Slow, *b1Slow, *delayOutputSigns;
+        float minDelay_seconds, maxDelay_seconds, sampleRate, hfDecayMultiplier, hfSlowDecayMultiplier, highShelfFC, rt60, slowDecayRT60;
+        size_t numDelays, totalSamples, capacityNumDelays, decimationFactor;
+        uint32_t seed;
+        BMCReverbMixingMatrix mixingMatrix;
+        int32_t refCount;
+        // impulse responses of the network with slow decay off and on,
+        // rendered the first time a reverb using the design freezes
+        struct BMCReverbFrozenIR* frozenIR [2];
+    } BMCReverbDesign;
+    
+    
     // the CReverb struct
+    //
+    // bufferLengths, delayTimes, the decay coefficients and the output
+    // signs point into the tables of the design the reverb is using.
     typedef struct BMCReverb {
         float *delayLines, *feedbackBuffers, *mixingBuffers, *fb0, *fb1, *fb2, *fb3, *mb0, *mb1, *mb2, *mb3, *z1, *a1, *b0, *b1, *a1Slow, *b0Slow, *b1Slow, *delayTimes, *decayGainAttenuation, *slowDecayGainAttenuation, *leftOutputTemp, *delayOutputSigns, *dryL, *dryR;
         size_t *bufferLengths, *bufferStartIndices, *bufferEndIndices, *rwIndices;
         float minDelay_seconds, maxDelay_seconds, sampleRate, wetGain, dryGain, inputAttenuation, matrixAttenuation, straightStereoMix, crossStereoMix, hfDecayMultiplier, hfSlowDecayMultiplier, highShelfFC, rt60, slowDecayRT60, highpassFC, lowpassFC;
-        size_t delayUnits, newNumDelayUnits, numDelays, halfNumDelays, fourthNumDelays, threeFourthsNumDelays, samplesTillNextWrap, totalSamples;
-        float* twoChannelFilterData [2];
-        vDSP_biquadm_Setup mainFilterSetup;
-        double mainFilterCoefficients[5*2*2], *fcChLSec0, *fcChRSec0, *fcChLSec1, *fcChRSec1;
-        bool slowDecay, settingsQueuedForUpdate, autoSustain;
+        size_t delayUnits, newNumDelays, numDelays, halfNumDelays, fourthNumDelays, threeFourthsNumDelays, samplesTillNextWrap, totalSamples, capacityNumDelays, capacityTotalSamples;
+        // frames processed since the last reset, counting up to the length
+        // of the longest delay. Delay memory not written since the reset
+        // reads as zero, so resetting doesn't have to clear it.
+        size_t framesSinceReset, longestDelay;
+        uint32_t seed;
+        float highpassCoefficients [5], lowpassCoefficients [5], *filterTemp0, *filterTemp1;
+        float mainFilterHistory [2*6]; // (x, highpass y, lowpass y) * 2 samples * 2 channels
+        bool slowDecay, settingsQueuedForUpdate, decayCoefficientsQueuedForUpdate, autoSustain;
+        BMCReverbMixingMatrix mixingMatrix, newMixingMatrix;
+        BMCReverbDesign *design, *newDesign;
+        // frozen impulse response mode. When the reverb switches between
+        // the network and the convolver, the one it stops using keeps
+        // running without input for idleFramesLeft frames to finish its tail.
+        // While freezePending, freezeJob is rendering the response on the
+        // background thread and the reverb carries on as it was.
+        BMCReverbFrozenIRMode frozenIRMode;
+        struct BMCReverbConvolver* convolver;
+        struct BMCReverbFreezeJob* freezeJob;
+        bool frozen, frozenSlowDecay, freezePending;
+        size_t idleFramesLeft;
+        // buffers are processed in chunks of up to chunkLength frames
+        BMCReverbKernel kernel;
+        size_t chunkLength;
+        // the blocked kernel's copy of the per-delay state and
+        // coefficients, for the length of a chunk. unitBlockMemory is the
+        // allocation, which unitBlocks is aligned within.
+        struct BMCReverbUnitBlock* unitBlocks;
+        void* unitBlockMemory;
+        // delay modulation. Each delay has an LFO with its own phase and
+        // rate. readOffsets and readWeights hold the read position and
+        // the interpolation weights for the current sample.
+        float *lfoPhases, *lfoIncrements, *readWeights;
+        int32_t *readOffsets;
+        float modulationDepth_seconds, modulationRate, modulationDepthSamples;
+        BMCReverbInterpolation interpolation;
+        bool modulationQueuedForUpdate;
+        // input diffusion. Each input goes through numDiffusionStages
+        // allpass filters in series before the network. The delays of the
+        // filters in use are ring buffers in diffusionMemory, the left
+        // channel's first, with their read positions in diffusionIndices.
+        float *diffusionMemory, diffusionTimes [BMCREVERB_MAXDIFFUSIONSTAGES], diffusionGain;
+        size_t numDiffusionStages, activeDiffusionStages, diffusionTotalSamples, capacityDiffusionSamples;
+        size_t diffusionLengths [2*BMCREVERB_MAXDIFFUSIONSTAGES], diffusionIndices [2*BMCREVERB_MAXDIFFUSIONSTAGES];
+        // the reduced rate wet path. decimation is the setting and
+        // decimationFactor the factor in use. With a factor above 1, the
+        // input is filtered and decimated into decimatedL and decimatedR,
+        // the wet path runs at networkSampleRate and its output is
+        // interpolated back up. The histories hold the filter inputs from
+        // earlier chunks. resamplerPhase is the position of the next input
+        // frame in its cycle of decimationFactor frames, and the frames at
+        // position 0 are the ones the network sees.
+        float networkSampleRate;
+        size_t decimation, decimationFactor, resamplerPhase;
+        float decimationFilter [BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS], interpolationFilters [BMCREVERB_MAXDECIMATION*BMCREVERB_RESAMPLERTAPS];
+        float *decimatedL, *decimatedR, *decimatorHistoryL, *decimatorHistoryR, *interpolatorHistoryL, *interpolatorHistoryR;
+#ifdef BMCREVERB_INSTRUMENTATION
+        BMCReverbInstrumentation instrumentation;
+#endif
+        // events are recorded in trace if it isn't NULL. bytesAllocated
+        // counts the memory allocated by settings updates.
+        struct BMCReverbTrace* trace;
+        uint64_t traceBufferStart;
+        size_t bytesAllocated;
+        // input samples replaced because they were NaN, infinite or beyond
+        // BMCREVERB_INPUTLIMIT, and buffers after which the state of the
+        // reverb wasn't finite and had to be cleared
+        uint64_t sanitisedSamples, faultsRecovered;
     } BMCReverb;
     
     
@@ -59,12 +231,188 @@ extern "C" {
     void BMCReverbInit(struct BMCReverb* rv);
     void BMCReverbFree(struct BMCReverb* rv);
     
+    
+    // Initialises the reverb and reserves enough memory for any combination
+    // of settings up to the given maximums. Afterwards, changes to the
+    // sample rate, pre-delay, room size and number of delay units that stay
+    // within these limits reuse the existing memory and never allocate.
+    // Settings beyond the limits still work, but allocate when applied.
+    //
+    // Example: BMCReverbInitWithCapacity(&rv, 192000.0, 64, 0.015, 0.5);
+    void BMCReverbInitWithCapacity(struct BMCReverb* rv, float maxSampleRate, size_t maxDelayUnits, float maxPreDelay_seconds, float maxRoomSize_seconds);
+    
+    
+    // Initialises the reverb to share an existing design instead of
+    // computing its own. This is much faster than BMCReverbInit and the
+    // reverb only allocates its delay memory and feedback state. Use
+    // this to create many reverbs with the same preset.
+    //
+    // Changing any setting that the design depends on gives the reverb a
+    // private copy of the design with the new setting. The copy is made
+    // at the end of the next call to BMCReverbProcessBuffer, so changes to
+    // the decay settings of a reverb that shares its design take effect
+    // one buffer later than usual.
+    void BMCReverbInitWithDesign(struct BMCReverb* rv, BMCReverbDesign* design);
+    
+    
+    // Returns a new design with the network rv is currently running. Queued
+    // settings are applied first, so don't call this while another thread
+    // is processing rv. The caller owns the returned reference and must
+    // release it.
+    //
+    // Example: make a preset and share it with 100 reverbs
+    //
+    //     struct BMCReverb preset;
+    //     BMCReverbInit(&preset);
+    //     BMCReverbSetRT60DecayTime(&preset, 2.3);
+    //     BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(&preset);
+    //     BMCReverbFree(&preset);
+    //     for (size_t i=0; i<100; i++)
+    //         BMCReverbInitWithDesign(&bank[i], design);
+    //     BMCReverbDesignRelease(design);
+    BMCReverbDesign* BMCReverbDesignCreateFromReverb(struct BMCReverb* rv);
+    
+    
+    // Reference counting for designs. These are safe to call from any
+    // thread. The design is freed when the last reference is released.
+    BMCReverbDesign* BMCReverbDesignRetain(BMCReverbDesign* design);
+    void BMCReverbDesignRelease(BMCReverbDesign* design);
+    
+    
+    // Copies the settings that are not part of the design (wet and dry
+    // gain, stereo mix, slow decay, the output filters, the kernel, the
+    // chunk length, the modulation and the input diffusion) from source to
+    // destination. Use this after
+    // BMCReverbInitWithDesign to make an exact copy of the reverb the
+    // design came from.
+    void BMCReverbCopyMixSettings(struct BMCReverb* destination, const struct BMCReverb* source);
+    
+    // Copies all the settings of source to destination, queued like the
+    // setters. The state of the reverbs is not changed.
+    void BMCReverbCopySettings(struct BMCReverb* destination, const struct BMCReverb* source);
+    
     // main audio processing function
     void BMCReverbProcessBuffer(struct BMCReverb* rv, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples);
     
+    // Processes a send bus: the reverb input is the sum of numSources
+    // stereo sources, each scaled by its send gain, and the output is the
+    // wet signal only, at unity gain. wetGain and dryGain are ignored. Pass
+    // the same buffer as inputsL[i] and inputsR[i] for a mono source. The
+    // send gains are constant over the buffer. The output must not
+    // overlap the inputs.
+    void BMCReverbProcessSends(struct BMCReverb* rv, const float* const* inputsL, const float* const* inputsR, const float* sendGains, size_t numSources, float* outputL, float* outputR, size_t numSamples);
+    
+    
+    // Silences the reverb by clearing the delays, the feedback state and
+    // the output filters. Settings are not affected. The delay memory is
+    // marked as stale rather than cleared, so this takes time in
+    // proportion to the number of delays, not their length. (A frozen
+    // reverb also clears the history of its convolver.)
+    void BMCReverbReset(struct BMCReverb* rv);
+    
+    
+    // Applies queued settings now instead of at the end of the next
+    // buffer, so that the next buffer is processed with them. This
+    // allocates memory if the settings need more than the reverb has, and
+    // renders the frozen impulse response if it isn't cached instead of
+    // waiting for the background thread.
+    void BMCReverbApplySettings(struct BMCReverb* rv);
+    
+    
+    // Copies the counters of time spent in each stage of the processing to
+    // stats (see BMCReverbInstrumentation.h). Safe to call from any thread
+    // while rv is processing. Returns false, with stats cleared, unless
+    // the code was compiled with BMCREVERB_INSTRUMENTATION.
+    bool BMCReverbGetStats(const struct BMCReverb* rv, BMCReverbStats* stats);
+    
+    
+    // Reads the number of input samples that were NaN, infinite or beyond
+    // BMCREVERB_INPUTLIMIT, and the number of times the network or the
+    // output filters had to be cleared because their state wasn't finite.
+    // The reverb replaces such samples with silence instead of letting
+    // them into the feedback, where a single NaN would silence it for
+    // good, and clears only the state that went bad. Safe to call from
+    // any thread while rv is processing.
+    void BMCReverbGetFaultCounts(const struct BMCReverb* rv, uint64_t* sanitisedSamples, uint64_t* faultsRecovered);
+    
+    
+    // Attaches a trace that records the buffers, settings updates and
+    // changes of state of rv (see BMCReverbTrace.h), or detaches it if
+    // trace is NULL. Call this while rv is not processing. The caller
+    // keeps ownership of the trace.
+    void BMCReverbSetTrace(struct BMCReverb* rv, struct BMCReverbTrace* trace);
+    
+    
+    // Returns the total energy (sum of squares) of the signal stored in the
+    // network. This is zero after BMCReverbReset and falls by 60 dB every
+    // RT60 seconds once the input stops. Its cost is proportional to the
+    // total length of the delays, so don't call it every sample.
+    //
+    // A frozen reverb adds the energy held in the convolver, which stays
+    // roughly level after the input stops and drops to zero when the
+    // input has passed through the whole impulse response.
+    float BMCReverbStoredEnergy(const struct BMCReverb* rv);
+    
+    
+    // Renders the response of the current settings to an impulse on both
+    // inputs into left and right. Rendering stops when the stored energy
+    // has fallen threshold_dB below its peak, or after maxLength frames.
+    // The length is checked every BMCREVERB_IRBLOCKLENGTH frames, so the
+    // response can run up to that many frames past the threshold.
+    //
+    // Queued settings are applied first. The reverb is reset before and
+    // after, so don't call this while it is processing audio.
+    //
+    // Returns the length of the response. Frames after it are not written.
+    size_t BMCReverbRenderImpulseResponse(struct BMCReverb* rv, float* left, float* right, size_t maxLength, float threshold_dB);
+    
+    
+    // A snapshot holds the complete processing state of a reverb: its
+    // settings, the contents of the delays, the feedback and filter state,
+    // and the history of the convolver if it is frozen. Restoring a
+    // snapshot continues the output exactly where it was taken, for
+    // example to bring back a long tail after a restart. Snapshots can
+    // only be read by the same version of this code on the same
+    // architecture.
+    //
+    // BMCReverbSnapshotSize returns the number of bytes a snapshot needs.
+    // BMCReverbSaveSnapshot writes one into buffer and returns its size, or
+    // 0 if bufferSize is too small. Both apply queued settings first, so
+    // don't call them while another thread is processing rv.
+    size_t BMCReverbSnapshotSize(struct BMCReverb* rv);
+    size_t BMCReverbSaveSnapshot(struct BMCReverb* rv, void* buffer, size_t bufferSize);
+    
+    
+    // Replaces the settings and state of an initialised reverb with those
+    // in a snapshot. This allocates if the network doesn't fit in the
+    // reverb's memory, and renders the impulse response if the snapshot
+    // is frozen and the response isn't cached. Returns false if the
+    // snapshot is not valid or came from a different version. If the
+    // settings were already applied when that was found, the reverb is
+    // left silent with the snapshot's settings.
+    bool BMCReverbRestoreSnapshot(struct BMCReverb* rv, const void* snapshot, size_t size);
+    
+    
+    // Initialises destination as an exact copy of source. They share the
+    // design and the frozen impulse response, so this costs about one
+    // copy of the delay memory. Both produce the same output for the same
+    // input until their settings change, so forks of a warmed up reverb
+    // can render variants of the same tail, for example on several
+    // threads. Queued settings of source are applied first.
+    //
+    // Returns false if the convolver of a frozen reverb couldn't be
+    // copied. The destination then runs the network without the tail
+    // already in the convolver.
+    bool BMCReverbFork(struct BMCReverb* destination, struct BMCReverb* source);
+    
     
     /*
      * settings that can be safely changed during reverb operation
+     *
+     * Changes to the decay settings (RT60, HF decay multiplier and HF decay
+     * FC) are collected and applied together at the start of the next call
+     * to BMCReverbProcessBuffer, so it is cheap to automate all of them in
+     * the same buffer.
      */
     
     // wetGain in [0.0,1.0]. As wet gain increases, dry gain decreases automatically to keep a constant output volume.
@@ -89,6 +437,18 @@ extern "C" {
     void BMCReverbSetHFDecayFC(struct BMCReverb* rv, float fc);
     
     
+    // sets the cutoff frequency of a second order butterworth highpass
+    // filter on the wet signal.  (that's 12db cutoff slope).  This does
+    // not affect the dry signal at all.
+    void BMCReverbSetHighPassFC(struct BMCReverb* rv, float fc);
+    
+    
+    // sets the cutoff frequency of a second order butterworth lowpass
+    // filter on the wet signal.  (that's 12db cutoff slope).  This does
+    // not affect the dry signal at all.
+    void BMCReverbSetLowPassFC(struct BMCReverb* rv, float fc);
+    
+    
     // RT60 measures the time it takes for the reverb to decay to -60db
     // relative to its original level. Examples:
     // 0.2 = speaker cabinet simulator
@@ -100,6 +460,45 @@ extern "C" {
     void BMCReverbSetRT60DecayTime(struct BMCReverb* rv, float rt60);
     
     
+    // sets the RT60 decay time used while the sustain pedal is down
+    void BMCReverbSetSlowRT60DecayTime(struct BMCReverb* rv, float slowRT60);
+    
+    
+    // Selects the implementation of the network. The output is the same
+    // with every kernel.
+    void BMCReverbSetKernel(struct BMCReverb* rv, BMCReverbKernel kernel);
+    
+    
+    // Sets the length of the chunks that buffers are processed in, at most
+    // BMCREVERB_MAXCHUNKLENGTH. The output doesn't depend on it, except
+    // that auto-sustain checks the input volume once per chunk.
+    void BMCReverbSetChunkLength(struct BMCReverb* rv, size_t chunkLength);
+    
+    
+    // Modulates the length of each delay with a slow LFO, shortening it
+    // by between one sample and depth_seconds plus one sample. Each delay
+    // has its own phase and a rate within BMCREVERB_MODULATIONSPREAD of
+    // rate_hz, both set by the seed. This smears the resonances of the
+    // network, so a small modulated network sounds about as smooth as a
+    // much larger static one, for a small extra cost per delay. Depths of
+    // about 0.0003 seconds at rates around 0.5 Hz are not heard as pitch
+    // changes. The depth is limited by the shortest delay. depth_seconds
+    // = 0 turns modulation off (the default). Frozen reverbs convolve
+    // with a fixed response, so they are never modulated, and
+    // BMCREVERB_FROZENIR_AUTO doesn't freeze a modulated reverb.
+    void BMCReverbSetModulation(struct BMCReverb* rv, float depth_seconds, float rate_hz);
+    
+    
+    // selects how modulated delays are read between samples
+    void BMCReverbSetInterpolation(struct BMCReverb* rv, BMCReverbInterpolation interpolation);
+    
+    
+    // The feedback gain of the input allpass filters (see
+    // BMCReverbSetDiffusion), in [0.0,1.0). Higher gains smear each input
+    // sample over more echoes.
+    void BMCReverbSetDiffusionGain(struct BMCReverb* rv, float gain);
+    
+    
     // sets the sustain mode on=true or off=false.  This can be used to
     // simulate a sustain pedal effect by temporarily switching the reverb
     // to a long RT60 decay time.
@@ -112,7 +511,7 @@ extern "C" {
     // when the input volume drops below a threshold.
     void BMCReverbSetAutoSustain(struct BMCReverb* rv, bool autoSustain);
     
-
+    
     
     
     
@@ -120,6 +519,10 @@ extern "C" {
      * Settings for which changes will queue until the end of the next buffer.
      * Call these functions any time, but changes won't take effect until 
      * it's safe to apply them.
+     *
+     * Applying these may allocate memory unless the new settings fit within
+     * the limits given to BMCReverbInitWithCapacity. The delay memory is
+     * cleared only when the lengths of the delays change.
      */
     
     // A delay unit is a set of four delay lines.  We are using a sparse
@@ -133,6 +536,95 @@ extern "C" {
     void BMCReverbSetNumDelayUnits(struct BMCReverb* rv, size_t delayUnits);
     
     
+    // Sets the number of delays directly, for networks that are not built
+    // from whole delay units. numDelays must be even, since half of the
+    // delays go to each stereo channel, and it must be supported by the
+    // current mixing matrix (see BMCReverbMixingMatrixSupports).
+    void BMCReverbSetNumDelays(struct BMCReverb* rv, size_t numDelays);
+    
+    
+    // Selects the matrix that mixes the delay outputs back into the delay
+    // inputs. Denser mixing builds up echo density faster but costs more
+    // CPU per sample:
+    //
+    // BMCREVERB_MATRIX_PERMUTATION    O(n), no mixing at all
+    // BMCREVERB_MATRIX_HOUSEHOLDER    O(n)
+    // BMCREVERB_MATRIX_BLOCKCIRCULANT O(n), 2 butterfly stages (default)
+    // BMCREVERB_MATRIX_HADAMARD       O(n log n), fully dense
+    //
+    // The matrix must support the number of delays that will be in use
+    // when the change takes effect.
+    void BMCReverbSetMixingMatrix(struct BMCReverb* rv, BMCReverbMixingMatrix matrix);
+    
+    
+    // returns true if the given mixing matrix can be used with numDelays
+    bool BMCReverbMixingMatrixSupports(BMCReverbMixingMatrix matrix, size_t numDelays);
+    
+    
+    // Seeds the random jitter of the delay times and the random order of
+    // the output signs. Every instance has its own random number
+    // generator, so reverbs initialised with the same seed produce the same
+    // network, even when they are created concurrently on different
+    // threads. Give each instance in a bank a different seed to
+    // decorrelate them.
+    void BMCReverbSetSeed(struct BMCReverb* rv, uint32_t seed);
+    
+    
+    // The random number generator behind the seed, for code that needs
+    // noise without sharing the global state of rand(). RandomInit
+    // returns the starting state for a seed and a stream; RandomNext
+    // advances the state and returns the next number.
+    uint32_t BMCReverbRandomInit(uint32_t seed, uint32_t stream);
+    uint32_t BMCReverbRandomNext(uint32_t* state);
+    
+    
+    // Puts numStages allpass filters in series on each input before the
+    // network, at most BMCREVERB_MAXDIFFUSIONSTAGES. Every input sample
+    // reaches the delays as a burst of echoes instead of a single click,
+    // so the echo density builds up faster than the network alone can
+    // manage, and a small network with a few stages sounds about as dense
+    // as a much larger one, for less CPU. delayTimes_seconds holds the
+    // delay of each stage on the left input, at most
+    // BMCREVERB_MAXDIFFUSIONTIME. The right input uses slightly longer
+    // delays so that the two don't diffuse the same way. Pass NULL for the
+    // default times, between 1.5 and 13 ms.
+    // numStages = 0 turns diffusion off (the default).
+    //
+    // Diffusion is in front of the frozen impulse response too, so it
+    // doesn't have to be rendered again when these settings change.
+    void BMCReverbSetDiffusion(struct BMCReverb* rv, size_t numStages, const float* delayTimes_seconds);
+    
+    
+    // Runs the wet path at sampleRate / decimation, with polyphase
+    // filters to decimate the input and interpolate the output. The wet
+    // signal is lowpassed at a few kHz and its high frequencies decay
+    // fast anyway, so at 96 kHz and above most of the work of a full rate
+    // network goes into frequencies nobody hears. decimation is at most
+    // BMCREVERB_MAXDECIMATION. 1 runs the network at the full rate (the
+    // default) and BMCREVERB_DECIMATION_AUTO picks the largest factor
+    // that keeps the network at BMCREVERB_MINNETWORKSAMPLERATE or above,
+    // for example 2 at 96 kHz and 4 at 192 kHz, so the cost of the wet
+    // path hardly depends on the sample rate.
+    //
+    // The filters pass up to about a third of the network rate, 16 kHz at
+    // 48 kHz, and delay the wet signal by about BMCREVERB_RESAMPLERTAPS
+    // network frames, which is taken off the shortest delays so that the
+    // pre-delay stays the same.
+    // Changes take effect at the end of the buffer and reset the reverb.
+    void BMCReverbSetDecimation(struct BMCReverb* rv, size_t decimation);
+    
+    
+    // Switches the reverb to the network described by design, for example
+    // to apply a preset. This replaces the seed, pre-delay, room size,
+    // sample rate, number of delays, mixing matrix and decay settings with
+    // those of the design. The reverb retains the design, so the caller may
+    // release it right away.
+    //
+    // The switch is a pointer swap. If the new design has the same delay
+    // lengths as the old one, the reverb tail keeps ringing.
+    void BMCReverbSetDesign(struct BMCReverb* rv, BMCReverbDesign* design);
+    
+    
     // The shortest delay time in the network is the predelay.  Between the
     // moment a signal enters the reverb and when the predelay time is
     // no wet reverb output is generated. Long pre-delay gives the feeling
@@ -157,6 +649,38 @@ extern "C" {
     // over time as it echoes.
     void BMCReverbSetRoomSize(struct BMCReverb* rv, float roomSize_seconds);
     
+    // In frozen impulse response mode, the reverb renders the impulse
+    // response of its network once and convolves the input with it
+    // instead of running the network. For short decay times and large
+    // networks convolution is cheaper. The output matches the network to
+    // within float rounding, apart from the tail below
+    // BMCREVERB_FROZENIR_THRESHOLD_DB.
+    //
+    // BMCREVERB_FROZENIR_AUTO freezes only when convolution is estimated
+    // to cost less per frame than the network, judging by the RT60 time
+    // and the number of delays. The choice is made again whenever queued
+    // settings are applied.
+    //
+    // Rendering the impulse response costs about as much as running the
+    // network for the length of the response, twice. It happens on a
+    // background thread shared by all reverbs, started by the first one
+    // initialised. Until the response is ready the reverb keeps running
+    // the network, or convolving with the previous response if it was
+    // already frozen, and then switches at the end of a buffer. Frozen
+    // reverbs treat changes to the decay settings or the slow decay state
+    // the same way, so don't automate those while frozen. Responses are
+    // cached in the design, so reverbs that share a design render them
+    // only once. BMCReverbApplySettings renders the response on the
+    // calling thread instead, so the next buffer is frozen. Auto-sustain
+    // always runs the network.
+    void BMCReverbSetFrozenIRMode(struct BMCReverb* rv, BMCReverbFrozenIRMode mode);
+    
+    
+    // returns true if the reverb is currently convolving instead of
+    // running the network
+    bool BMCReverbIsFrozen(const struct BMCReverb* rv);
+    
+    
     // sets the sample rate of the input audio.  Reverb will work at any
     // sample rate you set, even if it's not correct, but setting this
     // correctly will ensure that delay times and filter frequencies are
@@ -164,18 +688,6 @@ extern "C" {
     void BMCReverbSetSampleRate(struct BMCReverb* rv, float sampleRate);
     
     
-    // sets the cutoff frequency of a second order butterworth highpass
-    // filter on the wet signal.  (that's 12db cutoff slope).  This does
-    // not affect the dry signal at all.
-    void BMCReverbSetHighPassFC(struct BMCReverb* rv, float fc);
-    
-    
-    // sets the cutoff frequency of a second order butterworth lowpass
-    // filter on the wet signal.  (that's 12db cutoff slope).  This does
-    // not affect the dry signal at all.
-    void BMCReverbSetLowPassFC(struct BMCReverb* rv, float fc);
-    
-    
 #ifdef __cplusplus
 }
 #endif
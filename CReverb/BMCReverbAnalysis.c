@@ -0,0 +1,323 @@
+//
+//  BMCReverbAnalysis.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbAnalysis.h"
+#include "BMFastMath.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_ANALYSIS_GAUSSIANDENSITY 0.3173105079 // erfc(1/sqrt(2))
+#define BMCREVERB_ANALYSIS_BANDQ 1.4142135624 // one octave bandwidth
+    
+    
+    // shared by the threads of BMCReverbAnalyseConfigurations
+    typedef struct BMCReverbAnalysisJob {
+        size_t numConfigurations, nextConfiguration;
+        BMCReverbConfigureFunction configure;
+        void* context;
+        BMCReverbAnalysis* results;
+        float maxLength_seconds;
+        bool success;
+    } BMCReverbAnalysisJob;
+    
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    float BMCReverbFitDecay(const float* edc_dB, size_t length, float sampleRate, float start_dB, float end_dB);
+    void BMCReverbOctaveFilter(const float* input, float* x, float* y, size_t length, float fc, float sampleRate);
+    void BMCReverbEchoDensity(const float* ir, float* temp, size_t length, float sampleRate, BMCReverbAnalysis* result);
+    void* BMCReverbAnalysisWorker(void* job);
+    
+    
+    
+    
+    
+    void BMCReverbEnergyDecayCurve(const float* left, const float* right, size_t length, float* edc_dB){
+        if (length == 0) return;
+        
+        // energy of each frame
+        vDSP_vsq(left, 1, edc_dB, 1, length);
+        vDSP_vma(right, 1, right, 1, edc_dB, 1, edc_dB, 1, length);
+        
+        // integrate backwards. The curve covers a range of 90 dB or more,
+        // so the running sum has to be double
+        double total = 0.0;
+        for (size_t i=length; i-- > 0;) {
+            total += edc_dB[i];
+            edc_dB[i] = (float)total;
+        }
+        
+        // normalise and convert to dB
+        float scale = total > 0.0 ? (float)(1.0 / total) : 0.0f;
+        float dBPerOctave = 10.0f * log10f(2.0f);
+        vDSP_vsmul(edc_dB, 1, &scale, edc_dB, 1, length);
+        BMFastLog2(edc_dB, edc_dB, length);
+        vDSP_vsmul(edc_dB, 1, &dBPerOctave, edc_dB, 1, length);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbDecayTimes(const float* edc_dB, size_t length, float sampleRate, float* t20, float* t30){
+        *t20 = BMCReverbFitDecay(edc_dB, length, sampleRate, -5.0f, -25.0f);
+        *t30 = BMCReverbFitDecay(edc_dB, length, sampleRate, -5.0f, -35.0f);
+    }
+    
+    
+    
+    
+    
+    // fits a line to the curve from where it first reaches start_dB to
+    // where it first reaches end_dB and returns the time it would take to
+    // fall by 60 dB
+    float BMCReverbFitDecay(const float* edc_dB, size_t length, float sampleRate, float start_dB, float end_dB){
+        size_t start = 0;
+        while (start < length && edc_dB[start] > start_dB) start++;
+        size_t end = start;
+        while (end < length && edc_dB[end] > end_dB) end++;
+        if (end >= length || end - start < 2) return NAN;
+        
+        // least squares slope, measuring time from the middle of the range
+        // so that the sums don't cancel
+        size_t n = end - start + 1;
+        double centre = 0.5 * (double)(n - 1);
+        double sxy = 0.0;
+        for (size_t i=0; i<n; i++)
+            sxy += ((double)i - centre) * edc_dB[start + i];
+        double sxx = (double)n * ((double)n*(double)n - 1.0) / 12.0;
+        double slope = sxy / sxx; // dB per frame
+        
+        return (float)(-60.0 / (slope * sampleRate));
+    }
+    
+    
+    
+    
+    
+    // filters input with two cascaded one octave bandpass filters centred
+    // on fc. x and y have length+2 elements. The output is in x+2.
+    void BMCReverbOctaveFilter(const float* input, float* x, float* y, size_t length, float fc, float sampleRate){
+        // constant peak gain bandpass (RBJ cookbook)
+        double w0 = 2.0 * M_PI * fc / sampleRate;
+        double alpha = sin(w0) / (2.0 * BMCREVERB_ANALYSIS_BANDQ);
+        double a0 = 1.0 + alpha;
+        float B [5] = {alpha/a0, 0.0f, -alpha/a0, -2.0*cos(w0)/a0, (1.0 - alpha)/a0};
+        
+        // the first two elements hold the filter history
+        x[0] = x[1] = y[0] = y[1] = 0.0f;
+        memcpy(x + 2, input, sizeof(float)*length);
+        vDSP_deq22(x, 1, B, y, 1, length);
+        vDSP_deq22(y, 1, B, x, 1, length);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbEchoDensity(const float* ir, float* temp, size_t length, float sampleRate, BMCReverbAnalysis* result){
+        size_t window = (size_t)(BMCREVERB_ANALYSIS_ECHOWINDOW * sampleRate);
+        size_t hop = (size_t)(BMCREVERB_ANALYSIS_ECHOHOP * sampleRate);
+        if (window == 0) window = 1;
+        
+        vDSP_vsq(ir, 1, temp, 1, length);
+        
+        result->mixingTime = NAN;
+        for (size_t k=0; k<BMCREVERB_ANALYSIS_ECHOPOINTS; k++) {
+            // windows are centred on the measurement time
+            size_t centre = k*hop;
+            size_t start = centre > window/2 ? centre - window/2 : 0;
+            size_t end = centre + window/2 < length ? centre + window/2 : length;
+            if (start >= end) {
+                result->echoDensity[k] = NAN;
+                continue;
+            }
+            size_t count = end - start;
+            
+            // count the samples whose square is above the mean square
+            float energy;
+            vDSP_sve(temp + start, 1, &energy, count);
+            float variance = energy / (float)count;
+            size_t above = 0;
+            for (size_t i=start; i<end; i++)
+                above += temp[i] > variance;
+            
+            float density = ((float)above / (float)count) / BMCREVERB_ANALYSIS_GAUSSIANDENSITY;
+            result->echoDensity[k] = density;
+            if (density >= 1.0f && isnan(result->mixingTime))
+                result->mixingTime = (float)centre / sampleRate;
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbAnalyseImpulseResponse(const float* left, const float* right, size_t length, float sampleRate, BMCReverbAnalysis* result){
+        result->length = length;
+        
+        // frame 0 holds the dry signal
+        if (length > 0) {
+            left++;
+            right++;
+            length--;
+        }
+        
+        float* edc = malloc(sizeof(float)*(length + 2));
+        float* bandL = malloc(sizeof(float)*(length + 2));
+        float* bandR = malloc(sizeof(float)*(length + 2));
+        float* temp = malloc(sizeof(float)*(length + 2));
+        bool success = edc && bandL && bandR && temp;
+        
+        if (success) {
+            // broadband decay
+            BMCReverbEnergyDecayCurve(left, right, length, edc);
+            BMCReverbDecayTimes(edc, length, sampleRate, &result->t20, &result->t30);
+            result->measuredRT60 = isnan(result->t30) ? result->t20 : result->t30;
+            
+            // decay in each band
+            for (size_t i=0; i<BMCREVERB_ANALYSIS_NUMBANDS; i++) {
+                float fc = BMCREVERB_ANALYSIS_LOWESTBAND * (float)(1 << i);
+                result->bandT20[i] = result->bandT30[i] = result->bandRT60[i] = NAN;
+                if (fc > 0.45f * sampleRate) continue;
+                
+                BMCReverbOctaveFilter(left, bandL, temp, length, fc, sampleRate);
+                BMCReverbOctaveFilter(right, bandR, temp, length, fc, sampleRate);
+                BMCReverbEnergyDecayCurve(bandL + 2, bandR + 2, length, edc);
+                BMCReverbDecayTimes(edc, length, sampleRate, &result->bandT20[i], &result->bandT30[i]);
+                result->bandRT60[i] = isnan(result->bandT30[i]) ? result->bandT20[i] : result->bandT30[i];
+            }
+            
+            // echo density of the left channel
+            BMCReverbEchoDensity(left, temp, length, sampleRate, result);
+            
+            // correlation
+            float leftEnergy, rightEnergy, product;
+            vDSP_svesq(left, 1, &leftEnergy, length);
+            vDSP_svesq(right, 1, &rightEnergy, length);
+            vDSP_dotpr(left, 1, right, 1, &product, length);
+            result->correlation = product / sqrtf(leftEnergy * rightEnergy);
+        }
+        
+        free(edc);
+        free(bandL);
+        free(bandR);
+        free(temp);
+        return success;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbAnalyseConfigurations(size_t numConfigurations, BMCReverbConfigureFunction configure, void* context, BMCReverbAnalysis* results, float maxLength_seconds, size_t numThreads){
+        assert(numThreads > 0);
+        
+        BMCReverbAnalysisJob job = {numConfigurations, 0, configure, context, results, maxLength_seconds, true};
+        
+        pthread_t* threads = malloc(sizeof(pthread_t)*numThreads);
+        if (!threads) return false;
+        size_t numStarted = 0;
+        while (numStarted < numThreads && pthread_create(&threads[numStarted], NULL, BMCReverbAnalysisWorker, &job) == 0)
+            numStarted++;
+        
+        // the threads that did start do all the work
+        for (size_t i=0; i<numStarted; i++)
+            pthread_join(threads[i], NULL);
+        
+        free(threads);
+        return numStarted > 0 && job.success;
+    }
+    
+    
+    
+    
+    
+    void* BMCReverbAnalysisWorker(void* arg){
+        BMCReverbAnalysisJob* job = arg;
+        
+        struct BMCReverb rv;
+        BMCReverbInit(&rv);
+        float *left = NULL, *right = NULL;
+        size_t capacity = 0;
+        
+        while (true) {
+            size_t i = __atomic_fetch_add(&job->nextConfiguration, 1, __ATOMIC_RELAXED);
+            if (i >= job->numConfigurations) break;
+            
+            job->configure(job->context, i, &rv);
+            
+            // the sample rate can change between configurations
+            size_t maxLength = (size_t)(job->maxLength_seconds * rv.sampleRate);
+            if (maxLength > capacity) {
+                free(left);
+                free(right);
+                left = malloc(sizeof(float)*maxLength);
+                right = malloc(sizeof(float)*maxLength);
+                capacity = left && right ? maxLength : 0;
+            }
+            BMCReverbAnalysis* result = &job->results[i];
+            if (capacity < maxLength) {
+                __atomic_store_n(&job->success, false, __ATOMIC_RELAXED);
+                break;
+            }
+            
+            size_t length = BMCReverbRenderImpulseResponse(&rv, left, right, maxLength, BMCREVERB_ANALYSIS_THRESHOLD_DB);
+            if (!BMCReverbAnalyseImpulseResponse(left, right, length, rv.sampleRate, result))
+                __atomic_store_n(&job->success, false, __ATOMIC_RELAXED);
+            
+            result->sampleRate = rv.sampleRate;
+            result->rt60 = rv.slowDecay ? rv.slowDecayRT60 : rv.rt60;
+            result->hfDecayMultiplier = rv.slowDecay ? rv.hfSlowDecayMultiplier : rv.hfDecayMultiplier;
+            result->highShelfFC = rv.highShelfFC;
+        }
+        
+        free(left);
+        free(right);
+        BMCReverbFree(&rv);
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbAnalysisWriteTable(const char* path, const BMCReverbAnalysis* results, size_t count){
+        FILE* file = fopen(path, "w");
+        if (!file) return false;
+        
+        fprintf(file, "index,sampleRate,rt60,hfDecayMultiplier,highShelfFC,length,t20,t30,measuredRT60,mixingTime,correlation");
+        for (size_t i=0; i<BMCREVERB_ANALYSIS_NUMBANDS; i++)
+            fprintf(file, ",rt60_%gHz", BMCREVERB_ANALYSIS_LOWESTBAND * (double)(1 << i));
+        fprintf(file, "\n");
+        
+        for (size_t i=0; i<count; i++) {
+            const BMCReverbAnalysis* r = &results[i];
+            fprintf(file, "%zu,%g,%g,%g,%g,%zu,%.4g,%.4g,%.4g,%.4g,%.4g", i, r->sampleRate, r->rt60, r->hfDecayMultiplier, r->highShelfFC, r->length, r->t20, r->t30, r->measuredRT60, r->mixingTime, r->correlation);
+            for (size_t j=0; j<BMCREVERB_ANALYSIS_NUMBANDS; j++)
+                fprintf(file, ",%.4g", r->bandRT60[j]);
+            fprintf(file, "\n");
+        }
+        
+        return fclose(file) == 0;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
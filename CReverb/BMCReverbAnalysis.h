@@ -0,0 +1,106 @@
+//
+//  BMCReverbAnalysis.h
+//  CReverb
+//
+//  Measures the decay of rendered impulse responses, so we can check that
+//  a preset decays the way its settings promise: the Schroeder energy
+//  decay curve, T20, T30 and RT60 in octave bands, echo density over time
+//  and the correlation between the left and right outputs.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbAnalysis_h
+#define BMCReverbAnalysis_h
+
+#include "BMCReverb.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_ANALYSIS_NUMBANDS 10 // octave bands
+#define BMCREVERB_ANALYSIS_LOWESTBAND 31.25 // centre of the lowest band (Hz)
+#define BMCREVERB_ANALYSIS_THRESHOLD_DB -90.0 // impulse responses stop here
+#define BMCREVERB_ANALYSIS_ECHOWINDOW 0.020 // seconds of signal per echo density measurement
+#define BMCREVERB_ANALYSIS_ECHOHOP 0.010 // seconds between echo density measurements
+#define BMCREVERB_ANALYSIS_ECHOPOINTS 100 // echo density measurements
+    
+    
+    typedef struct BMCReverbAnalysis {
+        // the settings the impulse response was rendered with. The decay
+        // settings are the slow ones if slow decay was on.
+        float sampleRate, rt60, hfDecayMultiplier, highShelfFC;
+        size_t length;
+        
+        // decay times in seconds, from fitting a line to the energy decay
+        // curve between -5 and -25 dB (T20) or -35 dB (T30). measuredRT60
+        // is T30, or T20 if the curve doesn't reach -35 dB. NaN if the curve
+        // doesn't reach -25 dB.
+        float t20, t30, measuredRT60;
+        
+        // the same for each octave band. Band i is centred on
+        // BMCREVERB_ANALYSIS_LOWESTBAND * 2^i Hz. Bands too close to the
+        // Nyquist frequency are NaN.
+        float bandT20 [BMCREVERB_ANALYSIS_NUMBANDS];
+        float bandT30 [BMCREVERB_ANALYSIS_NUMBANDS];
+        float bandRT60 [BMCREVERB_ANALYSIS_NUMBANDS];
+        
+        // normalised echo density (Abel and Huang) every
+        // BMCREVERB_ANALYSIS_ECHOHOP seconds: the fraction of samples in
+        // the window more than one standard deviation from zero, divided
+        // by the fraction for Gaussian noise. It rises from near 0 to 1 as
+        // the echoes fill in. mixingTime is the first time it reaches 1.
+        float echoDensity [BMCREVERB_ANALYSIS_ECHOPOINTS];
+        float mixingTime;
+        
+        // correlation between the left and right outputs
+        float correlation;
+    } BMCReverbAnalysis;
+    
+    
+    // sets the settings of the reverb for configuration number index
+    typedef void (*BMCReverbConfigureFunction)(void* context, size_t index, struct BMCReverb* rv);
+    
+    
+    
+    // Computes the Schroeder energy decay curve of a stereo impulse
+    // response in dB, so edc_dB[0] = 0. The energy of both channels is
+    // added together.
+    void BMCReverbEnergyDecayCurve(const float* left, const float* right, size_t length, float* edc_dB);
+    
+    
+    // Fits lines to an energy decay curve and returns T20 and T30 in
+    // seconds, or NaN where the curve doesn't fall far enough.
+    void BMCReverbDecayTimes(const float* edc_dB, size_t length, float sampleRate, float* t20, float* t30);
+    
+    
+    // Analyses an impulse response rendered by
+    // BMCReverbRenderImpulseResponse. Frame 0 holds the dry signal, so it
+    // is left out. Doesn't set the settings in the result. Returns false
+    // if there isn't enough memory.
+    bool BMCReverbAnalyseImpulseResponse(const float* left, const float* right, size_t length, float sampleRate, BMCReverbAnalysis* result);
+    
+    
+    // Renders and analyses numConfigurations impulse responses on
+    // numThreads threads. Each thread has one reverb. configure is called
+    // on that reverb before each impulse response, from the thread that
+    // renders it, so it must set every setting that changes between
+    // configurations. Impulse responses stop at
+    // BMCREVERB_ANALYSIS_THRESHOLD_DB or after maxLength_seconds.
+    //
+    // Returns false if the threads or memory couldn't be allocated.
+    bool BMCReverbAnalyseConfigurations(size_t numConfigurations, BMCReverbConfigureFunction configure, void* context, BMCReverbAnalysis* results, float maxLength_seconds, size_t numThreads);
+    
+    
+    // Writes a CSV table with one row per result: the settings, the
+    // broadband decay times, mixing time, correlation and RT60 per band.
+    bool BMCReverbAnalysisWriteTable(const char* path, const BMCReverbAnalysis* results, size_t count);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbAnalysis_h */
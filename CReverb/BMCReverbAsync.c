@@ -0,0 +1,259 @@
+//
+//  BMCReverbAsync.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbAsync.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+    #include <Accelerate/Accelerate.h>
+#else
+    #include "BMCrossPlatformVDSP.h"
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    void* BMCReverbAsyncWorker(void* context);
+    void BMCReverbAsyncRingWrite(float* ring, size_t mask, size_t position, const float* source, size_t numSamples);
+    void BMCReverbAsyncRingRead(const float* ring, size_t mask, size_t position, float* destination, size_t numSamples);
+    
+    
+    
+    
+    
+    bool BMCReverbAsyncInit(BMCReverbAsync* a, struct BMCReverb* rv, size_t maxBlockLength){
+        assert(maxBlockLength > 0);
+        a->rv = rv;
+        a->maxBlockLength = a->latency = maxBlockLength;
+        
+        // the rings hold BMCREVERB_ASYNC_RINGBLOCKS blocks, rounded up to a
+        // power of two
+        size_t length = 2;
+        while (length < BMCREVERB_ASYNC_RINGBLOCKS*maxBlockLength) length *= 2;
+        a->mask = length - 1;
+        
+        a->inputL = calloc(length, sizeof(float));
+        a->inputR = calloc(length, sizeof(float));
+        a->wetL = calloc(length, sizeof(float));
+        a->wetR = calloc(length, sizeof(float));
+        a->dryL = calloc(length, sizeof(float));
+        a->dryR = calloc(length, sizeof(float));
+        a->workL = malloc(sizeof(float)*maxBlockLength);
+        a->workR = malloc(sizeof(float)*maxBlockLength);
+        a->workWetL = malloc(sizeof(float)*maxBlockLength);
+        a->workWetR = malloc(sizeof(float)*maxBlockLength);
+        a->running = false;
+        a->wakeInitialised = BMSemaphoreInit(&a->wake);
+        if (!a->wakeInitialised || !a->inputL || !a->inputR || !a->wetL || !a->wetR || !a->dryL || !a->dryR || !a->workL || !a->workR || !a->workWetL || !a->workWetR) {
+            BMCReverbAsyncFree(a);
+            return false;
+        }
+        
+        // the callback starts at frame latency, so the first block of
+        // output is the silence in frames 0 to latency-1
+        a->inputWritten = a->inputRead = a->wetWritten = a->latency;
+        a->skipTo = 0;
+        a->underruns = 0;
+        
+        BMCReverbApplySettings(rv);
+        a->running = true;
+        if (pthread_create(&a->thread, NULL, BMCReverbAsyncWorker, a) != 0) {
+            a->running = false;
+            BMCReverbAsyncFree(a);
+            return false;
+        }
+        
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbAsyncProcessBuffer(BMCReverbAsync* a, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples){
+        assert(numSamples <= a->maxBlockLength);
+        size_t frame = a->inputWritten;
+        
+        // keep the dry signal until its wet signal is ready
+        BMCReverbAsyncRingWrite(a->dryL, a->mask, frame, inputL, numSamples);
+        BMCReverbAsyncRingWrite(a->dryR, a->mask, frame, inputR, numSamples);
+        
+        // send the input to the worker. If the worker is so far behind that
+        // the ring is full, we drop the input and tell the worker to skip
+        // it, so that the frames stay numbered the same on both sides.
+        size_t inputRead = __atomic_load_n(&a->inputRead, __ATOMIC_ACQUIRE);
+        if (frame + numSamples - inputRead <= a->mask + 1) {
+            BMCReverbAsyncRingWrite(a->inputL, a->mask, frame, inputL, numSamples);
+            BMCReverbAsyncRingWrite(a->inputR, a->mask, frame, inputR, numSamples);
+        } else
+            __atomic_store_n(&a->skipTo, frame + numSamples, __ATOMIC_RELEASE);
+        __atomic_store_n(&a->inputWritten, frame + numSamples, __ATOMIC_RELEASE);
+        BMSemaphoreSignal(&a->wake);
+        
+        // read the wet signal from latency frames ago, or silence if it
+        // isn't ready
+        size_t outputFrame = frame - a->latency;
+        size_t wetWritten = __atomic_load_n(&a->wetWritten, __ATOMIC_ACQUIRE);
+        size_t ready = wetWritten > outputFrame ? wetWritten - outputFrame : 0;
+        if (ready > numSamples) ready = numSamples;
+        BMCReverbAsyncRingRead(a->wetL, a->mask, outputFrame, outputL, ready);
+        BMCReverbAsyncRingRead(a->wetR, a->mask, outputFrame, outputR, ready);
+        memset(outputL+ready, 0, sizeof(float)*(numSamples - ready));
+        memset(outputR+ready, 0, sizeof(float)*(numSamples - ready));
+        if (ready < numSamples)
+            __atomic_store_n(&a->underruns, a->underruns + numSamples - ready, __ATOMIC_RELAXED);
+        
+        // mix dry and wet signals, in two parts if the dry signal wraps
+        // around the end of the ring
+        struct BMCReverb* rv = a->rv;
+        size_t i = 0;
+        while (i < numSamples) {
+            size_t index = (outputFrame + i) & a->mask;
+            size_t n = a->mask + 1 - index;
+            if (n > numSamples - i) n = numSamples - i;
+            vDSP_vsmsma(a->dryL+index, 1, &rv->dryGain, outputL+i, 1, &rv->wetGain, outputL+i, 1, n);
+            vDSP_vsmsma(a->dryR+index, 1, &rv->dryGain, outputR+i, 1, &rv->wetGain, outputR+i, 1, n);
+            i += n;
+        }
+    }
+    
+    
+    
+    
+    
+    void* BMCReverbAsyncWorker(void* context){
+        BMCReverbAsync* a = context;
+        struct BMCReverb* rv = a->rv;
+        const float one = 1.0f;
+        
+        while (__atomic_load_n(&a->running, __ATOMIC_ACQUIRE)) {
+            size_t inputWritten = __atomic_load_n(&a->inputWritten, __ATOMIC_ACQUIRE);
+            size_t skipTo = __atomic_load_n(&a->skipTo, __ATOMIC_ACQUIRE);
+            size_t frame = a->inputRead;
+            
+            // the callback dropped input while we were behind. The wet
+            // signal for those frames is silent.
+            if (skipTo > frame && skipTo <= inputWritten) {
+                size_t start = skipTo - frame > a->mask + 1 ? skipTo - (a->mask + 1) : frame;
+                for (size_t f = start; f < skipTo; f++)
+                    a->wetL[f & a->mask] = a->wetR[f & a->mask] = 0.0f;
+                frame = skipTo;
+                __atomic_store_n(&a->wetWritten, frame, __ATOMIC_RELEASE);
+                __atomic_store_n(&a->inputRead, frame, __ATOMIC_RELEASE);
+            }
+            
+            // wait for the next block. The callback may have signalled
+            // for blocks we have already taken, in which case we come
+            // straight back here.
+            if (inputWritten == frame) {
+                BMSemaphoreWait(&a->wake);
+                continue;
+            }
+            
+            // take the input, then let the callback reuse its place
+            size_t numSamples = inputWritten - frame;
+            if (numSamples > a->maxBlockLength) numSamples = a->maxBlockLength;
+            BMCReverbAsyncRingRead(a->inputL, a->mask, frame, a->workL, numSamples);
+            BMCReverbAsyncRingRead(a->inputR, a->mask, frame, a->workR, numSamples);
+            __atomic_store_n(&a->inputRead, frame + numSamples, __ATOMIC_RELEASE);
+            
+            // the wet signal only. The callback mixes in the dry signal.
+            const float* inputL = a->workL;
+            const float* inputR = a->workR;
+            BMCReverbProcessSends(rv, &inputL, &inputR, &one, 1, a->workWetL, a->workWetR, numSamples);
+            
+            BMCReverbAsyncRingWrite(a->wetL, a->mask, frame, a->workWetL, numSamples);
+            BMCReverbAsyncRingWrite(a->wetR, a->mask, frame, a->workWetR, numSamples);
+            __atomic_store_n(&a->wetWritten, frame + numSamples, __ATOMIC_RELEASE);
+        }
+        
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    // copies numSamples samples into a ring starting at frame position
+    void BMCReverbAsyncRingWrite(float* ring, size_t mask, size_t position, const float* source, size_t numSamples){
+        size_t index = position & mask;
+        size_t first = mask + 1 - index;
+        if (first > numSamples) first = numSamples;
+        memcpy(ring+index, source, sizeof(float)*first);
+        memcpy(ring, source+first, sizeof(float)*(numSamples - first));
+    }
+    
+    
+    
+    
+    
+    // copies numSamples samples out of a ring starting at frame position
+    void BMCReverbAsyncRingRead(const float* ring, size_t mask, size_t position, float* destination, size_t numSamples){
+        size_t index = position & mask;
+        size_t first = mask + 1 - index;
+        if (first > numSamples) first = numSamples;
+        memcpy(destination, ring+index, sizeof(float)*first);
+        memcpy(destination+first, ring, sizeof(float)*(numSamples - first));
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbAsyncLatency(const BMCReverbAsync* a){
+        return a->latency;
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbAsyncUnderruns(const BMCReverbAsync* a){
+        return __atomic_load_n(&a->underruns, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbAsyncFree(BMCReverbAsync* a){
+        if (a->running) {
+            __atomic_store_n(&a->running, false, __ATOMIC_RELEASE);
+            BMSemaphoreSignal(&a->wake);
+            pthread_join(a->thread, NULL);
+        }
+        if (a->wakeInitialised) {
+            BMSemaphoreFree(&a->wake);
+            a->wakeInitialised = false;
+        }
+        
+        free(a->inputL);
+        free(a->inputR);
+        free(a->wetL);
+        free(a->wetR);
+        free(a->dryL);
+        free(a->dryR);
+        free(a->workL);
+        free(a->workR);
+        free(a->workWetL);
+        free(a->workWetR);
+        a->inputL = a->inputR = a->wetL = a->wetR = a->dryL = a->dryR = NULL;
+        a->workL = a->workR = a->workWetL = a->workWetR = NULL;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,102 @@
+//
+//  BMCReverbAsync.h
+//  CReverb
+//
+//  Runs the wet path of a reverb on a worker thread, so that the audio
+//  callback only copies buffers and mixes the dry signal.
+//
+//  The callback writes its input into a single-producer single-consumer
+//  ring, signals the worker, and reads the wet output from a second ring.
+//  The worker sleeps on a semaphore until there is input, then processes
+//  whatever is waiting, through the network and the output filters,
+//  and writes the wet signal back. Frames are numbered from the start, and
+//  the output for frame f is read when the callback writes frame
+//  f + latency, so the worker has one block to catch up. The dry signal is
+//  delayed by the same amount in the callback, so the mix is the same as
+//  BMCReverbProcessBuffer, only later.
+//
+//  If the worker hasn't finished a frame when the callback needs it, the
+//  wet signal is silent for that frame and the late output is discarded
+//  when it arrives, so the wet and dry signals stay aligned.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbAsync_h
+#define BMCReverbAsync_h
+
+#include "BMCReverb.h"
+#include "BMLockFree.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_ASYNC_RINGBLOCKS 8 // blocks of input the worker may fall behind
+#define BMCREVERB_ASYNC_CACHELINE 64
+    
+    
+    typedef struct BMCReverbAsync {
+        struct BMCReverb* rv;
+        size_t maxBlockLength, latency;
+        
+        // input, wet output and delayed dry signal. Frame f is at index
+        // f & mask.
+        float *inputL, *inputR, *wetL, *wetR, *dryL, *dryR;
+        size_t mask;
+        
+        // the worker's buffers
+        float *workL, *workR, *workWetL, *workWetR;
+        
+        // written by the callback
+        char padding0 [BMCREVERB_ASYNC_CACHELINE];
+        size_t inputWritten, skipTo, underruns;
+        // written by the worker
+        char padding1 [BMCREVERB_ASYNC_CACHELINE];
+        size_t inputRead, wetWritten;
+        char padding2 [BMCREVERB_ASYNC_CACHELINE];
+        
+        // the callback signals wake after each block of input
+        BMSemaphore wake;
+        pthread_t thread;
+        bool running, wakeInitialised;
+    } BMCReverbAsync;
+    
+    
+    
+    // Starts a worker thread that processes rv. The callback may then
+    // process blocks of up to maxBlockLength frames with
+    // BMCReverbAsyncProcessBuffer. rv must be initialised, and must not be
+    // processed any other way until BMCReverbAsyncFree. Its settings can
+    // still be changed as usual. Returns false if the memory or the
+    // thread couldn't be allocated.
+    bool BMCReverbAsyncInit(BMCReverbAsync* a, struct BMCReverb* rv, size_t maxBlockLength);
+    
+    
+    // Processes numSamples frames, at most maxBlockLength, like
+    // BMCReverbProcessBuffer but delayed by BMCReverbAsyncLatency frames.
+    // Doesn't lock or allocate. Works in place. Call it from one thread at
+    // a time.
+    void BMCReverbAsyncProcessBuffer(BMCReverbAsync* a, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples);
+    
+    
+    // the delay added by processing on the worker, in frames. This is
+    // maxBlockLength.
+    size_t BMCReverbAsyncLatency(const BMCReverbAsync* a);
+    
+    
+    // the number of frames for which the wet signal wasn't ready in time
+    size_t BMCReverbAsyncUnderruns(const BMCReverbAsync* a);
+    
+    
+    // Stops the worker and frees the buffers. rv stays initialised.
+    void BMCReverbAsyncFree(BMCReverbAsync* a);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbAsync_h */
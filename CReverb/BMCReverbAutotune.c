@@ -0,0 +1,260 @@
+//
+//  BMCReverbAutotune.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbAutotune.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef __APPLE__
+    #include <sys/sysctl.h>
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    double BMCReverbAutotuneTime(void);
+    void BMCReverbAutotuneKey(struct BMCReverb* rv, size_t bufferLength, char* key, size_t length);
+    bool BMCReverbAutotuneLoad(const char* cachePath, const char* key, BMCReverbTuning* tuning);
+    void BMCReverbAutotuneSave(const char* cachePath, const char* key, const BMCReverbTuning* tuning);
+    
+    
+    
+    
+    
+    // monotonic wall clock time in seconds
+    double BMCReverbAutotuneTime(void){
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (double)t.tv_sec + 1.0e-9 * (double)t.tv_nsec;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbAutotuneCPUModel(char* name, size_t length){
+        snprintf(name, length, "unknown");
+        
+#ifdef __APPLE__
+        size_t size = length;
+        if (sysctlbyname("machdep.cpu.brand_string", name, &size, NULL, 0) != 0)
+            snprintf(name, length, "unknown");
+#else
+        // x86 has a model name. ARM has only the part number. Fields
+        // earlier in the list are preferred.
+        FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+        if (cpuinfo) {
+            const char* fields [] = {"model name", "Hardware", "CPU part"};
+            char line [BMCREVERB_AUTOTUNE_LINELENGTH];
+            size_t found = sizeof(fields)/sizeof(fields[0]);
+            while (found > 0 && fgets(line, sizeof(line), cpuinfo)) {
+                for (size_t i=0; i<found; i++) {
+                    char* colon = strchr(line, ':');
+                    if (colon && strncmp(line, fields[i], strlen(fields[i])) == 0) {
+                        colon += strspn(colon, ": ");
+                        snprintf(name, length, "%s", colon);
+                        found = i;
+                        break;
+                    }
+                }
+            }
+            fclose(cpuinfo);
+        }
+#endif
+        
+        // the name is a field in the cache file
+        for (char* c = name; *c; c++)
+            if (*c == '\t' || *c == '\n' || *c == '\r') *c = ' ';
+        size_t end = strlen(name);
+        while (end > 0 && name[end-1] == ' ') name[--end] = '\0';
+    }
+    
+    
+    
+    
+    
+    void BMCReverbAutotuneMeasure(struct BMCReverb* rv, size_t bufferLength, BMCReverbTuning* tuning){
+        BMCReverbApplySettings(rv);
+        
+        // a copy of the network to time, so that rv keeps its tail
+        struct BMCReverb copy;
+        BMCReverbInitWithDesign(&copy, rv->design);
+        BMCReverbCopyMixSettings(&copy, rv);
+        
+        // chunks longer than the buffer make no difference, so the
+        // longest chunk tried is the first one that covers the buffer
+        BMCReverbTuning candidates [3*2*BMCREVERB_MAXCHUNKLENGTH/BMCREVERB_AUTOTUNE_MINCHUNKLENGTH];
+        double fastest [3*2*BMCREVERB_MAXCHUNKLENGTH/BMCREVERB_AUTOTUNE_MINCHUNKLENGTH];
+        size_t numCandidates = 0;
+        BMCReverbKernel kernels [] = {BMCREVERB_KERNEL_VECTOR, BMCREVERB_KERNEL_SCALAR, BMCREVERB_KERNEL_BLOCKED};
+        for (size_t k=0; k<3; k++)
+            for (size_t chunkLength = BMCREVERB_AUTOTUNE_MINCHUNKLENGTH; chunkLength <= BMCREVERB_MAXCHUNKLENGTH; chunkLength *= 2) {
+                candidates[numCandidates].kernel = kernels[k];
+                candidates[numCandidates].chunkLength = chunkLength;
+                fastest[numCandidates++] = INFINITY;
+                if (chunkLength >= bufferLength) break;
+            }
+        
+        float* left = malloc(sizeof(float)*bufferLength);
+        float* right = malloc(sizeof(float)*bufferLength);
+        float* outL = malloc(sizeof(float)*bufferLength);
+        float* outR = malloc(sizeof(float)*bufferLength);
+        uint32_t randomState = BMCReverbRandomInit(0, 0);
+        for (size_t i=0; i<bufferLength; i++) {
+            left[i] = (float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX - 0.5f;
+            right[i] = (float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX - 0.5f;
+        }
+        
+        // alternate between the candidates so that they all see the same
+        // changes in clock speed and load
+        size_t numFrames = (size_t)(BMCREVERB_AUTOTUNE_SECONDS * rv->sampleRate);
+        for (size_t run=0; run<BMCREVERB_AUTOTUNE_RUNS; run++)
+            for (size_t c=0; c<numCandidates; c++) {
+                BMCReverbSetKernel(&copy, candidates[c].kernel);
+                BMCReverbSetChunkLength(&copy, candidates[c].chunkLength);
+                double begin = BMCReverbAutotuneTime();
+                for (size_t i=0; i<numFrames; i += bufferLength)
+                    BMCReverbProcessBuffer(&copy, left, right, outL, outR, bufferLength);
+                double seconds = BMCReverbAutotuneTime() - begin;
+                if (seconds < fastest[c]) fastest[c] = seconds;
+            }
+        
+        size_t best = 0;
+        for (size_t c=1; c<numCandidates; c++)
+            if (fastest[c] < fastest[best]) best = c;
+        *tuning = candidates[best];
+        
+        BMCReverbFree(&copy);
+        free(left);
+        free(right);
+        free(outL);
+        free(outR);
+    }
+    
+    
+    
+    
+    
+    // the configuration a tuning is for, as the first eight fields of a
+    // line in the cache file. Modulated reads are slower and change which
+    // kernel wins, so the key records whether the delays are modulated
+    // and how they interpolate.
+    void BMCReverbAutotuneKey(struct BMCReverb* rv, size_t bufferLength, char* key, size_t length){
+        char cpu [BMCREVERB_AUTOTUNE_LINELENGTH/2];
+        BMCReverbAutotuneCPUModel(cpu, sizeof(cpu));
+        int modulated = rv->modulationDepth_seconds > 0.0f;
+        snprintf(key, length, "%s\t%s\t%zu\t%d\t%zu\t%d\t%d\t%zu", cpu, BMCREVERB_VERSION, rv->numDelays, (int)rv->mixingMatrix, rv->decimationFactor, modulated, (int)rv->interpolation, bufferLength);
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbAutotuneLoad(const char* cachePath, const char* key, BMCReverbTuning* tuning){
+        FILE* file = fopen(cachePath, "r");
+        if (!file) return false;
+        
+        bool found = false;
+        size_t keyLength = strlen(key);
+        char line [BMCREVERB_AUTOTUNE_LINELENGTH];
+        while (!found && fgets(line, sizeof(line), file)) {
+            if (strncmp(line, key, keyLength) != 0 || line[keyLength] != '\t')
+                continue;
+            int kernel;
+            size_t chunkLength;
+            if (sscanf(line + keyLength + 1, "%d\t%zu", &kernel, &chunkLength) == 2
+                && kernel >= BMCREVERB_KERNEL_VECTOR && kernel <= BMCREVERB_KERNEL_BLOCKED
+                && chunkLength > 0 && chunkLength <= BMCREVERB_MAXCHUNKLENGTH) {
+                tuning->kernel = (BMCReverbKernel)kernel;
+                tuning->chunkLength = chunkLength;
+                found = true;
+            }
+        }
+        
+        fclose(file);
+        return found;
+    }
+    
+    
+    
+    
+    
+    // Writes the file again with the new line at the end, keeping the
+    // lines for other configurations of this version. The new file
+    // replaces the old one in a single rename, so a reader never sees it
+    // half written.
+    void BMCReverbAutotuneSave(const char* cachePath, const char* key, const BMCReverbTuning* tuning){
+        size_t pathLength = strlen(cachePath) + 5;
+        char* tempPath = malloc(pathLength);
+        if (!tempPath) return;
+        snprintf(tempPath, pathLength, "%s.tmp", cachePath);
+        
+        FILE* out = fopen(tempPath, "w");
+        if (!out) {
+            free(tempPath);
+            return;
+        }
+        
+        FILE* in = fopen(cachePath, "r");
+        if (in) {
+            const char* version = "\t" BMCREVERB_VERSION "\t";
+            size_t keyLength = strlen(key);
+            char line [BMCREVERB_AUTOTUNE_LINELENGTH];
+            while (fgets(line, sizeof(line), in)) {
+                const char* field = strchr(line, '\t');
+                bool sameVersion = field && strncmp(field, version, strlen(version)) == 0;
+                bool sameKey = strncmp(line, key, keyLength) == 0 && line[keyLength] == '\t';
+                if (sameVersion && !sameKey)
+                    fputs(line, out);
+            }
+            fclose(in);
+        }
+        
+        fprintf(out, "%s\t%d\t%zu\n", key, (int)tuning->kernel, tuning->chunkLength);
+        if (fclose(out) == 0)
+            rename(tempPath, cachePath);
+        else
+            remove(tempPath);
+        free(tempPath);
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbAutotune(struct BMCReverb* rv, size_t bufferLength, const char* cachePath){
+        BMCReverbApplySettings(rv);
+        
+        char key [BMCREVERB_AUTOTUNE_LINELENGTH];
+        BMCReverbAutotuneKey(rv, bufferLength, key, sizeof(key));
+        
+        BMCReverbTuning tuning;
+        bool cached = cachePath && BMCReverbAutotuneLoad(cachePath, key, &tuning);
+        if (!cached) {
+            BMCReverbAutotuneMeasure(rv, bufferLength, &tuning);
+            if (cachePath)
+                BMCReverbAutotuneSave(cachePath, key, &tuning);
+        }
+        
+        BMCReverbSetKernel(rv, tuning.kernel);
+        BMCReverbSetChunkLength(rv, tuning.chunkLength);
+        return cached;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+//
+//  BMCReverbAutotune.h
+//  CReverb
+//
+//  Chooses the fastest kernel and chunk length for a reverb on the machine
+//  it is running on.
+//
+//  The autotuner times every combination of kernel and chunk length on a
+//  copy of the reverb's network, with the buffer length the host uses,
+//  and sets the fastest one. The choice depends on the CPU, the number of
+//  delays, the mixing matrix and the modulation, so it is measured for
+//  the actual configuration. Every combination gives the same output, so
+//  the choice only affects the speed.
+//
+//  Measuring takes a fraction of a second, so the results can be kept in
+//  a small text file keyed by the CPU model and BMCREVERB_VERSION. Later
+//  runs on the same machine read the file instead of measuring again.
+//  Entries from other versions are dropped when the file is written.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbAutotune_h
+#define BMCReverbAutotune_h
+
+#include "BMCReverb.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_AUTOTUNE_SECONDS 0.05 // audio processed per timing run
+#define BMCREVERB_AUTOTUNE_RUNS 5 // the fastest of this many runs counts
+#define BMCREVERB_AUTOTUNE_MINCHUNKLENGTH 32
+#define BMCREVERB_AUTOTUNE_LINELENGTH 512
+    
+    
+    typedef struct BMCReverbTuning {
+        BMCReverbKernel kernel;
+        size_t chunkLength;
+    } BMCReverbTuning;
+    
+    
+    
+    // Writes a name for the CPU into name, for example "Intel(R) Core(TM)
+    // i7-8700 CPU @ 3.20GHz", or "unknown" if it can't be found.
+    void BMCReverbAutotuneCPUModel(char* name, size_t length);
+    
+    
+    // Times every kernel and chunk length on rv's network in buffers of
+    // bufferLength frames and returns the fastest in tuning. rv itself is
+    // not processed, but its queued settings are applied first, so don't
+    // call this while another thread is processing it.
+    void BMCReverbAutotuneMeasure(struct BMCReverb* rv, size_t bufferLength, BMCReverbTuning* tuning);
+    
+    
+    // Looks for a tuning for rv's configuration in the file at cachePath.
+    // If there is none, it measures one and adds it to the file. Either
+    // way, the tuning is set on rv. Pass NULL for cachePath to measure
+    // without a file. Returns true if the tuning came from the file.
+    //
+    // Call this at startup, or whenever the number of delays, the mixing
+    // matrix or the modulation changes, and not from the audio thread.
+    bool BMCReverbAutotune(struct BMCReverb* rv, size_t bufferLength, const char* cachePath);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbAutotune_h */
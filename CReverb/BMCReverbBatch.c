@@ -0,0 +1,479 @@
+//
+//  BMCReverbBatch.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbBatch.h"
+#include "BMLockFree.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    typedef struct BMCReverbBatchFileState {
+        BMCReverbBatchFile* file;
+        BMWavFile input, output;
+        bool inputOpen, outputOpen;
+    } BMCReverbBatchFileState;
+    
+    
+    // a block of frames on its way from the reader to the writer
+    typedef struct BMCReverbBatchBlock {
+        BMCReverbBatchFileState* state;
+        size_t startFrame, numFrames;
+        // first resets the reverb, last closes the output file
+        bool first, last;
+        float *left, *right;
+    } BMCReverbBatchBlock;
+    
+    
+    struct BMCReverbBatch;
+    
+    typedef struct BMCReverbBatchWorker {
+        struct BMCReverb rv;
+        BMLockFreeQueue queue;
+        // signalled by the reader after each push and when it finishes
+        BMSemaphore wake;
+        // incremented by the reader and decremented by the worker
+        size_t blocksInFlight;
+        // the file the reader is sending to this worker
+        BMCReverbBatchFileState* readerState;
+        size_t readerFrame;
+        pthread_t thread;
+        bool initialised, started, wakeInitialised;
+        struct BMCReverbBatch* batch;
+    } BMCReverbBatchWorker;
+    
+    
+    typedef struct BMCReverbBatch {
+        BMCReverbBatchFile* files;
+        size_t numFiles, nextFile;
+        const BMCReverbBatchSettings* settings;
+        double tail_seconds;
+        // files with half the sample rate below this can't be rendered
+        float highpassFC;
+        BMCReverbBatchFileState* states;
+        BMCReverbBatchBlock* blocks;
+        float* blockMemory;
+        size_t numBlocks;
+        BMCReverbBatchWorker* workers;
+        BMLockFreeQueue freeBlocks, writeQueue;
+        // The reader waits on readerWake when every worker's queue is full
+        // or there are no free blocks. Workers signal it when they take a
+        // block and the writer when it frees one. The writer waits on
+        // writerWake, which workers signal when they send it a block and
+        // BMCReverbBatchFinishFile when it finishes a file.
+        BMSemaphore readerWake, writerWake;
+        bool wakesInitialised;
+        // shared between threads. Use atomic loads and stores.
+        size_t filesFinished;
+        bool readerFinished, stop;
+    } BMCReverbBatch;
+    
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    void* BMCReverbBatchRead(void* batch);
+    void* BMCReverbBatchProcess(void* worker);
+    void* BMCReverbBatchWrite(void* batch);
+    BMCReverbBatchFileState* BMCReverbBatchOpenNext(BMCReverbBatch* b);
+    bool BMCReverbBatchReadBlock(BMCReverbBatch* b, BMCReverbBatchWorker* w);
+    void BMCReverbBatchFinishFile(BMCReverbBatch* b, BMCReverbBatchFileState* s, const char* error);
+    bool BMCReverbBatchInit(BMCReverbBatch* b, struct BMCReverb* rv, BMCReverbBatchFile* files, size_t numFiles, const BMCReverbBatchSettings* settings);
+    void BMCReverbBatchFree(BMCReverbBatch* b);
+    void BMCReverbBatchStop(BMCReverbBatch* b);
+    
+    
+    
+    
+    
+    void BMCReverbBatchSettingsInit(BMCReverbBatchSettings* settings){
+        long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+        settings->numWorkers = numCores > 0 ? (size_t)numCores : 1;
+        settings->blockLength = BMCREVERB_BATCH_BLOCKLENGTH;
+        settings->queueDepth = BMCREVERB_BATCH_QUEUEDEPTH;
+        settings->tail_seconds = -1.0;
+        settings->outputFormat = BMWAV_FLOAT32;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbRenderBatch(struct BMCReverb* rv, BMCReverbBatchFile* files, size_t numFiles, const BMCReverbBatchSettings* settings){
+        assert(settings->numWorkers > 0 && settings->blockLength > 0 && settings->queueDepth > 0);
+        
+        BMCReverbBatch b;
+        bool success = BMCReverbBatchInit(&b, rv, files, numFiles, settings);
+        
+        /*
+         * start the threads. If one of them doesn't start we tell the
+         * others to stop and wait for them
+         */
+        pthread_t reader, writer;
+        bool readerStarted = false, writerStarted = false;
+        for (size_t i=0; success && i<settings->numWorkers; i++) {
+            BMCReverbBatchWorker* w = &b.workers[i];
+            w->started = pthread_create(&w->thread, NULL, BMCReverbBatchProcess, w) == 0;
+            success = w->started;
+        }
+        if (success) success = writerStarted = pthread_create(&writer, NULL, BMCReverbBatchWrite, &b) == 0;
+        if (success) success = readerStarted = pthread_create(&reader, NULL, BMCReverbBatchRead, &b) == 0;
+        if (!success) BMCReverbBatchStop(&b);
+        
+        if (readerStarted) pthread_join(reader, NULL);
+        for (size_t i=0; b.workers && i<settings->numWorkers; i++)
+            if (b.workers[i].started) pthread_join(b.workers[i].thread, NULL);
+        if (writerStarted) pthread_join(writer, NULL);
+        
+        BMCReverbBatchFree(&b);
+        return success;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbBatchInit(BMCReverbBatch* b, struct BMCReverb* rv, BMCReverbBatchFile* files, size_t numFiles, const BMCReverbBatchSettings* settings){
+        memset(b, 0, sizeof(BMCReverbBatch));
+        b->files = files;
+        b->numFiles = numFiles;
+        b->settings = settings;
+        for (size_t i=0; i<numFiles; i++) {
+            files[i].error = NULL;
+            files[i].numOutputFrames = 0;
+            files[i].sampleRate = 0;
+        }
+        
+        if (BMSemaphoreInit(&b->readerWake)) {
+            b->wakesInitialised = BMSemaphoreInit(&b->writerWake);
+            if (!b->wakesInitialised) BMSemaphoreFree(&b->readerWake);
+        }
+        
+        // this applies any queued settings, so get it before reading rt60
+        BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(rv);
+        b->tail_seconds = settings->tail_seconds < 0.0 ? rv->rt60 : settings->tail_seconds;
+        b->highpassFC = rv->highpassFC;
+        
+        // each worker can have queueDepth blocks waiting for it and
+        // about as many waiting for the writer
+        b->numBlocks = 2 * settings->numWorkers * settings->queueDepth;
+        b->states = calloc(numFiles, sizeof(BMCReverbBatchFileState));
+        b->blocks = calloc(b->numBlocks, sizeof(BMCReverbBatchBlock));
+        b->blockMemory = malloc(sizeof(float) * 2 * settings->blockLength * b->numBlocks);
+        b->workers = calloc(settings->numWorkers, sizeof(BMCReverbBatchWorker));
+        bool success = (b->states || numFiles == 0) && b->blocks && b->blockMemory && b->workers && b->wakesInitialised;
+        success = success && BMLockFreeQueueInit(&b->freeBlocks, b->numBlocks);
+        success = success && BMLockFreeQueueInit(&b->writeQueue, b->numBlocks);
+        
+        for (size_t i=0; success && i<numFiles; i++)
+            b->states[i].file = &files[i];
+        
+        for (size_t i=0; success && i<b->numBlocks; i++) {
+            BMCReverbBatchBlock* block = &b->blocks[i];
+            block->left = b->blockMemory + 2*i*settings->blockLength;
+            block->right = block->left + settings->blockLength;
+            BMLockFreeQueuePush(&b->freeBlocks, block);
+        }
+        
+        for (size_t i=0; success && i<settings->numWorkers; i++) {
+            BMCReverbBatchWorker* w = &b->workers[i];
+            w->batch = b;
+            success = BMLockFreeQueueInit(&w->queue, settings->queueDepth);
+            success = success && (w->wakeInitialised = BMSemaphoreInit(&w->wake));
+            if (success) {
+                BMCReverbInitWithDesign(&w->rv, design);
+                BMCReverbCopyMixSettings(&w->rv, rv);
+                w->initialised = true;
+            }
+        }
+        
+        BMCReverbDesignRelease(design);
+        return success;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbBatchFree(BMCReverbBatch* b){
+        // close the files that were open when we stopped
+        for (size_t i=0; b->states && i<b->numFiles; i++) {
+            BMCReverbBatchFileState* s = &b->states[i];
+            if (s->inputOpen) BMWavFileClose(&s->input);
+            if (s->outputOpen) {
+                BMWavFileClose(&s->output);
+                s->file->error = "the batch stopped before this file was done";
+            }
+        }
+        
+        for (size_t i=0; b->workers && i<b->settings->numWorkers; i++) {
+            BMCReverbBatchWorker* w = &b->workers[i];
+            if (w->initialised) BMCReverbFree(&w->rv);
+            if (w->wakeInitialised) BMSemaphoreFree(&w->wake);
+            BMLockFreeQueueFree(&w->queue);
+        }
+        BMLockFreeQueueFree(&b->freeBlocks);
+        BMLockFreeQueueFree(&b->writeQueue);
+        if (b->wakesInitialised) {
+            BMSemaphoreFree(&b->readerWake);
+            BMSemaphoreFree(&b->writerWake);
+        }
+        free(b->states);
+        free(b->blocks);
+        free(b->blockMemory);
+        free(b->workers);
+    }
+    
+    
+    
+    
+    
+    // tells the threads that are running to stop, and wakes them so they
+    // see it
+    void BMCReverbBatchStop(BMCReverbBatch* b){
+        __atomic_store_n(&b->stop, true, __ATOMIC_RELEASE);
+        __atomic_store_n(&b->readerFinished, true, __ATOMIC_RELEASE);
+        if (!b->wakesInitialised) return;
+        for (size_t i=0; b->workers && i<b->settings->numWorkers; i++)
+            if (b->workers[i].wakeInitialised) BMSemaphoreSignal(&b->workers[i].wake);
+        BMSemaphoreSignal(&b->readerWake);
+        BMSemaphoreSignal(&b->writerWake);
+    }
+    
+    
+    
+    
+    
+    // the reader gives each worker one file at a time and sends it the
+    // next block of that file whenever the worker has room in its queue
+    void* BMCReverbBatchRead(void* batch){
+        BMCReverbBatch* b = batch;
+        
+        while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+            bool reading = false, progress = false;
+            
+            for (size_t i=0; i<b->settings->numWorkers; i++) {
+                BMCReverbBatchWorker* w = &b->workers[i];
+                if (!w->readerState) {
+                    w->readerState = BMCReverbBatchOpenNext(b);
+                    w->readerFrame = 0;
+                }
+                if (!w->readerState) continue;
+                
+                reading = true;
+                if (BMCReverbBatchReadBlock(b, w)) progress = true;
+            }
+            
+            if (!reading) break;
+            if (!progress) BMSemaphoreWait(&b->readerWake);
+        }
+        
+        // wake the workers that are waiting for blocks, so they see that
+        // there won't be any more
+        __atomic_store_n(&b->readerFinished, true, __ATOMIC_RELEASE);
+        for (size_t i=0; i<b->settings->numWorkers; i++)
+            BMSemaphoreSignal(&b->workers[i].wake);
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    // sends the next block of w's file to w. Returns false if w's queue or
+    // the pool of free blocks is full.
+    bool BMCReverbBatchReadBlock(BMCReverbBatch* b, BMCReverbBatchWorker* w){
+        if (__atomic_load_n(&w->blocksInFlight, __ATOMIC_ACQUIRE) >= b->settings->queueDepth)
+            return false;
+        void* item;
+        if (!BMLockFreeQueuePop(&b->freeBlocks, &item))
+            return false;
+        
+        BMCReverbBatchBlock* block = item;
+        BMCReverbBatchFileState* s = w->readerState;
+        size_t numOutputFrames = s->file->numOutputFrames;
+        block->state = s;
+        block->startFrame = w->readerFrame;
+        block->numFrames = numOutputFrames - block->startFrame < b->settings->blockLength ? numOutputFrames - block->startFrame : b->settings->blockLength;
+        block->first = block->startFrame == 0;
+        block->last = block->startFrame + block->numFrames == numOutputFrames;
+        
+        // read the input, padding with zeros after the end to render the tail
+        size_t inputFrames = 0;
+        if (block->startFrame < s->input.numFrames) {
+            inputFrames = s->input.numFrames - block->startFrame < block->numFrames ? s->input.numFrames - block->startFrame : block->numFrames;
+            BMWavFileReadFrames(&s->input, block->startFrame, inputFrames, block->left, block->right);
+        }
+        memset(block->left + inputFrames, 0, sizeof(float)*(block->numFrames - inputFrames));
+        memset(block->right + inputFrames, 0, sizeof(float)*(block->numFrames - inputFrames));
+        w->readerFrame += block->numFrames;
+        
+        // close the input before sending the last block, because the
+        // writer closes whatever is still open when the file is done
+        if (block->last) {
+            BMWavFileClose(&s->input);
+            s->inputOpen = false;
+            w->readerState = NULL;
+        }
+        
+        // the worker's queue holds queueDepth blocks, so this can't fail
+        __atomic_add_fetch(&w->blocksInFlight, 1, __ATOMIC_ACQ_REL);
+        BMLockFreeQueuePush(&w->queue, block);
+        BMSemaphoreSignal(&w->wake);
+        
+        return true;
+    }
+    
+    
+    
+    
+    
+    // opens the next file that can be opened, skipping the ones that
+    // fail. Returns NULL when there are no more files.
+    BMCReverbBatchFileState* BMCReverbBatchOpenNext(BMCReverbBatch* b){
+        while (b->nextFile < b->numFiles) {
+            BMCReverbBatchFileState* s = &b->states[b->nextFile++];
+            BMCReverbBatchFile* file = s->file;
+            
+            if (!BMWavFileOpenRead(&s->input, file->inputPath)) {
+                BMCReverbBatchFinishFile(b, s, s->input.error);
+                continue;
+            }
+            s->inputOpen = true;
+            if (b->highpassFC >= 0.5f*(float)s->input.sampleRate) {
+                BMCReverbBatchFinishFile(b, s, "the highpass cutoff is above half the sample rate");
+                continue;
+            }
+            
+            file->sampleRate = s->input.sampleRate;
+            file->numOutputFrames = s->input.numFrames + (size_t)(b->tail_seconds * s->input.sampleRate);
+            if (!BMWavFileCreate(&s->output, file->outputPath, file->numOutputFrames, 2, s->input.sampleRate, b->settings->outputFormat)) {
+                BMCReverbBatchFinishFile(b, s, s->output.error);
+                continue;
+            }
+            s->outputOpen = true;
+            
+            // there are no blocks to send, so the file is already done
+            if (file->numOutputFrames == 0) {
+                BMCReverbBatchFinishFile(b, s, NULL);
+                continue;
+            }
+            
+            return s;
+        }
+        
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    // closes the files and counts the file as finished. Called by the
+    // reader for files that fail to open and by the writer for files that
+    // are done.
+    void BMCReverbBatchFinishFile(BMCReverbBatch* b, BMCReverbBatchFileState* s, const char* error){
+        if (s->inputOpen) {
+            BMWavFileClose(&s->input);
+            s->inputOpen = false;
+        }
+        if (s->outputOpen) {
+            if (!BMWavFileClose(&s->output) && !error) error = s->output.error;
+            s->outputOpen = false;
+        }
+        s->file->error = error;
+        
+        // the writer may be waiting to see the last file finish
+        __atomic_add_fetch(&b->filesFinished, 1, __ATOMIC_ACQ_REL);
+        BMSemaphoreSignal(&b->writerWake);
+    }
+    
+    
+    
+    
+    
+    void* BMCReverbBatchProcess(void* worker){
+        BMCReverbBatchWorker* w = worker;
+        BMCReverbBatch* b = w->batch;
+        
+        while (true) {
+            void* item;
+            if (!BMLockFreeQueuePop(&w->queue, &item)) {
+                // the reader finishes after its last push, so if the queue
+                // is still empty once it has finished, we are done
+                if (__atomic_load_n(&b->readerFinished, __ATOMIC_ACQUIRE)) {
+                    if (!BMLockFreeQueuePop(&w->queue, &item)) break;
+                } else {
+                    BMSemaphoreWait(&w->wake);
+                    continue;
+                }
+            }
+            
+            BMCReverbBatchBlock* block = item;
+            if (block->first) {
+                // files at other sample rates give this worker a private
+                // copy of the design. The empty buffer applies it.
+                float sampleRate = block->state->file->sampleRate;
+                if (w->rv.sampleRate != sampleRate) {
+                    BMCReverbSetSampleRate(&w->rv, sampleRate);
+                    BMCReverbProcessBuffer(&w->rv, block->left, block->right, block->left, block->right, 0);
+                }
+                BMCReverbReset(&w->rv);
+            }
+            
+            BMCReverbProcessBuffer(&w->rv, block->left, block->right, block->left, block->right, block->numFrames);
+            
+            __atomic_sub_fetch(&w->blocksInFlight, 1, __ATOMIC_ACQ_REL);
+            // the write queue has room for every block, so this can't fail
+            BMLockFreeQueuePush(&b->writeQueue, block);
+            BMSemaphoreSignal(&b->writerWake);
+            BMSemaphoreSignal(&b->readerWake);
+        }
+        
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    void* BMCReverbBatchWrite(void* batch){
+        BMCReverbBatch* b = batch;
+        
+        while (__atomic_load_n(&b->filesFinished, __ATOMIC_ACQUIRE) < b->numFiles
+               && !__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+            void* item;
+            if (!BMLockFreeQueuePop(&b->writeQueue, &item)) {
+                BMSemaphoreWait(&b->writerWake);
+                continue;
+            }
+            
+            BMCReverbBatchBlock* block = item;
+            BMCReverbBatchFileState* s = block->state;
+            BMWavFileWriteFrames(&s->output, block->startFrame, block->numFrames, block->left, block->right);
+            if (block->last) BMCReverbBatchFinishFile(b, s, NULL);
+            
+            // the pool has room for every block, so this can't fail
+            BMLockFreeQueuePush(&b->freeBlocks, block);
+            BMSemaphoreSignal(&b->readerWake);
+        }
+        
+        return NULL;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,74 @@
+//
+//  BMCReverbBatch.h
+//  CReverb
+//
+//  Renders a list of WAV files with the same reverb settings on all cores.
+//
+//  One reader thread converts blocks of input into float buffers, N
+//  worker threads each run one reverb, and one writer thread converts the
+//  output and writes it. Blocks go between the threads on lock-free
+//  queues, and a thread with nothing to do waits on a semaphore until
+//  the thread that can give it work signals it. Each file is rendered by a single worker, which resets its
+//  reverb before starting the next file instead of initialising a new
+//  one, so the delay memory is allocated only once per worker.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbBatch_h
+#define BMCReverbBatch_h
+
+#include "BMCReverb.h"
+#include "BMWavFile.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_BATCH_BLOCKLENGTH 16384 // frames per block
+#define BMCREVERB_BATCH_QUEUEDEPTH 4 // blocks each worker can have waiting
+    
+    
+    typedef struct BMCReverbBatchFile {
+        const char *inputPath, *outputPath;
+        // NULL if the file was rendered, otherwise describes what went wrong
+        const char* error;
+        // the length of the output
+        size_t numOutputFrames;
+        uint32_t sampleRate;
+    } BMCReverbBatchFile;
+    
+    
+    typedef struct BMCReverbBatchSettings {
+        size_t numWorkers, blockLength, queueDepth;
+        // seconds of output after the end of each input. Negative values
+        // mean use the RT60 time.
+        double tail_seconds;
+        BMWavSampleFormat outputFormat;
+    } BMCReverbBatchSettings;
+    
+    
+    
+    // sets one worker per core and the defaults above
+    void BMCReverbBatchSettingsInit(BMCReverbBatchSettings* settings);
+    
+    
+    // Renders every file in files with the settings of rv, writing
+    // stereo output. Each file's error, numOutputFrames and sampleRate
+    // are set when it is done. Files with a sample rate different from
+    // rv are rendered at their own rate.
+    //
+    // Queued settings of rv are applied, but rv is not used for
+    // processing and its state is not changed.
+    //
+    // Returns false if the threads or memory couldn't be allocated. A file
+    // that can't be read or written doesn't stop the others.
+    bool BMCReverbRenderBatch(struct BMCReverb* rv, BMCReverbBatchFile* files, size_t numFiles, const BMCReverbBatchSettings* settings);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbBatch_h */
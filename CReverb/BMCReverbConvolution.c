@@ -0,0 +1,659 @@
+//
+//  BMCReverbConvolution.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbConvolution.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_CONVOLUTION_HEADCOST 1.0 // multiply-adds per tap per frame
+#define BMCREVERB_CONVOLUTION_FFTCOST 1.25 // multiply-adds per point per stage of a real FFT
+#define BMCREVERB_CONVOLUTION_CMACCOST 4.0 // multiply-adds per complex multiply-add
+#define BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS (2 + 8*BMCREVERB_CONVOLUTION_NUMSEGMENTS)
+    
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    void BMCReverbFrozenIRLayout(size_t length, size_t* blockLength, size_t* numPartitions);
+    size_t BMCReverbConvolutionLog2(size_t n);
+    void BMCReverbConvolverRunSegment(BMCReverbConvolver* c, size_t s);
+    void BMCReverbConvolverMultiplyAdd(const DSPSplitComplex* a, const DSPSplitComplex* b, DSPSplitComplex* accumulator, size_t length);
+    void BMCReverbConvolverPointersToNull(BMCReverbConvolver* c);
+    size_t BMCReverbConvolverStateBuffers(const BMCReverbConvolver* c, float** buffers, size_t* lengths);
+    
+    
+    
+    
+    
+    // sets the block length and number of partitions of each segment for
+    // an impulse response of the given length. Segment s starts at tap
+    // blockLength[s], which is where the segment before it ends.
+    void BMCReverbFrozenIRLayout(size_t length, size_t* blockLength, size_t* numPartitions){
+        size_t b = BMCREVERB_CONVOLUTION_HEADLENGTH;
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            blockLength[s] = b;
+            // partitions needed to reach the end of the response
+            size_t p = length > b ? (length - 1) / b : 0;
+            // only the last segment runs to the end of the response
+            if (s + 1 < BMCREVERB_CONVOLUTION_NUMSEGMENTS && p > BMCREVERB_CONVOLUTION_BLOCKRATIO - 1)
+                p = BMCREVERB_CONVOLUTION_BLOCKRATIO - 1;
+            numPartitions[s] = p;
+            b *= BMCREVERB_CONVOLUTION_BLOCKRATIO;
+        }
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbConvolutionLog2(size_t n){
+        size_t log2n = 0;
+        while (((size_t)1 << log2n) < n) log2n++;
+        return log2n;
+    }
+    
+    
+    
+    
+    
+    BMCReverbFrozenIR* BMCReverbFrozenIRCreate(const float* leftToLeft, const float* leftToRight, const float* rightToLeft, const float* rightToRight, size_t length){
+        const float* paths [BMCREVERB_CONVOLUTION_NUMPATHS] = {leftToLeft, leftToRight, rightToLeft, rightToRight};
+        
+        BMCReverbFrozenIR* ir = calloc(1, sizeof(BMCReverbFrozenIR));
+        if (!ir) return NULL;
+        ir->length = length;
+        ir->refCount = 1;
+        BMCReverbFrozenIRLayout(length, ir->blockLength, ir->numPartitions);
+        
+        // one setup for the largest transform serves all the segments
+        size_t maxBlockLength = ir->blockLength[BMCREVERB_CONVOLUTION_NUMSEGMENTS-1];
+        ir->fftSetup = vDSP_create_fftsetup(BMCReverbConvolutionLog2(2*maxBlockLength), kFFTRadix2);
+        float* temp = malloc(sizeof(float)*2*maxBlockLength);
+        if (!ir->fftSetup || !temp) {
+            free(temp);
+            BMCReverbFrozenIRRelease(ir);
+            return NULL;
+        }
+        
+        
+        /*
+         * the head is convolved in the time domain. vDSP_conv correlates,
+         * so we reverse it.
+         */
+        for (size_t i=0; i<BMCREVERB_CONVOLUTION_NUMPATHS; i++){
+            ir->head[i] = calloc(BMCREVERB_CONVOLUTION_HEADLENGTH, sizeof(float));
+            if (!ir->head[i]) {
+                free(temp);
+                BMCReverbFrozenIRRelease(ir);
+                return NULL;
+            }
+            for (size_t k=0; k<BMCREVERB_CONVOLUTION_HEADLENGTH && k<length; k++)
+                ir->head[i][BMCREVERB_CONVOLUTION_HEADLENGTH-1-k] = paths[i][k];
+        }
+        
+        
+        /*
+         * transform each block of the rest of the response, zero padded to
+         * twice its length
+         */
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            size_t b = ir->blockLength[s], p = ir->numPartitions[s];
+            if (p == 0) continue;
+            
+            ir->partitions[s].realp = malloc(sizeof(float)*BMCREVERB_CONVOLUTION_NUMPATHS*p*b);
+            ir->partitions[s].imagp = malloc(sizeof(float)*BMCREVERB_CONVOLUTION_NUMPATHS*p*b);
+            if (!ir->partitions[s].realp || !ir->partitions[s].imagp) {
+                free(temp);
+                BMCReverbFrozenIRRelease(ir);
+                return NULL;
+            }
+            
+            // a forward and inverse transform of the product of two
+            // transforms scales by 4 times the transform length, so we
+            // fold the correction into the response
+            size_t log2n = BMCReverbConvolutionLog2(2*b);
+            float scale = 1.0f / (float)(8*b);
+            for (size_t i=0; i<BMCREVERB_CONVOLUTION_NUMPATHS; i++){
+                for (size_t j=0; j<p; j++){
+                    size_t start = b + j*b;
+                    size_t n = length > start ? length - start : 0;
+                    if (n > b) n = b;
+                    memset(temp, 0, sizeof(float)*2*b);
+                    memcpy(temp, paths[i] + start, sizeof(float)*n);
+                    
+                    size_t offset = (i*p + j)*b;
+                    DSPSplitComplex partition = {ir->partitions[s].realp + offset, ir->partitions[s].imagp + offset};
+                    vDSP_ctoz((DSPComplex*)temp, 2, &partition, 1, b);
+                    vDSP_fft_zrip(ir->fftSetup, &partition, 1, log2n, kFFTDirection_Forward);
+                    vDSP_vsmul(partition.realp, 1, &scale, partition.realp, 1, b);
+                    vDSP_vsmul(partition.imagp, 1, &scale, partition.imagp, 1, b);
+                }
+            }
+        }
+        
+        free(temp);
+        return ir;
+    }
+    
+    
+    
+    
+    
+    BMCReverbFrozenIR* BMCReverbFrozenIRRetain(BMCReverbFrozenIR* ir){
+        __atomic_add_fetch(&ir->refCount, 1, __ATOMIC_RELAXED);
+        return ir;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbFrozenIRRelease(BMCReverbFrozenIR* ir){
+        if (!ir) return;
+        
+        if (__atomic_sub_fetch(&ir->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+            for (size_t i=0; i<BMCREVERB_CONVOLUTION_NUMPATHS; i++)
+                free(ir->head[i]);
+            for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+                free(ir->partitions[s].realp);
+                free(ir->partitions[s].imagp);
+            }
+            if (ir->fftSetup) vDSP_destroy_fftsetup(ir->fftSetup);
+            free(ir);
+        }
+    }
+    
+    
+    
+    
+    
+    float BMCReverbConvolutionCost(size_t length){
+        size_t blockLength [BMCREVERB_CONVOLUTION_NUMSEGMENTS], numPartitions [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        BMCReverbFrozenIRLayout(length, blockLength, numPartitions);
+        
+        // four paths through the head
+        float cost = BMCREVERB_CONVOLUTION_HEADCOST * BMCREVERB_CONVOLUTION_NUMPATHS * BMCREVERB_CONVOLUTION_HEADLENGTH;
+        
+        // each block, every segment does two forward and two inverse
+        // transforms of twice the block length, and one complex
+        // multiply-add per bin for each path and partition
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            if (numPartitions[s] == 0) continue;
+            float n = 2.0f * (float)blockLength[s];
+            float transforms = 4.0f * BMCREVERB_CONVOLUTION_FFTCOST * n * (float)BMCReverbConvolutionLog2(2*blockLength[s]);
+            float products = BMCREVERB_CONVOLUTION_CMACCOST * BMCREVERB_CONVOLUTION_NUMPATHS * (float)numPartitions[s] * (float)blockLength[s];
+            cost += (transforms + products) / (float)blockLength[s];
+        }
+        
+        return cost;
+    }
+    
+    
+    
+    
+    
+    /*
+     * Convolver
+     */
+    
+    bool BMCReverbConvolverInit(BMCReverbConvolver* c, BMCReverbFrozenIR* ir){
+        BMCReverbConvolverPointersToNull(c);
+        c->ir = BMCReverbFrozenIRRetain(ir);
+        c->position = 0;
+        
+        size_t headLength = 2*BMCREVERB_CONVOLUTION_HEADLENGTH - 1;
+        c->headL = calloc(headLength, sizeof(float));
+        c->headR = calloc(headLength, sizeof(float));
+        c->temp = malloc(sizeof(float)*BMCREVERB_CONVOLUTION_HEADLENGTH);
+        bool allocated = c->headL && c->headR && c->temp;
+        
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            BMCReverbConvolutionSegment* seg = &c->segments[s];
+            size_t b = ir->blockLength[s], p = ir->numPartitions[s];
+            seg->numPartitions = p;
+            seg->fdlIndex = 0;
+            if (p == 0) continue;
+            
+            seg->windowL = calloc(2*b, sizeof(float));
+            seg->windowR = calloc(2*b, sizeof(float));
+            seg->fdlL.realp = calloc(p*b, sizeof(float));
+            seg->fdlL.imagp = calloc(p*b, sizeof(float));
+            seg->fdlR.realp = calloc(p*b, sizeof(float));
+            seg->fdlR.imagp = calloc(p*b, sizeof(float));
+            seg->pendingL = calloc(b, sizeof(float));
+            seg->pendingR = calloc(b, sizeof(float));
+            seg->accumulator.realp = malloc(sizeof(float)*b);
+            seg->accumulator.imagp = malloc(sizeof(float)*b);
+            seg->timeTemp = malloc(sizeof(float)*2*b);
+            allocated = allocated
+                && seg->windowL && seg->windowR
+                && seg->fdlL.realp && seg->fdlL.imagp && seg->fdlR.realp && seg->fdlR.imagp
+                && seg->pendingL && seg->pendingR
+                && seg->accumulator.realp && seg->accumulator.imagp && seg->timeTemp;
+        }
+        
+        if (!allocated) {
+            BMCReverbConvolverFree(c);
+            return false;
+        }
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbConvolverSetIR(BMCReverbConvolver* c, BMCReverbFrozenIR* ir){
+        if (ir == c->ir) return true;
+        
+        // if the buffers are the right size, keep the history
+        if (memcmp(ir->numPartitions, c->ir->numPartitions, sizeof(ir->numPartitions)) == 0) {
+            BMCReverbFrozenIR* old = c->ir;
+            c->ir = BMCReverbFrozenIRRetain(ir);
+            BMCReverbFrozenIRRelease(old);
+            return true;
+        }
+        
+        BMCReverbConvolver replacement;
+        if (!BMCReverbConvolverInit(&replacement, ir))
+            return false;
+        BMCReverbConvolverFree(c);
+        *c = replacement;
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbConvolverProcess(BMCReverbConvolver* c, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples){
+        const BMCReverbFrozenIR* ir = c->ir;
+        const size_t headLength = BMCREVERB_CONVOLUTION_HEADLENGTH;
+        
+        // every block boundary of every segment is at a multiple of
+        // headLength, so we process up to the next one at a time
+        size_t done = 0;
+        while (done < numSamples) {
+            size_t headPosition = c->position % headLength;
+            size_t n = numSamples - done;
+            if (n > headLength - headPosition) n = headLength - headPosition;
+            float* outL = outputL + done;
+            float* outR = outputR + done;
+            
+            
+            /*
+             * direct convolution with the head
+             */
+            float* newL = c->headL + headLength - 1 + headPosition;
+            float* newR = c->headR + headLength - 1 + headPosition;
+            if (inputL) memcpy(newL, inputL + done, sizeof(float)*n);
+            else memset(newL, 0, sizeof(float)*n);
+            if (inputR) memcpy(newR, inputR + done, sizeof(float)*n);
+            else memset(newR, 0, sizeof(float)*n);
+            
+            vDSP_conv(c->headL + headPosition, 1, ir->head[0], 1, outL, 1, n, headLength);
+            vDSP_conv(c->headR + headPosition, 1, ir->head[2], 1, c->temp, 1, n, headLength);
+            vDSP_vadd(outL, 1, c->temp, 1, outL, 1, n);
+            vDSP_conv(c->headL + headPosition, 1, ir->head[1], 1, outR, 1, n, headLength);
+            vDSP_conv(c->headR + headPosition, 1, ir->head[3], 1, c->temp, 1, n, headLength);
+            vDSP_vadd(outR, 1, c->temp, 1, outR, 1, n);
+            
+            
+            /*
+             * add the output of the segments that was computed at the end
+             * of their previous block, and buffer the input for the next
+             */
+            for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+                BMCReverbConvolutionSegment* seg = &c->segments[s];
+                if (seg->numPartitions == 0) continue;
+                size_t b = ir->blockLength[s];
+                size_t position = c->position % b;
+                vDSP_vadd(outL, 1, seg->pendingL + position, 1, outL, 1, n);
+                vDSP_vadd(outR, 1, seg->pendingR + position, 1, outR, 1, n);
+                memcpy(seg->windowL + b + position, newL, sizeof(float)*n);
+                memcpy(seg->windowR + b + position, newR, sizeof(float)*n);
+            }
+            
+            
+            /*
+             * at the end of a block, run the segments whose blocks end here
+             */
+            c->position += n;
+            if (c->position % headLength == 0) {
+                memmove(c->headL, c->headL + headLength, sizeof(float)*(headLength-1));
+                memmove(c->headR, c->headR + headLength, sizeof(float)*(headLength-1));
+            }
+            for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++)
+                if (c->segments[s].numPartitions != 0 && c->position % ir->blockLength[s] == 0)
+                    BMCReverbConvolverRunSegment(c, s);
+            c->position %= ir->blockLength[BMCREVERB_CONVOLUTION_NUMSEGMENTS-1];
+            
+            done += n;
+        }
+    }
+    
+    
+    
+    
+    
+    // transforms the last block of input, multiplies the transformed
+    // history by the partitions and transforms the result back into the
+    // output for the next block
+    void BMCReverbConvolverRunSegment(BMCReverbConvolver* c, size_t s){
+        const BMCReverbFrozenIR* ir = c->ir;
+        BMCReverbConvolutionSegment* seg = &c->segments[s];
+        size_t b = ir->blockLength[s], p = seg->numPartitions;
+        size_t log2n = BMCReverbConvolutionLog2(2*b);
+        
+        
+        /*
+         * transform the last two blocks of input into the newest slot of
+         * the frequency domain delay line
+         */
+        seg->fdlIndex = (seg->fdlIndex + 1) % p;
+        size_t offset = seg->fdlIndex*b;
+        DSPSplitComplex newestL = {seg->fdlL.realp + offset, seg->fdlL.imagp + offset};
+        DSPSplitComplex newestR = {seg->fdlR.realp + offset, seg->fdlR.imagp + offset};
+        vDSP_ctoz((DSPComplex*)seg->windowL, 2, &newestL, 1, b);
+        vDSP_ctoz((DSPComplex*)seg->windowR, 2, &newestR, 1, b);
+        vDSP_fft_zrip(ir->fftSetup, &newestL, 1, log2n, kFFTDirection_Forward);
+        vDSP_fft_zrip(ir->fftSetup, &newestR, 1, log2n, kFFTDirection_Forward);
+        memcpy(seg->windowL, seg->windowL + b, sizeof(float)*b);
+        memcpy(seg->windowR, seg->windowR + b, sizeof(float)*b);
+        
+        
+        /*
+         * each output is the sum of both inputs convolved with their paths
+         * to it
+         */
+        for (size_t output=0; output<2; output++){
+            size_t pathFromL = output, pathFromR = 2 + output;
+            vDSP_vclr(seg->accumulator.realp, 1, b);
+            vDSP_vclr(seg->accumulator.imagp, 1, b);
+            
+            for (size_t j=0; j<p; j++){
+                size_t slot = ((seg->fdlIndex + p - j) % p)*b;
+                DSPSplitComplex inputL = {seg->fdlL.realp + slot, seg->fdlL.imagp + slot};
+                DSPSplitComplex inputR = {seg->fdlR.realp + slot, seg->fdlR.imagp + slot};
+                size_t offsetL = (pathFromL*p + j)*b, offsetR = (pathFromR*p + j)*b;
+                DSPSplitComplex partitionL = {ir->partitions[s].realp + offsetL, ir->partitions[s].imagp + offsetL};
+                DSPSplitComplex partitionR = {ir->partitions[s].realp + offsetR, ir->partitions[s].imagp + offsetR};
+                BMCReverbConvolverMultiplyAdd(&inputL, &partitionL, &seg->accumulator, b);
+                BMCReverbConvolverMultiplyAdd(&inputR, &partitionR, &seg->accumulator, b);
+            }
+            
+            // overlap-save: the second half of the circular convolution
+            // is the linear convolution of the last block
+            vDSP_fft_zrip(ir->fftSetup, &seg->accumulator, 1, log2n, kFFTDirection_Inverse);
+            vDSP_ztoc(&seg->accumulator, 1, (DSPComplex*)seg->timeTemp, 2, b);
+            memcpy(output == 0 ? seg->pendingL : seg->pendingR, seg->timeTemp + b, sizeof(float)*b);
+        }
+    }
+    
+    
+    
+    
+    
+    // accumulator += a*b for real FFTs in vDSP's packed format, where
+    // element 0 holds the real DC and Nyquist terms
+    void BMCReverbConvolverMultiplyAdd(const DSPSplitComplex* a, const DSPSplitComplex* b, DSPSplitComplex* accumulator, size_t length){
+        float dc = accumulator->realp[0] + a->realp[0]*b->realp[0];
+        float nyquist = accumulator->imagp[0] + a->imagp[0]*b->imagp[0];
+        vDSP_zvma(a, 1, b, 1, accumulator, 1, accumulator, 1, length);
+        accumulator->realp[0] = dc;
+        accumulator->imagp[0] = nyquist;
+    }
+    
+    
+    
+    
+    
+    float BMCReverbConvolverStoredEnergy(const BMCReverbConvolver* c){
+        const size_t headLength = BMCREVERB_CONVOLUTION_HEADLENGTH;
+        float total, energy;
+        vDSP_svesq(c->headL, 1, &total, 2*headLength - 1);
+        vDSP_svesq(c->headR, 1, &energy, 2*headLength - 1);
+        total += energy;
+        
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            const BMCReverbConvolutionSegment* seg = &c->segments[s];
+            if (seg->numPartitions == 0) continue;
+            size_t b = c->ir->blockLength[s], p = seg->numPartitions;
+            vDSP_svesq(seg->windowL, 1, &energy, 2*b);
+            total += energy;
+            vDSP_svesq(seg->windowR, 1, &energy, 2*b);
+            total += energy;
+            vDSP_svesq(seg->pendingL, 1, &energy, b);
+            total += energy;
+            vDSP_svesq(seg->pendingR, 1, &energy, b);
+            total += energy;
+            
+            // the transforms are scaled up by twice their length
+            float fdlEnergy = 0.0f;
+            vDSP_svesq(seg->fdlL.realp, 1, &energy, p*b);
+            fdlEnergy += energy;
+            vDSP_svesq(seg->fdlL.imagp, 1, &energy, p*b);
+            fdlEnergy += energy;
+            vDSP_svesq(seg->fdlR.realp, 1, &energy, p*b);
+            fdlEnergy += energy;
+            vDSP_svesq(seg->fdlR.imagp, 1, &energy, p*b);
+            fdlEnergy += energy;
+            total += fdlEnergy / (float)(4*b);
+        }
+        
+        return total;
+    }
+    
+    
+    
+    
+    
+    // lists the buffers that hold the history of the convolver. Returns
+    // the number of buffers.
+    size_t BMCReverbConvolverStateBuffers(const BMCReverbConvolver* c, float** buffers, size_t* lengths){
+        size_t count = 0;
+        buffers[count] = c->headL;
+        lengths[count++] = 2*BMCREVERB_CONVOLUTION_HEADLENGTH - 1;
+        buffers[count] = c->headR;
+        lengths[count++] = 2*BMCREVERB_CONVOLUTION_HEADLENGTH - 1;
+        
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            const BMCReverbConvolutionSegment* seg = &c->segments[s];
+            if (seg->numPartitions == 0) continue;
+            size_t b = c->ir->blockLength[s], p = seg->numPartitions;
+            float* segmentBuffers [8] = {seg->windowL, seg->windowR, seg->fdlL.realp, seg->fdlL.imagp, seg->fdlR.realp, seg->fdlR.imagp, seg->pendingL, seg->pendingR};
+            size_t segmentLengths [8] = {2*b, 2*b, p*b, p*b, p*b, p*b, b, b};
+            for (size_t i=0; i<8; i++){
+                buffers[count] = segmentBuffers[i];
+                lengths[count++] = segmentLengths[i];
+            }
+        }
+        
+        return count;
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbConvolverStateSize(const BMCReverbConvolver* c){
+        float* buffers [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t lengths [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t count = BMCReverbConvolverStateBuffers(c, buffers, lengths);
+        
+        // the position, then the layout and position of each segment
+        size_t size = sizeof(size_t)*(1 + 2*BMCREVERB_CONVOLUTION_NUMSEGMENTS);
+        for (size_t i=0; i<count; i++)
+            size += sizeof(float)*lengths[i];
+        return size;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbConvolverSaveState(const BMCReverbConvolver* c, void* state){
+        char* p = state;
+        memcpy(p, &c->position, sizeof(size_t));
+        p += sizeof(size_t);
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            memcpy(p, &c->segments[s].numPartitions, sizeof(size_t));
+            memcpy(p + sizeof(size_t), &c->segments[s].fdlIndex, sizeof(size_t));
+            p += 2*sizeof(size_t);
+        }
+        
+        float* buffers [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t lengths [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t count = BMCReverbConvolverStateBuffers(c, buffers, lengths);
+        for (size_t i=0; i<count; i++){
+            memcpy(p, buffers[i], sizeof(float)*lengths[i]);
+            p += sizeof(float)*lengths[i];
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbConvolverRestoreState(BMCReverbConvolver* c, const void* state, size_t size){
+        if (size != BMCReverbConvolverStateSize(c)) return false;
+        
+        // check the layout before changing anything
+        const char* p = state;
+        size_t position, numPartitions, fdlIndex [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        memcpy(&position, p, sizeof(size_t));
+        p += sizeof(size_t);
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            memcpy(&numPartitions, p, sizeof(size_t));
+            memcpy(&fdlIndex[s], p + sizeof(size_t), sizeof(size_t));
+            p += 2*sizeof(size_t);
+            if (numPartitions != c->segments[s].numPartitions || (numPartitions && fdlIndex[s] >= numPartitions))
+                return false;
+        }
+        if (position >= c->ir->blockLength[BMCREVERB_CONVOLUTION_NUMSEGMENTS-1])
+            return false;
+        
+        c->position = position;
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++)
+            c->segments[s].fdlIndex = fdlIndex[s];
+        
+        float* buffers [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t lengths [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t count = BMCReverbConvolverStateBuffers(c, buffers, lengths);
+        for (size_t i=0; i<count; i++){
+            memcpy(buffers[i], p, sizeof(float)*lengths[i]);
+            p += sizeof(float)*lengths[i];
+        }
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbConvolverCopyState(BMCReverbConvolver* destination, const BMCReverbConvolver* source){
+        if (memcmp(destination->ir->numPartitions, source->ir->numPartitions, sizeof(source->ir->numPartitions)) != 0)
+            return false;
+        
+        float* sourceBuffers [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        float* destinationBuffers [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        size_t lengths [BMCREVERB_CONVOLUTION_MAXSTATEBUFFERS];
+        BMCReverbConvolverStateBuffers(destination, destinationBuffers, lengths);
+        size_t count = BMCReverbConvolverStateBuffers(source, sourceBuffers, lengths);
+        for (size_t i=0; i<count; i++)
+            memcpy(destinationBuffers[i], sourceBuffers[i], sizeof(float)*lengths[i]);
+        
+        destination->position = source->position;
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++)
+            destination->segments[s].fdlIndex = source->segments[s].fdlIndex;
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbConvolverReset(BMCReverbConvolver* c){
+        const size_t headLength = BMCREVERB_CONVOLUTION_HEADLENGTH;
+        memset(c->headL, 0, sizeof(float)*(2*headLength - 1));
+        memset(c->headR, 0, sizeof(float)*(2*headLength - 1));
+        
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            BMCReverbConvolutionSegment* seg = &c->segments[s];
+            if (seg->numPartitions == 0) continue;
+            size_t b = c->ir->blockLength[s], p = seg->numPartitions;
+            memset(seg->windowL, 0, sizeof(float)*2*b);
+            memset(seg->windowR, 0, sizeof(float)*2*b);
+            memset(seg->fdlL.realp, 0, sizeof(float)*p*b);
+            memset(seg->fdlL.imagp, 0, sizeof(float)*p*b);
+            memset(seg->fdlR.realp, 0, sizeof(float)*p*b);
+            memset(seg->fdlR.imagp, 0, sizeof(float)*p*b);
+            memset(seg->pendingL, 0, sizeof(float)*b);
+            memset(seg->pendingR, 0, sizeof(float)*b);
+            seg->fdlIndex = 0;
+        }
+        
+        c->position = 0;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbConvolverPointersToNull(BMCReverbConvolver* c){
+        c->ir = NULL;
+        c->headL = c->headR = c->temp = NULL;
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            BMCReverbConvolutionSegment* seg = &c->segments[s];
+            seg->windowL = seg->windowR = NULL;
+            seg->fdlL.realp = seg->fdlL.imagp = NULL;
+            seg->fdlR.realp = seg->fdlR.imagp = NULL;
+            seg->pendingL = seg->pendingR = NULL;
+            seg->accumulator.realp = seg->accumulator.imagp = NULL;
+            seg->timeTemp = NULL;
+            seg->numPartitions = 0;
+        }
+    }
+    
+    
+    
+    
+    
+    void BMCReverbConvolverFree(BMCReverbConvolver* c){
+        free(c->headL);
+        free(c->headR);
+        free(c->temp);
+        for (size_t s=0; s<BMCREVERB_CONVOLUTION_NUMSEGMENTS; s++){
+            BMCReverbConvolutionSegment* seg = &c->segments[s];
+            free(seg->windowL);
+            free(seg->windowR);
+            free(seg->fdlL.realp);
+            free(seg->fdlL.imagp);
+            free(seg->fdlR.realp);
+            free(seg->fdlR.imagp);
+            free(seg->pendingL);
+            free(seg->pendingR);
+            free(seg->accumulator.realp);
+            free(seg->accumulator.imagp);
+            free(seg->timeTemp);
+        }
+        BMCReverbFrozenIRRelease(c->ir);
+        
+        BMCReverbConvolverPointersToNull(c);
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
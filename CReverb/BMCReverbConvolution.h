@@ -0,0 +1,155 @@
+//
+//  BMCReverbConvolution.h
+//  CReverb
+//
+//  Zero latency stereo convolution with a fixed impulse response, used by
+//  the frozen impulse response mode of BMCReverb.
+//
+//  The impulse response is split into segments of increasing block length
+//  (non-uniform partitioning). The first BMCREVERB_CONVOLUTION_HEADLENGTH
+//  taps are convolved directly in the time domain, so there is no latency.
+//  Each following segment is a uniformly partitioned overlap-save
+//  convolution whose block length is BMCREVERB_CONVOLUTION_BLOCKRATIO times
+//  that of the segment before it, and which starts one block into the
+//  response, so its output is always ready in time. With the defaults the
+//  blocks are 64, 256 and 1024 frames long and the last segment covers
+//  everything after the first 1024 taps.
+//
+//  The response is a 2x2 matrix: left to left, left to right, right to
+//  left and right to right. The transformed partitions of the response
+//  are immutable and reference counted so that any number of convolvers
+//  can share them.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbConvolution_h
+#define BMCReverbConvolution_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __APPLE__
+    #include <Accelerate/Accelerate.h>
+#else
+    #include "BMCrossPlatformVDSP.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_CONVOLUTION_HEADLENGTH 64 // taps convolved in the time domain
+#define BMCREVERB_CONVOLUTION_BLOCKRATIO 4 // block length ratio between segments
+#define BMCREVERB_CONVOLUTION_NUMSEGMENTS 3 // segments after the head
+#define BMCREVERB_CONVOLUTION_NUMPATHS 4 // LL, LR, RL, RR
+    
+    
+    typedef struct BMCReverbFrozenIR {
+        size_t length;
+        // the head of each path, reversed for vDSP_conv
+        float* head [BMCREVERB_CONVOLUTION_NUMPATHS];
+        // the transformed partitions of each segment. Path i, partition p
+        // starts at element (i*numPartitions[s] + p)*blockLength[s].
+        DSPSplitComplex partitions [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        size_t blockLength [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        size_t numPartitions [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        FFTSetup fftSetup;
+        int32_t refCount;
+    } BMCReverbFrozenIR;
+    
+    
+    typedef struct BMCReverbConvolutionSegment {
+        // the last two blocks of input for each channel
+        float *windowL, *windowR;
+        // the transformed input blocks, newest at fdlIndex
+        DSPSplitComplex fdlL, fdlR;
+        // the output for the current block
+        float *pendingL, *pendingR;
+        DSPSplitComplex accumulator;
+        float* timeTemp;
+        size_t numPartitions, fdlIndex;
+    } BMCReverbConvolutionSegment;
+    
+    
+    typedef struct BMCReverbConvolver {
+        BMCReverbFrozenIR* ir;
+        // the previous HEADLENGTH-1 input samples followed by the current
+        // block
+        float *headL, *headR, *temp;
+        BMCReverbConvolutionSegment segments [BMCREVERB_CONVOLUTION_NUMSEGMENTS];
+        size_t position;
+    } BMCReverbConvolver;
+    
+    
+    
+    // Transforms a stereo impulse response of the given length into
+    // partitions. The four paths are the responses of each output to an
+    // impulse on each input. Returns NULL if there isn't enough memory.
+    // The caller owns the returned reference and must release it.
+    BMCReverbFrozenIR* BMCReverbFrozenIRCreate(const float* leftToLeft, const float* leftToRight, const float* rightToLeft, const float* rightToRight, size_t length);
+    
+    
+    // Reference counting for frozen impulse responses. These are safe to
+    // call from any thread.
+    BMCReverbFrozenIR* BMCReverbFrozenIRRetain(BMCReverbFrozenIR* ir);
+    void BMCReverbFrozenIRRelease(BMCReverbFrozenIR* ir);
+    
+    
+    // Returns an estimate of the processing cost per frame of convolving
+    // with an impulse response of the given length, in multiply-adds.
+    float BMCReverbConvolutionCost(size_t length);
+    
+    
+    // Initialises a convolver with silent history. The convolver retains
+    // ir. Returns false if there isn't enough memory.
+    bool BMCReverbConvolverInit(BMCReverbConvolver* c, BMCReverbFrozenIR* ir);
+    
+    
+    // Switches to a different impulse response. If it has the same number
+    // of partitions as the current one, the input history is kept and the
+    // new response applies to it right away. Otherwise the convolver is
+    // reallocated and starts silent. Returns false if there isn't enough
+    // memory, leaving the convolver unchanged.
+    bool BMCReverbConvolverSetIR(BMCReverbConvolver* c, BMCReverbFrozenIR* ir);
+    
+    
+    // Convolves numSamples frames of input. inputL and inputR may be NULL
+    // to process silence, which lets the tail ring out. The inputs must
+    // not overlap the outputs.
+    void BMCReverbConvolverProcess(BMCReverbConvolver* c, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples);
+    
+    
+    // Returns the energy (sum of squares) of the signal held in the
+    // convolver's buffers. This is zero once the last of the input has
+    // passed through the whole impulse response.
+    float BMCReverbConvolverStoredEnergy(const BMCReverbConvolver* c);
+    
+    
+    // The history of a convolver can be saved to a buffer of
+    // BMCReverbConvolverStateSize bytes and restored into a convolver with
+    // an impulse response of the same layout. Restoring returns false,
+    // without changing anything, if the layouts don't match.
+    size_t BMCReverbConvolverStateSize(const BMCReverbConvolver* c);
+    void BMCReverbConvolverSaveState(const BMCReverbConvolver* c, void* state);
+    bool BMCReverbConvolverRestoreState(BMCReverbConvolver* c, const void* state, size_t size);
+    
+    
+    // copies the history of source to destination. Returns false if their
+    // impulse responses don't have the same layout.
+    bool BMCReverbConvolverCopyState(BMCReverbConvolver* destination, const BMCReverbConvolver* source);
+    
+    
+    // clears the history
+    void BMCReverbConvolverReset(BMCReverbConvolver* c);
+    
+    
+    void BMCReverbConvolverFree(BMCReverbConvolver* c);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbConvolution_h */
@@ -0,0 +1,419 @@
+//
+//  BMCReverbGovernor.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbGovernor.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+    #include <Accelerate/Accelerate.h>
+#else
+    #include "BMCrossPlatformVDSP.h"
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    double BMCReverbGovernorTime(void);
+    double BMCReverbGovernorMeasure(size_t delayUnits, size_t bufferLength);
+    void BMCReverbGovernorPrepare(BMCReverbGovernor* g, size_t level);
+    void BMCReverbGovernorSwitch(BMCReverbGovernor* g);
+    double BMCReverbGovernorFadeSeconds(const struct BMCReverb* rv);
+    void* BMCReverbGovernorWorker(void* context);
+    float BMCReverbGovernorPredictRatio(const BMCReverbGovernor* g, size_t fromLevel, size_t toLevel, size_t bufferLength);
+    
+    enum {BMCREVERB_STANDBY_IDLE, BMCREVERB_STANDBY_PREPARING, BMCREVERB_STANDBY_READY};
+    
+    
+    
+    
+    
+    // monotonic wall clock time in seconds
+    double BMCReverbGovernorTime(void){
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (double)t.tv_sec + 1.0e-9 * (double)t.tv_nsec;
+    }
+    
+    
+    
+    
+    
+    // returns the fastest time per frame of three runs of half a second of
+    // audio
+    double BMCReverbGovernorMeasure(size_t delayUnits, size_t bufferLength){
+        size_t numFrames = (size_t)(0.5*BMCREVERB_DEFAULTSAMPLERATE);
+        float* left = malloc(sizeof(float)*bufferLength);
+        float* right = malloc(sizeof(float)*bufferLength);
+        float* outL = malloc(sizeof(float)*bufferLength);
+        float* outR = malloc(sizeof(float)*bufferLength);
+        uint32_t randomState = BMCReverbRandomInit(0, 0);
+        for (size_t i=0; i<bufferLength; i++)
+            left[i] = right[i] = (float)BMCReverbRandomNext(&randomState) / (float)UINT32_MAX - 0.5f;
+        
+        struct BMCReverb rv;
+        BMCReverbInit(&rv);
+        BMCReverbSetNumDelayUnits(&rv, delayUnits);
+        BMCReverbApplySettings(&rv);
+        
+        double fastest = INFINITY;
+        for (size_t run=0; run<3; run++) {
+            double begin = BMCReverbGovernorTime();
+            for (size_t i=0; i<numFrames; i += bufferLength)
+                BMCReverbProcessBuffer(&rv, left, right, outL, outR, bufferLength);
+            double seconds = BMCReverbGovernorTime() - begin;
+            if (seconds < fastest) fastest = seconds;
+        }
+        
+        BMCReverbFree(&rv);
+        free(left);
+        free(right);
+        free(outL);
+        free(outR);
+        return fastest / (double)numFrames;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorCalibrate(BMCReverbGovernorModel* model){
+        // the cost of a small and a large network with long buffers gives
+        // the cost per delay, and short buffers give the cost per buffer
+        double small = BMCReverbGovernorMeasure(4, 256);
+        double large = BMCReverbGovernorMeasure(16, 256);
+        double shortBuffers = BMCReverbGovernorMeasure(4, 16);
+        
+        model->perDelay = fmax(0.0, (large - small) / (double)(4*16 - 4*4));
+        model->perBuffer = fmax(0.0, (shortBuffers - small) / (1.0/16.0 - 1.0/256.0));
+        model->perFrame = fmax(0.0, small - model->perDelay*(double)(4*4) - model->perBuffer/256.0);
+    }
+    
+    
+    
+    
+    
+    float BMCReverbGovernorPredictLoad(const BMCReverbGovernorModel* model, size_t delayUnits, size_t bufferLength, float sampleRate){
+        double seconds = model->perFrame + model->perDelay*(double)(4*delayUnits) + model->perBuffer/(double)bufferLength;
+        return seconds * sampleRate;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorBudgetInit(BMCReverbGovernorBudget* b, float budget){
+        b->budget = budget;
+        b->loadPPM = 0;
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbGovernorInit(BMCReverbGovernor* g, struct BMCReverb* prototype, size_t minDelayUnits, float budget, BMCReverbGovernorBudget* sharedBudget, const BMCReverbGovernorModel* model){
+        assert(prototype->frozenIRMode == BMCREVERB_FROZENIR_OFF);
+        
+        // halve the network at each level
+        size_t maxDelayUnits = prototype->newNumDelays / 4;
+        assert(maxDelayUnits > 0);
+        g->numLevels = 0;
+        for (size_t units = maxDelayUnits; units >= minDelayUnits && units > 0 && g->numLevels < BMCREVERB_GOVERNOR_MAXLEVELS; units /= 2) {
+            assert(BMCReverbMixingMatrixSupports(prototype->newMixingMatrix, 4*units));
+            g->levelDelayUnits[g->numLevels++] = units;
+        }
+        
+        // both reverbs have room for the largest network
+        for (size_t i=0; i<2; i++) {
+            BMCReverbInitWithCapacity(&g->reverbs[i], prototype->sampleRate, maxDelayUnits, prototype->minDelay_seconds, prototype->maxDelay_seconds);
+            BMCReverbCopySettings(&g->reverbs[i], prototype);
+            BMCReverbSetNumDelayUnits(&g->reverbs[i], maxDelayUnits);
+            BMCReverbApplySettings(&g->reverbs[i]);
+        }
+        g->active = 0;
+        g->level = 0;
+        
+        if (model) g->model = *model;
+        else memset(&g->model, 0, sizeof(g->model));
+        g->budget = budget;
+        g->sharedBudget = sharedBudget;
+        g->load = 0.0;
+        g->loadPPM = 0;
+        g->holdFramesLeft = (size_t)(BMCREVERB_GOVERNOR_HOLD_SECONDS * prototype->sampleRate);
+        g->fadeFrames = g->fadeFramesLeft = 0;
+        g->standbyState = BMCREVERB_STANDBY_IDLE;
+        g->standbyLevel = 0;
+        
+        g->zeros = calloc(BMCREVERB_GOVERNOR_CHUNKLENGTH, sizeof(float));
+        g->tailL = malloc(sizeof(float)*BMCREVERB_GOVERNOR_CHUNKLENGTH);
+        g->tailR = malloc(sizeof(float)*BMCREVERB_GOVERNOR_CHUNKLENGTH);
+        g->fade = malloc(sizeof(float)*BMCREVERB_GOVERNOR_CHUNKLENGTH);
+        g->running = false;
+        g->wakeInitialised = BMSemaphoreInit(&g->wake);
+        if (!g->wakeInitialised || !g->zeros || !g->tailL || !g->tailR || !g->fade) {
+            BMCReverbGovernorFree(g);
+            return false;
+        }
+        
+        g->running = true;
+        if (pthread_create(&g->thread, NULL, BMCReverbGovernorWorker, g) != 0) {
+            g->running = false;
+            BMCReverbGovernorFree(g);
+            return false;
+        }
+        
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorProcessBuffer(BMCReverbGovernor* g, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples){
+        double begin = BMCReverbGovernorTime();
+        struct BMCReverb* rv = &g->reverbs[g->active];
+        BMCReverbProcessBuffer(rv, inputL, inputR, outputL, outputR, numSamples);
+        
+        // after a change of size, the old network finishes its tail
+        // without input, fading out
+        struct BMCReverb* old = &g->reverbs[1 - g->active];
+        for (size_t i=0; i<numSamples && g->fadeFramesLeft > 0;) {
+            size_t n = numSamples - i;
+            if (n > BMCREVERB_GOVERNOR_CHUNKLENGTH) n = BMCREVERB_GOVERNOR_CHUNKLENGTH;
+            if (n > g->fadeFramesLeft) n = g->fadeFramesLeft;
+            BMCReverbProcessBuffer(old, g->zeros, g->zeros, g->tailL, g->tailR, n);
+            
+            float start = (float)g->fadeFramesLeft / (float)g->fadeFrames;
+            float step = -1.0f / (float)g->fadeFrames;
+            vDSP_vramp(&start, &step, g->fade, 1, n);
+            vDSP_vma(g->tailL, 1, g->fade, 1, outputL+i, 1, outputL+i, 1, n);
+            vDSP_vma(g->tailR, 1, g->fade, 1, outputR+i, 1, outputR+i, 1, n);
+            
+            g->fadeFramesLeft -= n;
+            i += n;
+        }
+        if (numSamples == 0) return;
+        
+        // update the smoothed load and publish it
+        double bufferSeconds = (double)numSamples / (double)rv->sampleRate;
+        double load = (BMCReverbGovernorTime() - begin) / bufferSeconds;
+        g->load += (1.0 - exp(-bufferSeconds / BMCREVERB_GOVERNOR_SMOOTHING_SECONDS)) * (load - g->load);
+        int64_t loadPPM = (int64_t)(1.0e6 * g->load);
+        if (g->sharedBudget)
+            __atomic_add_fetch(&g->sharedBudget->loadPPM, loadPPM - g->loadPPM, __ATOMIC_RELAXED);
+        __atomic_store_n(&g->loadPPM, loadPPM, __ATOMIC_RELAXED);
+        
+        // wait for the load to settle after a change before the next one
+        bool holding = g->holdFramesLeft > numSamples;
+        g->holdFramesLeft = holding ? g->holdFramesLeft - numSamples : 0;
+        
+        // once the old tail has faded, the standby reverb is free. Have
+        // it prepared for the next level down, so that it is ready when
+        // the load goes over the budget.
+        if (g->fadeFramesLeft > 0) return;
+        int32_t standbyState = __atomic_load_n(&g->standbyState, __ATOMIC_ACQUIRE);
+        if (standbyState == BMCREVERB_STANDBY_IDLE && g->level + 1 < g->numLevels) {
+            BMCReverbGovernorPrepare(g, g->level + 1);
+            standbyState = BMCREVERB_STANDBY_PREPARING;
+        }
+        if (holding) return;
+        
+        // the budget left for this governor
+        float budget = g->budget;
+        if (g->sharedBudget) {
+            int64_t othersPPM = __atomic_load_n(&g->sharedBudget->loadPPM, __ATOMIC_RELAXED) - loadPPM;
+            budget = g->sharedBudget->budget - 1.0e-6f * (float)othersPPM;
+        }
+        
+        size_t level = g->level;
+        if (g->load > budget && g->level + 1 < g->numLevels)
+            level = g->level + 1;
+        else if (g->level > 0 && g->load * BMCReverbGovernorPredictRatio(g, g->level, g->level - 1, numSamples) < BMCREVERB_GOVERNOR_UPMARGIN * budget)
+            level = g->level - 1;
+        if (level == g->level) return;
+        
+        // switch if the standby reverb is ready for the level, or else have
+        // it prepared and try again on a later buffer
+        if (standbyState == BMCREVERB_STANDBY_READY && g->standbyLevel == level)
+            BMCReverbGovernorSwitch(g);
+        else if (standbyState != BMCREVERB_STANDBY_PREPARING)
+            BMCReverbGovernorPrepare(g, level);
+    }
+    
+    
+    
+    
+    
+    // returns the predicted ratio of the load at toLevel to the load at
+    // fromLevel
+    float BMCReverbGovernorPredictRatio(const BMCReverbGovernor* g, size_t fromLevel, size_t toLevel, size_t bufferLength){
+        size_t from = g->levelDelayUnits[fromLevel];
+        size_t to = g->levelDelayUnits[toLevel];
+        const BMCReverbGovernorModel* m = &g->model;
+        if (m->perFrame == 0.0 && m->perDelay == 0.0 && m->perBuffer == 0.0)
+            return (float)to / (float)from;
+        
+        float sampleRate = g->reverbs[g->active].sampleRate;
+        return BMCReverbGovernorPredictLoad(m, to, bufferLength, sampleRate) / BMCReverbGovernorPredictLoad(m, from, bufferLength, sampleRate);
+    }
+    
+    
+    
+    
+    
+    // Copies the settings of the active reverb to the standby one, for the
+    // network at level, and hands the standby reverb to the worker to
+    // compute its design and clear it. Called from the audio thread while
+    // the standby reverb belongs to it.
+    void BMCReverbGovernorPrepare(BMCReverbGovernor* g, size_t level){
+        struct BMCReverb* current = &g->reverbs[g->active];
+        struct BMCReverb* standby = &g->reverbs[1 - g->active];
+        BMCReverbCopySettings(standby, current);
+        BMCReverbSetNumDelayUnits(standby, g->levelDelayUnits[level]);
+        g->standbyLevel = level;
+        
+        __atomic_store_n(&g->standbyState, BMCREVERB_STANDBY_PREPARING, __ATOMIC_RELEASE);
+        BMSemaphoreSignal(&g->wake);
+    }
+    
+    
+    
+    
+    
+    // Moves the input to the standby reverb, which the worker has prepared
+    // for the network at standbyLevel. Settings changed on the active
+    // reverb since then are copied across. If they don't need a new
+    // design, the update at the end of the next buffer finds the design up
+    // to date.
+    void BMCReverbGovernorSwitch(BMCReverbGovernor* g){
+        struct BMCReverb* current = &g->reverbs[g->active];
+        struct BMCReverb* next = &g->reverbs[1 - g->active];
+        BMCReverbCopySettings(next, current);
+        BMCReverbSetNumDelayUnits(next, g->levelDelayUnits[g->standbyLevel]);
+        
+        // the old reverb plays its tail until the fade is over, then is
+        // prepared again
+        g->active = 1 - g->active;
+        __atomic_store_n(&g->standbyState, BMCREVERB_STANDBY_IDLE, __ATOMIC_RELAXED);
+        __atomic_store_n(&g->level, g->standbyLevel, __ATOMIC_RELAXED);
+        g->fadeFrames = g->fadeFramesLeft = (size_t)(BMCReverbGovernorFadeSeconds(current) * current->sampleRate);
+        g->holdFramesLeft = (size_t)(BMCREVERB_GOVERNOR_HOLD_SECONDS * current->sampleRate);
+    }
+    
+    
+    
+    
+    
+    // the time the tail of rv takes to fall by
+    // BMCREVERB_GOVERNOR_FADE_DECIBELS, at its current decay time
+    double BMCReverbGovernorFadeSeconds(const struct BMCReverb* rv){
+        double rt60 = rv->slowDecay ? rv->slowDecayRT60 : rv->rt60;
+        return fmax(BMCREVERB_GOVERNOR_MINFADE_SECONDS, rt60 * BMCREVERB_GOVERNOR_FADE_DECIBELS / 60.0);
+    }
+    
+    
+    
+    
+    
+    // computes the design of the standby reverb and clears it, off the
+    // audio thread
+    void* BMCReverbGovernorWorker(void* context){
+        BMCReverbGovernor* g = context;
+        
+        while (true) {
+            BMSemaphoreWait(&g->wake);
+            if (!__atomic_load_n(&g->running, __ATOMIC_ACQUIRE))
+                break;
+            if (__atomic_load_n(&g->standbyState, __ATOMIC_ACQUIRE) != BMCREVERB_STANDBY_PREPARING)
+                continue;
+            
+            struct BMCReverb* standby = &g->reverbs[1 - g->active];
+            BMCReverbApplySettings(standby);
+            BMCReverbReset(standby);
+            __atomic_store_n(&g->standbyState, BMCREVERB_STANDBY_READY, __ATOMIC_RELEASE);
+        }
+        
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    struct BMCReverb* BMCReverbGovernorReverb(BMCReverbGovernor* g){
+        return &g->reverbs[g->active];
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorSetBudget(BMCReverbGovernor* g, float budget){
+        g->budget = budget;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorGetStatus(const BMCReverbGovernor* g, BMCReverbGovernorStatus* status){
+        status->level = __atomic_load_n(&g->level, __ATOMIC_RELAXED);
+        status->numLevels = g->numLevels;
+        status->delayUnits = g->levelDelayUnits[status->level];
+        status->load = 1.0e-6f * (float)__atomic_load_n(&g->loadPPM, __ATOMIC_RELAXED);
+        if (g->sharedBudget) {
+            status->budget = g->sharedBudget->budget;
+            status->headroom = status->budget - 1.0e-6f * (float)__atomic_load_n(&g->sharedBudget->loadPPM, __ATOMIC_RELAXED);
+        } else {
+            status->budget = g->budget;
+            status->headroom = status->budget - status->load;
+        }
+        status->preparing = __atomic_load_n(&g->standbyState, __ATOMIC_RELAXED) == BMCREVERB_STANDBY_PREPARING;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbGovernorFree(BMCReverbGovernor* g){
+        // stop the worker, waking it if it's waiting
+        if (g->running) {
+            __atomic_store_n(&g->running, false, __ATOMIC_RELEASE);
+            BMSemaphoreSignal(&g->wake);
+            pthread_join(g->thread, NULL);
+        }
+        if (g->wakeInitialised) {
+            BMSemaphoreFree(&g->wake);
+            g->wakeInitialised = false;
+        }
+        
+        if (g->sharedBudget)
+            __atomic_sub_fetch(&g->sharedBudget->loadPPM, g->loadPPM, __ATOMIC_RELAXED);
+        g->loadPPM = 0;
+        
+        BMCReverbFree(&g->reverbs[0]);
+        BMCReverbFree(&g->reverbs[1]);
+        free(g->zeros);
+        free(g->tailL);
+        free(g->tailR);
+        free(g->fade);
+        g->zeros = g->tailL = g->tailR = g->fade = NULL;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,164 @@
+//
+//  BMCReverbGovernor.h
+//  CReverb
+//
+//  Keeps a reverb within a CPU budget by changing the size of its network.
+//
+//  The governor times each buffer and keeps a smoothed load: processing
+//  time divided by the duration of the audio. When the load goes over the
+//  budget it halves the number of delay units, and when a cost model
+//  predicts that the next larger network fits comfortably it doubles
+//  them again, up to the size of the prototype reverb.
+//
+//  The change is made by switching between two reverbs that were
+//  allocated up front for the largest network, so it never allocates.
+//  While one reverb takes the input, a background thread prepares the
+//  other for the next level, so the switch itself only moves the input
+//  across. The new network takes the input from the switch on, while the
+//  old one finishes its tail without input and fades out over the time
+//  the tail takes to fall by BMCREVERB_GOVERNOR_FADE_DECIBELS, so there is
+//  no gap or click. Both networks run until the fade is over, and the
+//  next change waits for it, so a long decay time slows the governor
+//  down.
+//
+//  Several governors can share one budget, for example all the reverbs
+//  in a host. Each one then steps down when the total load is over the
+//  budget.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbGovernor_h
+#define BMCReverbGovernor_h
+
+#include "BMCReverb.h"
+#include "BMLockFree.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_GOVERNOR_MAXLEVELS 8 // each level has half the delay units of the one before
+#define BMCREVERB_GOVERNOR_SMOOTHING_SECONDS 0.25 // time constant of the load measurement
+#define BMCREVERB_GOVERNOR_HOLD_SECONDS 1.0 // minimum time between changes
+#define BMCREVERB_GOVERNOR_FADE_DECIBELS 30.0 // the old network's tail fades out while it falls this much
+#define BMCREVERB_GOVERNOR_MINFADE_SECONDS 0.25 // shortest fade, for short decay times
+#define BMCREVERB_GOVERNOR_UPMARGIN 0.7 // step up only if the prediction is below this fraction of the budget
+#define BMCREVERB_GOVERNOR_CHUNKLENGTH 256 // frames of old tail processed at a time
+    
+    
+    // The cost of processing in seconds per frame is modelled as
+    //
+    //     perFrame + perDelay*numDelays + perBuffer/bufferLength
+    //
+    // and the load as that times the sample rate.
+    typedef struct BMCReverbGovernorModel {
+        double perFrame, perDelay, perBuffer;
+    } BMCReverbGovernorModel;
+    
+    
+    // a budget shared by several governors. The load is in millionths of
+    // one core.
+    typedef struct BMCReverbGovernorBudget {
+        float budget;
+        int64_t loadPPM;
+    } BMCReverbGovernorBudget;
+    
+    
+    typedef struct BMCReverbGovernorStatus {
+        // level 0 is the prototype's network; each level after it has
+        // half the delay units
+        size_t level, numLevels, delayUnits;
+        // the smoothed load of this governor, the budget it is held to and
+        // what is left of it, as fractions of one core. With a shared
+        // budget, the headroom is what the governors sharing it leave.
+        float load, budget, headroom;
+        // the background thread is preparing the standby network
+        bool preparing;
+    } BMCReverbGovernorStatus;
+    
+    
+    typedef struct BMCReverbGovernor {
+        struct BMCReverb reverbs [2];
+        size_t active;
+        size_t levelDelayUnits [BMCREVERB_GOVERNOR_MAXLEVELS];
+        size_t level, numLevels;
+        BMCReverbGovernorModel model;
+        float budget;
+        BMCReverbGovernorBudget* sharedBudget;
+        double load;
+        int64_t loadPPM;
+        size_t holdFramesLeft, fadeFrames, fadeFramesLeft;
+        float *zeros, *tailL, *tailR, *fade;
+        
+        // the reverb that isn't active belongs to the worker while it
+        // prepares it for standbyLevel, and to the audio thread otherwise
+        int32_t standbyState;
+        size_t standbyLevel;
+        BMSemaphore wake;
+        pthread_t thread;
+        bool running, wakeInitialised;
+    } BMCReverbGovernor;
+    
+    
+    
+    // Measures the model on this machine. This takes a fraction of a
+    // second.
+    void BMCReverbGovernorCalibrate(BMCReverbGovernorModel* model);
+    
+    
+    // returns the load the model predicts, as a fraction of one core
+    float BMCReverbGovernorPredictLoad(const BMCReverbGovernorModel* model, size_t delayUnits, size_t bufferLength, float sampleRate);
+    
+    
+    // sets the budget, as a fraction of one core, and clears the load
+    void BMCReverbGovernorBudgetInit(BMCReverbGovernorBudget* b, float budget);
+    
+    
+    // Initialises a governor with the settings of prototype, starting
+    // with its number of delay units. It steps down to no fewer than
+    // minDelayUnits. The governor is held to budget, a fraction of one
+    // core, or to sharedBudget if it isn't NULL. If model is NULL, the
+    // load is predicted to be proportional to the number of delays.
+    //
+    // The frozen impulse response mode must be off, and the mixing
+    // matrix must support every level. Returns false if there isn't
+    // enough memory or the background thread can't be started.
+    bool BMCReverbGovernorInit(BMCReverbGovernor* g, struct BMCReverb* prototype, size_t minDelayUnits, float budget, BMCReverbGovernorBudget* sharedBudget, const BMCReverbGovernorModel* model);
+    
+    
+    // Processes a buffer like BMCReverbProcessBuffer, then decides whether
+    // to change the size of the network. If the standby network isn't
+    // ready for the new size yet, the change waits for it.
+    void BMCReverbGovernorProcessBuffer(BMCReverbGovernor* g, const float* inputL, const float* inputR, float* outputL, float* outputR, size_t numSamples);
+    
+    
+    // Returns the reverb that takes the input at the moment. Settings
+    // changes made to it are carried over when the network changes size,
+    // except the number of delay units, which the governor controls. A
+    // change that needs a new design, made after the standby network was
+    // prepared, is applied at the end of its first buffer.
+    struct BMCReverb* BMCReverbGovernorReverb(BMCReverbGovernor* g);
+    
+    
+    // changes the budget for a governor that isn't sharing one
+    void BMCReverbGovernorSetBudget(BMCReverbGovernor* g, float budget);
+    
+    
+    // Safe to call from any thread, for monitoring. The values may be one
+    // buffer old.
+    void BMCReverbGovernorGetStatus(const BMCReverbGovernor* g, BMCReverbGovernorStatus* status);
+    
+    
+    // stops the background thread and frees the reverbs
+    void BMCReverbGovernorFree(BMCReverbGovernor* g);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbGovernor_h */
@@ -0,0 +1,79 @@
+//
+//  BMCReverbInstrumentation.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbInstrumentation.h"
+#include <string.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    void BMCReverbInstrumentationInit(BMCReverbInstrumentation* ins){
+        memset(ins, 0, sizeof(BMCReverbInstrumentation));
+        for (size_t i=0; i<BMCREVERB_NUMSTAGES; i++)
+            ins->working.stages[i].minCycles = ins->published.stages[i].minCycles = UINT64_MAX;
+        ins->stageStart = BMCReverbCycles();
+    }
+    
+    
+    
+    
+    
+    // The published counters are a sequence lock: the sequence number is
+    // odd while they are being written. The counters are copied one word
+    // at a time with atomic operations, so a reader that overlaps a write
+    // sees a torn copy, but never undefined behaviour, and tries again.
+    void BMCReverbInstrumentationPublish(BMCReverbInstrumentation* ins){
+        const uint64_t* source = (const uint64_t*)&ins->working;
+        uint64_t* destination = (uint64_t*)&ins->published;
+        size_t numWords = sizeof(BMCReverbStats) / sizeof(uint64_t);
+        
+        uint32_t sequence = ins->sequence;
+        __atomic_store_n(&ins->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (size_t i=0; i<numWords; i++)
+            __atomic_store_n(&destination[i], source[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&ins->sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbInstrumentationRead(const BMCReverbInstrumentation* ins, BMCReverbStats* stats){
+        const uint64_t* source = (const uint64_t*)&ins->published;
+        uint64_t* destination = (uint64_t*)stats;
+        size_t numWords = sizeof(BMCReverbStats) / sizeof(uint64_t);
+        
+        uint32_t before, after;
+        do {
+            before = __atomic_load_n(&ins->sequence, __ATOMIC_ACQUIRE);
+            for (size_t i=0; i<numWords; i++)
+                destination[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&ins->sequence, __ATOMIC_RELAXED);
+        } while ((before & 1) || before != after);
+    }
+    
+    
+    
+    
+    
+    const char* BMCReverbStageName(BMCReverbStage stage){
+        static const char* names [BMCREVERB_NUMSTAGES] = {
+            "diffusion", "input", "decay", "shelf", "write", "increment", "gather", "output sum",
+            "mixing", "rotation", "cross stereo", "dry/wet", "biquad", "resampling", "settings"
+        };
+        return stage < BMCREVERB_NUMSTAGES ? names[stage] : "unknown";
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
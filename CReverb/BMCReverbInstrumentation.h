@@ -0,0 +1,141 @@
+//
+//  BMCReverbInstrumentation.h
+//  CReverb
+//
+//  Counts the time spent in each stage of the processing, to see where it
+//  goes. The counters are compiled in only when BMCREVERB_INSTRUMENTATION
+//  is defined for every file, for example with
+//
+//      make CFLAGS="-lm -lpthread -DBMCREVERB_INSTRUMENTATION"
+//
+//  Without it, the stage markers in BMCReverb.c compile to nothing and the
+//  reverb has no counters.
+//
+//  Time is counted in cycles of the time stamp counter on x86, ticks of
+//  the virtual counter on ARM64 and nanoseconds elsewhere. Reading the
+//  counter costs some cycles of its own, so measure with a network large
+//  enough that the stages take longer than that.
+//
+//  The audio thread keeps its own copy of the counters and publishes it at
+//  the end of each buffer under a sequence lock, so any thread can read
+//  them without locking and without slowing the audio thread down.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbInstrumentation_h
+#define BMCReverbInstrumentation_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    // With the scalar kernel, the input, decay and shelf filter stages are
+    // a single loop, counted as the input stage. With the blocked kernel,
+    // everything from the input stage to the rotation except the output
+    // sum is a single loop, counted as the input stage.
+    typedef enum BMCReverbStage {
+        BMCREVERB_STAGE_DIFFUSION, // the input allpass filters
+        BMCREVERB_STAGE_INPUT, // mixing the input into the feedback
+        BMCREVERB_STAGE_DECAY, // broadband decay
+        BMCREVERB_STAGE_SHELF, // high frequency decay
+        BMCREVERB_STAGE_WRITE, // writing the delays
+        BMCREVERB_STAGE_INCREMENT, // incrementing and wrapping the indices
+        BMCREVERB_STAGE_GATHER, // reading the delays
+        BMCREVERB_STAGE_OUTPUTSUM, // summing the delays into the output
+        BMCREVERB_STAGE_MIXING, // the mixing matrix
+        BMCREVERB_STAGE_ROTATION, // rotating the feedback
+        BMCREVERB_STAGE_CROSSSTEREO, // mixing the wet channels
+        BMCREVERB_STAGE_DRYWET, // mixing the dry and wet signals
+        BMCREVERB_STAGE_BIQUAD, // highpass and lowpass filters on the wet signal
+        BMCREVERB_STAGE_RESAMPLING, // decimating and interpolating the reduced rate wet path
+        BMCREVERB_STAGE_SETTINGS, // applying queued settings
+        BMCREVERB_NUMSTAGES
+    } BMCReverbStage;
+    
+    
+    // each call is one sample of the network stages, or one chunk or
+    // buffer of the others
+    typedef struct BMCReverbStageCounter {
+        uint64_t cycles, calls, minCycles, maxCycles;
+    } BMCReverbStageCounter;
+    
+    
+    typedef struct BMCReverbStats {
+        BMCReverbStageCounter stages [BMCREVERB_NUMSTAGES];
+        // buffers processed, input samples replaced because they were NaN,
+        // infinite or beyond BMCREVERB_INPUTLIMIT, and delay outputs in the
+        // denormal range, which are slow on many CPUs
+        uint64_t buffers, nonFiniteInputs, denormals;
+    } BMCReverbStats;
+    
+    
+    typedef struct BMCReverbInstrumentation {
+        BMCReverbStats working, published;
+        uint64_t stageStart;
+        uint32_t sequence;
+    } BMCReverbInstrumentation;
+    
+    
+    
+    // reads the cycle counter
+    static __inline uint64_t BMCReverbCycles(void){
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t low, high;
+        __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+        return ((uint64_t)high << 32) | low;
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+        return ticks;
+#else
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+#endif
+    }
+    
+    
+    // Adds the time since the last stage ended to the counter of stage.
+    // Called from the audio thread only.
+    static __inline void BMCReverbInstrumentationStageEnd(BMCReverbInstrumentation* ins, BMCReverbStage stage){
+        uint64_t now = BMCReverbCycles();
+        uint64_t cycles = now - ins->stageStart;
+        BMCReverbStageCounter* counter = &ins->working.stages[stage];
+        counter->cycles += cycles;
+        counter->calls++;
+        if (cycles < counter->minCycles) counter->minCycles = cycles;
+        if (cycles > counter->maxCycles) counter->maxCycles = cycles;
+        ins->stageStart = now;
+    }
+    
+    
+    
+    // clears the counters
+    void BMCReverbInstrumentationInit(BMCReverbInstrumentation* ins);
+    
+    
+    // copies the working counters to the published ones. Called from the
+    // audio thread at the end of each buffer.
+    void BMCReverbInstrumentationPublish(BMCReverbInstrumentation* ins);
+    
+    
+    // copies the published counters to stats. Safe to call from any thread.
+    void BMCReverbInstrumentationRead(const BMCReverbInstrumentation* ins, BMCReverbStats* stats);
+    
+    
+    // returns a short name for a stage, for printing
+    const char* BMCReverbStageName(BMCReverbStage stage);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbInstrumentation_h */
@@ -0,0 +1,269 @@
+//
+//  BMCReverbParallel.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbParallel.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_PARALLEL_CHECKINTERVAL 4096 // frames between energy checks
+#define BMCREVERB_PARALLEL_TAILMARGIN 1.25 // allow 25% longer tails than the RT60 predicts
+    
+    
+    struct BMCReverbParallelJob;
+    
+    // renders one chunk at a time
+    typedef struct BMCReverbChunkWorker {
+        struct BMCReverb rv;
+        float *bodyL, *bodyR, *tailL, *tailR;
+        size_t chunkIndex, regionLength, tailLength;
+        bool active;
+        struct BMCReverbParallelJob* job;
+    } BMCReverbChunkWorker;
+    
+    
+    typedef struct BMCReverbParallelJob {
+        size_t numInputFrames, numOutputFrames, chunkLength, numWorkers;
+        float threshold;
+        BMCReverbReadFunction read;
+        BMCReverbWriteFunction write;
+        void* context;
+        BMCReverbChunkWorker* workers;
+        // the tail of the last chunk in the previous group of chunks
+        float *carryL, *carryR;
+        size_t carryLength;
+    } BMCReverbParallelJob;
+    
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    void* BMCReverbRenderChunk(void* worker);
+    void* BMCReverbWriteChunk(void* worker);
+    bool BMCReverbRunWorkers(BMCReverbParallelJob* job, void* (*function)(void*));
+    
+    
+    
+    
+    
+    bool BMCReverbRenderParallel(struct BMCReverb* rv, size_t numInputFrames, size_t numOutputFrames, BMCReverbReadFunction read, BMCReverbWriteFunction write, void* context, size_t numThreads, double threshold_dB){
+        assert(!rv->autoSustain);
+        assert(rv->modulationDepth_seconds == 0.0f);
+        assert(numThreads > 0 && threshold_dB < 0.0);
+        
+        // this applies any queued settings
+        BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(rv);
+        
+        
+        /*
+         * choose the chunk length
+         *
+         * The tail of a chunk has to fit inside the next chunk, so chunks
+         * are at least as long as the longest tail. Longer chunks waste
+         * less time on tails but give fewer chunks to share between the
+         * threads.
+         */
+        double rt60 = rv->slowDecay ? rv->slowDecayRT60 : rv->rt60;
+        double tail_seconds = BMCREVERB_PARALLEL_TAILMARGIN * rt60 * (-threshold_dB / 60.0) + rv->maxDelay_seconds;
+        size_t maxTailLength = (size_t)ceil(tail_seconds * rv->sampleRate) + BMCREVERB_PARALLEL_CHECKINTERVAL;
+        size_t framesPerThread = (numOutputFrames + numThreads - 1) / numThreads;
+        size_t chunkLength = framesPerThread < 4*maxTailLength ? framesPerThread : 4*maxTailLength;
+        if (chunkLength < maxTailLength) chunkLength = maxTailLength;
+        
+        
+        /*
+         * set up the workers. Each one gets a reverb that shares the design
+         */
+        BMCReverbParallelJob job;
+        job.numInputFrames = numInputFrames;
+        job.numOutputFrames = numOutputFrames;
+        job.chunkLength = chunkLength;
+        job.numWorkers = numThreads;
+        job.threshold = pow(10.0, threshold_dB / 10.0);
+        job.read = read;
+        job.write = write;
+        job.context = context;
+        job.carryLength = 0;
+        job.carryL = malloc(sizeof(float)*chunkLength);
+        job.carryR = malloc(sizeof(float)*chunkLength);
+        job.workers = calloc(numThreads, sizeof(BMCReverbChunkWorker));
+        bool success = job.carryL && job.carryR && job.workers;
+        for (size_t i=0; success && i<numThreads; i++) {
+            BMCReverbChunkWorker* w = &job.workers[i];
+            w->job = &job;
+            BMCReverbInitWithDesign(&w->rv, design);
+            BMCReverbCopyMixSettings(&w->rv, rv);
+            w->bodyL = malloc(sizeof(float)*chunkLength);
+            w->bodyR = malloc(sizeof(float)*chunkLength);
+            w->tailL = malloc(sizeof(float)*chunkLength);
+            w->tailR = malloc(sizeof(float)*chunkLength);
+            success = w->bodyL && w->bodyR && w->tailL && w->tailR;
+        }
+        BMCReverbDesignRelease(design);
+        
+        
+        /*
+         * render in groups of numThreads chunks. First all the chunks in
+         * the group render in parallel, then each one adds the tail of the
+         * chunk before it and writes the result
+         */
+        size_t numChunks = (numOutputFrames + chunkLength - 1) / chunkLength;
+        for (size_t firstChunk = 0; success && firstChunk < numChunks; firstChunk += numThreads) {
+            for (size_t i=0; i<numThreads; i++) {
+                job.workers[i].chunkIndex = firstChunk + i;
+                job.workers[i].active = firstChunk + i < numChunks;
+            }
+            
+            success = BMCReverbRunWorkers(&job, BMCReverbRenderChunk) && BMCReverbRunWorkers(&job, BMCReverbWriteChunk);
+            
+            // keep the tail of the last chunk for the next group
+            BMCReverbChunkWorker* last = &job.workers[numThreads-1];
+            float* temp;
+            temp = job.carryL; job.carryL = last->tailL; last->tailL = temp;
+            temp = job.carryR; job.carryR = last->tailR; last->tailR = temp;
+            job.carryLength = last->active ? last->tailLength : 0;
+        }
+        
+        
+        /*
+         * clean up
+         */
+        for (size_t i=0; job.workers && i<numThreads; i++) {
+            BMCReverbChunkWorker* w = &job.workers[i];
+            if (w->job) BMCReverbFree(&w->rv);
+            free(w->bodyL);
+            free(w->bodyR);
+            free(w->tailL);
+            free(w->tailR);
+        }
+        free(job.workers);
+        free(job.carryL);
+        free(job.carryR);
+        
+        return success;
+    }
+    
+    
+    
+    
+    
+    // runs function on every active worker, each in its own thread, and
+    // waits for them to finish
+    bool BMCReverbRunWorkers(BMCReverbParallelJob* job, void* (*function)(void*)){
+        pthread_t* threads = malloc(sizeof(pthread_t)*job->numWorkers);
+        bool* started = calloc(job->numWorkers, sizeof(bool));
+        bool success = threads && started;
+        
+        for (size_t i=0; success && i<job->numWorkers; i++)
+            if (job->workers[i].active) {
+                started[i] = pthread_create(&threads[i], NULL, function, &job->workers[i]) == 0;
+                success = started[i];
+            }
+        
+        for (size_t i=0; started && i<job->numWorkers; i++)
+            if (started[i]) pthread_join(threads[i], NULL);
+        
+        free(threads);
+        free(started);
+        return success;
+    }
+    
+    
+    
+    
+    
+    // renders the part of the output that starts with the chunk's input
+    // into the body buffers, then keeps going until the network is quiet,
+    // putting the tail that overlaps the next chunk in the tail buffers.
+    void* BMCReverbRenderChunk(void* worker){
+        BMCReverbChunkWorker* w = worker;
+        BMCReverbParallelJob* job = w->job;
+        size_t start = w->chunkIndex * job->chunkLength;
+        w->regionLength = job->numOutputFrames - start < job->chunkLength ? job->numOutputFrames - start : job->chunkLength;
+        w->tailLength = 0;
+        
+        // chunks after the end of the input only contain the tails of
+        // earlier chunks
+        size_t inputLength = 0;
+        if (start < job->numInputFrames)
+            inputLength = job->numInputFrames - start < w->regionLength ? job->numInputFrames - start : w->regionLength;
+        if (inputLength == 0) {
+            memset(w->bodyL, 0, sizeof(float)*w->regionLength);
+            memset(w->bodyR, 0, sizeof(float)*w->regionLength);
+            return NULL;
+        }
+        
+        // the body. We check the stored energy as we go to find its peak
+        BMCReverbReset(&w->rv);
+        job->read(job->context, start, inputLength, w->bodyL, w->bodyR);
+        memset(w->bodyL + inputLength, 0, sizeof(float)*(w->regionLength - inputLength));
+        memset(w->bodyR + inputLength, 0, sizeof(float)*(w->regionLength - inputLength));
+        float peakEnergy = 0.0f, energy = 0.0f;
+        for (size_t i=0; i < w->regionLength; i += BMCREVERB_PARALLEL_CHECKINTERVAL) {
+            size_t n = w->regionLength - i < BMCREVERB_PARALLEL_CHECKINTERVAL ? w->regionLength - i : BMCREVERB_PARALLEL_CHECKINTERVAL;
+            BMCReverbProcessBuffer(&w->rv, w->bodyL+i, w->bodyR+i, w->bodyL+i, w->bodyR+i, n);
+            energy = BMCReverbStoredEnergy(&w->rv);
+            if (energy > peakEnergy) peakEnergy = energy;
+        }
+        
+        // the tail, which can't run past the end of the next chunk or the
+        // end of the output
+        size_t end = start + w->regionLength;
+        size_t maxTailLength = job->numOutputFrames - end < job->chunkLength ? job->numOutputFrames - end : job->chunkLength;
+        while (w->tailLength < maxTailLength && energy > job->threshold*peakEnergy) {
+            size_t n = maxTailLength - w->tailLength < BMCREVERB_PARALLEL_CHECKINTERVAL ? maxTailLength - w->tailLength : BMCREVERB_PARALLEL_CHECKINTERVAL;
+            float* tailL = w->tailL + w->tailLength;
+            float* tailR = w->tailR + w->tailLength;
+            memset(tailL, 0, sizeof(float)*n);
+            memset(tailR, 0, sizeof(float)*n);
+            BMCReverbProcessBuffer(&w->rv, tailL, tailR, tailL, tailR, n);
+            w->tailLength += n;
+            energy = BMCReverbStoredEnergy(&w->rv);
+        }
+        
+        return NULL;
+    }
+    
+    
+    
+    
+    
+    // adds the tail of the previous chunk to the body and writes the result
+    void* BMCReverbWriteChunk(void* worker){
+        BMCReverbChunkWorker* w = worker;
+        BMCReverbParallelJob* job = w->job;
+        
+        // the previous chunk is either the previous worker or the last
+        // chunk of the previous group
+        const float *previousTailL = job->carryL, *previousTailR = job->carryR;
+        size_t previousTailLength = job->carryLength;
+        if (w != job->workers) {
+            previousTailL = (w-1)->tailL;
+            previousTailR = (w-1)->tailR;
+            previousTailLength = (w-1)->tailLength;
+        }
+        if (previousTailLength > w->regionLength) previousTailLength = w->regionLength;
+        
+        vDSP_vadd(w->bodyL, 1, previousTailL, 1, w->bodyL, 1, previousTailLength);
+        vDSP_vadd(w->bodyR, 1, previousTailR, 1, w->bodyR, 1, previousTailLength);
+        job->write(job->context, w->chunkIndex * job->chunkLength, w->regionLength, w->bodyL, w->bodyR);
+        
+        return NULL;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,82 @@
+//
+//  BMCReverbParallel.h
+//  CReverb
+//
+//  Offline rendering of long files on several cores.
+//
+//  With fixed settings the reverb is linear and time-invariant, so we can
+//  cut the input into chunks, render each chunk from silence on its own
+//  core, and add the results back together (overlap-add). Each chunk
+//  keeps running after its input ends until the energy stored in the
+//  network falls below a threshold, so the tail that spills into the next
+//  chunk is included.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbParallel_h
+#define BMCReverbParallel_h
+
+#include "BMCReverb.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    // A chunk stops rendering its tail when the energy stored in the
+    // network has fallen this far below the highest energy it stored
+    // while rendering the chunk.
+    //
+    // With the default settings, the parallel render differs from
+    // BMCReverbProcessBuffer by at most 5e-4 times the peak output level
+    // (-66 dB). Almost all of that is float rounding in the highpass filter
+    // on the wet signal, whose poles are close to 1 at low cutoffs, so
+    // small differences in the rounding of its input grow into a low
+    // frequency difference in its output. Lowering the threshold doesn't
+    // make the error smaller. The error is about 1e-3 of the peak with the
+    // highpass at 10 Hz, 1e-4 at 60 Hz and 1e-6 with it bypassed. main.c
+    // checks this with the default settings.
+#define BMCREVERB_PARALLEL_THRESHOLD_DB -120.0
+#define BMCREVERB_PARALLEL_MAXERROR 5.0e-4
+    
+    
+    // reads numFrames frames of input starting at startFrame
+    typedef void (*BMCReverbReadFunction)(void* context, size_t startFrame, size_t numFrames, float* left, float* right);
+    
+    // writes numFrames frames of output starting at startFrame
+    typedef void (*BMCReverbWriteFunction)(void* context, size_t startFrame, size_t numFrames, const float* left, const float* right);
+    
+    
+    
+    // Renders numInputFrames frames of input through a reverb with the
+    // settings of rv and writes numOutputFrames frames of output, using
+    // numThreads threads. Output frames after the end of the input are the
+    // tail of the reverb.
+    //
+    // read and write are called from several threads at once, always for
+    // ranges of frames that don't overlap. Each output frame is written
+    // exactly once, and read is never called past the end of the input.
+    //
+    // The result matches processing the whole file with one reverb, within
+    // the tolerance given above. This requires autoSustain to be off,
+    // because automatic sustain makes the reverb depend on the level of
+    // the input, and the modulation depth to be 0. Each chunk starts its
+    // LFOs from the phases a reverb has after a reset, not from where a
+    // single reverb's LFOs would be at the start of the chunk, so with
+    // modulation the chunks don't add up to the serial render. rv itself is not used for processing and its state is
+    // not changed, but queued settings are applied.
+    //
+    // Pass threshold_dB = BMCREVERB_PARALLEL_THRESHOLD_DB unless you need
+    // a different trade-off between accuracy and speed.
+    //
+    // Returns false if the threads or memory couldn't be allocated.
+    bool BMCReverbRenderParallel(struct BMCReverb* rv, size_t numInputFrames, size_t numOutputFrames, BMCReverbReadFunction read, BMCReverbWriteFunction write, void* context, size_t numThreads, double threshold_dB);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbParallel_h */
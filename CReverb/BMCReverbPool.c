@@ -0,0 +1,86 @@
+//
+//  BMCReverbPool.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbPool.h"
+#include <stdlib.h>
+#include <assert.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    bool BMCReverbPoolInit(BMCReverbPool* pool, struct BMCReverb* prototype, size_t count){
+        pool->count = 0;
+        pool->reverbs = malloc(sizeof(struct BMCReverb)*count);
+        if (!pool->reverbs) return false;
+        if (!BMLockFreeQueueInit(&pool->freeReverbs, count)) {
+            free(pool->reverbs);
+            pool->reverbs = NULL;
+            return false;
+        }
+        
+        BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(prototype);
+        for (size_t i=0; i<count; i++) {
+            struct BMCReverb* rv = &pool->reverbs[i];
+            BMCReverbInitWithDesign(rv, design);
+            BMCReverbCopyMixSettings(rv, prototype);
+            BMCReverbSetAutoSustain(rv, prototype->autoSustain);
+            BMCReverbSetFrozenIRMode(rv, prototype->frozenIRMode);
+            
+            // a frozen reverb needs its convolver before it is acquired
+            BMCReverbApplySettings(rv);
+            BMLockFreeQueuePush(&pool->freeReverbs, rv);
+        }
+        pool->count = count;
+        
+        BMCReverbDesignRelease(design);
+        return true;
+    }
+    
+    
+    
+    
+    
+    struct BMCReverb* BMCReverbPoolAcquire(BMCReverbPool* pool){
+        void* rv;
+        return BMLockFreeQueuePop(&pool->freeReverbs, &rv) ? rv : NULL;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbPoolRelease(BMCReverbPool* pool, struct BMCReverb* rv){
+        assert(pool->reverbs <= rv && rv < pool->reverbs + pool->count);
+        
+        // the next voice to acquire rv expects no queued settings
+        BMCReverbApplySettings(rv);
+        BMCReverbReset(rv);
+        
+        // the queue has room for every reverb, so this can't fail
+        BMLockFreeQueuePush(&pool->freeReverbs, rv);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbPoolFree(BMCReverbPool* pool){
+        for (size_t i=0; i<pool->count; i++)
+            BMCReverbFree(&pool->reverbs[i]);
+        free(pool->reverbs);
+        pool->reverbs = NULL;
+        BMLockFreeQueueFree(&pool->freeReverbs);
+        pool->count = 0;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,74 @@
+//
+//  BMCReverbPool.h
+//  CReverb
+//
+//  A pool of reverbs for voices that start and stop all the time.
+//
+//  All the reverbs are initialised up front with the same settings and
+//  share one design, so taking one from the pool and giving it back
+//  never allocates memory. The free reverbs wait on a lock-free queue. A
+//  reverb is silenced when it goes back into the pool, with
+//  BMCReverbReset, which marks the delay memory as stale instead of
+//  clearing it. Settings queued while it was in use are applied first.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbPool_h
+#define BMCReverbPool_h
+
+#include "BMCReverb.h"
+#include "BMLockFree.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    typedef struct BMCReverbPool {
+        struct BMCReverb* reverbs;
+        size_t count;
+        BMLockFreeQueue freeReverbs;
+    } BMCReverbPool;
+    
+    
+    
+    // Initialises count reverbs with the settings of prototype, including
+    // its mix settings, auto sustain and frozen impulse response mode.
+    // Queued settings of prototype are applied first. Returns false if
+    // there isn't enough memory.
+    bool BMCReverbPoolInit(BMCReverbPool* pool, struct BMCReverb* prototype, size_t count);
+    
+    
+    // Takes a silent reverb out of the pool. It has no queued settings, so
+    // it can process audio in the same callback. Returns NULL if all the
+    // reverbs are in use. Safe to call from any thread; doesn't lock or
+    // allocate.
+    //
+    // The reverbs share their design, so changing a decay or network
+    // setting gives the reverb a private copy, which allocates. To give a
+    // voice its own settings, set them and call BMCReverbApplySettings
+    // outside the audio thread, or before processing if allocation is
+    // acceptable there.
+    struct BMCReverb* BMCReverbPoolAcquire(BMCReverbPool* pool);
+    
+    
+    // Applies any settings queued while rv was in use, silences it and
+    // returns it to the pool. Settings changed while it was in use stay
+    // with it. Safe to call from any thread and doesn't lock. If rv's
+    // settings were changed without BMCReverbApplySettings, applying them
+    // may allocate, so release it outside the audio thread in that case.
+    // Otherwise this doesn't allocate.
+    void BMCReverbPoolRelease(BMCReverbPool* pool, struct BMCReverb* rv);
+    
+    
+    // Frees the reverbs. They must all have been released.
+    void BMCReverbPoolFree(BMCReverbPool* pool);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbPool_h */
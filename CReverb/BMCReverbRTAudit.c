@@ -0,0 +1,361 @@
+//
+//  BMCReverbRTAudit.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for RTLD_NEXT and dlvsym
+#endif
+
+#include "BMCReverbRTAudit.h"
+
+#if defined(BMCREVERB_RTAUDIT) && defined(__GLIBC__)
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    // the allocator in glibc, under the names it exports for interposers
+    extern void* __libc_malloc(size_t size);
+    extern void* __libc_calloc(size_t count, size_t size);
+    extern void* __libc_realloc(void* ptr, size_t size);
+    extern void __libc_free(void* ptr);
+    
+    
+    // the blocking calls we replace, as the next library defines them
+    typedef struct BMCReverbRTAuditCalls {
+        int (*mutexLock)(pthread_mutex_t* mutex);
+        int (*condWait)(pthread_cond_t* cond, pthread_mutex_t* mutex);
+        int (*condTimedWait)(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* time);
+        int (*join)(pthread_t thread, void** result);
+        int (*nanosleep)(const struct timespec* time, struct timespec* remaining);
+        int (*usleep)(useconds_t microseconds);
+        unsigned int (*sleep)(unsigned int seconds);
+        int (*open)(const char* path, int flags, ...);
+        ssize_t (*read)(int fd, void* buffer, size_t count);
+        ssize_t (*write)(int fd, const void* buffer, size_t count);
+        FILE* (*fopen)(const char* path, const char* mode);
+    } BMCReverbRTAuditCalls;
+    
+    
+    static BMCReverbRTAuditCalls BMCReverbRTAuditNext;
+    static BMCReverbRTAuditMode BMCReverbRTAuditCurrentMode = BMCREVERB_RTAUDIT_ABORT;
+    static size_t BMCReverbRTAuditCount;
+    static bool BMCReverbRTAuditBacktraceLoaded;
+    
+    // how many regions the thread is in, and whether it is reporting a
+    // violation, during which the calls it makes are not checked
+    static __thread size_t BMCReverbRTAuditDepth;
+    static __thread bool BMCReverbRTAuditReporting;
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    void BMCReverbRTAuditResolve(void) __attribute__((constructor));
+    void BMCReverbRTAuditViolation(const char* call);
+    
+    
+    
+    
+    
+    static __inline bool BMCReverbRTAuditInRegion(void){
+        return BMCReverbRTAuditDepth > 0 && !BMCReverbRTAuditReporting;
+    }
+    
+    
+    
+    
+    
+    // Finds the calls we replace in the libraries after this one. This
+    // runs before main, and again from any replacement called before that.
+    void BMCReverbRTAuditResolve(void){
+        if (BMCReverbRTAuditNext.fopen) return;
+        
+        // dlsym allocates, which is not a violation
+        bool reporting = BMCReverbRTAuditReporting;
+        BMCReverbRTAuditReporting = true;
+        
+        BMCReverbRTAuditCalls next;
+        next.mutexLock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        // the condition variable functions have an older version for
+        // binary compatibility, which dlsym may find first
+        next.condWait = dlvsym(RTLD_NEXT, "pthread_cond_wait", "GLIBC_2.3.2");
+        if (!next.condWait) next.condWait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+        next.condTimedWait = dlvsym(RTLD_NEXT, "pthread_cond_timedwait", "GLIBC_2.3.2");
+        if (!next.condTimedWait) next.condTimedWait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+        next.join = dlsym(RTLD_NEXT, "pthread_join");
+        next.nanosleep = dlsym(RTLD_NEXT, "nanosleep");
+        next.usleep = dlsym(RTLD_NEXT, "usleep");
+        next.sleep = dlsym(RTLD_NEXT, "sleep");
+        next.open = dlsym(RTLD_NEXT, "open");
+        next.read = dlsym(RTLD_NEXT, "read");
+        next.write = dlsym(RTLD_NEXT, "write");
+        next.fopen = dlsym(RTLD_NEXT, "fopen");
+        BMCReverbRTAuditNext = next;
+        
+        BMCReverbRTAuditReporting = reporting;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbRTAuditViolation(const char* call){
+        BMCReverbRTAuditReporting = true;
+        __atomic_fetch_add(&BMCReverbRTAuditCount, 1, __ATOMIC_RELAXED);
+        
+        BMCReverbRTAuditMode mode = __atomic_load_n(&BMCReverbRTAuditCurrentMode, __ATOMIC_RELAXED);
+        if (mode != BMCREVERB_RTAUDIT_COUNT) {
+            // no stdio here: it may be the call that failed the audit
+            char message [128];
+            int length = snprintf(message, sizeof(message), "BMCReverbRTAudit: %s called in a real-time region\n", call);
+            if (length > 0 && BMCReverbRTAuditNext.write)
+                BMCReverbRTAuditNext.write(STDERR_FILENO, message, (size_t)length);
+            void* frames [BMCREVERB_RTAUDIT_BACKTRACEDEPTH];
+            int numFrames = backtrace(frames, BMCREVERB_RTAUDIT_BACKTRACEDEPTH);
+            // skip this function and the replacement that called it
+            if (numFrames > 2)
+                backtrace_symbols_fd(frames + 2, numFrames - 2, STDERR_FILENO);
+            if (mode == BMCREVERB_RTAUDIT_ABORT)
+                abort();
+        }
+        
+        BMCReverbRTAuditReporting = false;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbRTAuditSetMode(BMCReverbRTAuditMode mode){
+        __atomic_store_n(&BMCReverbRTAuditCurrentMode, mode, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    void BMCReverbRTAuditBegin(void){
+        BMCReverbRTAuditResolve();
+        
+        // the first backtrace loads the unwinder, which allocates, so we
+        // take one now rather than in the region
+        if (!__atomic_load_n(&BMCReverbRTAuditBacktraceLoaded, __ATOMIC_ACQUIRE)) {
+            void* frame;
+            BMCReverbRTAuditReporting = true;
+            backtrace(&frame, 1);
+            BMCReverbRTAuditReporting = false;
+            __atomic_store_n(&BMCReverbRTAuditBacktraceLoaded, true, __ATOMIC_RELEASE);
+        }
+        
+        BMCReverbRTAuditDepth++;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbRTAuditEnd(void){
+        if (BMCReverbRTAuditDepth > 0)
+            BMCReverbRTAuditDepth--;
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbRTAuditViolations(void){
+        return __atomic_load_n(&BMCReverbRTAuditCount, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    /*
+     * Replacements for the memory allocation functions
+     */
+    
+    void* malloc(size_t size){
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("malloc");
+        return __libc_malloc(size);
+    }
+    
+    
+    
+    
+    
+    void* calloc(size_t count, size_t size){
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("calloc");
+        return __libc_calloc(count, size);
+    }
+    
+    
+    
+    
+    
+    void* realloc(void* ptr, size_t size){
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("realloc");
+        return __libc_realloc(ptr, size);
+    }
+    
+    
+    
+    
+    
+    // free(NULL) does nothing, so it isn't a violation
+    void free(void* ptr){
+        if (ptr && BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("free");
+        __libc_free(ptr);
+    }
+    
+    
+    
+    
+    
+    /*
+     * Replacements for the blocking calls
+     */
+    
+    int pthread_mutex_lock(pthread_mutex_t* mutex){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("pthread_mutex_lock");
+        return BMCReverbRTAuditNext.mutexLock(mutex);
+    }
+    
+    
+    
+    
+    
+    int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("pthread_cond_wait");
+        return BMCReverbRTAuditNext.condWait(cond, mutex);
+    }
+    
+    
+    
+    
+    
+    int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* time){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("pthread_cond_timedwait");
+        return BMCReverbRTAuditNext.condTimedWait(cond, mutex, time);
+    }
+    
+    
+    
+    
+    
+    int pthread_join(pthread_t thread, void** result){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("pthread_join");
+        return BMCReverbRTAuditNext.join(thread, result);
+    }
+    
+    
+    
+    
+    
+    int nanosleep(const struct timespec* time, struct timespec* remaining){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("nanosleep");
+        return BMCReverbRTAuditNext.nanosleep(time, remaining);
+    }
+    
+    
+    
+    
+    
+    int usleep(useconds_t microseconds){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("usleep");
+        return BMCReverbRTAuditNext.usleep(microseconds);
+    }
+    
+    
+    
+    
+    
+    unsigned int sleep(unsigned int seconds){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("sleep");
+        return BMCReverbRTAuditNext.sleep(seconds);
+    }
+    
+    
+    
+    
+    
+    int open(const char* path, int flags, ...){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("open");
+        
+        // the mode is there only if the file may be created
+        int mode = 0;
+#ifdef O_TMPFILE
+        bool hasMode = (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE;
+#else
+        bool hasMode = flags & O_CREAT;
+#endif
+        if (hasMode) {
+            va_list arguments;
+            va_start(arguments, flags);
+            mode = va_arg(arguments, int);
+            va_end(arguments);
+        }
+        return BMCReverbRTAuditNext.open(path, flags, mode);
+    }
+    
+    
+    
+    
+    
+    ssize_t read(int fd, void* buffer, size_t count){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("read");
+        return BMCReverbRTAuditNext.read(fd, buffer, count);
+    }
+    
+    
+    
+    
+    
+    ssize_t write(int fd, const void* buffer, size_t count){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("write");
+        return BMCReverbRTAuditNext.write(fd, buffer, count);
+    }
+    
+    
+    
+    
+    
+    FILE* fopen(const char* path, const char* mode){
+        BMCReverbRTAuditResolve();
+        if (BMCReverbRTAuditInRegion()) BMCReverbRTAuditViolation("fopen");
+        return BMCReverbRTAuditNext.fopen(path, mode);
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCREVERB_RTAUDIT && __GLIBC__ */
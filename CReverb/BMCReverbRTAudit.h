@@ -0,0 +1,87 @@
+//
+//  BMCReverbRTAudit.h
+//  CReverb
+//
+//  A test build mode that catches memory allocation and blocking calls on
+//  the audio thread.
+//
+//  Build every file with BMCREVERB_RTAUDIT defined and link with -ldl, and
+//  with -rdynamic to see function names in the backtraces, for example
+//
+//      make CFLAGS="-lm -lpthread -ldl -rdynamic -DBMCREVERB_RTAUDIT"
+//
+//  Then malloc, calloc, realloc and free, and the calls that can block
+//  (locking a mutex, waiting on a condition or a thread, sleeping, and
+//  opening, reading and writing files) are interposed. A thread marks the
+//  code it runs in real time with BMCReverbRTAuditBegin and
+//  BMCReverbRTAuditEnd, for example around the body of its audio callback.
+//  Any interposed call inside the marked region is a violation, which
+//  aborts or prints a backtrace, depending on the mode.
+//
+//  Interposition works on Linux with glibc. Without BMCREVERB_RTAUDIT,
+//  or on other platforms, these functions do nothing and no violations
+//  are found.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbRTAudit_h
+#define BMCReverbRTAudit_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h> // defines __GLIBC__ on glibc
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_RTAUDIT_BACKTRACEDEPTH 32
+    
+    
+    typedef enum BMCReverbRTAuditMode {
+        // print a backtrace and abort (the default)
+        BMCREVERB_RTAUDIT_ABORT,
+        // print a backtrace and continue
+        BMCREVERB_RTAUDIT_LOG,
+        // only count the violations
+        BMCREVERB_RTAUDIT_COUNT
+    } BMCReverbRTAuditMode;
+    
+    
+#if defined(BMCREVERB_RTAUDIT) && defined(__GLIBC__)
+    
+    // the mode for all threads
+    void BMCReverbRTAuditSetMode(BMCReverbRTAuditMode mode);
+    
+    
+    // Marks the start and end of a real-time region on the calling thread.
+    // Regions can be nested. A thread that runs in real time all the
+    // time calls BMCReverbRTAuditBegin once.
+    void BMCReverbRTAuditBegin(void);
+    void BMCReverbRTAuditEnd(void);
+    
+    
+    // the number of violations so far, on all threads
+    size_t BMCReverbRTAuditViolations(void);
+    
+    
+    // returns true if the audit is compiled in
+    static __inline bool BMCReverbRTAuditEnabled(void){ return true; }
+    
+#else
+    
+    static __inline void BMCReverbRTAuditSetMode(BMCReverbRTAuditMode mode){ (void)mode; }
+    static __inline void BMCReverbRTAuditBegin(void){}
+    static __inline void BMCReverbRTAuditEnd(void){}
+    static __inline size_t BMCReverbRTAuditViolations(void){ return 0; }
+    static __inline bool BMCReverbRTAuditEnabled(void){ return false; }
+    
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbRTAudit_h */
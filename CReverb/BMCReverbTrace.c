@@ -0,0 +1,172 @@
+//
+//  BMCReverbTrace.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMCReverbTrace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    bool BMCReverbTraceInit(BMCReverbTrace* t, size_t capacity){
+        size_t length = 2;
+        while (length < capacity) length *= 2;
+        t->events = calloc(length, sizeof(BMCReverbTraceEvent));
+        t->mask = length - 1;
+        t->written = t->read = 0;
+        t->dropped = 0;
+        return t->events != NULL;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbTraceFree(BMCReverbTrace* t){
+        free(t->events);
+        t->events = NULL;
+    }
+    
+    
+    
+    
+    
+    uint64_t BMCReverbTraceTime(void){
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbTraceRecord(BMCReverbTrace* t, BMCReverbTraceEventType type, uint64_t start_ns, uint64_t value){
+        uint64_t now = BMCReverbTraceTime();
+        
+        // drop the event rather than wait for the reader
+        size_t written = t->written;
+        if (written - __atomic_load_n(&t->read, __ATOMIC_ACQUIRE) > t->mask) {
+            __atomic_store_n(&t->dropped, t->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        
+        BMCReverbTraceEvent* e = &t->events[written & t->mask];
+        e->start_ns = start_ns ? start_ns : now;
+        e->duration_ns = start_ns ? now - start_ns : 0;
+        e->value = value;
+        e->type = type;
+        __atomic_store_n(&t->written, written + 1, __ATOMIC_RELEASE);
+    }
+    
+    
+    
+    
+    
+    size_t BMCReverbTraceDrain(BMCReverbTrace* t, BMCReverbTraceEvent* events, size_t maxEvents){
+        size_t read = t->read;
+        size_t available = __atomic_load_n(&t->written, __ATOMIC_ACQUIRE) - read;
+        size_t n = available < maxEvents ? available : maxEvents;
+        for (size_t i=0; i<n; i++)
+            events[i] = t->events[(read + i) & t->mask];
+        __atomic_store_n(&t->read, read + n, __ATOMIC_RELEASE);
+        return n;
+    }
+    
+    
+    
+    
+    
+    uint64_t BMCReverbTraceDropped(const BMCReverbTrace* t){
+        return __atomic_load_n(&t->dropped, __ATOMIC_RELAXED);
+    }
+    
+    
+    
+    
+    
+    const char* BMCReverbTraceEventName(BMCReverbTraceEventType type){
+        static const char* names [BMCREVERB_TRACE_NUMTYPES] = {
+            "process", "update settings", "decay coefficients", "slow decay", "freeze", "idle"
+        };
+        return type < BMCREVERB_TRACE_NUMTYPES ? names[type] : "unknown";
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbTraceWriterOpen(BMCReverbTraceWriter* w, const char* path){
+        w->file = fopen(path, "w");
+        w->numEvents = 0;
+        if (!w->file) return false;
+        fprintf(w->file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMCReverbTraceWriterNameThread(BMCReverbTraceWriter* w, uint32_t pid, uint32_t tid, const char* name){
+        fprintf(w->file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"", w->numEvents ? "," : "", pid, tid);
+        // escape the characters that would end the string
+        for (const char* c = name; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', w->file);
+            if ((unsigned char)*c >= 0x20) fputc(*c, w->file);
+        }
+        fprintf(w->file, "\"}}");
+        w->numEvents++;
+    }
+    
+    
+    
+    
+    
+    // Timestamps are in microseconds. Events with a duration are complete
+    // events ("X") and the others are instant events ("i") on the
+    // timeline of the thread.
+    void BMCReverbTraceWriterAdd(BMCReverbTraceWriter* w, const BMCReverbTraceEvent* events, size_t numEvents, uint32_t pid, uint32_t tid){
+        const char* argNames [BMCREVERB_TRACE_NUMTYPES] = {"frames", "bytesAllocated", NULL, "slowDecay", "frozen", NULL};
+        
+        for (size_t i=0; i<numEvents; i++) {
+            const BMCReverbTraceEvent* e = &events[i];
+            BMCReverbTraceEventType type = e->type < BMCREVERB_TRACE_NUMTYPES ? (BMCReverbTraceEventType)e->type : BMCREVERB_TRACE_NUMTYPES;
+            bool instant = type == BMCREVERB_TRACE_SLOWDECAY || type == BMCREVERB_TRACE_FREEZE || type == BMCREVERB_TRACE_IDLE;
+            
+            fprintf(w->file, "%s\n{\"name\":\"%s\",\"cat\":\"BMCReverb\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f", w->numEvents ? "," : "", BMCReverbTraceEventName(type), pid, tid, 1.0e-3 * (double)e->start_ns);
+            if (instant)
+                fprintf(w->file, ",\"ph\":\"i\",\"s\":\"t\"");
+            else
+                fprintf(w->file, ",\"ph\":\"X\",\"dur\":%.3f", 1.0e-3 * (double)e->duration_ns);
+            if (type < BMCREVERB_TRACE_NUMTYPES && argNames[type])
+                fprintf(w->file, ",\"args\":{\"%s\":%llu}", argNames[type], (unsigned long long)e->value);
+            fprintf(w->file, "}");
+            w->numEvents++;
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMCReverbTraceWriterClose(BMCReverbTraceWriter* w){
+        fprintf(w->file, "\n]}\n");
+        bool failed = ferror(w->file) != 0;
+        failed |= fclose(w->file) != 0;
+        w->file = NULL;
+        return !failed;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
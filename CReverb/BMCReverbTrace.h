@@ -0,0 +1,136 @@
+//
+//  BMCReverbTrace.h
+//  CReverb
+//
+//  Records what a reverb does and when, to explain single dropouts that
+//  the counters in BMCReverbInstrumentation.h average away.
+//
+//  A trace is a ring of timestamped events owned by the caller and
+//  attached to one reverb with BMCReverbSetTrace. The audio thread adds
+//  events without locking or waiting: if the ring is full, the event is
+//  dropped and counted. Another thread drains the ring and can write the
+//  events in the trace event JSON format, which chrome://tracing and
+//  ui.perfetto.dev open. Timestamps come from CLOCK_MONOTONIC, so they
+//  line up with host traces that use the same clock.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMCReverbTrace_h
+#define BMCReverbTrace_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMCREVERB_TRACE_CAPACITY 4096 // a suggested size, enough for several seconds of buffers
+#define BMCREVERB_TRACE_CACHELINE 64
+    
+    
+    typedef enum BMCReverbTraceEventType {
+        // a call to BMCReverbProcessBuffer or BMCReverbProcessSends.
+        // value is the number of frames.
+        BMCREVERB_TRACE_PROCESS,
+        // queued settings applied. value is the number of bytes allocated.
+        BMCREVERB_TRACE_UPDATESETTINGS,
+        // the decay coefficients recomputed
+        BMCREVERB_TRACE_COEFFICIENTS,
+        // auto-sustain turned slow decay on or off. value is the new state.
+        BMCREVERB_TRACE_SLOWDECAY,
+        // the reverb started convolving (value 1) or running the network
+        // (value 0). The path it left keeps running without input until
+        // its tail ends.
+        BMCREVERB_TRACE_FREEZE,
+        // the tail of the path the reverb left ended, and it stopped running
+        BMCREVERB_TRACE_IDLE,
+        BMCREVERB_TRACE_NUMTYPES
+    } BMCReverbTraceEventType;
+    
+    
+    // times are in nanoseconds of CLOCK_MONOTONIC. Events that happen at
+    // an instant have no duration.
+    typedef struct BMCReverbTraceEvent {
+        uint64_t start_ns, duration_ns, value;
+        uint32_t type;
+    } BMCReverbTraceEvent;
+    
+    
+    typedef struct BMCReverbTrace {
+        BMCReverbTraceEvent* events;
+        size_t mask;
+        // written by the audio thread
+        char padding0 [BMCREVERB_TRACE_CACHELINE];
+        size_t written;
+        uint64_t dropped;
+        // written by the thread that drains the ring
+        char padding1 [BMCREVERB_TRACE_CACHELINE];
+        size_t read;
+        char padding2 [BMCREVERB_TRACE_CACHELINE];
+    } BMCReverbTrace;
+    
+    
+    // writes events from any number of traces to one JSON file
+    typedef struct BMCReverbTraceWriter {
+        FILE* file;
+        size_t numEvents;
+    } BMCReverbTraceWriter;
+    
+    
+    
+    // Allocates a ring for at least capacity events. Returns false if
+    // there isn't enough memory.
+    bool BMCReverbTraceInit(BMCReverbTrace* t, size_t capacity);
+    void BMCReverbTraceFree(BMCReverbTrace* t);
+    
+    
+    // the time now, in nanoseconds
+    uint64_t BMCReverbTraceTime(void);
+    
+    
+    // Adds an event that started at start_ns and ends now, or an instant
+    // event now if start_ns is 0. Called by the reverb on the audio thread.
+    void BMCReverbTraceRecord(BMCReverbTrace* t, BMCReverbTraceEventType type, uint64_t start_ns, uint64_t value);
+    
+    
+    // Moves up to maxEvents events, oldest first, from the ring to events
+    // and returns how many. Call it from one thread at a time, often
+    // enough that the ring doesn't fill up.
+    size_t BMCReverbTraceDrain(BMCReverbTrace* t, BMCReverbTraceEvent* events, size_t maxEvents);
+    
+    
+    // the number of events dropped because the ring was full
+    uint64_t BMCReverbTraceDropped(const BMCReverbTrace* t);
+    
+    
+    // returns a short name for an event type
+    const char* BMCReverbTraceEventName(BMCReverbTraceEventType type);
+    
+    
+    // Starts a trace event JSON file at path. Returns false if it can't be
+    // opened.
+    bool BMCReverbTraceWriterOpen(BMCReverbTraceWriter* w, const char* path);
+    
+    
+    // Names the timeline of the events with the given pid and tid, for
+    // example after the reverb or the track it is on.
+    void BMCReverbTraceWriterNameThread(BMCReverbTraceWriter* w, uint32_t pid, uint32_t tid, const char* name);
+    
+    
+    // writes numEvents events on the timeline of pid and tid
+    void BMCReverbTraceWriterAdd(BMCReverbTraceWriter* w, const BMCReverbTraceEvent* events, size_t numEvents, uint32_t pid, uint32_t tid);
+    
+    
+    // finishes and closes the file. Returns false if writing failed.
+    bool BMCReverbTraceWriterClose(BMCReverbTraceWriter* w);
+    
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMCReverbTrace_h */
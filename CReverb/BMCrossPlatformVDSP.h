@@ -120,7 +120,7 @@ static __inline vDSP_biquadm_Setup vDSP_biquadm_CreateSetup(const double* coeffi
     
     setup->numChannels = numChannels;
     setup->numLevels = numLevels;
-
+    
     return setup;
 }
 
@@ -193,6 +193,23 @@ static __inline void vDSP_biquadm(vDSP_biquadm_Setup setup,
 
 
 
+// single biquad section, difference equation of order 2
+//
+// C[n] = A[n]*B[0] + A[n-1]*B[1] + A[n-2]*B[2] - C[n-1]*B[3] - C[n-2]*B[4]
+//
+// A and C have count+2 elements. The first two elements of each hold the
+// previous inputs and outputs; the output starts at C[2].
+static __inline void vDSP_deq22(const float* A, size_t Astride, const float* B, float* C, size_t Cstride, size_t count){
+    assert (Astride * Cstride == 1);
+    for (size_t n=2; n<count+2; n++)
+        C[n] = A[n]*B[0] + A[n-1]*B[1] + A[n-2]*B[2] - C[n-1]*B[3] - C[n-2]*B[4];
+}
+
+
+
+
+
+
 
 /**********************************
  *  Vector mathematics functions  *
@@ -357,6 +374,24 @@ static __inline void vDSP_vma(const float* A, size_t Astride, const float* B, si
 
 
 
+// vector scalar multiply and add
+// D[i] = A[i]*B + C[i]
+static __inline void vDSP_vsma(const float* A, size_t Astride, const float* B, const float* C, size_t Cstride, float* D, size_t Dstride, size_t count){
+    // if all strides are 1
+    if(Astride*Cstride*Dstride == 1)
+        for (size_t i=0; i<count; i++)
+            D[i] = A[i]*(*B) + C[i];
+    
+    // if some strides are not 1
+    else {
+        for (size_t i=0; i<count; i++)
+            D[i*Dstride] = A[i*Astride]*(*B) + C[i*Cstride];
+    }
+}
+
+
+
+
 // vector clear
 // A[i]=0
 static __inline void vDSP_vclr(float* A, size_t Astride, size_t count){
@@ -416,6 +451,38 @@ static __inline void vDSP_sve(const float* A, size_t Astride, float* result, siz
 
 
 
+// dot product
+// *result = sum(A[i]*B[i])
+static __inline void vDSP_dotpr(const float* A, size_t Astride, const float* B, size_t Bstride, float* result, size_t count){
+    *result = 0;
+    
+    if (Astride*Bstride==1) {
+        for (size_t i=0; i<count; i++)
+            *result += A[i]*B[i];
+    } else {
+        for (size_t i=0; i<count; i++)
+            *result += A[i*Astride]*B[i*Bstride];
+    }
+}
+
+
+
+
+// vector square
+// C[i] = A[i]*A[i]
+static __inline void vDSP_vsq(const float* A, size_t Astride, float* C, size_t Cstride, size_t count){
+    if (Astride*Cstride==1) {
+        for (size_t i=0; i<count; i++)
+            C[i] = A[i]*A[i];
+    } else {
+        for (size_t i=0; i<count; i++)
+            C[i*Cstride] = A[i*Astride]*A[i*Astride];
+    }
+}
+
+
+
+
 // batch copy from vector of array indices
 // B[i] = A[AIDX[i]-1];
 static __inline void vDSP_vgathr(const float* A, const size_t* AIDX, size_t AIDXstride, float* B, size_t Bstride, size_t count){
@@ -508,6 +575,239 @@ static __inline void vDSP_vsmul(const float* A, size_t Astride, const float* b,
 
 
 
+
+/**********************************
+ *  Fourier transform functions   *
+ **********************************/
+
+typedef struct DSPComplex {
+    float real, imag;
+} DSPComplex;
+
+
+typedef struct DSPSplitComplex {
+    float *realp, *imagp;
+} DSPSplitComplex;
+
+
+typedef int FFTDirection;
+typedef int FFTRadix;
+enum { kFFTDirection_Forward = 1, kFFTDirection_Inverse = -1 };
+enum { kFFTRadix2 = 0 };
+
+
+// twiddle factors for transforms of up to 2^log2n points. Tables are
+// read only after setup, so one setup can be used by several threads.
+typedef struct vDSP_FFTSetupStruct {
+    float *cosTable, *sinTable;
+    size_t log2n;
+}*FFTSetup;
+
+
+
+
+static __inline FFTSetup vDSP_create_fftsetup(size_t log2n, FFTRadix radix){
+    assert(radix == kFFTRadix2);
+    FFTSetup setup = malloc(sizeof(struct vDSP_FFTSetupStruct));
+    size_t n = (size_t)1 << log2n;
+    setup->log2n = log2n;
+    setup->cosTable = malloc(sizeof(float)*(n/2 + 1));
+    setup->sinTable = malloc(sizeof(float)*(n/2 + 1));
+    
+    // cosTable[k] + i*sinTable[k] = exp(-2*pi*i*k/n)
+    for (size_t k=0; k<=n/2; k++){
+        double angle = -2.0 * 3.14159265358979323846 * (double)k / (double)n;
+        setup->cosTable[k] = cos(angle);
+        setup->sinTable[k] = sin(angle);
+    }
+    
+    return setup;
+}
+
+
+
+
+static __inline void vDSP_destroy_fftsetup(FFTSetup setup){
+    if (!setup) return;
+    free(setup->cosTable);
+    free(setup->sinTable);
+    free(setup);
+}
+
+
+
+
+// unscaled in place radix 2 complex transform of 2^log2n points with
+// stride 1. Used by vDSP_fft_zrip.
+static __inline void vDSP_fft_zip_stride1(FFTSetup setup, DSPSplitComplex* C, size_t log2n, FFTDirection direction){
+    size_t n = (size_t)1 << log2n;
+    float* re = C->realp;
+    float* im = C->imagp;
+    
+    // bit reversed reordering
+    for (size_t i=1, j=0; i<n; i++){
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    
+    // butterflies
+    float sign = direction == kFFTDirection_Forward ? 1.0f : -1.0f;
+    for (size_t length=2; length<=n; length <<= 1){
+        size_t half = length/2;
+        size_t tableStride = ((size_t)1 << setup->log2n) / length;
+        for (size_t start=0; start<n; start += length){
+            for (size_t k=0; k<half; k++){
+                float wr = setup->cosTable[k*tableStride];
+                float wi = sign*setup->sinTable[k*tableStride];
+                size_t a = start + k, b = a + half;
+                float tr = re[b]*wr - im[b]*wi;
+                float ti = re[b]*wi + im[b]*wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+
+
+
+// in place real transform of 2^log2n points, packed as 2^(log2n-1)
+// complex values by vDSP_ctoz.
+//
+// The forward transform returns twice the DFT. Element 0 holds the DC
+// term in realp and the Nyquist term in imagp. The inverse takes data in
+// the same format and returns n times the inverse DFT, so a forward
+// transform followed by an inverse scales the signal by 2n.
+static __inline void vDSP_fft_zrip(FFTSetup setup, const DSPSplitComplex* C, size_t stride, size_t log2n, FFTDirection direction){
+    assert(stride == 1);
+    assert(log2n >= 1 && log2n <= setup->log2n);
+    size_t m = (size_t)1 << (log2n-1);
+    size_t tableStride = ((size_t)1 << setup->log2n) >> log2n;
+    float* re = C->realp;
+    float* im = C->imagp;
+    DSPSplitComplex z = *C;
+    
+    if (direction == kFFTDirection_Forward) {
+        if (m > 1) vDSP_fft_zip_stride1(setup, &z, log2n-1, direction);
+        
+        // split the transform of the even and odd samples apart and
+        // combine them into the transform of the real signal
+        float dc = re[0] + im[0];
+        float nyquist = re[0] - im[0];
+        re[0] = 2.0f*dc;
+        im[0] = 2.0f*nyquist;
+        for (size_t k=1; k<=m/2; k++){
+            size_t j = m - k;
+            // even = z[k] + conj(z[j]), odd = -i*(z[k] - conj(z[j]))
+            float er = re[k] + re[j], ei = im[k] - im[j];
+            float or_ = im[k] + im[j], oi = re[j] - re[k];
+            float wr = setup->cosTable[k*tableStride];
+            float wi = setup->sinTable[k*tableStride];
+            float tr = or_*wr - oi*wi, ti = or_*wi + oi*wr;
+            // X[k] = even + w*odd, X[j] = conj(even - w*odd)
+            re[k] = er + tr;
+            im[k] = ei + ti;
+            if (j != k) {
+                re[j] = er - tr;
+                im[j] = ti - ei;
+            }
+        }
+    }
+    
+    else {
+        float dc = re[0], nyquist = im[0];
+        re[0] = dc + nyquist;
+        im[0] = dc - nyquist;
+        for (size_t k=1; k<=m/2; k++){
+            size_t j = m - k;
+            // even = X[k] + conj(X[j]), odd = conj(w)*(X[k] - conj(X[j]))
+            float er = re[k] + re[j], ei = im[k] - im[j];
+            float dr = re[k] - re[j], di = im[k] + im[j];
+            float wr = setup->cosTable[k*tableStride];
+            float wi = -setup->sinTable[k*tableStride];
+            float or_ = dr*wr - di*wi, oi = dr*wi + di*wr;
+            // z[k] = even + i*odd, z[j] = conj(even - i*odd)
+            re[k] = er - oi;
+            im[k] = ei + or_;
+            if (j != k) {
+                re[j] = er + oi;
+                im[j] = or_ - ei;
+            }
+        }
+        
+        if (m > 1) vDSP_fft_zip_stride1(setup, &z, log2n-1, direction);
+    }
+}
+
+
+
+
+// copy interleaved complex data to split complex format.
+// Cstride counts floats, so use 2 for contiguous complex data.
+static __inline void vDSP_ctoz(const DSPComplex* C, size_t Cstride, const DSPSplitComplex* Z, size_t Zstride, size_t count){
+    const float* c = (const float*)C;
+    for (size_t i=0; i<count; i++){
+        Z->realp[i*Zstride] = c[i*Cstride];
+        Z->imagp[i*Zstride] = c[i*Cstride + 1];
+    }
+}
+
+
+
+
+// copy split complex data to interleaved complex format
+static __inline void vDSP_ztoc(const DSPSplitComplex* Z, size_t Zstride, DSPComplex* C, size_t Cstride, size_t count){
+    float* c = (float*)C;
+    for (size_t i=0; i<count; i++){
+        c[i*Cstride] = Z->realp[i*Zstride];
+        c[i*Cstride + 1] = Z->imagp[i*Zstride];
+    }
+}
+
+
+
+
+// complex vector multiply and add
+// D[i] = A[i]*B[i] + C[i]
+static __inline void vDSP_zvma(const DSPSplitComplex* A, size_t Astride, const DSPSplitComplex* B, size_t Bstride, const DSPSplitComplex* C, size_t Cstride, const DSPSplitComplex* D, size_t Dstride, size_t count){
+    assert(Astride*Bstride*Cstride*Dstride == 1);
+    const float *ar = A->realp, *ai = A->imagp, *br = B->realp, *bi = B->imagp;
+    const float *cr = C->realp, *ci = C->imagp;
+    float *dr = D->realp, *di = D->imagp;
+    for (size_t i=0; i<count; i++){
+        float re = ar[i]*br[i] - ai[i]*bi[i] + cr[i];
+        float im = ar[i]*bi[i] + ai[i]*br[i] + ci[i];
+        dr[i] = re;
+        di[i] = im;
+    }
+}
+
+
+
+
+// correlation (convolution if F is reversed)
+// C[n] = sum(A[n+p]*F[p]) for p in [0,P)
+static __inline void vDSP_conv(const float* A, size_t Astride, const float* F, size_t Fstride, float* C, size_t Cstride, size_t count, size_t P){
+    assert(Astride*Fstride*Cstride == 1);
+    for (size_t n=0; n<count; n++){
+        float sum = 0.0f;
+        for (size_t p=0; p<P; p++)
+            sum += A[n+p]*F[p];
+        C[n] = sum;
+    }
+}
+
+
+
 #ifdef __APPLE__
 #if __has_feature(assume_nonnull)
 _Pragma("clang assume_nonnull end")
@@ -0,0 +1,116 @@
+//
+//  BMFastMath.h
+//  CReverb
+//
+//  Fast approximations of transcendental functions, applied to whole
+//  arrays. The loops have no branches and no dependencies between
+//  elements so the compiler can vectorise them.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMFastMath_h
+#define BMFastMath_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// The largest relative error of BMFastExp2 for inputs in [-125, 126].
+// The polynomial itself is accurate to 7.5e-8; the rest is float rounding.
+// main.c checks this bound against exp2() over the whole input range.
+#define BMFASTEXP2_MAXRELATIVEERROR 2.5e-7
+
+// The largest error of BMFastLog2 for positive normal inputs, absolute
+// for results in [-1, 1] and relative outside that range, where float
+// rounding of the result dominates. main.c checks this bound against
+// log2() over the whole input range.
+#define BMFASTLOG2_MAXERROR 2.5e-7
+
+
+/*
+ * Y[i] = 2^X[i]
+ *
+ * Works in place. Inputs are clamped to [-125, 126], so the result is
+ * never a denormal and never infinite.
+ *
+ * We split x into an integer n = floor(x) and a remainder f in [0, 1),
+ * evaluate 2^f with a degree 5 minimax polynomial and then build 2^n
+ * directly from exponent bits.
+ *
+ * We avoid the (x + 1.5*2^23) - 1.5*2^23 rounding trick and any other
+ * rearrangement of x - n because -ffast-math is allowed to reassociate
+ * them, which costs several bits of accuracy.
+ */
+static __inline void BMFastExp2(const float* X, float* Y, size_t count){
+    for (size_t i=0; i<count; i++){
+        float x = X[i];
+        x = x < -125.0f ? -125.0f : x;
+        x = x > 126.0f ? 126.0f : x;
+        
+        // split into integer and fractional parts
+        int32_t n = (int32_t)x;
+        n -= x < (float)n; // truncation rounds negative numbers up
+        float f = x - (float)n;
+        
+        // 2^f for f in [0,1)
+        float p = 1.8775766734e-03f;
+        p = p*f + 8.9893400947e-03f;
+        p = p*f + 5.5826318050e-02f;
+        p = p*f + 2.4015361705e-01f;
+        p = p*f + 6.9315307320e-01f;
+        p = p*f + 9.9999992506e-01f;
+        
+        // 2^n, built directly from the exponent bits
+        int32_t exponentBits = (n + 127) << 23;
+        float scale;
+        memcpy(&scale, &exponentBits, sizeof(float));
+        
+        Y[i] = p * scale;
+    }
+}
+
+
+
+
+/*
+ * Y[i] = log2(X[i])
+ *
+ * Works in place. Inputs are clamped to the normal float range, so zero,
+ * negative and denormal inputs give -126.
+ *
+ * We split x into 2^e * m with m in [sqrt(1/2), sqrt(2)) by moving the
+ * exponent boundary to sqrt(1/2), then evaluate log2(m) with the series
+ * 2/ln(2) * atanh(t), t = (m-1)/(m+1). |t| < 0.172, so four terms of the
+ * series are accurate to 3e-8.
+ */
+static __inline void BMFastLog2(const float* X, float* Y, size_t count){
+    for (size_t i=0; i<count; i++){
+        float x = X[i];
+        x = x < 1.17549435e-38f ? 1.17549435e-38f : x;
+        x = x > 3.40282347e+38f ? 3.40282347e+38f : x;
+        
+        // split into exponent and mantissa. 0x004afb0d is the distance
+        // from the bits of sqrt(1/2) to the bits of 1
+        int32_t bits;
+        memcpy(&bits, &x, sizeof(float));
+        int32_t e = ((bits + 0x004afb0d) >> 23) - 127;
+        int32_t mantissaBits = bits - e * (1 << 23);
+        float m;
+        memcpy(&m, &mantissaBits, sizeof(float));
+        
+        // log2(m)
+        float t = (m - 1.0f) / (m + 1.0f);
+        float t2 = t*t;
+        float p = 4.1219858e-01f;
+        p = p*t2 + 5.7707802e-01f;
+        p = p*t2 + 9.6179669e-01f;
+        p = p*t2 + 2.8853901e+00f;
+        
+        Y[i] = (float)e + p*t;
+    }
+}
+
+
+#endif /* BMFastMath_h */
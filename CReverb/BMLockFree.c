@@ -0,0 +1,158 @@
+//
+//  BMLockFree.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMLockFree.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    
+    bool BMLockFreeQueueInit(BMLockFreeQueue* q, size_t capacity){
+        size_t length = 2;
+        while (length < capacity) length *= 2;
+        
+        q->cells = malloc(sizeof(BMLockFreeQueueCell)*length);
+        if (!q->cells) return false;
+        q->mask = length - 1;
+        
+        // cell i is ready for the push at position i
+        for (size_t i=0; i<length; i++)
+            q->cells[i].sequence = i;
+        q->pushPosition = q->popPosition = 0;
+        
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMLockFreeQueuePush(BMLockFreeQueue* q, void* item){
+        size_t position = __atomic_load_n(&q->pushPosition, __ATOMIC_RELAXED);
+        BMLockFreeQueueCell* cell;
+        while (true) {
+            cell = &q->cells[position & q->mask];
+            size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            
+            // the cell is free. Try to claim it
+            if (difference == 0) {
+                if (__atomic_compare_exchange_n(&q->pushPosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            // the cell still holds the item pushed one lap ago
+            else if (difference < 0)
+                return false;
+            // another thread pushed here first
+            else
+                position = __atomic_load_n(&q->pushPosition, __ATOMIC_RELAXED);
+        }
+        
+        // publish the item to the pop at this position
+        cell->item = item;
+        __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMLockFreeQueuePop(BMLockFreeQueue* q, void** item){
+        size_t position = __atomic_load_n(&q->popPosition, __ATOMIC_RELAXED);
+        BMLockFreeQueueCell* cell;
+        while (true) {
+            cell = &q->cells[position & q->mask];
+            size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+            
+            // the cell holds an item. Try to claim it
+            if (difference == 0) {
+                if (__atomic_compare_exchange_n(&q->popPosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            // nothing has been pushed here yet
+            else if (difference < 0)
+                return false;
+            // another thread popped here first
+            else
+                position = __atomic_load_n(&q->popPosition, __ATOMIC_RELAXED);
+        }
+        
+        // hand the cell back to the push one lap from now
+        *item = cell->item;
+        __atomic_store_n(&cell->sequence, position + q->mask + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    
+    
+    
+    
+    
+    void BMLockFreeQueueFree(BMLockFreeQueue* q){
+        free(q->cells);
+        q->cells = NULL;
+    }
+    
+    
+    
+    
+    
+    bool BMSemaphoreInit(BMSemaphore* s){
+#ifdef __APPLE__
+        s->semaphore = dispatch_semaphore_create(0);
+        return s->semaphore != NULL;
+#else
+        return sem_init(&s->semaphore, 0, 0) == 0;
+#endif
+    }
+    
+    
+    
+    
+    
+    void BMSemaphoreSignal(BMSemaphore* s){
+#ifdef __APPLE__
+        dispatch_semaphore_signal(s->semaphore);
+#else
+        sem_post(&s->semaphore);
+#endif
+    }
+    
+    
+    
+    
+    
+    void BMSemaphoreWait(BMSemaphore* s){
+#ifdef __APPLE__
+        dispatch_semaphore_wait(s->semaphore, DISPATCH_TIME_FOREVER);
+#else
+        // a signal handler can interrupt the wait
+        while (sem_wait(&s->semaphore) != 0 && errno == EINTR);
+#endif
+    }
+    
+    
+    
+    
+    
+    void BMSemaphoreFree(BMSemaphore* s){
+#ifdef __APPLE__
+        dispatch_release(s->semaphore);
+#else
+        sem_destroy(&s->semaphore);
+#endif
+    }
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,109 @@
+//
+//  BMLockFree.h
+//  CReverb
+//
+//  A bounded multi-producer, multi-consumer queue of pointers that never
+//  takes a lock. Each cell has a sequence number that tells producers and
+//  consumers whose turn it is, so a push or pop is one compare-and-swap on
+//  the queue position plus one store to the cell (Dmitry Vyukov's design).
+//
+//  The queue never waits, so threads that have nothing to do until an
+//  item arrives wait on a semaphore that the other side signals after
+//  each push or pop. Signalling doesn't lock or allocate, so it can be
+//  done from an audio callback.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMLockFree_h
+#define BMLockFree_h
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __APPLE__
+    // macOS doesn't support unnamed POSIX semaphores
+    #include <dispatch/dispatch.h>
+#else
+    #include <semaphore.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMLOCKFREE_CACHELINE 64
+    
+    
+    typedef struct BMLockFreeQueueCell {
+        size_t sequence;
+        void* item;
+    } BMLockFreeQueueCell;
+    
+    
+    typedef struct BMLockFreeQueue {
+        BMLockFreeQueueCell* cells;
+        size_t mask;
+        // the positions are written by different threads, so keep them on
+        // separate cache lines
+        char padding0 [BMLOCKFREE_CACHELINE];
+        size_t pushPosition;
+        char padding1 [BMLOCKFREE_CACHELINE];
+        size_t popPosition;
+        char padding2 [BMLOCKFREE_CACHELINE];
+    } BMLockFreeQueue;
+    
+    
+    
+    // Initialises an empty queue that holds at least capacity items.
+    // The capacity is rounded up to a power of two. Returns false if the
+    // memory couldn't be allocated. Not thread safe.
+    bool BMLockFreeQueueInit(BMLockFreeQueue* q, size_t capacity);
+    
+    
+    // Adds item to the back of the queue. Returns false without waiting
+    // if the queue is full.
+    bool BMLockFreeQueuePush(BMLockFreeQueue* q, void* item);
+    
+    
+    // Removes the item at the front of the queue. Returns false without
+    // waiting if the queue is empty.
+    bool BMLockFreeQueuePop(BMLockFreeQueue* q, void** item);
+    
+    
+    // Frees the queue's memory. Not thread safe.
+    void BMLockFreeQueueFree(BMLockFreeQueue* q);
+    
+    
+    
+    typedef struct BMSemaphore {
+#ifdef __APPLE__
+        dispatch_semaphore_t semaphore;
+#else
+        sem_t semaphore;
+#endif
+    } BMSemaphore;
+    
+    
+    // Initialises a semaphore with a count of 0. Returns false if it
+    // couldn't be created. Not thread safe.
+    bool BMSemaphoreInit(BMSemaphore* s);
+    
+    
+    // Adds one to the count, waking a thread that is waiting. Doesn't
+    // wait, lock or allocate.
+    void BMSemaphoreSignal(BMSemaphore* s);
+    
+    
+    // Waits until the count is above 0, then subtracts one.
+    void BMSemaphoreWait(BMSemaphore* s);
+    
+    
+    // Destroys the semaphore. No thread may be waiting on it.
+    void BMSemaphoreFree(BMSemaphore* s);
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMLockFree_h */
@@ -0,0 +1,455 @@
+//
+//  BMWavFile.c
+//  CReverb
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include "BMWavFile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BMWAV_FORMAT_PCM 1
+#define BMWAV_FORMAT_FLOAT 3
+#define BMWAV_FORMAT_EXTENSIBLE 0xFFFE
+    
+    // RIFF header + ds64 (or JUNK) chunk + fmt chunk + data chunk header
+#define BMWAV_HEADERLENGTH (12 + 8+28 + 8+16 + 8)
+    
+    
+    
+    /*
+     * these functions should be called only from functions within this file
+     */
+    uint16_t BMWavRead16(const unsigned char* p);
+    uint32_t BMWavRead32(const unsigned char* p);
+    uint64_t BMWavRead64(const unsigned char* p);
+    void BMWavWrite16(unsigned char* p, uint16_t x);
+    void BMWavWrite32(unsigned char* p, uint32_t x);
+    void BMWavWrite64(unsigned char* p, uint64_t x);
+    bool BMWavFileFail(BMWavFile* wav, const char* error);
+    float BMWavReadSample(const unsigned char* p, BMWavSampleFormat format);
+    void BMWavWriteSample(unsigned char* p, float x, BMWavSampleFormat format);
+    
+    
+    
+    
+    
+    // WAV files are little-endian on every platform, so we assemble values
+    // from bytes rather than casting pointers.
+    uint16_t BMWavRead16(const unsigned char* p){
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+    
+    uint32_t BMWavRead32(const unsigned char* p){
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    
+    uint64_t BMWavRead64(const unsigned char* p){
+        return (uint64_t)BMWavRead32(p) | ((uint64_t)BMWavRead32(p+4) << 32);
+    }
+    
+    void BMWavWrite16(unsigned char* p, uint16_t x){
+        p[0] = x & 0xFF;
+        p[1] = x >> 8;
+    }
+    
+    void BMWavWrite32(unsigned char* p, uint32_t x){
+        BMWavWrite16(p, x & 0xFFFF);
+        BMWavWrite16(p+2, x >> 16);
+    }
+    
+    void BMWavWrite64(unsigned char* p, uint64_t x){
+        BMWavWrite32(p, x & 0xFFFFFFFF);
+        BMWavWrite32(p+4, x >> 32);
+    }
+    
+    
+    
+    
+    
+    size_t BMWavBytesPerSample(BMWavSampleFormat format){
+        switch (format) {
+            case BMWAV_PCM16:
+                return 2;
+            case BMWAV_PCM24:
+                return 3;
+            default:
+                return 4;
+        }
+    }
+    
+    
+    
+    
+    
+    // cleans up after a failed open and records the reason
+    bool BMWavFileFail(BMWavFile* wav, const char* error){
+        if (wav->map && wav->map != MAP_FAILED) munmap(wav->map, wav->mapLength);
+        if (wav->fd >= 0) close(wav->fd);
+        wav->map = wav->data = NULL;
+        wav->fd = -1;
+        wav->error = error;
+        return false;
+    }
+    
+    
+    
+    
+    
+    bool BMWavFileOpenRead(BMWavFile* wav, const char* path){
+        memset(wav, 0, sizeof(BMWavFile));
+        wav->fd = open(path, O_RDONLY);
+        if (wav->fd < 0) return BMWavFileFail(wav, "can't open the input file");
+        
+        struct stat fileInfo;
+        if (fstat(wav->fd, &fileInfo) != 0) return BMWavFileFail(wav, "can't read the size of the input file");
+        wav->mapLength = (size_t)fileInfo.st_size;
+        if (wav->mapLength < 12) return BMWavFileFail(wav, "the input file is too short to be a WAV file");
+        
+        wav->map = mmap(NULL, wav->mapLength, PROT_READ, MAP_PRIVATE, wav->fd, 0);
+        if (wav->map == MAP_FAILED) return BMWavFileFail(wav, "can't map the input file");
+        // we read the file from start to end once
+        madvise(wav->map, wav->mapLength, MADV_SEQUENTIAL);
+        
+        const unsigned char* p = wav->map;
+        const unsigned char* end = wav->map + wav->mapLength;
+        bool isRF64 = memcmp(p, "RF64", 4) == 0;
+        if ((!isRF64 && memcmp(p, "RIFF", 4) != 0) || memcmp(p+8, "WAVE", 4) != 0)
+            return BMWavFileFail(wav, "the input file is not a WAV or RF64 file");
+        
+        
+        /*
+         * walk the chunks until we find the audio data
+         */
+        uint64_t rf64DataSize = 0;
+        uint16_t formatTag = 0, bitsPerSample = 0, blockAlign = 0;
+        p += 12;
+        while (p + 8 <= end) {
+            uint64_t chunkSize = BMWavRead32(p+4);
+            const unsigned char* chunk = p + 8;
+            bool isData = memcmp(p, "data", 4) == 0;
+            
+            // only the data chunk may run past the end of the file, when
+            // the file was truncated while being written. We don't read
+            // the fields of any other chunk that does.
+            if (!isData && chunkSize > (uint64_t)(end - chunk)) break;
+            
+            if (memcmp(p, "ds64", 4) == 0 && chunkSize >= 24)
+                rf64DataSize = BMWavRead64(chunk + 8);
+            
+            else if (memcmp(p, "fmt ", 4) == 0 && chunkSize >= 16) {
+                formatTag = BMWavRead16(chunk);
+                wav->numChannels = BMWavRead16(chunk + 2);
+                wav->sampleRate = BMWavRead32(chunk + 4);
+                blockAlign = BMWavRead16(chunk + 12);
+                bitsPerSample = BMWavRead16(chunk + 14);
+                
+                // the extensible format keeps the real format tag in the
+                // first two bytes of the sub-format GUID
+                if (formatTag == BMWAV_FORMAT_EXTENSIBLE && chunkSize >= 40)
+                    formatTag = BMWavRead16(chunk + 24);
+            }
+            
+            else if (isData) {
+                // in RF64 files the size in the chunk header is a placeholder
+                if (isRF64 && chunkSize == 0xFFFFFFFF) chunkSize = rf64DataSize;
+                
+                // tolerate files that were truncated while being written
+                if (chunkSize > (uint64_t)(end - chunk)) chunkSize = (uint64_t)(end - chunk);
+                
+                wav->data = (unsigned char*)chunk;
+                if (blockAlign != 0) wav->numFrames = (size_t)(chunkSize / blockAlign);
+                break;
+            }
+            
+            // chunks are padded to an even length
+            if (chunkSize == (uint64_t)(end - chunk)) break;
+            p = chunk + chunkSize + (chunkSize & 1);
+        }
+        
+        
+        /*
+         * check that we can read this format
+         */
+        if (!wav->data || formatTag == 0)
+            return BMWavFileFail(wav, "the input file has no fmt or data chunk");
+        
+        if (wav->numChannels == 0 || wav->sampleRate == 0)
+            return BMWavFileFail(wav, "the input file has no channels or a sample rate of 0");
+        
+        if (formatTag == BMWAV_FORMAT_PCM && bitsPerSample == 16)
+            wav->format = BMWAV_PCM16;
+        else if (formatTag == BMWAV_FORMAT_PCM && bitsPerSample == 24)
+            wav->format = BMWAV_PCM24;
+        else if (formatTag == BMWAV_FORMAT_PCM && bitsPerSample == 32)
+            wav->format = BMWAV_PCM32;
+        else if (formatTag == BMWAV_FORMAT_FLOAT && bitsPerSample == 32)
+            wav->format = BMWAV_FLOAT32;
+        else
+            return BMWavFileFail(wav, "the input sample format is not 16, 24 or 32 bit PCM or 32 bit float");
+        
+        wav->bytesPerSample = BMWavBytesPerSample(wav->format);
+        wav->bytesPerFrame = blockAlign;
+        if (wav->bytesPerFrame < wav->bytesPerSample*wav->numChannels)
+            return BMWavFileFail(wav, "the input file has an invalid block size");
+        
+        wav->writable = false;
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMWavFileCreate(BMWavFile* wav, const char* path, size_t numFrames, uint16_t numChannels, uint32_t sampleRate, BMWavSampleFormat format){
+        memset(wav, 0, sizeof(BMWavFile));
+        wav->numFrames = numFrames;
+        wav->numChannels = numChannels;
+        wav->sampleRate = sampleRate;
+        wav->format = format;
+        wav->bytesPerSample = BMWavBytesPerSample(format);
+        wav->bytesPerFrame = wav->bytesPerSample*numChannels;
+        
+        uint64_t dataSize = (uint64_t)numFrames * wav->bytesPerFrame;
+        uint64_t riffSize = BMWAV_HEADERLENGTH - 8 + dataSize + (dataSize & 1);
+        wav->mapLength = (size_t)(riffSize + 8);
+        
+        wav->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (wav->fd < 0) return BMWavFileFail(wav, "can't create the output file");
+        if (ftruncate(wav->fd, (off_t)wav->mapLength) != 0) return BMWavFileFail(wav, "can't set the size of the output file");
+        
+        wav->map = mmap(NULL, wav->mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, wav->fd, 0);
+        if (wav->map == MAP_FAILED) return BMWavFileFail(wav, "can't map the output file");
+        
+        
+        /*
+         * write the header
+         *
+         * We always reserve room for a ds64 chunk. Files that fit in 4 GB
+         * get a JUNK chunk there instead, which is what the EBU recommends
+         * so that RIFF readers skip it.
+         */
+        unsigned char* p = wav->map;
+        bool isRF64 = riffSize > 0xFFFFFFFF;
+        memcpy(p, isRF64 ? "RF64" : "RIFF", 4);
+        BMWavWrite32(p+4, isRF64 ? 0xFFFFFFFF : (uint32_t)riffSize);
+        memcpy(p+8, "WAVE", 4);
+        p += 12;
+        
+        memcpy(p, isRF64 ? "ds64" : "JUNK", 4);
+        BMWavWrite32(p+4, 28);
+        if (isRF64) {
+            BMWavWrite64(p+8, riffSize);
+            BMWavWrite64(p+16, dataSize);
+            BMWavWrite64(p+24, numFrames);
+            BMWavWrite32(p+32, 0);
+        }
+        p += 8+28;
+        
+        memcpy(p, "fmt ", 4);
+        BMWavWrite32(p+4, 16);
+        BMWavWrite16(p+8, format == BMWAV_FLOAT32 ? BMWAV_FORMAT_FLOAT : BMWAV_FORMAT_PCM);
+        BMWavWrite16(p+10, numChannels);
+        BMWavWrite32(p+12, sampleRate);
+        BMWavWrite32(p+16, (uint32_t)(sampleRate*wav->bytesPerFrame));
+        BMWavWrite16(p+20, (uint16_t)wav->bytesPerFrame);
+        BMWavWrite16(p+22, (uint16_t)(8*wav->bytesPerSample));
+        p += 8+16;
+        
+        memcpy(p, "data", 4);
+        BMWavWrite32(p+4, isRF64 ? 0xFFFFFFFF : (uint32_t)dataSize);
+        wav->data = p + 8;
+        
+        wav->writable = true;
+        return true;
+    }
+    
+    
+    
+    
+    
+    __inline float BMWavReadSample(const unsigned char* p, BMWavSampleFormat format){
+        switch (format) {
+            case BMWAV_PCM16:
+                return (float)(int16_t)BMWavRead16(p) * (1.0f / 32768.0f);
+            case BMWAV_PCM24:
+                // shift into the top of an int32 to sign-extend
+                return (float)((int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8) * (1.0f / 8388608.0f);
+            case BMWAV_PCM32:
+                return (float)((double)(int32_t)BMWavRead32(p) * (1.0 / 2147483648.0));
+            default: {
+                uint32_t bits = BMWavRead32(p);
+                float x;
+                memcpy(&x, &bits, sizeof(float));
+                return x;
+            }
+        }
+    }
+    
+    
+    
+    
+    
+    __inline void BMWavWriteSample(unsigned char* p, float x, BMWavSampleFormat format){
+        if (format == BMWAV_FLOAT32) {
+            uint32_t bits;
+            memcpy(&bits, &x, sizeof(float));
+            BMWavWrite32(p, bits);
+            return;
+        }
+        
+        // clip PCM output. (this also maps NaN to -1)
+        x = x > 1.0f ? 1.0f : (x >= -1.0f ? x : -1.0f);
+        
+        switch (format) {
+            case BMWAV_PCM16:
+                BMWavWrite16(p, (uint16_t)(int16_t)lrintf(x * 32767.0f));
+                break;
+            case BMWAV_PCM24: {
+                uint32_t y = (uint32_t)(int32_t)lrintf(x * 8388607.0f);
+                p[0] = y & 0xFF;
+                p[1] = (y >> 8) & 0xFF;
+                p[2] = (y >> 16) & 0xFF;
+                break;
+            }
+            default:
+                // float can't represent 2^31 - 1, so we scale in double
+                BMWavWrite32(p, (uint32_t)(int32_t)lrint((double)x * 2147483647.0));
+        }
+    }
+    
+    
+    
+    
+    
+    void BMWavFileReadFrames(const BMWavFile* wav, size_t startFrame, size_t numFrames, float* left, float* right){
+        const unsigned char* frame = wav->data + startFrame*wav->bytesPerFrame;
+        size_t rightOffset = wav->numChannels > 1 ? wav->bytesPerSample : 0;
+        
+        for (size_t i=0; i<numFrames; i++) {
+            left[i] = BMWavReadSample(frame, wav->format);
+            right[i] = BMWavReadSample(frame + rightOffset, wav->format);
+            frame += wav->bytesPerFrame;
+        }
+    }
+    
+    
+    
+    
+    
+    void BMWavFileWriteFrames(BMWavFile* wav, size_t startFrame, size_t numFrames, const float* left, const float* right){
+        unsigned char* frame = wav->data + startFrame*wav->bytesPerFrame;
+        
+        if (wav->numChannels == 1) {
+            for (size_t i=0; i<numFrames; i++) {
+                BMWavWriteSample(frame, 0.5f*(left[i] + right[i]), wav->format);
+                frame += wav->bytesPerFrame;
+            }
+            return;
+        }
+        
+        for (size_t i=0; i<numFrames; i++) {
+            BMWavWriteSample(frame, left[i], wav->format);
+            BMWavWriteSample(frame + wav->bytesPerSample, right[i], wav->format);
+            frame += wav->bytesPerFrame;
+        }
+    }
+    
+    
+    
+    
+    
+    bool BMWavFileSave(const char* path, const float* left, const float* right, size_t numFrames, uint32_t sampleRate, BMWavSampleFormat format, const char** error){
+        BMWavFile wav;
+        if (!BMWavFileCreate(&wav, path, numFrames, 2, sampleRate, format)) {
+            if (error) *error = wav.error;
+            return false;
+        }
+        
+        // the file is mapped, so the data goes to the disk in one msync
+        // when we close it
+        BMWavFileWriteFrames(&wav, 0, numFrames, left, right);
+        if (!BMWavFileClose(&wav)) {
+            if (error) *error = wav.error;
+            return false;
+        }
+        return true;
+    }
+    
+    
+    
+    
+    
+    bool BMWavFileSaveRaw(const char* path, const float* left, const float* right, size_t numFrames, const char** error){
+        float* interleaved = malloc(sizeof(float)*2*numFrames + 1);
+        if (!interleaved) {
+            if (error) *error = "not enough memory";
+            return false;
+        }
+        for (size_t i=0; i<numFrames; i++) {
+            interleaved[2*i] = left[i];
+            interleaved[2*i + 1] = right[i];
+        }
+        
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            free(interleaved);
+            if (error) *error = "can't create the output file";
+            return false;
+        }
+        
+        // write can return early for very large files, so finish the job
+        // in as many more calls as it takes
+        const char* bytes = (const char*)interleaved;
+        size_t remaining = sizeof(float)*2*numFrames;
+        bool success = true;
+        while (success && remaining > 0) {
+            ssize_t written = write(fd, bytes, remaining);
+            success = written > 0;
+            if (success) {
+                bytes += written;
+                remaining -= (size_t)written;
+            }
+        }
+        if (close(fd) != 0) success = false;
+        
+        free(interleaved);
+        if (!success && error) *error = "can't write the output file";
+        return success;
+    }
+    
+    
+    
+    
+    
+    bool BMWavFileClose(BMWavFile* wav){
+        bool success = true;
+        if (wav->map && wav->map != MAP_FAILED) {
+            // (the pad byte after an odd length data chunk is already zero
+            // because ftruncate fills the file with zeros)
+            if (wav->writable && msync(wav->map, wav->mapLength, MS_SYNC) != 0) success = false;
+            munmap(wav->map, wav->mapLength);
+        }
+        if (wav->fd >= 0 && close(wav->fd) != 0) success = false;
+        
+        wav->map = wav->data = NULL;
+        wav->fd = -1;
+        if (!success) wav->error = "can't write the output file";
+        return success;
+    }
+    
+    
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,91 @@
+//
+//  BMWavFile.h
+//  CReverb
+//
+//  Memory-mapped reading and writing of WAV and RF64 files. Samples are
+//  converted to and from deinterleaved float buffers directly in the
+//  mapped file, with no stdio buffering in between.
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#ifndef BMWavFile_h
+#define BMWavFile_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    
+    // sample formats we can read and write
+    typedef enum BMWavSampleFormat {
+        BMWAV_PCM16,
+        BMWAV_PCM24,
+        BMWAV_PCM32,
+        BMWAV_FLOAT32
+    } BMWavSampleFormat;
+    
+    
+    typedef struct BMWavFile {
+        int fd;
+        unsigned char *map, *data;
+        size_t mapLength, numFrames, bytesPerFrame, bytesPerSample;
+        uint32_t sampleRate;
+        uint16_t numChannels;
+        BMWavSampleFormat format;
+        bool writable;
+        // describes the last error, or NULL
+        const char* error;
+    } BMWavFile;
+    
+    
+    
+    // Opens a WAV or RF64 file for reading. Returns false and sets
+    // wav->error if the file can't be opened or isn't in one of the
+    // formats above.
+    bool BMWavFileOpenRead(BMWavFile* wav, const char* path);
+    
+    
+    // Creates a file with room for numFrames frames and maps it for
+    // writing. If the data won't fit in a 4 GB RIFF file we write RF64.
+    bool BMWavFileCreate(BMWavFile* wav, const char* path, size_t numFrames, uint16_t numChannels, uint32_t sampleRate, BMWavSampleFormat format);
+    
+    
+    // Converts numFrames frames starting at startFrame to float. Mono files
+    // are copied to both left and right. Files with more than two channels
+    // use the first two.
+    void BMWavFileReadFrames(const BMWavFile* wav, size_t startFrame, size_t numFrames, float* left, float* right);
+    
+    
+    // Converts numFrames frames to the sample format of the file and writes
+    // them starting at startFrame. PCM output is clipped to [-1, 1].
+    // Mono files get the average of left and right.
+    void BMWavFileWriteFrames(BMWavFile* wav, size_t startFrame, size_t numFrames, const float* left, const float* right);
+    
+    
+    // unmaps and closes the file. Returns false if writing it failed.
+    bool BMWavFileClose(BMWavFile* wav);
+    
+    
+    // Writes a whole stereo signal to a new WAV (or RF64) file in one go.
+    // Returns false and sets *error if error isn't NULL.
+    bool BMWavFileSave(const char* path, const float* left, const float* right, size_t numFrames, uint32_t sampleRate, BMWavSampleFormat format, const char** error);
+    
+    
+    // Writes a whole stereo signal to a headerless file of interleaved
+    // native-endian float32 samples, with a single call to write.
+    // Returns false and sets *error if error isn't NULL.
+    bool BMWavFileSaveRaw(const char* path, const float* left, const float* right, size_t numFrames, const char** error);
+    
+    
+    // returns the size in bytes of one sample
+    size_t BMWavBytesPerSample(BMWavSampleFormat format);
+    
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMWavFile_h */
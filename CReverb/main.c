@@ -6,19 +6,1413 @@
 //  Copyright © 2016 Hans. All rights reserved.
 //
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L // for nanosleep
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
+#include <assert.h>
+#include <string.h>
 #include "BMCReverb.h"
+#include "BMFastMath.h"
+#include "BMCReverbParallel.h"
+#include "BMWavFile.h"
+#include "BMCReverbAnalysis.h"
+#include "BMCReverbPool.h"
+#include "BMCReverbAsync.h"
+#include "BMCReverbGovernor.h"
+#include "BMCReverbAutotune.h"
+#include "BMCReverbTrace.h"
+#include "BMCReverbRTAudit.h"
 
 
 #define TESTBUFFERLENGTH 128
+#define BENCHMARKSECONDS 2
 
-int main(int argc, const char * argv[]) {
+
+// times the reverb with each mixing matrix over a range of network sizes
+// and prints the cost per sample and per delay
+void benchmarkMixingMatrices(void){
+    const char* matrixNames [4] = {"block-circulant", "hadamard", "householder", "permutation"};
+    BMCReverbMixingMatrix matrices [4] = {BMCREVERB_MATRIX_BLOCKCIRCULANT, BMCREVERB_MATRIX_HADAMARD, BMCREVERB_MATRIX_HOUSEHOLDER, BMCREVERB_MATRIX_PERMUTATION};
+    size_t numDelays [7] = {6, 8, 12, 16, 32, 64, 128};
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH];
+    float outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    printf("\nmixing matrix      delays   ns/sample   ns/sample/delay\n");
+    for (size_t m=0; m<4; m++) {
+        for (size_t n=0; n<7; n++) {
+            if (!BMCReverbMixingMatrixSupports(matrices[m], numDelays[n])) continue;
+            
+            struct BMCReverb rv;
+            BMCReverbInit(&rv);
+            BMCReverbSetMixingMatrix(&rv, matrices[m]);
+            BMCReverbSetNumDelays(&rv, numDelays[n]);
+            // apply the queued settings before timing
+            BMCReverbApplySettings(&rv);
+            
+            size_t numBuffers = BENCHMARKSECONDS * (size_t)BMCREVERB_DEFAULTSAMPLERATE / TESTBUFFERLENGTH;
+            clock_t begin = clock();
+            for (size_t b=0; b<numBuffers; b++)
+                BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+            double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+            
+            double nsPerSample = 1.0e9 * seconds / (double)(numBuffers*TESTBUFFERLENGTH);
+            printf("%-18s %6zu   %9.1f   %15.2f\n", matrixNames[m], numDelays[n], nsPerSample, nsPerSample / (double)numDelays[n]);
+            
+            BMCReverbFree(&rv);
+        }
+    }
+}
+
+
+
+// compares BMFastExp2 with exp2 over its whole input range and checks
+// that the error stays within the documented bound
+void verifyFastExp2(void){
+    const size_t length = 4096;
+    float x [length], y [length];
+    double maxError = 0.0;
+    
+    // 2^16 points per unit of input
+    for (float start = -125.0f; start < 126.0f; start += (float)length / 65536.0f) {
+        float step = 1.0f / 65536.0f;
+        vDSP_vramp(&start, &step, x, 1, length);
+        BMFastExp2(x, y, length);
+        
+        for (size_t i=0; i<length; i++) {
+            double exact = exp2((double)x[i]);
+            double error = fabs((double)y[i] - exact) / exact;
+            if (error > maxError) maxError = error;
+        }
+    }
+    
+    printf("BMFastExp2 max relative error: %g (bound %g)\n", maxError, BMFASTEXP2_MAXRELATIVEERROR);
+    assert(maxError <= BMFASTEXP2_MAXRELATIVEERROR);
+}
+
+
+
+// checks that reverbs sharing a design sound exactly like a reverb that
+// computed its own, including after one of them changes a setting, and
+// compares the time it takes to initialise them
+void verifySharedDesign(void){
+    const size_t numReverbs = 64;
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH];
+    float refL [TESTBUFFERLENGTH], refR [TESTBUFFERLENGTH];
+    float outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    // make a preset
+    struct BMCReverb reference;
+    BMCReverbInit(&reference);
+    BMCReverbSetNumDelayUnits(&reference, 8);
+    BMCReverbSetRT60DecayTime(&reference, 2.3);
+    BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(&reference);
+    
+    // time initialisation with and without the shared design
+    struct BMCReverb* bank = malloc(sizeof(struct BMCReverb)*numReverbs);
+    clock_t begin = clock();
+    for (size_t i=0; i<numReverbs; i++){
+        BMCReverbInit(&bank[i]);
+        BMCReverbSetNumDelayUnits(&bank[i], 8);
+        BMCReverbSetRT60DecayTime(&bank[i], 2.3);
+        BMCReverbProcessBuffer(&bank[i], inL, inR, outL, outR, TESTBUFFERLENGTH);
+    }
+    double ownSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    for (size_t i=0; i<numReverbs; i++) BMCReverbFree(&bank[i]);
+    begin = clock();
+    for (size_t i=0; i<numReverbs; i++)
+        BMCReverbInitWithDesign(&bank[i], design);
+    double sharedSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    printf("init %zu reverbs: %f s with their own designs, %f s sharing one\n", numReverbs, ownSeconds, sharedSeconds);
+    
+    // the instances that share the design must match the reference
+    for (size_t b=0; b<8; b++){
+        // change the decay time half way through. This makes the first
+        // instance copy the design at the end of the buffer, so the
+        // change reaches it one buffer later than the reference.
+        if (b == 4) BMCReverbSetRT60DecayTime(&bank[0], 0.8);
+        if (b == 5) BMCReverbSetRT60DecayTime(&reference, 0.8);
+        BMCReverbProcessBuffer(&reference, inL, inR, refL, refR, TESTBUFFERLENGTH);
+        BMCReverbProcessBuffer(&bank[0], inL, inR, outL, outR, TESTBUFFERLENGTH);
+        assert(memcmp(refL, outL, sizeof(refL)) == 0);
+        assert(memcmp(refR, outR, sizeof(refR)) == 0);
+    }
+    assert(bank[0].design != design && bank[1].design == design);
+    
+    BMCReverbDesignRelease(design);
+    for (size_t i=0; i<numReverbs; i++) BMCReverbFree(&bank[i]);
+    BMCReverbFree(&reference);
+    free(bank);
+}
+
+
+
+// input and output buffers for verifyParallelRender
+typedef struct ParallelTestBuffers {
+    const float *inL, *inR;
+    float *outL, *outR;
+} ParallelTestBuffers;
+
+
+
+void readTestInput(void* context, size_t startFrame, size_t numFrames, float* left, float* right){
+    ParallelTestBuffers* buffers = context;
+    memcpy(left, buffers->inL + startFrame, sizeof(float)*numFrames);
+    memcpy(right, buffers->inR + startFrame, sizeof(float)*numFrames);
+}
+
+
+
+void writeTestOutput(void* context, size_t startFrame, size_t numFrames, const float* left, const float* right){
+    ParallelTestBuffers* buffers = context;
+    memcpy(buffers->outL + startFrame, left, sizeof(float)*numFrames);
+    memcpy(buffers->outR + startFrame, right, sizeof(float)*numFrames);
+}
+
+
+
+// checks that rendering in parallel chunks matches rendering the whole
+// signal with one reverb, within BMCREVERB_PARALLEL_MAXERROR
+void verifyParallelRender(void){
+    const size_t numThreads = 4;
+    const size_t numInputFrames = 10*44100, numOutputFrames = 13*44100;
+    float* inL = calloc(numOutputFrames, sizeof(float));
+    float* inR = calloc(numOutputFrames, sizeof(float));
+    float* refL = malloc(sizeof(float)*numOutputFrames);
+    float* refR = malloc(sizeof(float)*numOutputFrames);
+    float* outL = malloc(sizeof(float)*numOutputFrames);
+    float* outR = malloc(sizeof(float)*numOutputFrames);
+    
+    // noise bursts, so that some chunks start in silence and some don't
+    for (size_t i=0; i<numInputFrames; i++)
+        if ((i / 30000) % 3 != 2) {
+            inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        }
+    
+    struct BMCReverb rv;
+    BMCReverbInit(&rv);
+    BMCReverbSetRT60DecayTime(&rv, 2.0);
+    BMCReverbSetCrossStereoMix(&rv, 0.3f);
+    BMCReverbSetWetGain(&rv, 0.7f);
+    
+    // render in parallel first, because that applies the settings without
+    // processing anything
+    clock_t begin = clock();
+    ParallelTestBuffers buffers = {inL, inR, outL, outR};
+    bool success = BMCReverbRenderParallel(&rv, numInputFrames, numOutputFrames, readTestInput, writeTestOutput, &buffers, numThreads, BMCREVERB_PARALLEL_THRESHOLD_DB);
+    assert(success);
+    double parallelSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    
+    // the reference. The input is zero after numInputFrames.
+    begin = clock();
+    for (size_t i=0; i<numOutputFrames; i += TESTBUFFERLENGTH){
+        size_t n = numOutputFrames - i < TESTBUFFERLENGTH ? numOutputFrames - i : TESTBUFFERLENGTH;
+        BMCReverbProcessBuffer(&rv, inL+i, inR+i, refL+i, refR+i, n);
+    }
+    double sequentialSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    
+    float peak = 0.0f, error = 0.0f;
+    for (size_t i=0; i<numOutputFrames; i++){
+        peak = fmaxf(peak, fmaxf(fabsf(refL[i]), fabsf(refR[i])));
+        error = fmaxf(error, fmaxf(fabsf(refL[i] - outL[i]), fabsf(refR[i] - outR[i])));
+    }
+    printf("parallel render: max error %g of peak, cpu time %f s on %zu threads, %f s on one\n", error / peak, parallelSeconds, numThreads, sequentialSeconds);
+    assert(error <= BMCREVERB_PARALLEL_MAXERROR * peak);
+    
+    BMCReverbFree(&rv);
+    free(inL);
+    free(inR);
+    free(refL);
+    free(refR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// checks that a reverb switching between the network and its frozen
+// impulse response sounds like one that always runs the network, and
+// that auto mode picks the cheaper path
+void verifyFrozenIR(void){
+    const size_t numFrames = 5*44100, freezeFrame = 44100;
+    float* inL = calloc(numFrames, sizeof(float));
+    float* inR = calloc(numFrames, sizeof(float));
+    float* refL = malloc(sizeof(float)*numFrames);
+    float* refR = malloc(sizeof(float)*numFrames);
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    
+    // noise for three seconds, then silence
+    for (size_t i=0; i<3*44100; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    struct BMCReverb network, frozen;
+    BMCReverbInitWithCapacity(&network, 44100.0, 32, BMCREVERB_PREDELAY, BMCREVERB_ROOMSIZE);
+    BMCReverbSetNumDelayUnits(&network, 32);
+    BMCReverbSetRT60DecayTime(&network, 0.3f);
+    BMCReverbSetWetGain(&network, 1.0f);
+    BMCReverbDesign* design = BMCReverbDesignCreateFromReverb(&network);
+    BMCReverbInitWithDesign(&frozen, design);
+    BMCReverbCopyMixSettings(&frozen, &network);
+    BMCReverbDesignRelease(design);
+    
+    // the response renders in the background while the reverb keeps
+    // running the network. A host calls back in real time, so we let the
+    // background thread run between buffers until it's ready, and thaw a
+    // second after the reverb has frozen.
+    struct timespec period = {0, (long)(1.0e9 * TESTBUFFERLENGTH / 44100.0)};
+    double networkSeconds = 0.0, frozenSeconds = 0.0;
+    size_t frozenFrames = 0, thawFrame = SIZE_MAX;
+    for (size_t i=0; i<numFrames; i += TESTBUFFERLENGTH){
+        size_t n = numFrames - i < TESTBUFFERLENGTH ? numFrames - i : TESTBUFFERLENGTH;
+        if (i <= freezeFrame && freezeFrame < i+n) BMCReverbSetFrozenIRMode(&frozen, BMCREVERB_FROZENIR_ON);
+        if (BMCReverbIsFrozen(&frozen) && thawFrame == SIZE_MAX) thawFrame = i + 44100;
+        if (i <= thawFrame && thawFrame < i+n) BMCReverbSetFrozenIRMode(&frozen, BMCREVERB_FROZENIR_OFF);
+        
+        clock_t begin = clock();
+        BMCReverbProcessBuffer(&network, inL+i, inR+i, refL+i, refR+i, n);
+        networkSeconds += (double)(clock() - begin) / CLOCKS_PER_SEC;
+        
+        // time the frozen reverb only while it is fully frozen
+        begin = clock();
+        BMCReverbProcessBuffer(&frozen, inL+i, inR+i, outL+i, outR+i, n);
+        if (BMCReverbIsFrozen(&frozen) && frozen.idleFramesLeft == 0) {
+            frozenSeconds += (double)(clock() - begin) / CLOCKS_PER_SEC;
+            frozenFrames += n;
+        }
+        if (frozen.freezePending)
+            nanosleep(&period, NULL);
+    }
+    
+    float peak = 0.0f, error = 0.0f;
+    for (size_t i=0; i<numFrames; i++){
+        peak = fmaxf(peak, fmaxf(fabsf(refL[i]), fabsf(refR[i])));
+        error = fmaxf(error, fmaxf(fabsf(refL[i] - outL[i]), fabsf(refR[i] - outR[i])));
+    }
+    printf("frozen impulse response: max error %g of peak\n", error / peak);
+    printf("    ns/sample: network %.1f, frozen %.1f\n", 1.0e9 * networkSeconds / (double)numFrames, 1.0e9 * frozenSeconds / (double)frozenFrames);
+    assert(error <= 1.0e-3f * peak);
+    assert(frozenFrames > 0);
+    
+    // auto mode should convolve a big network with a short decay, but
+    // not the default network. Applying the settings renders the
+    // response here rather than in the background.
+    BMCReverbSetFrozenIRMode(&network, BMCREVERB_FROZENIR_AUTO);
+    BMCReverbApplySettings(&network);
+    assert(BMCReverbIsFrozen(&network));
+    BMCReverbSetNumDelayUnits(&network, BMCREVERB_NUMDELAYUNITS);
+    BMCReverbApplySettings(&network);
+    assert(!BMCReverbIsFrozen(&network));
+    
+    BMCReverbFree(&network);
+    BMCReverbFree(&frozen);
+    free(inL);
+    free(inR);
+    free(refL);
+    free(refR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// warms up a reverb, then checks that a reverb restored from a snapshot
+// of it and a fork of it continue with exactly the same output, both
+// running the network and frozen
+void verifySnapshots(void){
+    const size_t warmFrames = 44100, numFrames = 44100;
+    float* inL = malloc(sizeof(float)*(warmFrames + numFrames));
+    float* inR = malloc(sizeof(float)*(warmFrames + numFrames));
+    float* outL [3], * outR [3];
+    for (size_t j=0; j<3; j++){
+        outL[j] = malloc(sizeof(float)*numFrames);
+        outR[j] = malloc(sizeof(float)*numFrames);
+    }
+    for (size_t i=0; i<warmFrames + numFrames; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    for (int frozen=0; frozen<2; frozen++){
+        struct BMCReverb original, restored, forked;
+        BMCReverbInit(&original);
+        BMCReverbSetRT60DecayTime(&original, frozen ? 0.3f : 2.0f);
+        BMCReverbSetWetGain(&original, 1.0f);
+        if (frozen) BMCReverbSetFrozenIRMode(&original, BMCREVERB_FROZENIR_ON);
+        // the LFO phases are part of the state of the network
+        else BMCReverbSetModulation(&original, 0.0003f, 0.5f);
+        // and the input diffusion and the resampling filters have state
+        // in both modes
+        BMCReverbSetDiffusion(&original, 4, NULL);
+        BMCReverbSetDecimation(&original, 2);
+        BMCReverbApplySettings(&original);
+        for (size_t i=0; i<warmFrames; i += TESTBUFFERLENGTH){
+            size_t n = warmFrames - i < TESTBUFFERLENGTH ? warmFrames - i : TESTBUFFERLENGTH;
+            BMCReverbProcessBuffer(&original, inL+i, inR+i, outL[0], outR[0], n);
+        }
+        assert(BMCReverbIsFrozen(&original) == frozen);
+        
+        size_t size = BMCReverbSnapshotSize(&original);
+        void* snapshot = malloc(size);
+        assert(BMCReverbSaveSnapshot(&original, snapshot, size - 1) == 0);
+        assert(BMCReverbSaveSnapshot(&original, snapshot, size) == size);
+        BMCReverbInit(&restored);
+        assert(!BMCReverbRestoreSnapshot(&restored, snapshot, size - 1));
+        assert(BMCReverbRestoreSnapshot(&restored, snapshot, size));
+        assert(BMCReverbFork(&forked, &original));
+        
+        struct BMCReverb* reverbs [3] = {&original, &restored, &forked};
+        for (size_t j=0; j<3; j++)
+            for (size_t i=0; i<numFrames; i += TESTBUFFERLENGTH){
+                size_t n = numFrames - i < TESTBUFFERLENGTH ? numFrames - i : TESTBUFFERLENGTH;
+                BMCReverbProcessBuffer(reverbs[j], inL+warmFrames+i, inR+warmFrames+i, outL[j]+i, outR[j]+i, n);
+            }
+        for (size_t j=1; j<3; j++){
+            assert(memcmp(outL[0], outL[j], sizeof(float)*numFrames) == 0);
+            assert(memcmp(outR[0], outR[j], sizeof(float)*numFrames) == 0);
+        }
+        printf("snapshot and fork (%s): %zu bytes, output identical\n", frozen ? "frozen" : "network", size);
+        
+        free(snapshot);
+        for (size_t j=0; j<3; j++)
+            BMCReverbFree(reverbs[j]);
+    }
+    
+    free(inL);
+    free(inR);
+    for (size_t j=0; j<3; j++){
+        free(outL[j]);
+        free(outR[j]);
+    }
+}
+
+
+
+// dirties every reverb in a pool, then checks that a reverb acquired
+// again after its release sounds exactly like a new one, and that
+// settings queued while a voice was in use are applied on release
+void verifyVoicePool(void){
+    const size_t numVoices = 8, numFrames = 22050;
+    float* inL = malloc(sizeof(float)*numFrames);
+    float* inR = malloc(sizeof(float)*numFrames);
+    float* refL = malloc(sizeof(float)*numFrames);
+    float* refR = malloc(sizeof(float)*numFrames);
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    for (size_t i=0; i<numFrames; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    struct BMCReverb prototype;
+    BMCReverbInit(&prototype);
+    BMCReverbSetRT60DecayTime(&prototype, 2.0f);
+    BMCReverbSetWetGain(&prototype, 1.0f);
+    BMCReverbPool pool;
+    bool initialised = BMCReverbPoolInit(&pool, &prototype, numVoices);
+    assert(initialised);
+    
+    // the reference has never processed anything
+    BMCReverbApplySettings(&prototype);
+    BMCReverbProcessBuffer(&prototype, inL, inR, refL, refR, numFrames);
+    
+    // fill the delays of every voice
+    struct BMCReverb* voices [numVoices];
+    for (size_t i=0; i<numVoices; i++){
+        voices[i] = BMCReverbPoolAcquire(&pool);
+        assert(voices[i]);
+        BMCReverbProcessBuffer(voices[i], inL, inR, outL, outR, numFrames);
+    }
+    assert(BMCReverbPoolAcquire(&pool) == NULL);
+    
+    clock_t begin = clock();
+    for (size_t i=0; i<numVoices; i++)
+        BMCReverbPoolRelease(&pool, voices[i]);
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    
+    struct BMCReverb* rv = BMCReverbPoolAcquire(&pool);
+    BMCReverbProcessBuffer(rv, inL, inR, outL, outR, numFrames);
+    assert(memcmp(refL, outL, sizeof(float)*numFrames) == 0);
+    assert(memcmp(refR, outR, sizeof(float)*numFrames) == 0);
+    printf("voice pool: reused voice matches a new reverb, release takes %.0f ns\n", 1.0e9 * seconds / (double)numVoices);
+    
+    BMCReverbSetRT60DecayTime(rv, 1.0f);
+    BMCReverbPoolRelease(&pool, rv);
+    for (size_t i=0; i<numVoices; i++){
+        voices[i] = BMCReverbPoolAcquire(&pool);
+        assert(!voices[i]->settingsQueuedForUpdate && !voices[i]->decayCoefficientsQueuedForUpdate);
+    }
+    assert(rv->rt60 == 1.0f && rv->design->rt60 == 1.0f);
+    for (size_t i=0; i<numVoices; i++)
+        BMCReverbPoolRelease(&pool, voices[i]);
+    BMCReverbPoolFree(&pool);
+    BMCReverbFree(&prototype);
+    free(inL);
+    free(inR);
+    free(refL);
+    free(refR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// checks that a send bus sounds like the wet output of a reverb fed with
+// the sum of the sends
+void verifySendBus(void){
+    enum {numSources = 3};
+    const size_t numFrames = 44100;
+    const float sendGains [numSources] = {1.0f, 0.5f, 0.0f};
+    float* inputs [numSources];
+    for (size_t j=0; j<numSources; j++){
+        inputs[j] = malloc(sizeof(float)*numFrames);
+        for (size_t i=0; i<numFrames; i++)
+            inputs[j][i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    float* sumL = calloc(numFrames, sizeof(float));
+    float* sumR = calloc(numFrames, sizeof(float));
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    
+    // the first two sources are mono, the third is the right channel of
+    // a stereo pair with the first
+    const float* inputsL [numSources] = {inputs[0], inputs[1], inputs[0]};
+    const float* inputsR [numSources] = {inputs[0], inputs[1], inputs[2]};
+    for (size_t j=0; j<numSources; j++)
+        for (size_t i=0; i<numFrames; i++){
+            sumL[i] += sendGains[j] * inputsL[j][i];
+            sumR[i] += sendGains[j] * inputsR[j][i];
+        }
+    
+    struct BMCReverb bus, reference;
+    BMCReverbInit(&bus);
+    BMCReverbInit(&reference);
+    BMCReverbSetWetGain(&reference, 1.0f);
+    
+    float peak = 0.0f, error = 0.0f;
+    for (size_t i=0; i<numFrames; i += TESTBUFFERLENGTH){
+        size_t n = numFrames - i < TESTBUFFERLENGTH ? numFrames - i : TESTBUFFERLENGTH;
+        const float* blocksL [numSources], * blocksR [numSources];
+        for (size_t j=0; j<numSources; j++){
+            blocksL[j] = inputsL[j] + i;
+            blocksR[j] = inputsR[j] + i;
+        }
+        BMCReverbProcessSends(&bus, blocksL, blocksR, sendGains, numSources, outL+i, outR+i, n);
+        BMCReverbProcessBuffer(&reference, sumL+i, sumR+i, sumL+i, sumR+i, n);
+    }
+    for (size_t i=0; i<numFrames; i++){
+        peak = fmaxf(peak, fmaxf(fabsf(sumL[i]), fabsf(sumR[i])));
+        error = fmaxf(error, fmaxf(fabsf(sumL[i] - outL[i]), fabsf(sumR[i] - outR[i])));
+    }
+    printf("send bus: max error %g of peak\n", error / peak);
+    assert(error <= 1.0e-5f * peak);
+    
+    BMCReverbFree(&bus);
+    BMCReverbFree(&reference);
+    for (size_t j=0; j<numSources; j++)
+        free(inputs[j]);
+    free(sumL);
+    free(sumR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// runs the wet path on a worker thread in real time and checks that the
+// output is the output of BMCReverbProcessBuffer, delayed by the latency
+void verifyAsync(void){
+    const size_t numFrames = 44100;
+    float* inL = malloc(sizeof(float)*numFrames);
+    float* inR = malloc(sizeof(float)*numFrames);
+    float* refL = malloc(sizeof(float)*numFrames);
+    float* refR = malloc(sizeof(float)*numFrames);
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    for (size_t i=0; i<numFrames; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    struct BMCReverb rv, reference;
+    BMCReverbInit(&rv);
+    BMCReverbInit(&reference);
+    BMCReverbSetWetGain(&rv, 0.5f);
+    BMCReverbSetWetGain(&reference, 0.5f);
+    BMCReverbAsync async;
+    bool started = BMCReverbAsyncInit(&async, &rv, TESTBUFFERLENGTH);
+    assert(started);
+    size_t latency = BMCReverbAsyncLatency(&async);
+    
+    // call back once per block period
+    struct timespec period = {0, (long)(1.0e9 * TESTBUFFERLENGTH / 44100.0)};
+    double callbackSeconds = 0.0;
+    for (size_t i=0; i<numFrames; i += TESTBUFFERLENGTH){
+        size_t n = numFrames - i < TESTBUFFERLENGTH ? numFrames - i : TESTBUFFERLENGTH;
+        // the CPU time of this thread only. clock() would also count the
+        // worker when it runs during the callback.
+        struct timespec begin, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+        BMCReverbAsyncProcessBuffer(&async, inL+i, inR+i, outL+i, outR+i, n);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+        callbackSeconds += (double)(end.tv_sec - begin.tv_sec) + 1.0e-9 * (double)(end.tv_nsec - begin.tv_nsec);
+        BMCReverbProcessBuffer(&reference, inL+i, inR+i, refL+i, refR+i, n);
+        nanosleep(&period, NULL);
+    }
+    size_t underruns = BMCReverbAsyncUnderruns(&async);
+    BMCReverbAsyncFree(&async);
+    
+    printf("async: latency %zu frames, %zu underruns, callback %.1f ns/sample\n", latency, underruns, 1.0e9 * callbackSeconds / (double)numFrames);
+    for (size_t i=0; i<latency; i++)
+        assert(outL[i] == 0.0f && outR[i] == 0.0f);
+    // late wet output is replaced with silence, so the output only
+    // matches if the worker kept up
+    if (underruns == 0) {
+        assert(memcmp(refL, outL+latency, sizeof(float)*(numFrames - latency)) == 0);
+        assert(memcmp(refR, outR+latency, sizeof(float)*(numFrames - latency)) == 0);
+    }
+    
+    BMCReverbFree(&rv);
+    BMCReverbFree(&reference);
+    free(inL);
+    free(inR);
+    free(refL);
+    free(refR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// checks that the governor steps the network down to the smallest size
+// when the budget is too small, and back up when it is large
+void verifyGovernor(void){
+    BMCReverbGovernorModel model;
+    clock_t begin = clock();
+    BMCReverbGovernorCalibrate(&model);
+    double calibrationSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    printf("governor model: %.1f ns/frame + %.2f ns/frame/delay + %.1f ns/buffer (calibrated in %.2f s)\n", 1.0e9 * model.perFrame, 1.0e9 * model.perDelay, 1.0e9 * model.perBuffer, calibrationSeconds);
+    
+    struct BMCReverb prototype;
+    BMCReverbInit(&prototype);
+    BMCReverbSetNumDelayUnits(&prototype, 16);
+    BMCReverbSetWetGain(&prototype, 1.0f);
+    BMCReverbGovernor governor;
+    bool initialised = BMCReverbGovernorInit(&governor, &prototype, 1, 1.0e-6f, NULL, &model);
+    assert(initialised);
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    BMCReverbGovernorStatus status;
+    const size_t numBuffers = 6 * 44100 / TESTBUFFERLENGTH;
+    struct timespec period = {0, (long)(1.0e9 * TESTBUFFERLENGTH / 44100.0)};
+    for (size_t pass=0; pass<2; pass++){
+        // an impossible budget, then a generous one
+        BMCReverbGovernorSetBudget(&governor, pass == 0 ? 1.0e-6f : 10.0f);
+        for (size_t b=0; b<numBuffers; b++){
+            for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+                inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+                inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            }
+            // the switch itself must be real-time safe
+            BMCReverbRTAuditBegin();
+            BMCReverbGovernorProcessBuffer(&governor, inL, inR, outL, outR, TESTBUFFERLENGTH);
+            BMCReverbRTAuditEnd();
+            for (size_t i=0; i<TESTBUFFERLENGTH; i++)
+                assert(isfinite(outL[i]) && isfinite(outR[i]));
+            
+            // we run faster than real time, so give the background thread
+            // the time it would have had
+            BMCReverbGovernorGetStatus(&governor, &status);
+            if (status.preparing)
+                nanosleep(&period, NULL);
+        }
+        BMCReverbGovernorGetStatus(&governor, &status);
+        printf("governor: level %zu of %zu, %zu delay units, load %.4f, predicted %.4f, headroom %.4f\n", status.level, status.numLevels, status.delayUnits, status.load, BMCReverbGovernorPredictLoad(&model, status.delayUnits, TESTBUFFERLENGTH, 44100.0f), status.headroom);
+        assert(status.level == (pass == 0 ? status.numLevels - 1 : 0));
+    }
+    
+    BMCReverbGovernorFree(&governor);
+    BMCReverbFree(&prototype);
+}
+
+
+
+// checks that every kernel and chunk length gives the same output, and
+// that the autotuner finds its result in the cache on the second run
+void verifyAutotune(void){
+    struct BMCReverb reference, scalar, blocked;
+    BMCReverbInit(&reference);
+    BMCReverbInit(&scalar);
+    BMCReverbInit(&blocked);
+    BMCReverbSetWetGain(&reference, 1.0f);
+    BMCReverbSetWetGain(&scalar, 1.0f);
+    BMCReverbSetWetGain(&blocked, 1.0f);
+    BMCReverbSetKernel(&scalar, BMCREVERB_KERNEL_SCALAR);
+    BMCReverbSetChunkLength(&scalar, 100);
+    BMCReverbSetKernel(&blocked, BMCREVERB_KERNEL_BLOCKED);
+    BMCReverbSetChunkLength(&blocked, 64);
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], refL [TESTBUFFERLENGTH], refR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    for (size_t b=0; b<2000; b++){
+        for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+            inL[i] = b < 500 ? (float)rand() / (float)RAND_MAX - 0.5f : 0.0f;
+            inR[i] = b < 500 ? (float)rand() / (float)RAND_MAX - 0.5f : 0.0f;
+        }
+        // try the slow decay filters too
+        BMCReverbSetSlowDecayState(&reference, b >= 1000);
+        BMCReverbSetSlowDecayState(&scalar, b >= 1000);
+        BMCReverbSetSlowDecayState(&blocked, b >= 1000);
+        BMCReverbProcessBuffer(&reference, inL, inR, refL, refR, TESTBUFFERLENGTH);
+        BMCReverbProcessBuffer(&scalar, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        assert(memcmp(refL, outL, sizeof(refL)) == 0 && memcmp(refR, outR, sizeof(refR)) == 0);
+        BMCReverbProcessBuffer(&blocked, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        assert(memcmp(refL, outL, sizeof(refL)) == 0 && memcmp(refR, outR, sizeof(refR)) == 0);
+    }
+    
+    const char* cachePath = "BMCReverbAutotune.cache";
+    remove(cachePath);
+    char cpu [256];
+    BMCReverbAutotuneCPUModel(cpu, sizeof(cpu));
+    clock_t begin = clock();
+    bool cached = BMCReverbAutotune(&reference, TESTBUFFERLENGTH, cachePath);
+    double measureSeconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    assert(!cached);
+    BMCReverbKernel kernel = reference.kernel;
+    size_t chunkLength = reference.chunkLength;
+    BMCReverbSetKernel(&reference, BMCREVERB_KERNEL_VECTOR);
+    BMCReverbSetChunkLength(&reference, BMCREVERB_CHUNKLENGTH);
+    cached = BMCReverbAutotune(&reference, TESTBUFFERLENGTH, cachePath);
+    assert(cached && reference.kernel == kernel && reference.chunkLength == chunkLength);
+    const char* kernelNames [] = {"vector", "scalar", "blocked"};
+    printf("autotune on %s: %s kernel, chunks of %zu (measured in %.2f s)\n", cpu, kernelNames[kernel], chunkLength, measureSeconds);
+    remove(cachePath);
+    
+    BMCReverbFree(&reference);
+    BMCReverbFree(&scalar);
+    BMCReverbFree(&blocked);
+}
+
+
+
+// checks that NaN, infinite and huge input samples anywhere in a buffer
+// give the same output as silence in their place, and that the reverb
+// recovers from a fault in its state
+void verifySanitisation(void){
+    struct BMCReverb rv, reference;
+    BMCReverbInit(&rv);
+    BMCReverbInit(&reference);
+    BMCReverbSetSlowDecayState(&rv, true);
+    BMCReverbSetSlowDecayState(&reference, true);
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], refInL [TESTBUFFERLENGTH], refInR [TESTBUFFERLENGTH];
+    float outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH], refL [TESTBUFFERLENGTH], refR [TESTBUFFERLENGTH];
+    const float bad [] = {NAN, INFINITY, -INFINITY, 1.0e30f, -2.0f * BMCREVERB_INPUTLIMIT};
+    const size_t numBad = sizeof(bad)/sizeof(bad[0]);
+    const size_t numBuffers = 200;
+    size_t numReplaced = 0;
+    double maxError = 0.0;
+    for (size_t b=0; b<numBuffers; b++){
+        for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+            refInL[i] = inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            refInR[i] = inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        }
+        // a bad sample at a random position in every tenth buffer
+        if (b % 10 == 5) {
+            size_t i = (size_t)rand() % TESTBUFFERLENGTH;
+            float* in = b % 20 == 5 ? inL : inR;
+            float* refIn = b % 20 == 5 ? refInL : refInR;
+            in[i] = bad[(b / 10) % numBad];
+            refIn[i] = 0.0f;
+            numReplaced++;
+        }
+        BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        BMCReverbProcessBuffer(&reference, refInL, refInR, refL, refR, TESTBUFFERLENGTH);
+        for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+            maxError = fmax(maxError, fabs((double)outL[i] - (double)refL[i]));
+            maxError = fmax(maxError, fabs((double)outR[i] - (double)refR[i]));
+        }
+    }
+    
+    // a fault in the network state is cleared at the end of the buffer
+    rv.feedbackBuffers[3] = NAN;
+    for (size_t b=0; b<2; b++)
+        BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+    bool finite = true;
+    for (size_t i=0; i<TESTBUFFERLENGTH; i++)
+        finite &= isfinite(outL[i]) && isfinite(outR[i]);
+    
+    uint64_t sanitised, faults;
+    BMCReverbGetFaultCounts(&rv, &sanitised, &faults);
+    printf("sanitisation: max error %g, %llu samples replaced, %llu faults recovered\n", maxError, (unsigned long long)sanitised, (unsigned long long)faults);
+    assert(maxError == 0.0);
+    assert(sanitised == numReplaced);
+    assert(faults == 1 && finite);
+    
+    BMCReverbFree(&rv);
+    BMCReverbFree(&reference);
+}
+
+
+
+// the configurations in verifyModulation
+void configureModulation(void* context, size_t index, struct BMCReverb* rv){
+    BMCReverbSetNumDelayUnits(rv, index == 2 ? 16 : 4);
+    BMCReverbSetModulation(rv, index == 1 ? 0.0003f : 0.0f, 0.5f);
+    BMCReverbSetRT60DecayTime(rv, 2.0f);
+}
+
+
+
+// checks that modulation doesn't change the decay time and that both
+// kernels still agree, and compares a modulated network of 4 delay units
+// with static ones of 4 and 16
+void verifyModulation(void){
+    BMCReverbAnalysis results [3];
+    bool success = BMCReverbAnalyseConfigurations(3, configureModulation, NULL, results, 6.0f, 3);
+    assert(success);
+    const char* names [3] = {"4 units", "4 units modulated", "16 units"};
+    printf("network             rt60  measured  mixing time  correlation\n");
+    for (size_t i=0; i<3; i++)
+        printf("%-18s  %4.2f  %8.3f  %11.3f  %11.3f\n", names[i], results[i].rt60, results[i].measuredRT60, results[i].mixingTime, results[i].correlation);
+    assert(fabsf(results[1].measuredRT60 - results[0].measuredRT60) <= 0.1f * results[0].measuredRT60);
+    
+    for (int interpolation=0; interpolation<2; interpolation++){
+        struct BMCReverb vector, scalar;
+        BMCReverbInit(&vector);
+        BMCReverbInit(&scalar);
+        BMCReverbSetModulation(&vector, 0.0005f, 1.0f);
+        BMCReverbSetInterpolation(&vector, (BMCReverbInterpolation)interpolation);
+        BMCReverbCopySettings(&scalar, &vector);
+        BMCReverbSetKernel(&scalar, BMCREVERB_KERNEL_SCALAR);
+        
+        float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], refL [TESTBUFFERLENGTH], refR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+        bool identical = true;
+        for (size_t b=0; b<200; b++){
+            for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+                inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+                inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            }
+            BMCReverbProcessBuffer(&vector, inL, inR, refL, refR, TESTBUFFERLENGTH);
+            BMCReverbProcessBuffer(&scalar, inL, inR, outL, outR, TESTBUFFERLENGTH);
+            identical &= memcmp(refL, outL, sizeof(refL)) == 0 && memcmp(refR, outR, sizeof(refR)) == 0;
+        }
+        assert(identical);
+        
+        BMCReverbFree(&vector);
+        BMCReverbFree(&scalar);
+    }
+    
+    // a reset leaves the delay memory as it is and reads it as zero until
+    // it is written again. The modulated reads must hear the same as they
+    // would from memory that really was cleared.
+    for (int interpolation=0; interpolation<2; interpolation++){
+        struct BMCReverb reset, cleared;
+        BMCReverbInit(&reset);
+        BMCReverbInit(&cleared);
+        BMCReverbSetModulation(&reset, 0.0005f, 1.0f);
+        BMCReverbSetInterpolation(&reset, (BMCReverbInterpolation)interpolation);
+        BMCReverbCopySettings(&cleared, &reset);
+        BMCReverbApplySettings(&reset);
+        BMCReverbApplySettings(&cleared);
+        
+        float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], refL [TESTBUFFERLENGTH], refR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+        for (size_t b=0; b<100; b++){
+            for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+                inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+                inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            }
+            BMCReverbProcessBuffer(&reset, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        }
+        BMCReverbReset(&reset);
+        memset(cleared.delayLines, 0, sizeof(float)*cleared.totalSamples);
+        cleared.framesSinceReset = cleared.longestDelay;
+        
+        bool identical = true;
+        for (size_t b=0; b<200; b++){
+            for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+                inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+                inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            }
+            BMCReverbProcessBuffer(&cleared, inL, inR, refL, refR, TESTBUFFERLENGTH);
+            BMCReverbProcessBuffer(&reset, inL, inR, outL, outR, TESTBUFFERLENGTH);
+            identical &= memcmp(refL, outL, sizeof(refL)) == 0 && memcmp(refR, outR, sizeof(refR)) == 0;
+        }
+        assert(identical);
+        
+        BMCReverbFree(&reset);
+        BMCReverbFree(&cleared);
+    }
+}
+
+
+
+// the configurations in verifyDiffusion
+static const size_t diffusionDelayUnits [4] = {4, 4, 8, 16};
+static const size_t diffusionStages [4] = {0, 4, 0, 0};
+void configureDiffusion(void* context, size_t index, struct BMCReverb* rv){
+    BMCReverbSetNumDelayUnits(rv, diffusionDelayUnits[index]);
+    BMCReverbSetDiffusion(rv, diffusionStages[index], NULL);
+    BMCReverbSetRT60DecayTime(rv, 2.0f);
+}
+
+
+
+// filters data in place through an allpass filter, one sample at a time
+void referenceAllpass(float* data, size_t numSamples, size_t length, float gain){
+    float* ring = calloc(length, sizeof(float));
+    size_t index = 0;
+    for (size_t i=0; i<numSamples; i++){
+        float delayed = ring[index];
+        float v = delayed*gain + data[i];
+        ring[index] = v;
+        data[i] = v*(-gain) + delayed;
+        index = index + 1 == length ? 0 : index + 1;
+    }
+    free(ring);
+}
+
+
+
+// checks the block allpass filters against a sample by sample reference,
+// then compares the echo density and cost of a small network with
+// diffusion against larger networks without it
+void verifyDiffusion(void){
+    const size_t numFrames = 20000;
+    const float times [3] = {0.0011f, 0.0004f, 0.0029f};
+    const float gain = 0.7f;
+    float* inL = malloc(sizeof(float)*numFrames);
+    float* inR = malloc(sizeof(float)*numFrames);
+    float* refL = malloc(sizeof(float)*numFrames);
+    float* refR = malloc(sizeof(float)*numFrames);
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    for (size_t i=0; i<numFrames; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    // a reverb with diffusion against one without, fed the input filtered
+    // by the reference. The right input's delays are 13% longer.
+    struct BMCReverb diffused, plain;
+    BMCReverbInit(&diffused);
+    BMCReverbInit(&plain);
+    BMCReverbSetWetGain(&diffused, 1.0f);
+    BMCReverbSetWetGain(&plain, 1.0f);
+    BMCReverbSetDiffusion(&diffused, 3, times);
+    BMCReverbSetDiffusionGain(&diffused, gain);
+    BMCReverbApplySettings(&diffused);
+    memcpy(refL, inL, sizeof(float)*numFrames);
+    memcpy(refR, inR, sizeof(float)*numFrames);
+    for (size_t i=0; i<3; i++){
+        referenceAllpass(refL, numFrames, (size_t)roundf(times[i] * 44100.0f), gain);
+        referenceAllpass(refR, numFrames, (size_t)roundf(times[i] * 1.13f * 44100.0f), gain);
+    }
+    for (size_t i=0; i<numFrames; i += TESTBUFFERLENGTH){
+        size_t n = numFrames - i < TESTBUFFERLENGTH ? numFrames - i : TESTBUFFERLENGTH;
+        BMCReverbProcessBuffer(&diffused, inL+i, inR+i, outL+i, outR+i, n);
+        BMCReverbProcessBuffer(&plain, refL+i, refR+i, refL+i, refR+i, n);
+    }
+    float maxError = 0.0f;
+    for (size_t i=0; i<numFrames; i++)
+        maxError = fmaxf(maxError, fmaxf(fabsf(outL[i] - refL[i]), fabsf(outR[i] - refR[i])));
+    printf("input diffusion max error against the reference: %g\n", maxError);
+    assert(maxError < 1.0e-5f);
+    BMCReverbFree(&diffused);
+    BMCReverbFree(&plain);
+    
+    
+    // echo density and cost
+    BMCReverbAnalysis results [4];
+    bool success = BMCReverbAnalyseConfigurations(4, configureDiffusion, NULL, results, 6.0f, 4);
+    assert(success);
+    printf("\nnetwork                 rt60  measured  mixing time  correlation   ns/sample\n");
+    for (size_t c=0; c<4; c++){
+        struct BMCReverb rv;
+        BMCReverbInit(&rv);
+        configureDiffusion(NULL, c, &rv);
+        BMCReverbApplySettings(&rv);
+        size_t numBuffers = BENCHMARKSECONDS * (size_t)BMCREVERB_DEFAULTSAMPLERATE / TESTBUFFERLENGTH;
+        clock_t begin = clock();
+        for (size_t b=0; b<numBuffers; b++)
+            BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        BMCReverbFree(&rv);
+        
+        char name [32];
+        snprintf(name, sizeof(name), "%zu units, %zu stages", diffusionDelayUnits[c], diffusionStages[c]);
+        printf("%-22s  %4.2f  %8.3f  %11.3f  %11.3f  %10.1f\n", name, results[c].rt60, results[c].measuredRT60, results[c].mixingTime, results[c].correlation, 1.0e9 * seconds / (double)(numBuffers*TESTBUFFERLENGTH));
+    }
+    // diffusion is allpass, so it doesn't change the decay
+    assert(fabsf(results[1].measuredRT60 - results[0].measuredRT60) <= 0.1f * results[0].measuredRT60);
+    // and the small network with diffusion fills in at least as fast as
+    // the largest one without
+    assert(results[1].mixingTime <= results[3].mixingTime);
+    
+    free(inL);
+    free(inR);
+    free(refL);
+    free(refR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// the configurations in verifyDecimation
+static const float decimationSampleRates [5] = {48000.0f, 96000.0f, 96000.0f, 192000.0f, 192000.0f};
+static const size_t decimationSettings [5] = {1, 1, BMCREVERB_DECIMATION_AUTO, 1, BMCREVERB_DECIMATION_AUTO};
+void configureDecimation(void* context, size_t index, struct BMCReverb* rv){
+    BMCReverbSetSampleRate(rv, decimationSampleRates[index]);
+    BMCReverbSetDecimation(rv, decimationSettings[index]);
+    BMCReverbSetRT60DecayTime(rv, 2.0f);
+}
+
+
+
+// the time of the first output sample within 40 dB of the peak
+double onsetTime(const float* data, size_t numSamples, float sampleRate){
+    float peak = 0.0f;
+    for (size_t i=0; i<numSamples; i++)
+        peak = fmaxf(peak, fabsf(data[i]));
+    size_t i = 0;
+    while (fabsf(data[i]) < 0.01f * peak) i++;
+    return (double)i / (double)sampleRate;
+}
+
+
+
+// checks that running the network at a reduced rate keeps the decay and
+// the pre-delay of the full rate network, and compares the cost at each
+// sample rate
+void verifyDecimation(void){
+    BMCReverbAnalysis results [5];
+    bool success = BMCReverbAnalyseConfigurations(5, configureDecimation, NULL, results, 6.0f, 4);
+    assert(success);
+    
+    const size_t numFrames = 192000 / 10;
+    float* inL = calloc(numFrames, sizeof(float));
+    float* inR = calloc(numFrames, sizeof(float));
+    float* outL = malloc(sizeof(float)*numFrames);
+    float* outR = malloc(sizeof(float)*numFrames);
+    printf("\nsample rate  network rate  measured rt60  onset (ms)  ns/frame  ms/second\n");
+    double onsets [5], nsPerSecond [5];
+    for (size_t c=0; c<5; c++){
+        struct BMCReverb rv;
+        BMCReverbInitWithCapacity(&rv, decimationSampleRates[c], BMCREVERB_NUMDELAYUNITS, BMCREVERB_PREDELAY, BMCREVERB_ROOMSIZE);
+        BMCReverbSetWetGain(&rv, 1.0f);
+        configureDecimation(NULL, c, &rv);
+        BMCReverbApplySettings(&rv);
+        
+        // the first 100 ms of the impulse response
+        size_t n = (size_t)(0.1f * decimationSampleRates[c]);
+        inL[0] = inR[0] = 1.0f;
+        for (size_t i=0; i<n; i += TESTBUFFERLENGTH){
+            size_t m = n - i < TESTBUFFERLENGTH ? n - i : TESTBUFFERLENGTH;
+            BMCReverbProcessBuffer(&rv, inL+i, inR+i, outL+i, outR+i, m);
+        }
+        onsets[c] = onsetTime(outL, n, decimationSampleRates[c]);
+        inL[0] = inR[0] = 0.0f;
+        
+        // the cost of BENCHMARKSECONDS of audio
+        for (size_t i=0; i<n; i++){
+            inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        }
+        size_t numBuffers = BENCHMARKSECONDS * (size_t)decimationSampleRates[c] / TESTBUFFERLENGTH;
+        clock_t begin = clock();
+        for (size_t b=0; b<numBuffers; b++)
+            BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        nsPerSecond[c] = 1.0e9 * seconds / (double)BENCHMARKSECONDS;
+        memset(inL, 0, sizeof(float)*n);
+        memset(inR, 0, sizeof(float)*n);
+        
+        printf("%11.0f  %12.0f  %13.3f  %10.2f  %8.1f  %9.1f\n", decimationSampleRates[c], rv.networkSampleRate, results[c].measuredRT60, 1000.0 * onsets[c], nsPerSecond[c] / (double)decimationSampleRates[c], 1.0e-6 * nsPerSecond[c]);
+        BMCReverbFree(&rv);
+    }
+    
+    // the decimated networks decay at the same rate as the full rate ones,
+    // start at about the same time, and cost less
+    for (size_t c=2; c<5; c += 2){
+        assert(fabsf(results[c].measuredRT60 - results[c-1].measuredRT60) <= 0.1f * results[c-1].measuredRT60);
+        assert(fabs(onsets[c] - onsets[c-1]) < 0.0005);
+        assert(nsPerSecond[c] < nsPerSecond[c-1]);
+    }
+    
+    free(inL);
+    free(inR);
+    free(outL);
+    free(outR);
+}
+
+
+
+// prints the time spent in each stage, if the instrumentation is
+// compiled in, and checks the counts
+void verifyInstrumentation(void){
+    struct BMCReverb rv;
+    BMCReverbInit(&rv);
+    BMCReverbSetNumDelayUnits(&rv, 8);
+    BMCReverbSetWetGain(&rv, 1.0f);
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    const size_t numBuffers = 44100 / TESTBUFFERLENGTH;
+    for (size_t b=0; b<numBuffers; b++){
+        for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+            inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+            inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        }
+        // the last buffer has a NaN, which is replaced with silence
+        if (b == numBuffers - 1) inL[7] = NAN;
+        BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+    }
+    
+    BMCReverbStats stats;
+    if (!BMCReverbGetStats(&rv, &stats)) {
+        printf("instrumentation is compiled out. Build with -DBMCREVERB_INSTRUMENTATION to see the time in each stage.\n");
+        BMCReverbFree(&rv);
+        return;
+    }
+    
+    assert(stats.buffers == numBuffers);
+    assert(stats.nonFiniteInputs == 1);
+    assert(stats.stages[BMCREVERB_STAGE_WRITE].calls == numBuffers * TESTBUFFERLENGTH);
+    
+    printf("%-14s %14s %12s %10s %10s %10s\n", "stage", "cycles", "calls", "mean", "min", "max");
+    for (size_t i=0; i<BMCREVERB_NUMSTAGES; i++){
+        BMCReverbStageCounter* c = &stats.stages[i];
+        if (c->calls == 0) continue;
+        printf("%-14s %14llu %12llu %10.1f %10llu %10llu\n", BMCReverbStageName((BMCReverbStage)i), (unsigned long long)c->cycles, (unsigned long long)c->calls, (double)c->cycles / (double)c->calls, (unsigned long long)c->minCycles, (unsigned long long)c->maxCycles);
+    }
+    printf("%llu buffers, %llu non-finite inputs, %llu denormal delay outputs\n", (unsigned long long)stats.buffers, (unsigned long long)stats.nonFiniteInputs, (unsigned long long)stats.denormals);
+    
+    BMCReverbFree(&rv);
+}
+
+
+
+// records a trace of a reverb that switches auto-sustain, decay time and
+// frozen mode and grows its network, checks the events and writes them
+// to rvTrace.json
+void verifyTrace(void){
+    BMCReverbTrace trace;
+    bool initialised = BMCReverbTraceInit(&trace, BMCREVERB_TRACE_CAPACITY);
+    assert(initialised);
+    struct BMCReverb rv;
+    BMCReverbInit(&rv);
+    BMCReverbSetTrace(&rv, &trace);
+    BMCReverbSetAutoSustain(&rv, true);
+    
+    BMCReverbTraceWriter writer;
+    bool opened = BMCReverbTraceWriterOpen(&writer, "./rvTrace.json");
+    if (opened) BMCReverbTraceWriterNameThread(&writer, 1, 1, "BMCReverb");
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    BMCReverbTraceEvent events [256];
+    size_t counts [BMCREVERB_TRACE_NUMTYPES] = {0};
+    size_t bytesAllocated = 0;
+    const size_t numBuffers = 2000;
+    size_t thawBuffer = SIZE_MAX;
+    for (size_t b=0; b<=numBuffers; b++){
+        // loud input then silence, so auto-sustain turns on and off
+        float level = b < 400 ? 0.5f : 0.0f;
+        for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+            inL[i] = level * ((float)rand() / (float)RAND_MAX - 0.5f);
+            inR[i] = level * ((float)rand() / (float)RAND_MAX - 0.5f);
+        }
+        if (b == 600) BMCReverbSetRT60DecayTime(&rv, 0.8f);
+        // auto-sustain always runs the network
+        if (b == 700) BMCReverbSetAutoSustain(&rv, false);
+        if (b == 800) BMCReverbSetFrozenIRMode(&rv, BMCREVERB_FROZENIR_ON);
+        // thaw long enough after the freeze for the network's tail to
+        // finish, however long the response took to render
+        if (BMCReverbIsFrozen(&rv) && thawBuffer == SIZE_MAX) thawBuffer = b + 400;
+        if (b == thawBuffer) BMCReverbSetFrozenIRMode(&rv, BMCREVERB_FROZENIR_OFF);
+        // the frozen response is set up in the background, but more delays
+        // than the reverb has room for are allocated on the audio thread
+        if (b == 1500) BMCReverbSetNumDelayUnits(&rv, 2*BMCREVERB_NUMDELAYUNITS);
+        if (b < numBuffers)
+            BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+        
+        // let the background thread render the frozen response, as it
+        // would in real time
+        if (rv.freezePending) {
+            struct timespec period = {0, (long)(1.0e9 * TESTBUFFERLENGTH / 44100.0)};
+            nanosleep(&period, NULL);
+        }
+        
+        // drain now and then, as a background thread would
+        if (b % 100 == 0 || b == numBuffers) {
+            size_t n;
+            while ((n = BMCReverbTraceDrain(&trace, events, 256)) > 0) {
+                for (size_t i=0; i<n; i++){
+                    counts[events[i].type]++;
+                    if (events[i].type == BMCREVERB_TRACE_UPDATESETTINGS)
+                        bytesAllocated += events[i].value;
+                }
+                if (opened) BMCReverbTraceWriterAdd(&writer, events, n, 1, 1);
+            }
+        }
+    }
+    
+    printf("trace:");
+    for (size_t i=0; i<BMCREVERB_TRACE_NUMTYPES; i++)
+        printf(" %zu %s,", counts[i], BMCReverbTraceEventName((BMCReverbTraceEventType)i));
+    printf(" %zu bytes allocated, %llu dropped\n", bytesAllocated, (unsigned long long)BMCReverbTraceDropped(&trace));
+    assert(counts[BMCREVERB_TRACE_PROCESS] == numBuffers);
+    assert(counts[BMCREVERB_TRACE_SLOWDECAY] >= 2);
+    assert(counts[BMCREVERB_TRACE_COEFFICIENTS] >= 1);
+    assert(counts[BMCREVERB_TRACE_FREEZE] == 2);
+    assert(counts[BMCREVERB_TRACE_IDLE] == 2);
+    assert(bytesAllocated > 0);
+    assert(BMCReverbTraceDropped(&trace) == 0);
+    
+    if (opened && !BMCReverbTraceWriterClose(&writer))
+        printf("can't write rvTrace.json\n");
+    
+    BMCReverbFree(&rv);
+    BMCReverbTraceFree(&trace);
+}
+
+
+
+// a design and a trace for the setters that take one
+static BMCReverbDesign* auditDesign;
+static BMCReverbTrace auditTrace;
+
+void auditSetTrace(struct BMCReverb* rv){ BMCReverbSetTrace(rv, &auditTrace); }
+void auditSetWetGain(struct BMCReverb* rv){ BMCReverbSetWetGain(rv, 0.3f); }
+void auditSetCrossStereoMix(struct BMCReverb* rv){ BMCReverbSetCrossStereoMix(rv, 0.8f); }
+void auditSetHFDecayMultiplier(struct BMCReverb* rv){ BMCReverbSetHFDecayMultiplier(rv, 4.0f); }
+void auditSetHFDecayFC(struct BMCReverb* rv){ BMCReverbSetHFDecayFC(rv, 3000.0f); }
+void auditSetHighPassFC(struct BMCReverb* rv){ BMCReverbSetHighPassFC(rv, 300.0f); }
+void auditSetLowPassFC(struct BMCReverb* rv){ BMCReverbSetLowPassFC(rv, 6000.0f); }
+void auditSetRT60DecayTime(struct BMCReverb* rv){ BMCReverbSetRT60DecayTime(rv, 2.0f); }
+void auditSetSlowRT60DecayTime(struct BMCReverb* rv){ BMCReverbSetSlowRT60DecayTime(rv, 12.0f); }
+void auditSetKernel(struct BMCReverb* rv){ BMCReverbSetKernel(rv, BMCREVERB_KERNEL_SCALAR); }
+void auditSetModulation(struct BMCReverb* rv){ BMCReverbSetModulation(rv, 0.0003f, 0.5f); }
+void auditSetInterpolation(struct BMCReverb* rv){ BMCReverbSetInterpolation(rv, BMCREVERB_INTERPOLATION_LINEAR); }
+void auditSetDiffusion(struct BMCReverb* rv){ BMCReverbSetDiffusion(rv, 4, NULL); }
+void auditSetDiffusionGain(struct BMCReverb* rv){ BMCReverbSetDiffusionGain(rv, 0.7f); }
+void auditSetDecimation(struct BMCReverb* rv){ BMCReverbSetDecimation(rv, 2); }
+void auditSetChunkLength(struct BMCReverb* rv){ BMCReverbSetChunkLength(rv, 100); }
+void auditSetSlowDecayState(struct BMCReverb* rv){ BMCReverbSetSlowDecayState(rv, true); }
+void auditSetAutoSustain(struct BMCReverb* rv){ BMCReverbSetAutoSustain(rv, true); }
+void auditSetNumDelayUnits(struct BMCReverb* rv){ BMCReverbSetNumDelayUnits(rv, 16); }
+void auditSetNumDelays(struct BMCReverb* rv){ BMCReverbSetNumDelays(rv, 24); }
+void auditSetMixingMatrix(struct BMCReverb* rv){ BMCReverbSetMixingMatrix(rv, BMCREVERB_MATRIX_HOUSEHOLDER); }
+void auditSetSeed(struct BMCReverb* rv){ BMCReverbSetSeed(rv, 1234); }
+void auditSetDesign(struct BMCReverb* rv){ BMCReverbSetDesign(rv, auditDesign); }
+void auditSetPreDelay(struct BMCReverb* rv){ BMCReverbSetPreDelay(rv, 0.01f); }
+void auditSetRoomSize(struct BMCReverb* rv){ BMCReverbSetRoomSize(rv, 0.3f); }
+void auditSetFrozenIRMode(struct BMCReverb* rv){ BMCReverbSetFrozenIRMode(rv, BMCREVERB_FROZENIR_ON); }
+void auditSetSampleRate(struct BMCReverb* rv){ BMCReverbSetSampleRate(rv, 48000.0f); }
+void auditReset(struct BMCReverb* rv){ BMCReverbReset(rv); }
+
+
+
+// Calls every setter at each point relative to the processing and counts
+// the allocations and blocking calls in the audio callback. The setter
+// is called
+//
+//   before:  after init, before the first buffer
+//   between: from the control thread between two buffers
+//   inside:  from the audio callback, between two buffers
+//   applied: between two buffers, followed by BMCReverbApplySettings
+//
+// Only the processing, and the setter at the inside point, are in the
+// real-time region. Applying the settings first must keep the callback
+// clean. Without BMCREVERB_RTAUDIT the setters still run at every point,
+// but nothing is counted.
+void auditSetters(void){
+    struct { const char* name; void (*set)(struct BMCReverb* rv); } setters [] = {
+        {"SetTrace", auditSetTrace},
+        {"SetWetGain", auditSetWetGain},
+        {"SetCrossStereoMix", auditSetCrossStereoMix},
+        {"SetHFDecayMultiplier", auditSetHFDecayMultiplier},
+        {"SetHFDecayFC", auditSetHFDecayFC},
+        {"SetHighPassFC", auditSetHighPassFC},
+        {"SetLowPassFC", auditSetLowPassFC},
+        {"SetRT60DecayTime", auditSetRT60DecayTime},
+        {"SetSlowRT60DecayTime", auditSetSlowRT60DecayTime},
+        {"SetKernel", auditSetKernel},
+        {"SetModulation", auditSetModulation},
+        {"SetInterpolation", auditSetInterpolation},
+        {"SetDiffusion", auditSetDiffusion},
+        {"SetDiffusionGain", auditSetDiffusionGain},
+        {"SetDecimation", auditSetDecimation},
+        {"SetChunkLength", auditSetChunkLength},
+        {"SetSlowDecayState", auditSetSlowDecayState},
+        {"SetAutoSustain", auditSetAutoSustain},
+        {"SetNumDelayUnits", auditSetNumDelayUnits},
+        {"SetNumDelays", auditSetNumDelays},
+        {"SetMixingMatrix", auditSetMixingMatrix},
+        {"SetSeed", auditSetSeed},
+        {"SetDesign", auditSetDesign},
+        {"SetPreDelay", auditSetPreDelay},
+        {"SetRoomSize", auditSetRoomSize},
+        {"SetFrozenIRMode", auditSetFrozenIRMode},
+        {"SetSampleRate", auditSetSampleRate},
+        {"Reset", auditReset}
+    };
+    const size_t numSetters = sizeof(setters)/sizeof(setters[0]);
+    enum {BEFORE, BETWEEN, INSIDE, APPLIED, NUMPOINTS};
+    const size_t warmBuffers = 20, numBuffers = 40;
+    
+    struct BMCReverb preset;
+    BMCReverbInit(&preset);
+    BMCReverbSetRT60DecayTime(&preset, 2.3f);
+    BMCReverbSetNumDelayUnits(&preset, 6);
+    auditDesign = BMCReverbDesignCreateFromReverb(&preset);
+    BMCReverbFree(&preset);
+    bool initialised = BMCReverbTraceInit(&auditTrace, BMCREVERB_TRACE_CAPACITY);
+    assert(initialised);
+    
+    float inL [TESTBUFFERLENGTH], inR [TESTBUFFERLENGTH], outL [TESTBUFFERLENGTH], outR [TESTBUFFERLENGTH];
+    for (size_t i=0; i<TESTBUFFERLENGTH; i++){
+        inL[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+        inR[i] = (float)rand() / (float)RAND_MAX - 0.5f;
+    }
+    
+    BMCReverbRTAuditSetMode(BMCREVERB_RTAUDIT_COUNT);
+    size_t violations [numSetters][NUMPOINTS];
+    for (size_t s=0; s<numSetters; s++)
+        for (size_t p=0; p<NUMPOINTS; p++){
+            struct BMCReverb rv;
+            BMCReverbInit(&rv);
+            if (p == BEFORE) setters[s].set(&rv);
+            
+            // buffers with no changes must never fail the audit
+            size_t start = BMCReverbRTAuditViolations();
+            for (size_t b=0; b<warmBuffers && p != BEFORE; b++){
+                BMCReverbRTAuditBegin();
+                BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+                BMCReverbRTAuditEnd();
+            }
+            assert(BMCReverbRTAuditViolations() == start);
+            
+            if (p == BETWEEN) setters[s].set(&rv);
+            if (p == APPLIED) {
+                setters[s].set(&rv);
+                BMCReverbApplySettings(&rv);
+            }
+            
+            for (size_t b=0; b<numBuffers; b++){
+                BMCReverbRTAuditBegin();
+                if (p == INSIDE && b == 0) setters[s].set(&rv);
+                BMCReverbProcessBuffer(&rv, inL, inR, outL, outR, TESTBUFFERLENGTH);
+                BMCReverbRTAuditEnd();
+            }
+            violations[s][p] = BMCReverbRTAuditViolations() - start;
+            
+            BMCReverbFree(&rv);
+            BMCReverbTraceEvent events [64];
+            while (BMCReverbTraceDrain(&auditTrace, events, 64) > 0);
+        }
+    BMCReverbRTAuditSetMode(BMCREVERB_RTAUDIT_ABORT);
+    
+    BMCReverbDesignRelease(auditDesign);
+    BMCReverbTraceFree(&auditTrace);
+    
+    if (!BMCReverbRTAuditEnabled()) {
+        printf("real-time audit: compiled out, build with BMCREVERB_RTAUDIT to count violations\n");
+        return;
+    }
+    printf("real-time audit: violations in the audio callback\n");
+    printf("%-22s %7s %8s %7s %8s\n", "", "before", "between", "inside", "applied");
+    for (size_t s=0; s<numSetters; s++){
+        printf("%-22s %7zu %8zu %7zu %8zu\n", setters[s].name, violations[s][BEFORE], violations[s][BETWEEN], violations[s][INSIDE], violations[s][APPLIED]);
+        assert(violations[s][APPLIED] == 0);
+    }
+}
+
+
+// compares BMFastLog2 with log2 over the positive normal floats and
+// checks that the error stays within the documented bound
+void verifyFastLog2(void){
+    const size_t length = 4096;
+    float x [length], y [length];
+    double maxError = 0.0;
     
-    // open a file for writing
-    FILE* audioFile;
-    audioFile = fopen("./rvImpulse.csv", "w+");
+    // 2^12 points per octave from 2^-126 to 2^127
+    for (float start = -126.0f; start < 127.0f; start += (float)length / 4096.0f) {
+        float step = 1.0f / 4096.0f;
+        vDSP_vramp(&start, &step, x, 1, length);
+        BMFastExp2(x, x, length);
+        BMFastLog2(x, y, length);
+        
+        for (size_t i=0; i<length; i++) {
+            double exact = log2((double)x[i]);
+            double error = fabs((double)y[i] - exact) / fmax(1.0, fabs(exact));
+            if (error > maxError) maxError = error;
+        }
+    }
+    
+    printf("BMFastLog2 max error: %g (bound %g)\n", maxError, BMFASTLOG2_MAXERROR);
+    assert(maxError <= BMFASTLOG2_MAXERROR);
+}
+
+
+
+// the decay settings of each configuration in analyseDecaySettings
+static const float analysisRT60s [4] = {0.5f, 1.0f, 2.0f, 4.0f};
+static const float analysisHFMultipliers [2] = {2.0f, 6.0f};
+
+
+
+void configureDecay(void* context, size_t index, struct BMCReverb* rv){
+    BMCReverbSetRT60DecayTime(rv, analysisRT60s[index / 2]);
+    BMCReverbSetHFDecayMultiplier(rv, analysisHFMultipliers[index % 2]);
+}
+
+
+
+// measures the decay of a grid of settings, writes the results to
+// rvAnalysis.csv and prints the measured RT60 next to the setting
+void analyseDecaySettings(void){
+    const size_t numConfigurations = 8;
+    BMCReverbAnalysis results [numConfigurations];
+    
+    clock_t begin = clock();
+    bool success = BMCReverbAnalyseConfigurations(numConfigurations, configureDecay, NULL, results, 10.0f, 4);
+    assert(success);
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    
+    printf("analysed %zu impulse responses in %f s\n", numConfigurations, seconds);
+    printf("rt60  hf multiplier  measured: broadband  500 Hz  8 kHz  mixing time  correlation\n");
+    for (size_t i=0; i<numConfigurations; i++) {
+        BMCReverbAnalysis* r = &results[i];
+        printf("%4.2f  %13.1f  %19.3f  %6.3f  %5.3f  %11.3f  %11.3f\n", r->rt60, r->hfDecayMultiplier, r->measuredRT60, r->bandRT60[4], r->bandRT60[8], r->mixingTime, r->correlation);
+        
+        // with a gentle multiplier the shelf filters leave 500 Hz alone,
+        // so it should decay at the RT60 setting
+        if (r->hfDecayMultiplier <= 2.0f)
+            assert(fabsf(r->bandRT60[4] - r->rt60) <= 0.1f * r->rt60);
+    }
+    
+    if (!BMCReverbAnalysisWriteTable("./rvAnalysis.csv", results, numConfigurations))
+        printf("can't write rvAnalysis.csv\n");
+}
+
+
+
+int main(int argc, const char * argv[]) {
     
     system("pwd\n");
     
@@ -41,31 +1435,12 @@ int main(int argc, const char * argv[]) {
     // adjust the highpass filter frequency
     BMCReverbSetHighPassFC(&rv, 250.0f);
     
-
-    float testBufferInL [TESTBUFFERLENGTH];
-    float testBufferInR [TESTBUFFERLENGTH];
-    float testBufferOutL [TESTBUFFERLENGTH];
-    float testBufferOutR [TESTBUFFERLENGTH];
-    
-    
-    // create the initial impulse followed by zeros
-    testBufferInL[0] = 1.0f;
-    testBufferInR[0] = 1.0f;
-    memset(testBufferInL+1, 0, sizeof(float)*(TESTBUFFERLENGTH-1));
-    memset(testBufferInR+1, 0, sizeof(float)*(TESTBUFFERLENGTH-1));
-    
-    
-    // process the first frame twice (the first time to trigger an update)
-    BMCReverbProcessBuffer(&rv, testBufferInL, testBufferInR, testBufferOutL, testBufferOutR, TESTBUFFERLENGTH);
-    BMCReverbProcessBuffer(&rv, testBufferInL, testBufferInR, testBufferOutL, testBufferOutR, TESTBUFFERLENGTH);
     
-    // print out the entire frame in .csv format
-    for (size_t i=0; i<TESTBUFFERLENGTH; i++) {
-        fprintf(audioFile, "%f,%f\n",testBufferOutL[i],testBufferOutR[i]);
-    }
-    
-    // set the input buffers to all zeros (only the first value was non-zero)
-    testBufferInL[0] = testBufferInR[0] = 0.0;
+    // render one second of impulse response, stopping early if it decays
+    // by 90 dB
+    size_t maxLength = 44100;
+    float* impulseL = malloc(sizeof(float)*maxLength);
+    float* impulseR = malloc(sizeof(float)*maxLength);
     
     
     // start a timer
@@ -73,19 +1448,7 @@ int main(int argc, const char * argv[]) {
     double time_spent;
     begin = clock();
     
-    
-    // process and print more frames
-    size_t numFramesToPrint = 44100/128;
-    while (numFramesToPrint-- != 0) {
-        // turn the hold pedal on
-        //if (numFramesToPrint < 1400) BMCReverbSetSlowDecayState(&rv, true);
-        // turn it back off
-        //if (numFramesToPrint < 500) BMCReverbSetSlowDecayState(&rv, false);
-        BMCReverbProcessBuffer(&rv, testBufferInL, testBufferInR, testBufferOutL, testBufferOutR, TESTBUFFERLENGTH);
-        for (size_t i = 0; i<TESTBUFFERLENGTH; i++)
-            fprintf(audioFile, "%f,%f\n", testBufferOutL[i], testBufferOutR[i]);
-    }
-    
+    size_t length = BMCReverbRenderImpulseResponse(&rv, impulseL, impulseR, maxLength, -90.0f);
     
     // print the time taken to process reverb
     end = clock();
@@ -93,6 +1456,75 @@ int main(int argc, const char * argv[]) {
     printf("time: %f\n", time_spent);
     
     
-    fclose(audioFile);
+    // save it
+    const char* error;
+    if (!BMWavFileSave("./rvImpulse.wav", impulseL, impulseR, length, rv.sampleRate, BMWAV_FLOAT32, &error))
+        printf("can't save rvImpulse.wav: %s\n", error);
+    free(impulseL);
+    free(impulseR);
+    
+    
+    // check the accuracy of the fast exp2 used to compute decay coefficients
+    verifyFastExp2();
+    
+    // and the fast log2 used to analyse impulse responses
+    verifyFastLog2();
+    
+    // check that reverbs sharing a design sound right
+    verifySharedDesign();
+    
+    // check that parallel rendering matches rendering with one reverb
+    verifyParallelRender();
+    
+    // check that convolving with the frozen impulse response matches the
+    // network
+    verifyFrozenIR();
+    
+    // check that snapshots and forks continue where the original is
+    verifySnapshots();
+    
+    // check that voices from a pool start silent
+    verifyVoicePool();
+    
+    // check that a send bus matches summing the sends ourselves
+    verifySendBus();
+    
+    // check that the asynchronous wet path is the same, only later
+    verifyAsync();
+    
+    // check that the governor adapts the network to the budget
+    verifyGovernor();
+    
+    // check that the kernels agree and the autotuner uses its cache
+    verifyAutotune();
+    
+    // check that modulated delays keep the decay time
+    verifyModulation();
+    
+    // compare input diffusion with larger networks
+    verifyDiffusion();
+    
+    // check that the reduced rate wet path keeps the decay and pre-delay
+    verifyDecimation();
+    
+    // check that bad input samples are replaced wherever they are
+    verifySanitisation();
+    
+    // print where the time goes, if the instrumentation is compiled in
+    verifyInstrumentation();
+    
+    // record a trace and export it for a timeline viewer
+    verifyTrace();
+    
+    // check that every setter is real-time safe once its settings are
+    // applied, and show where the others allocate or block
+    auditSetters();
+    
+    // check that the measured decay matches the settings
+    analyseDecaySettings();
+    
+    // compare the cost of the mixing matrix options
+    benchmarkMixingMatrices();
+    
     return 0;
 }
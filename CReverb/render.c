@@ -0,0 +1,525 @@
+//
+//  render.c
+//  CReverb
+//
+//  Command line renderer. Reads a WAV or RF64 file, runs it through
+//  BMCReverb and writes the result to a new file. Both files are memory
+//  mapped, so samples go from the input file to the reverb and from the
+//  reverb to the output file without passing through stdio.
+//
+//  usage: creverb-render [options] input.wav output.wav
+//         creverb-render [options] --batch manifest
+//
+//  This file is provided free without any restrictions on its use.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <time.h>
+#include "BMCReverb.h"
+#include "BMWavFile.h"
+#include "BMCReverbParallel.h"
+#include "BMCReverbBatch.h"
+
+
+#define RENDER_BLOCKLENGTH 65536 // frames per call to BMCReverbProcessBuffer
+#define RENDER_DEFAULTTAIL -1.0 // -1 means use the RT60 time
+
+
+// settings that aren't reverb settings
+typedef struct RenderOptions {
+    double tail_seconds;
+    BMWavSampleFormat outputFormat;
+    size_t blockLength, numThreads;
+    double tolerance_dB;
+    // render the files listed in this file instead of one file
+    const char* manifestPath;
+    bool quiet;
+} RenderOptions;
+
+
+enum {
+    OPT_WET = 256, OPT_CROSSMIX, OPT_HFMULT, OPT_HFFC, OPT_RT60, OPT_SLOWRT60,
+    OPT_SUSTAIN, OPT_AUTOSUSTAIN, OPT_DELAYUNITS, OPT_DELAYS, OPT_MATRIX,
+    OPT_SEED, OPT_PREDELAY, OPT_ROOMSIZE, OPT_HIGHPASS, OPT_LOWPASS,
+    OPT_TAIL, OPT_FORMAT, OPT_BLOCK, OPT_THREADS, OPT_TOLERANCE, OPT_BATCH, OPT_QUIET, OPT_HELP
+};
+
+
+static const struct option longOptions [] = {
+    {"wet",                 required_argument, NULL, OPT_WET},
+    {"cross-mix",           required_argument, NULL, OPT_CROSSMIX},
+    {"hf-decay-multiplier", required_argument, NULL, OPT_HFMULT},
+    {"hf-decay-fc",         required_argument, NULL, OPT_HFFC},
+    {"rt60",                required_argument, NULL, OPT_RT60},
+    {"slow-rt60",           required_argument, NULL, OPT_SLOWRT60},
+    {"sustain",             no_argument,       NULL, OPT_SUSTAIN},
+    {"auto-sustain",        no_argument,       NULL, OPT_AUTOSUSTAIN},
+    {"delay-units",         required_argument, NULL, OPT_DELAYUNITS},
+    {"delays",              required_argument, NULL, OPT_DELAYS},
+    {"matrix",              required_argument, NULL, OPT_MATRIX},
+    {"seed",                required_argument, NULL, OPT_SEED},
+    {"predelay",            required_argument, NULL, OPT_PREDELAY},
+    {"room-size",           required_argument, NULL, OPT_ROOMSIZE},
+    {"highpass",            required_argument, NULL, OPT_HIGHPASS},
+    {"lowpass",             required_argument, NULL, OPT_LOWPASS},
+    {"tail",                required_argument, NULL, OPT_TAIL},
+    {"format",              required_argument, NULL, OPT_FORMAT},
+    {"block",               required_argument, NULL, OPT_BLOCK},
+    {"threads",             required_argument, NULL, OPT_THREADS},
+    {"tolerance",           required_argument, NULL, OPT_TOLERANCE},
+    {"batch",               required_argument, NULL, OPT_BATCH},
+    {"quiet",               no_argument,       NULL, OPT_QUIET},
+    {"help",                no_argument,       NULL, OPT_HELP},
+    {NULL, 0, NULL, 0}
+};
+
+
+
+void printUsage(FILE* stream){
+    fprintf(stream,
+            "usage: creverb-render [options] input.wav output.wav\n"
+            "       creverb-render [options] --batch manifest\n"
+            "\n"
+            "reverb settings (defaults from BMCReverb.h):\n"
+            "  --wet x                   wet gain in [0,1]\n"
+            "  --cross-mix x             mixing between L and R wet signals in [0,1]\n"
+            "  --hf-decay-multiplier x   high frequencies decay x times faster (>= 1)\n"
+            "  --hf-decay-fc hz          cutoff of the high frequency decay filters\n"
+            "  --rt60 s                  decay time\n"
+            "  --slow-rt60 s             decay time with the sustain pedal down\n"
+            "  --sustain                 hold the sustain pedal down\n"
+            "  --auto-sustain            sustain automatically when the input is loud\n"
+            "  --delay-units n           4n delays in the network\n"
+            "  --delays n                number of delays in the network\n"
+            "  --matrix name             block-circulant, hadamard, householder or permutation\n"
+            "  --seed n                  seed for the delay times and output signs\n"
+            "  --predelay s              length of the shortest delay\n"
+            "  --room-size s             length of the longest delay\n"
+            "  --highpass hz             highpass cutoff on the wet signal\n"
+            "  --lowpass hz              lowpass cutoff on the wet signal\n"
+            "\n"
+            "rendering:\n"
+            "  --tail s                  seconds of tail after the input (default: rt60)\n"
+            "  --format f                output format: pcm16, pcm24, pcm32 or float (default)\n"
+            "  --block n                 frames per processing block (default %d)\n"
+            "  --threads n               render in n chunks at a time on n threads (default 1).\n"
+            "                            Not available with --auto-sustain. With --batch,\n"
+            "                            the number of files rendered at once (default: cores)\n"
+            "  --tolerance db            with --threads, stop each chunk's tail when the\n"
+            "                            reverb is this quiet (default %.0f)\n"
+            "  --batch manifest          render every file listed in manifest with the same\n"
+            "                            settings. Each line has an input and an output path\n"
+            "                            separated by a tab. Lines starting with # are skipped\n"
+            "  --quiet                   don't print statistics\n",
+            RENDER_BLOCKLENGTH, BMCREVERB_PARALLEL_THRESHOLD_DB);
+}
+
+
+
+bool parseFormat(const char* name, BMWavSampleFormat* format){
+    if (strcmp(name, "pcm16") == 0) *format = BMWAV_PCM16;
+    else if (strcmp(name, "pcm24") == 0) *format = BMWAV_PCM24;
+    else if (strcmp(name, "pcm32") == 0) *format = BMWAV_PCM32;
+    else if (strcmp(name, "float") == 0) *format = BMWAV_FLOAT32;
+    else return false;
+    return true;
+}
+
+
+
+bool parseMatrix(const char* name, BMCReverbMixingMatrix* matrix){
+    if (strcmp(name, "block-circulant") == 0) *matrix = BMCREVERB_MATRIX_BLOCKCIRCULANT;
+    else if (strcmp(name, "hadamard") == 0) *matrix = BMCREVERB_MATRIX_HADAMARD;
+    else if (strcmp(name, "householder") == 0) *matrix = BMCREVERB_MATRIX_HOUSEHOLDER;
+    else if (strcmp(name, "permutation") == 0) *matrix = BMCREVERB_MATRIX_PERMUTATION;
+    else return false;
+    return true;
+}
+
+
+
+// the input and output files for BMCReverbRenderParallel
+typedef struct RenderFiles {
+    const BMWavFile* input;
+    BMWavFile* output;
+} RenderFiles;
+
+
+
+void readInput(void* context, size_t startFrame, size_t numFrames, float* left, float* right){
+    RenderFiles* files = context;
+    BMWavFileReadFrames(files->input, startFrame, numFrames, left, right);
+}
+
+
+
+void writeOutput(void* context, size_t startFrame, size_t numFrames, const float* left, const float* right){
+    RenderFiles* files = context;
+    BMWavFileWriteFrames(files->output, startFrame, numFrames, left, right);
+}
+
+
+
+// wall clock time, so that time spent on other threads isn't counted
+double wallTime(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1.0e-9 * (double)t.tv_nsec;
+}
+
+
+
+// The setters check their arguments with assert, so we check the ranges
+// here to give a useful message instead.
+bool checkRange(const char* name, double value, double min, double max){
+    if (value >= min && value <= max) return true;
+    fprintf(stderr, "creverb-render: --%s must be between %g and %g\n", name, min, max);
+    return false;
+}
+
+
+
+// Reads the manifest into files. The paths point into *text, which the
+// caller frees along with *files. Returns the number of files, or -1 if
+// the manifest can't be read.
+long readManifest(const char* path, BMCReverbBatchFile** files, char** text){
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *text = malloc(length + 1);
+    if (!*text || fread(*text, 1, length, f) != (size_t)length) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    (*text)[length] = '\0';
+    
+    // at most one file per line
+    size_t maxFiles = 1;
+    for (long i=0; i<length; i++)
+        if ((*text)[i] == '\n') maxFiles++;
+    *files = calloc(maxFiles, sizeof(BMCReverbBatchFile));
+    if (!*files) return -1;
+    
+    long numFiles = 0;
+    char* line = *text;
+    while (line) {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        size_t end = strlen(line);
+        if (end > 0 && line[end-1] == '\r') line[end-1] = '\0';
+        
+        char* tab = strchr(line, '\t');
+        if (line[0] != '#' && line[0] != '\0') {
+            if (!tab) {
+                fprintf(stderr, "creverb-render: %s: expected input<tab>output, got \"%s\"\n", path, line);
+                return -1;
+            }
+            *tab = '\0';
+            (*files)[numFiles].inputPath = line;
+            (*files)[numFiles].outputPath = tab + 1;
+            numFiles++;
+        }
+        line = next;
+    }
+    
+    return numFiles;
+}
+
+
+
+// renders every file in the manifest and prints the throughput
+bool renderBatch(struct BMCReverb* rv, const RenderOptions* options){
+    BMCReverbBatchFile* files = NULL;
+    char* text = NULL;
+    long numFiles = readManifest(options->manifestPath, &files, &text);
+    if (numFiles < 0) {
+        fprintf(stderr, "creverb-render: can't read %s\n", options->manifestPath);
+        free(files);
+        free(text);
+        return false;
+    }
+    
+    BMCReverbBatchSettings settings;
+    BMCReverbBatchSettingsInit(&settings);
+    if (options->numThreads > 0) settings.numWorkers = options->numThreads;
+    settings.blockLength = options->blockLength;
+    settings.tail_seconds = options->tail_seconds;
+    settings.outputFormat = options->outputFormat;
+    
+    double begin = wallTime();
+    bool success = BMCReverbRenderBatch(rv, files, numFiles, &settings);
+    double seconds = wallTime() - begin;
+    if (!success) fprintf(stderr, "creverb-render: couldn't allocate the threads or their memory\n");
+    
+    double audio_seconds = 0.0;
+    size_t numFailed = 0;
+    for (long i=0; i<numFiles; i++) {
+        if (files[i].error) {
+            fprintf(stderr, "creverb-render: %s: %s\n", files[i].inputPath, files[i].error);
+            numFailed++;
+        } else
+            audio_seconds += (double)files[i].numOutputFrames / (double)files[i].sampleRate;
+    }
+    
+    if (!options->quiet && success)
+        printf("rendered %ld files (%.2f s of audio) in %.2f s on %zu threads (%.1fx realtime), %zu failed\n", numFiles - (long)numFailed, audio_seconds, seconds, settings.numWorkers, seconds > 0.0 ? audio_seconds / seconds : 0.0, numFailed);
+    
+    free(files);
+    free(text);
+    return success && numFailed == 0;
+}
+
+
+
+int main(int argc, char* argv[]){
+    struct BMCReverb rv;
+    BMCReverbInit(&rv);
+    
+    RenderOptions options = {RENDER_DEFAULTTAIL, BMWAV_FLOAT32, RENDER_BLOCKLENGTH, 0, BMCREVERB_PARALLEL_THRESHOLD_DB, NULL, false};
+    
+    // the number of delays and the matrix have to be compatible, so we
+    // apply them after reading all the options
+    size_t numDelays = 4*BMCREVERB_NUMDELAYUNITS;
+    BMCReverbMixingMatrix matrix = BMCREVERB_MIXINGMATRIX;
+    float preDelay = BMCREVERB_PREDELAY, roomSize = BMCREVERB_ROOMSIZE;
+    
+    
+    /*
+     * read the options
+     */
+    int option;
+    while ((option = getopt_long(argc, argv, "", longOptions, NULL)) != -1) {
+        double x = optarg ? atof(optarg) : 0.0;
+        switch (option) {
+            case OPT_WET:
+                if (!checkRange("wet", x, 0.0, 1.0)) return 1;
+                BMCReverbSetWetGain(&rv, x);
+                break;
+            case OPT_CROSSMIX:
+                if (!checkRange("cross-mix", x, 0.0, 1.0)) return 1;
+                BMCReverbSetCrossStereoMix(&rv, x);
+                break;
+            case OPT_HFMULT:
+                if (!checkRange("hf-decay-multiplier", x, 1.0, 1.0e6)) return 1;
+                BMCReverbSetHFDecayMultiplier(&rv, x);
+                break;
+            case OPT_HFFC:
+                // (the lower limit is exclusive)
+                if (!checkRange("hf-decay-fc", x, nextafter(100.0, 18000.0), 18000.0)) return 1;
+                BMCReverbSetHFDecayFC(&rv, x);
+                break;
+            case OPT_RT60:
+                if (!checkRange("rt60", x, 0.0, 1.0e6)) return 1;
+                BMCReverbSetRT60DecayTime(&rv, x);
+                break;
+            case OPT_SLOWRT60:
+                if (!checkRange("slow-rt60", x, 0.0, 1.0e6)) return 1;
+                BMCReverbSetSlowRT60DecayTime(&rv, x);
+                break;
+            case OPT_SUSTAIN:
+                BMCReverbSetSlowDecayState(&rv, true);
+                break;
+            case OPT_AUTOSUSTAIN:
+                BMCReverbSetAutoSustain(&rv, true);
+                break;
+            case OPT_DELAYUNITS:
+                if (!checkRange("delay-units", x, 1.0, 1.0e6)) return 1;
+                numDelays = 4*(size_t)x;
+                break;
+            case OPT_DELAYS:
+                if (!checkRange("delays", x, 2.0, 1.0e6)) return 1;
+                numDelays = (size_t)x;
+                break;
+            case OPT_MATRIX:
+                if (!parseMatrix(optarg, &matrix)){
+                    fprintf(stderr, "creverb-render: unknown matrix %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_SEED:
+                if (!checkRange("seed", x, 0.0, (double)UINT32_MAX)) return 1;
+                BMCReverbSetSeed(&rv, (uint32_t)x);
+                break;
+            case OPT_PREDELAY:
+                if (!checkRange("predelay", x, 1.0e-4, 1.0e6)) return 1;
+                preDelay = x;
+                break;
+            case OPT_ROOMSIZE:
+                roomSize = x;
+                break;
+            case OPT_HIGHPASS:
+                // the upper limit is half the sample rate, which we check
+                // when we open the input
+                if (!checkRange("highpass", x, 0.0, 1.0e6)) return 1;
+                BMCReverbSetHighPassFC(&rv, x);
+                break;
+            case OPT_LOWPASS:
+                // cutoffs near or above half the sample rate bypass the filter
+                if (!checkRange("lowpass", x, 1.0, 1.0e6)) return 1;
+                BMCReverbSetLowPassFC(&rv, x);
+                break;
+            case OPT_TAIL:
+                if (!checkRange("tail", x, 0.0, 1.0e6)) return 1;
+                options.tail_seconds = x;
+                break;
+            case OPT_FORMAT:
+                if (!parseFormat(optarg, &options.outputFormat)){
+                    fprintf(stderr, "creverb-render: unknown format %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_BLOCK:
+                if (!checkRange("block", x, 1.0, 1.0e8)) return 1;
+                options.blockLength = (size_t)x;
+                break;
+            case OPT_THREADS:
+                if (!checkRange("threads", x, 1.0, 1024.0)) return 1;
+                options.numThreads = (size_t)x;
+                break;
+            case OPT_TOLERANCE:
+                if (!checkRange("tolerance", x, -300.0, -1.0)) return 1;
+                options.tolerance_dB = x;
+                break;
+            case OPT_BATCH:
+                options.manifestPath = optarg;
+                break;
+            case OPT_QUIET:
+                options.quiet = true;
+                break;
+            case OPT_HELP:
+                printUsage(stdout);
+                return 0;
+            default:
+                printUsage(stderr);
+                return 1;
+        }
+    }
+    if (argc - optind != (options.manifestPath ? 0 : 2)) {
+        printUsage(stderr);
+        return 1;
+    }
+    
+    
+    /*
+     * check the settings that depend on each other
+     */
+    if (numDelays % 2 != 0 || !BMCReverbMixingMatrixSupports(matrix, numDelays)) {
+        fprintf(stderr, "creverb-render: the mixing matrix doesn't support %zu delays\n", numDelays);
+        return 1;
+    }
+    if (!(preDelay > 0.0 && roomSize > preDelay)) {
+        fprintf(stderr, "creverb-render: --predelay must be less than --room-size\n");
+        return 1;
+    }
+    if (!options.manifestPath && options.numThreads > 1 && rv.autoSustain) {
+        fprintf(stderr, "creverb-render: --threads can't be used with --auto-sustain\n");
+        return 1;
+    }
+    // the setters check pre-delay against the current room size and vice
+    // versa, so set the room size first when it is growing
+    if (roomSize > rv.maxDelay_seconds) {
+        BMCReverbSetRoomSize(&rv, roomSize);
+        BMCReverbSetPreDelay(&rv, preDelay);
+    } else {
+        BMCReverbSetPreDelay(&rv, preDelay);
+        BMCReverbSetRoomSize(&rv, roomSize);
+    }
+    BMCReverbSetMixingMatrix(&rv, BMCREVERB_MATRIX_PERMUTATION);
+    BMCReverbSetNumDelays(&rv, numDelays);
+    BMCReverbSetMixingMatrix(&rv, matrix);
+    
+    if (options.manifestPath) {
+        bool success = renderBatch(&rv, &options);
+        BMCReverbFree(&rv);
+        return success ? 0 : 1;
+    }
+    const char* inputPath = argv[optind];
+    const char* outputPath = argv[optind+1];
+    
+    
+    /*
+     * open the files
+     */
+    BMWavFile input, output;
+    if (!BMWavFileOpenRead(&input, inputPath)) {
+        fprintf(stderr, "creverb-render: %s: %s\n", inputPath, input.error);
+        return 1;
+    }
+    if (rv.highpassFC >= 0.5f*(float)input.sampleRate) {
+        fprintf(stderr, "creverb-render: %s: --highpass must be below half the sample rate of %u Hz\n", inputPath, input.sampleRate);
+        BMWavFileClose(&input);
+        return 1;
+    }
+    BMCReverbSetSampleRate(&rv, input.sampleRate);
+    
+    double tail_seconds = options.tail_seconds < 0.0 ? rv.rt60 : options.tail_seconds;
+    size_t tailFrames = (size_t)(tail_seconds * input.sampleRate);
+    size_t outputFrames = input.numFrames + tailFrames;
+    if (!BMWavFileCreate(&output, outputPath, outputFrames, 2, input.sampleRate, options.outputFormat)) {
+        fprintf(stderr, "creverb-render: %s: %s\n", outputPath, output.error);
+        BMWavFileClose(&input);
+        return 1;
+    }
+    
+    
+    /*
+     * render
+     */
+    double begin = wallTime();
+    bool success = true;
+    if (options.numThreads > 1) {
+        RenderFiles files = {&input, &output};
+        success = BMCReverbRenderParallel(&rv, input.numFrames, outputFrames, readInput, writeOutput, &files, options.numThreads, options.tolerance_dB);
+        if (!success) fprintf(stderr, "creverb-render: couldn't allocate the threads or their memory\n");
+    } else {
+        float* left = malloc(sizeof(float)*options.blockLength);
+        float* right = malloc(sizeof(float)*options.blockLength);
+        
+        // settings changes take effect at the end of a buffer, so apply
+        // them before the first block
+        BMCReverbApplySettings(&rv);
+        
+        for (size_t frame = 0; frame < outputFrames; frame += options.blockLength) {
+            size_t blockLength = outputFrames - frame < options.blockLength ? outputFrames - frame : options.blockLength;
+            
+            // read the input, padding with zeros after the end to render
+            // the tail
+            size_t inputFrames = 0;
+            if (frame < input.numFrames) {
+                inputFrames = input.numFrames - frame < blockLength ? input.numFrames - frame : blockLength;
+                BMWavFileReadFrames(&input, frame, inputFrames, left, right);
+            }
+            memset(left + inputFrames, 0, sizeof(float)*(blockLength - inputFrames));
+            memset(right + inputFrames, 0, sizeof(float)*(blockLength - inputFrames));
+            
+            BMCReverbProcessBuffer(&rv, left, right, left, right, blockLength);
+            BMWavFileWriteFrames(&output, frame, blockLength, left, right);
+        }
+        
+        free(left);
+        free(right);
+    }
+    double seconds = wallTime() - begin;
+    
+    
+    if (!BMWavFileClose(&output)) {
+        fprintf(stderr, "creverb-render: %s: %s\n", outputPath, output.error);
+        success = false;
+    }
+    BMWavFileClose(&input);
+    
+    if (!options.quiet && success) {
+        double audio_seconds = (double)outputFrames / (double)input.sampleRate;
+        printf("rendered %.2f s of audio in %.2f s (%.1fx realtime)\n", audio_seconds, seconds, seconds > 0.0 ? audio_seconds / seconds : 0.0);
+    }
+    
+    BMCReverbFree(&rv);
+    return success ? 0 : 1;
+}